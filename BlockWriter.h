@@ -0,0 +1,299 @@
+#pragma once
+
+#ifndef _BLOCKWRITER_H
+#define _BLOCKWRITER_H
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#endif
+#include <string.h>
+#include <string>
+using namespace std;
+
+// Alignment of the staging buffer, of direct writes and of their file offsets
+#define BLOCKWRITER_ALIGN 4096
+#define BLOCKWRITER_DEFAULT_BLOCK (4 << 20)
+
+/// <summary>
+/// Output file written through one aligned staging block. Small writes are
+/// gathered into the block and reach the OS as a single large write when it
+/// fills up. With direct I/O the page cache is bypassed (O_DIRECT or
+/// FILE_FLAG_NO_BUFFERING), partial blocks are written padded and the file
+/// is cut back to its real size by Close().
+/// </summary>
+class BlockWriter
+{
+private:
+	unsigned char* buffer;
+	long long blockSize;
+	// File offset of buffer[0]
+	long long bufferStart;
+	// Bytes of the buffer written by Write()
+	long long bufferUsed;
+	// Bytes of the buffer holding file content, from Seek() or an earlier Flush()
+	long long bufferValid;
+	// Logical size of the file
+	long long fileEnd;
+	bool direct;
+#ifdef _WIN32
+	HANDLE fileHandle;
+#else
+	int fd;
+#endif
+
+	static long long AlignUp(long long n)
+	{
+		return (n + BLOCKWRITER_ALIGN - 1) / BLOCKWRITER_ALIGN * BLOCKWRITER_ALIGN;
+	}
+
+	bool WriteRaw(const unsigned char* p, long long n, long long offset)
+	{
+#ifdef _WIN32
+		while (n > 0)
+		{
+			OVERLAPPED o;
+			memset(&o, 0, sizeof(o));
+			o.Offset = (DWORD)(offset & 0xFFFFFFFF);
+			o.OffsetHigh = (DWORD)(offset >> 32);
+			DWORD chunk = (DWORD)(n > (1 << 30) ? (1 << 30) : n);
+			DWORD written = 0;
+			if (!WriteFile(fileHandle, p, chunk, &written, &o) || written == 0) return false;
+			p += written;
+			n -= written;
+			offset += written;
+		}
+#else
+		while (n > 0)
+		{
+			ssize_t written = pwrite(fd, p, (size_t)n, (off_t)offset);
+			if (written <= 0) return false;
+			p += written;
+			n -= written;
+			offset += written;
+		}
+#endif
+		return true;
+	}
+
+	long long ReadRaw(unsigned char* p, long long n, long long offset)
+	{
+		long long total = 0;
+#ifdef _WIN32
+		while (n > 0)
+		{
+			OVERLAPPED o;
+			memset(&o, 0, sizeof(o));
+			o.Offset = (DWORD)(offset & 0xFFFFFFFF);
+			o.OffsetHigh = (DWORD)(offset >> 32);
+			DWORD got = 0;
+			if (!ReadFile(fileHandle, p, (DWORD)n, &got, &o) || got == 0) break;
+			p += got;
+			n -= got;
+			offset += got;
+			total += got;
+		}
+#else
+		while (n > 0)
+		{
+			ssize_t got = pread(fd, p, (size_t)n, (off_t)offset);
+			if (got <= 0) break;
+			p += got;
+			n -= got;
+			offset += got;
+			total += got;
+		}
+#endif
+		return total;
+	}
+
+	bool OpenHandle(string filename, bool direct)
+	{
+#ifdef _WIN32
+		fileHandle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+			direct ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : FILE_ATTRIBUTE_NORMAL, NULL);
+		return fileHandle != INVALID_HANDLE_VALUE;
+#else
+		int flags = O_RDWR | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+		if (direct) flags |= O_DIRECT;
+#endif
+		fd = open(filename.c_str(), flags, 0644);
+		if (fd < 0) return false;
+#if defined(__APPLE__)
+		if (direct) fcntl(fd, F_NOCACHE, 1);
+#endif
+		return true;
+#endif
+	}
+
+public:
+#ifdef _WIN32
+	BlockWriter() : buffer(NULL), blockSize(0), bufferStart(0), bufferUsed(0), bufferValid(0), fileEnd(0), direct(false), fileHandle(INVALID_HANDLE_VALUE) {}
+#else
+	BlockWriter() : buffer(NULL), blockSize(0), bufferStart(0), bufferUsed(0), bufferValid(0), fileEnd(0), direct(false), fd(-1) {}
+#endif
+
+	~BlockWriter()
+	{
+		Close();
+	}
+
+	/// <summary>
+	/// Create or truncate the file for writing
+	/// </summary>
+	/// <param name="filename">The file to write</param>
+	/// <param name="direct">Bypass the OS cache. Falls back to buffered writes if the file system refuses it.</param>
+	/// <param name="blockSize">Size of the staging block, rounded up to BLOCKWRITER_ALIGN</param>
+	/// <returns>Returns true if the file is open</returns>
+	bool Open(string filename, bool direct = false, long long blockSize = BLOCKWRITER_DEFAULT_BLOCK)
+	{
+		Close();
+		this->blockSize = AlignUp(blockSize < BLOCKWRITER_ALIGN ? BLOCKWRITER_ALIGN : blockSize);
+#ifdef _WIN32
+		buffer = (unsigned char*)_aligned_malloc((size_t)this->blockSize, BLOCKWRITER_ALIGN);
+#else
+		void* p = NULL;
+		buffer = posix_memalign(&p, BLOCKWRITER_ALIGN, (size_t)this->blockSize) == 0 ? (unsigned char*)p : NULL;
+#endif
+		if (buffer == NULL) return false;
+		this->direct = direct && OpenHandle(filename, true);
+		if (!this->direct && !OpenHandle(filename, false))
+		{
+			Close();
+			return false;
+		}
+		bufferStart = bufferUsed = bufferValid = fileEnd = 0;
+		return true;
+	}
+
+	/// <summary>
+	/// Append n bytes at Position()
+	/// </summary>
+	bool Write(const void* data, long long n)
+	{
+		if (buffer == NULL) return false;
+		const unsigned char* p = (const unsigned char*)data;
+		while (n > 0)
+		{
+			long long chunk = blockSize - bufferUsed;
+			if (chunk > n) chunk = n;
+			memcpy(buffer + bufferUsed, p, (size_t)chunk);
+			bufferUsed += chunk;
+			p += chunk;
+			n -= chunk;
+			if (bufferUsed == blockSize)
+			{
+				if (!WriteRaw(buffer, blockSize, bufferStart)) return false;
+				bufferStart += blockSize;
+				if (bufferStart > fileEnd) fileEnd = bufferStart;
+				bufferUsed = bufferValid = 0;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Write out the buffered bytes. The block stays buffered, so a partial
+	/// block keeps growing in place and is written again by the next flush.
+	/// </summary>
+	bool Flush()
+	{
+		if (buffer == NULL) return false;
+		long long length = bufferUsed > bufferValid ? bufferUsed : bufferValid;
+		if (length == 0) return true;
+		long long writeLength = length;
+		if (direct)
+		{
+			writeLength = AlignUp(length);
+			memset(buffer + length, 0, (size_t)(writeLength - length));
+		}
+		if (!WriteRaw(buffer, writeLength, bufferStart)) return false;
+		bufferValid = length;
+		if (bufferStart + length > fileEnd) fileEnd = bufferStart + length;
+		return true;
+	}
+
+	/// <summary>
+	/// Move the write position. With direct I/O the aligned block around pos
+	/// is read back, so writes inside existing content keep their neighbours.
+	/// </summary>
+	bool Seek(long long pos)
+	{
+		if (buffer == NULL || !Flush()) return false;
+		bufferStart = direct ? pos / BLOCKWRITER_ALIGN * BLOCKWRITER_ALIGN : pos;
+		bufferUsed = pos - bufferStart;
+		bufferValid = 0;
+		if (direct && bufferStart < fileEnd)
+		{
+			long long length = fileEnd - bufferStart;
+			if (length > blockSize) length = blockSize;
+			bufferValid = ReadRaw(buffer, AlignUp(length), bufferStart);
+			if (bufferValid > length) bufferValid = length;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Flush, cut padding written by direct I/O and close the file
+	/// </summary>
+	bool Close()
+	{
+		bool ok = true;
+		if (buffer != NULL)
+		{
+			ok = Flush();
+#ifdef _WIN32
+			if (fileHandle != INVALID_HANDLE_VALUE && direct)
+			{
+				LARGE_INTEGER end;
+				end.QuadPart = fileEnd;
+				ok = SetFilePointerEx(fileHandle, end, NULL, FILE_BEGIN) && SetEndOfFile(fileHandle) && ok;
+			}
+			_aligned_free(buffer);
+#else
+			if (fd >= 0 && direct)
+				ok = ftruncate(fd, (off_t)fileEnd) == 0 && ok;
+			free(buffer);
+#endif
+		}
+#ifdef _WIN32
+		if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (fd >= 0) close(fd);
+		fd = -1;
+#endif
+		buffer = NULL;
+		bufferStart = bufferUsed = bufferValid = fileEnd = 0;
+		return ok;
+	}
+
+	bool IsOpen()
+	{
+		return buffer != NULL;
+	}
+
+	bool Direct()
+	{
+		return direct;
+	}
+
+	long long Position()
+	{
+		return bufferStart + bufferUsed;
+	}
+
+	long long Size()
+	{
+		long long end = bufferStart + (bufferUsed > bufferValid ? bufferUsed : bufferValid);
+		return end > fileEnd ? end : fileEnd;
+	}
+};
+
+#endif
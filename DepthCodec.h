@@ -0,0 +1,339 @@
+#pragma once
+
+#ifndef _DEPTHCODEC_H
+#define _DEPTHCODEC_H
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+#include <vector>
+using namespace std;
+
+// Lossless codec for CV_16U depth and infrared frames.
+// Every pixel is predicted from its left, upper and upper-left neighbours
+// (the LOCO-I median predictor), the residual is zig-zag mapped to an
+// unsigned value and the residuals are bit-packed in blocks of
+// DEPTHCODEC_BLOCK, each block prefixed by one byte holding its bit width.
+
+#define DEPTHCODEC_BLOCK 16
+
+/// <summary>
+/// Worst case encoded size of a rows x cols frame
+/// </summary>
+inline size_t DepthCodecBound(int rows, int cols)
+{
+	size_t pixels = (size_t)rows * cols;
+	// Blocks start over on every row
+	size_t blocks = (size_t)rows * ((cols + DEPTHCODEC_BLOCK - 1) / DEPTHCODEC_BLOCK);
+	// 17 bits per residual, one width byte per block, and 8 bytes of slack for the bit writer
+	return blocks + (pixels * 17 + 7) / 8 + 8;
+}
+
+inline int DepthPredict(int a, int b, int c)
+{
+	int mn = a < b ? a : b;
+	int mx = a < b ? b : a;
+	if (c >= mx) return mn;
+	if (c <= mn) return mx;
+	return a + b - c;
+}
+
+/// <summary>
+/// Compute the zig-zag mapped prediction residuals of one row
+/// </summary>
+inline void DepthResiduals(const unsigned short* row, const unsigned short* up, int cols, unsigned int* out)
+{
+	if (up == NULL)
+	{
+		int left = 0;
+		for (int j = 0; j < cols; j++)
+		{
+			int r = row[j] - left;
+			out[j] = ((unsigned int)r << 1) ^ (unsigned int)(r >> 31);
+			left = row[j];
+		}
+		return;
+	}
+	int r = row[0] - up[0];
+	out[0] = ((unsigned int)r << 1) ^ (unsigned int)(r >> 31);
+	for (int j = 1; j < cols; j++)
+	{
+		r = row[j] - DepthPredict(row[j - 1], up[j], up[j - 1]);
+		out[j] = ((unsigned int)r << 1) ^ (unsigned int)(r >> 31);
+	}
+}
+
+/// <summary>
+/// Move the low 32 bits of the bit writer to the output once they are full
+/// </summary>
+inline void DepthFlush(unsigned char*& out, unsigned long long& acc, int& bits)
+{
+	if (bits < 32) return;
+	unsigned int word = (unsigned int)acc;
+	memcpy(out, &word, sizeof(word));
+	out += sizeof(word);
+	acc >>= 32;
+	bits -= 32;
+}
+
+/// <summary>
+/// Append the low width bits of value to the bit writer
+/// </summary>
+inline void DepthPut(unsigned char*& out, unsigned long long& acc, int& bits, unsigned int value, int width)
+{
+	DepthFlush(out, acc, bits);
+	acc |= (unsigned long long)value << bits;
+	bits += width;
+}
+
+/// <summary>
+/// Write out the bits left in the bit writer
+/// </summary>
+inline void DepthFinish(unsigned char*& out, unsigned long long& acc, int& bits)
+{
+	while (bits > 0)
+	{
+		*out++ = (unsigned char)acc;
+		acc >>= 8;
+		bits -= 8;
+	}
+}
+
+/// <summary>
+/// Take the next width bits from the bit reader
+/// </summary>
+inline bool DepthGet(const unsigned char*& in, const unsigned char* end, unsigned long long& acc, int& bits, int width, unsigned int& value)
+{
+	while (bits < width)
+	{
+		if (in == end) return false;
+		acc |= (unsigned long long)(*in++) << bits;
+		bits += 8;
+	}
+	value = (unsigned int)(acc & ((1ull << width) - 1));
+	acc >>= width;
+	bits -= width;
+	return true;
+}
+
+/// <summary>
+/// Number of bits needed for the largest residual of a block
+/// </summary>
+inline int DepthBlockWidth(const unsigned int* block, int n)
+{
+	unsigned int any = 0;
+	for (int k = 0; k < n; k++) any |= block[k];
+	int width = 0;
+	while (any >> width) width++;
+	return width;
+}
+
+/// <summary>
+/// Encode a CV_16U single channel Mat.
+/// </summary>
+/// <param name="src">The frame to encode</param>
+/// <param name="dst">Receives the encoded bytes. Its capacity is reused between calls.</param>
+/// <param name="residuals">Scratch row, its capacity is reused between calls as well</param>
+/// <returns>Returns the number of encoded bytes, or -1 if the Mat type is not supported</returns>
+inline int DepthEncode(const Mat& src, vector<unsigned char>& dst, vector<unsigned int>& residuals)
+{
+	if (src.type() != CV_16U || src.empty()) return -1;
+	int cols = src.cols;
+	dst.resize(DepthCodecBound(src.rows, cols));
+	residuals.resize(cols);
+	unsigned char* out = dst.data();
+	unsigned long long acc = 0;
+	int bits = 0;
+	for (int i = 0; i < src.rows; i++)
+	{
+		DepthResiduals(src.ptr<unsigned short>(i), i > 0 ? src.ptr<unsigned short>(i - 1) : NULL, cols, residuals.data());
+		for (int j = 0; j < cols; j += DEPTHCODEC_BLOCK)
+		{
+			int n = cols - j < DEPTHCODEC_BLOCK ? cols - j : DEPTHCODEC_BLOCK;
+			const unsigned int* block = residuals.data() + j;
+			int width = DepthBlockWidth(block, n);
+			// The width byte is emitted through the bit writer so blocks stay packed back to back
+			DepthPut(out, acc, bits, width, 8);
+			for (int k = 0; k < n; k++)
+				DepthPut(out, acc, bits, block[k], width);
+		}
+	}
+	DepthFlush(out, acc, bits);
+	DepthFinish(out, acc, bits);
+	int size = (int)(out - dst.data());
+	dst.resize(size);
+	return size;
+}
+
+inline int DepthEncode(const Mat& src, vector<unsigned char>& dst)
+{
+	vector<unsigned int> residuals;
+	return DepthEncode(src, dst, residuals);
+}
+
+/// <summary>
+/// Decode a frame produced by DepthEncode.
+/// </summary>
+/// <param name="src">The encoded bytes</param>
+/// <param name="size">Number of encoded bytes</param>
+/// <param name="dst">Output frame. It is (re)allocated as rows x cols CV_16U if needed.</param>
+/// <returns>Returns false if the data is truncated</returns>
+inline bool DepthDecode(const unsigned char* src, size_t size, int rows, int cols, Mat& dst)
+{
+	dst.create(rows, cols, CV_16U);
+	const unsigned char* in = src;
+	const unsigned char* end = src + size;
+	unsigned long long acc = 0;
+	int bits = 0;
+	for (int i = 0; i < rows; i++)
+	{
+		unsigned short* row = dst.ptr<unsigned short>(i);
+		const unsigned short* up = i > 0 ? dst.ptr<unsigned short>(i - 1) : NULL;
+		for (int j = 0; j < cols; j += DEPTHCODEC_BLOCK)
+		{
+			int n = cols - j < DEPTHCODEC_BLOCK ? cols - j : DEPTHCODEC_BLOCK;
+			unsigned int width;
+			if (!DepthGet(in, end, acc, bits, 8, width) || width > 17) return false;
+			for (int k = j; k < j + n; k++)
+			{
+				unsigned int z;
+				if (!DepthGet(in, end, acc, bits, width, z)) return false;
+				int r = (int)(z >> 1) ^ -(int)(z & 1);
+				int pred;
+				if (up == NULL) pred = k > 0 ? row[k - 1] : 0;
+				else if (k == 0) pred = up[0];
+				else pred = DepthPredict(row[k - 1], up[k], up[k - 1]);
+				row[k] = (unsigned short)(pred + r);
+			}
+		}
+	}
+	return true;
+}
+
+// Delta frames store the zig-zag mapped difference to a reference frame
+// (the previous decoded frame) with the same block packing. A width byte
+// with DEPTHCODEC_RUN set stands for a run of up to 127 all-zero blocks, so
+// a static scene costs a few bytes per frame.
+#define DEPTHCODEC_RUN 0x80
+
+/// <summary>
+/// Encode the difference of a CV_16U frame to a reference frame.
+/// </summary>
+/// <param name="src">The frame to encode</param>
+/// <param name="reference">The previous decoded frame, same size and type. Updated to the decoded src.</param>
+/// <param name="threshold">Differences up to this magnitude are dropped, 0 is lossless</param>
+/// <param name="dst">Receives the encoded bytes. Its capacity is reused between calls.</param>
+/// <param name="residuals">Scratch row, its capacity is reused between calls as well</param>
+/// <returns>Returns the number of encoded bytes, or -1 if the Mats do not match</returns>
+inline int DepthEncodeDelta(const Mat& src, Mat& reference, int threshold, vector<unsigned char>& dst, vector<unsigned int>& residuals)
+{
+	if (src.type() != CV_16U || src.empty() || reference.size() != src.size() || reference.type() != CV_16U) return -1;
+	int cols = src.cols;
+	dst.resize(DepthCodecBound(src.rows, cols));
+	residuals.resize(cols);
+	unsigned char* out = dst.data();
+	unsigned long long acc = 0;
+	int bits = 0;
+	int run = 0;
+	for (int i = 0; i < src.rows; i++)
+	{
+		const unsigned short* row = src.ptr<unsigned short>(i);
+		unsigned short* ref = reference.ptr<unsigned short>(i);
+		for (int j = 0; j < cols; j++)
+		{
+			int r = row[j] - ref[j];
+			if (r <= threshold && r >= -threshold)
+			{
+				residuals[j] = 0;
+				continue;
+			}
+			residuals[j] = ((unsigned int)r << 1) ^ (unsigned int)(r >> 31);
+			// The reference follows what the decoder will see, so dropped differences do not accumulate
+			ref[j] = row[j];
+		}
+		for (int j = 0; j < cols; j += DEPTHCODEC_BLOCK)
+		{
+			int n = cols - j < DEPTHCODEC_BLOCK ? cols - j : DEPTHCODEC_BLOCK;
+			const unsigned int* block = residuals.data() + j;
+			int width = DepthBlockWidth(block, n);
+			if (width == 0)
+			{
+				if (++run == DEPTHCODEC_RUN - 1)
+				{
+					DepthPut(out, acc, bits, DEPTHCODEC_RUN | run, 8);
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0)
+			{
+				DepthPut(out, acc, bits, DEPTHCODEC_RUN | run, 8);
+				run = 0;
+			}
+			DepthPut(out, acc, bits, width, 8);
+			for (int k = 0; k < n; k++)
+				DepthPut(out, acc, bits, block[k], width);
+		}
+	}
+	if (run > 0)
+		DepthPut(out, acc, bits, DEPTHCODEC_RUN | run, 8);
+	DepthFlush(out, acc, bits);
+	DepthFinish(out, acc, bits);
+	int size = (int)(out - dst.data());
+	dst.resize(size);
+	return size;
+}
+
+inline int DepthEncodeDelta(const Mat& src, Mat& reference, int threshold, vector<unsigned char>& dst)
+{
+	vector<unsigned int> residuals;
+	return DepthEncodeDelta(src, reference, threshold, dst, residuals);
+}
+
+/// <summary>
+/// Apply a frame produced by DepthEncodeDelta to its reference frame.
+/// </summary>
+/// <param name="src">The encoded bytes</param>
+/// <param name="size">Number of encoded bytes</param>
+/// <param name="reference">The previous decoded frame. Receives the decoded frame in place.</param>
+/// <returns>Returns false if the data is truncated or the reference is not CV_16U</returns>
+inline bool DepthDecodeDelta(const unsigned char* src, size_t size, Mat& reference)
+{
+	if (reference.type() != CV_16U || reference.empty()) return false;
+	int cols = reference.cols;
+	const unsigned char* in = src;
+	const unsigned char* end = src + size;
+	unsigned long long acc = 0;
+	int bits = 0;
+	int run = 0;
+	for (int i = 0; i < reference.rows; i++)
+	{
+		unsigned short* ref = reference.ptr<unsigned short>(i);
+		for (int j = 0; j < cols; j += DEPTHCODEC_BLOCK)
+		{
+			int n = cols - j < DEPTHCODEC_BLOCK ? cols - j : DEPTHCODEC_BLOCK;
+			if (run > 0)
+			{
+				run--;
+				continue;
+			}
+			unsigned int width;
+			if (!DepthGet(in, end, acc, bits, 8, width)) return false;
+			if (width & DEPTHCODEC_RUN)
+			{
+				run = (int)(width & ~DEPTHCODEC_RUN) - 1;
+				continue;
+			}
+			if (width > 17) return false;
+			for (int k = j; k < j + n; k++)
+			{
+				unsigned int z;
+				if (!DepthGet(in, end, acc, bits, width, z)) return false;
+				int r = (int)(z >> 1) ^ -(int)(z & 1);
+				ref[k] = (unsigned short)(ref[k] + r);
+			}
+		}
+	}
+	return true;
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "EasyKinect.h"
 #include <opencv2\opencv.hpp>
+#include "KinectBuffer.h"
+#include "KinectColor.h"
 #define _OPENCV_USED
 
 #ifdef _OPENCV_USED
@@ -137,70 +139,105 @@ string KinectSensor::BoneName[KinectSensor::BoneType_Count] =
 };
 
 /// <summary>
-/// Convert depthframe in IDepthFrame* to a CV_16U Mat.
+/// Read the size of any frame with a frame description
 /// </summary>
-/// <param name="depthframe">The pointer to the obtained depth frame</param>
-/// <returns>Returns a Mat in CV_16U containing the depth frame</returns>
-Mat depth2mat(IDepthFrame* depthframe)
+template<class Frame>
+static bool GetFrameSize(Frame* frame, int& height, int& width)
 {
-	if (depthframe == NULL)
+	height = width = 0;
+	IFrameDescription* size = NULL;
+	if (frame == NULL || FAILED(frame->get_FrameDescription(&size)) || size == NULL)
 	{
-		return Mat();
+		return false;
 	}
-	IFrameDescription* size = NULL;
-	depthframe->get_FrameDescription(&size);
-	int height = 0, width = 0;
 	size->get_Height(&height);
 	size->get_Width(&width);
 	SafeRelease(size);
-	Mat frame(height, width, CV_16U, Scalar::all(0));
-	UINT16* depthbuffer = NULL;
+	return true;
+}
+
+/// <summary>
+/// Copy the underlying buffer of a frame into a Mat, or zeros if it cannot be accessed
+/// </summary>
+template<class Frame, class Pixel>
+static Mat CopyFrameBuffer(Frame* frame, int type)
+{
+	int height, width;
+	if (!GetFrameSize(frame, height, width))
+	{
+		return Mat();
+	}
+	Mat mat;
+	Pixel* buffer = NULL;
 	UINT buffersize = 0;
-	if (SUCCEEDED(depthframe->AccessUnderlyingBuffer(&buffersize, &depthbuffer)))
+	if (FAILED(frame->AccessUnderlyingBuffer(&buffersize, &buffer)) || !KinectCopyBuffer(buffer, buffersize, height, width, type, mat))
 	{
-		for (int i = 0; i < height; i++)
-		{
-			for (int j = 0; j < width; j++)
-			{
-				frame.at<unsigned short>(i, j) = depthbuffer[i*width + j];
-			}
-		}
+		return Mat(height, width, type, Scalar::all(0));
 	}
-	return frame;
+	return mat;
+}
+
+/// <summary>
+/// Wrap the underlying buffer of a frame in a Mat holding a reference on the frame
+/// </summary>
+template<class Frame, class Pixel>
+static Mat WrapFrameBuffer(Frame* frame, int type)
+{
+	int height, width;
+	if (!GetFrameSize(frame, height, width))
+	{
+		return Mat();
+	}
+	Pixel* buffer = NULL;
+	UINT buffersize = 0;
+	if (FAILED(frame->AccessUnderlyingBuffer(&buffersize, &buffer)))
+	{
+		return Mat();
+	}
+	return KinectWrapFrame(frame, buffer, buffersize, height, width, type);
+}
+
+/// <summary>
+/// Convert depthframe in IDepthFrame* to a CV_16U Mat.
+/// </summary>
+/// <param name="depthframe">The pointer to the obtained depth frame</param>
+/// <returns>Returns a Mat in CV_16U containing the depth frame</returns>
+Mat depth2mat(IDepthFrame* depthframe)
+{
+	return CopyFrameBuffer<IDepthFrame, UINT16>(depthframe, CV_16U);
 }
 
 /// <summary>
 /// Convert colorframe in IColorFrame* to a CV_8UC3 Mat.
 /// </summary>
 /// <param name="colorframe">The pointer to the obtained color frame</param>
-/// <returns>Returns a Mat in CV_8UC3 containing the color frame</returns>
-Mat color2mat(IColorFrame* colorframe)
+/// <param name="bgra">Return the CV_8UC4 BGRA frame the sensor converts to, without a further copy</param>
+/// <returns>Returns a Mat in CV_8UC3 containing the color frame, or CV_8UC4 with bgra</returns>
+Mat color2mat(IColorFrame* colorframe, bool bgra)
 {
-	if (colorframe == NULL)
+	int height, width;
+	if (!GetFrameSize(colorframe, height, width))
 	{
 		return Mat();
 	}
-	IFrameDescription* size = NULL;
-	colorframe->get_FrameDescription(&size);
-	int height = 0, width = 0;
-	size->get_Height(&height);
-	size->get_Width(&width);
-	SafeRelease(size);
-	Mat frame(height, width, CV_8UC3, Scalar::all(0));
-	static RGBQUAD* colorbuffer = new RGBQUAD[height * width];
-	UINT buffersize = height * width * sizeof(RGBQUAD);
-	HRESULT hr = colorframe->CopyConvertedFrameDataToArray(buffersize, reinterpret_cast<BYTE*>(colorbuffer), ColorImageFormat_Bgra);
-	if (SUCCEEDED(hr))
+	if (bgra)
 	{
-		for (int i = 0; i < height; i++)
+		Mat frame(height, width, CV_8UC4);
+		UINT buffersize = (UINT)(frame.total() * frame.elemSize());
+		if (FAILED(colorframe->CopyConvertedFrameDataToArray(buffersize, frame.data, ColorImageFormat_Bgra)))
 		{
-			for (int j = 0; j < width; j++)
-			{
-				frame.at<Vec3b>(i, j)[0] = colorbuffer[i*width + j].rgbBlue;
-				frame.at<Vec3b>(i, j)[1] = colorbuffer[i*width + j].rgbGreen;
-				frame.at<Vec3b>(i, j)[2] = colorbuffer[i*width + j].rgbRed;
-			}
+			return Mat(height, width, CV_8UC4, Scalar::all(0));
 		}
+		return frame;
+	}
+	// Each thread has its own staging buffer, which follows the resolution of the frames
+	static thread_local KinectColorConverter converter;
+	Mat& buffer = converter.Buffer(height, width);
+	UINT buffersize = (UINT)(buffer.total() * buffer.elemSize());
+	Mat frame;
+	if (FAILED(colorframe->CopyConvertedFrameDataToArray(buffersize, buffer.data, ColorImageFormat_Bgra)) || !converter.ToBgr(frame))
+	{
+		return Mat(height, width, CV_8UC3, Scalar::all(0));
 	}
 	return frame;
 }
@@ -212,30 +249,7 @@ Mat color2mat(IColorFrame* colorframe)
 /// <returns>Returns a Mat in CV_16U containing the infrared frame</returns>
 Mat infra2mat(IInfraredFrame* infraframe)
 {
-	IFrameDescription* size = NULL;
-	if (infraframe == NULL)
-	{
-		return Mat();
-	}
-	infraframe->get_FrameDescription(&size);
-	int height = 0, width = 0;
-	size->get_Height(&height);
-	size->get_Width(&width);
-	SafeRelease(size);
-	Mat frame(height, width, CV_16U, Scalar::all(0));
-	UINT16* buffer = NULL;
-	UINT buffersize = 0;
-	if (SUCCEEDED(infraframe->AccessUnderlyingBuffer(&buffersize, &buffer)))
-	{
-		for (int i = 0; i < height; i++)
-		{
-			for (int j = 0; j < width; j++)
-			{
-				frame.at<unsigned short>(i, j) = buffer[i*width + j];
-			}
-		}
-	}
-	return frame;
+	return CopyFrameBuffer<IInfraredFrame, UINT16>(infraframe, CV_16U);
 }
 
 /// <summary>
@@ -245,48 +259,21 @@ Mat infra2mat(IInfraredFrame* infraframe)
 /// <returns>Returns a Mat in CV_16U containing the infrared frame</returns>
 Mat longinfra2mat(ILongExposureInfraredFrame* infraframe)
 {
-	IFrameDescription* size = NULL;
-	infraframe->get_FrameDescription(&size);
-	int height = 0, width = 0;
-	size->get_Height(&height);
-	size->get_Width(&width);
-	SafeRelease(size);
-	Mat frame(height, width, CV_16U, Scalar::all(0));
-	UINT16* buffer = NULL;
-	UINT buffersize = 0;
-	if (SUCCEEDED(infraframe->AccessUnderlyingBuffer(&buffersize, &buffer)))
-	{
-		for (int i = 0; i < height; i++)
-		{
-			for (int j = 0; j < width; j++)
-			{
-				frame.at<unsigned short>(i, j) = buffer[i*width + j];
-			}
-		}
-	}
-	return frame;
+	return CopyFrameBuffer<ILongExposureInfraredFrame, UINT16>(infraframe, CV_16U);
 }
 
 Mat bodyindex2mat(IBodyIndexFrame* bodyindex)
 {
-	IFrameDescription* size = NULL;
-	bodyindex->get_FrameDescription(&size);
-	int height = 0, width = 0;
-	size->get_Height(&height);
-	size->get_Width(&width);
-	SafeRelease(size);
-	Mat frame(height, width, CV_8U, Scalar::all(0));
+	int height, width;
+	if (!GetFrameSize(bodyindex, height, width))
+	{
+		return Mat();
+	}
+	Mat frame;
 	BYTE* buffer = NULL;
 	UINT buffersize = 0;
-	if (SUCCEEDED(bodyindex->AccessUnderlyingBuffer(&buffersize, &buffer)))
+	if (SUCCEEDED(bodyindex->AccessUnderlyingBuffer(&buffersize, &buffer)) && KinectCopyBuffer(buffer, buffersize, height, width, CV_8U, frame))
 	{
-		for (int i = 0; i < height; i++)
-		{
-			for (int j = 0; j < width; j++)
-			{
-				frame.at<uchar>(i, j) = buffer[i*width + j];
-			}
-		}
 		return frame;
 	}
 #ifdef _LJX_DEBUG
@@ -296,6 +283,26 @@ Mat bodyindex2mat(IBodyIndexFrame* bodyindex)
 	return Mat();
 }
 
+Mat depth2matref(IDepthFrame* depthframe)
+{
+	return WrapFrameBuffer<IDepthFrame, UINT16>(depthframe, CV_16U);
+}
+
+Mat infra2matref(IInfraredFrame* infraframe)
+{
+	return WrapFrameBuffer<IInfraredFrame, UINT16>(infraframe, CV_16U);
+}
+
+Mat longinfra2matref(ILongExposureInfraredFrame* infraframe)
+{
+	return WrapFrameBuffer<ILongExposureInfraredFrame, UINT16>(infraframe, CV_16U);
+}
+
+Mat bodyindex2matref(IBodyIndexFrame* bodyindex)
+{
+	return WrapFrameBuffer<IBodyIndexFrame, BYTE>(bodyindex, CV_8U);
+}
+
 #endif
 
 void PrintMatrix4(Matrix4 mat, int fw, ostream &stream)
@@ -9,6 +9,9 @@
 #include <iostream>
 #include <NuiKinectFusionApi.h>
 #include <iomanip>
+#include <chrono>
+#include <string.h>
+#include <vector>
 using namespace std;
 
 #ifndef SAFE_DELETE
@@ -37,6 +40,9 @@ inline void SafeRelease(Interface *& pInterfaceToRelease)
 #define _OPENCV_USED
 #include <opencv2\opencv.hpp>
 using namespace cv;
+#include "KinectBuffer.h"
+#include "KinectColor.h"
+#include "KinectCamera.h"
 
 /// <summary>
 /// Convert depthframe in IDepthFrame* to a CV_16U Mat.
@@ -49,8 +55,9 @@ Mat depth2mat(IDepthFrame* depthframe);
 /// Convert colorframe in IColorFrame* to a CV_8UC3 Mat.
 /// </summary>
 /// <param name="colorframe">The pointer to the obtained color frame</param>
-/// <returns>Returns a Mat in CV_8UC3 containing the color frame</returns>
-Mat color2mat(IColorFrame* colorframe);
+/// <param name="bgra">Return the CV_8UC4 BGRA frame the sensor converts to, without a further copy</param>
+/// <returns>Returns a Mat in CV_8UC3 containing the color frame, or CV_8UC4 with bgra</returns>
+Mat color2mat(IColorFrame* colorframe, bool bgra = false);
 
 /// <summary>
 /// Convert infraredframe in IInfraredFrame* to a CV_16U Mat.
@@ -68,6 +75,40 @@ Mat longinfra2mat(ILongExposureInfraredFrame* infraframe);
 
 Mat bodyindex2mat(IBodyIndexFrame* bodyindex);
 
+// The *2matref variants wrap the frame buffer without copying it. The Mat
+// holds a reference on the frame until its last copy is released, so the
+// caller may release the frame right away. The sensor does not deliver new
+// frames of a source while one of its frames is alive, so such Mats should
+// not be kept longer than a frame period; clone() them to keep the pixels.
+
+/// <summary>
+/// Wrap the buffer of IDepthFrame* in a CV_16U Mat without copying it.
+/// </summary>
+/// <param name="depthframe">The pointer to the obtained depth frame</param>
+/// <returns>Returns a Mat in CV_16U sharing the depth frame buffer</returns>
+Mat depth2matref(IDepthFrame* depthframe);
+
+/// <summary>
+/// Wrap the buffer of IInfraredFrame* in a CV_16U Mat without copying it.
+/// </summary>
+/// <param name="infraframe">The pointer to the obtained infrared frame</param>
+/// <returns>Returns a Mat in CV_16U sharing the infrared frame buffer</returns>
+Mat infra2matref(IInfraredFrame* infraframe);
+
+/// <summary>
+/// Wrap the buffer of ILongExposureInfraredFrame* in a CV_16U Mat without copying it.
+/// </summary>
+/// <param name="infraframe">The pointer to the obtained infrared frame</param>
+/// <returns>Returns a Mat in CV_16U sharing the infrared frame buffer</returns>
+Mat longinfra2matref(ILongExposureInfraredFrame* infraframe);
+
+/// <summary>
+/// Wrap the buffer of IBodyIndexFrame* in a CV_8U Mat without copying it.
+/// </summary>
+/// <param name="bodyindex">The pointer to the obtained body index frame</param>
+/// <returns>Returns a Mat in CV_8U sharing the body index frame buffer</returns>
+Mat bodyindex2matref(IBodyIndexFrame* bodyindex);
+
 
 #endif // _USE_OPENCV
 
@@ -408,18 +449,36 @@ public:
 	}
 
 #ifdef _USE_OPENCV
+	/// <summary>
+	/// Get the factory calibration of the depth camera, e.g. for KinectRegistration.
+	/// The sensor reports zeros until it has been running for a moment.
+	/// </summary>
+	HRESULT getDepthIntrinsics(KinectIntrinsics& intrinsics)
+	{
+		if (coordinatemapper == NULL) return E_POINTER;
+		CameraIntrinsics camera;
+		HRESULT result = coordinatemapper->GetDepthCameraIntrinsics(&camera);
+		if (FAILED(result)) return result;
+		if (camera.FocalLengthX == 0) return E_PENDING;
+		intrinsics = KinectMakeIntrinsics(NUI_DEPTH_RAW_WIDTH, NUI_DEPTH_RAW_HEIGHT,
+			camera.FocalLengthX, camera.FocalLengthY, camera.PrincipalPointX, camera.PrincipalPointY,
+			camera.RadialDistortionSecondOrder, camera.RadialDistortionFourthOrder, camera.RadialDistortionSixthOrder);
+		return S_OK;
+	}
+
 	/// <summary>
 	/// Get the depth frame and store it to a CV_16U Mat class
 	/// </summary>
+	/// <param name="share">Wrap the frame buffer instead of copying it, see depth2matref</param>
 	/// <returns>Pointer to a pointer to store the depth frame </returns>
-	Mat getDepthMat(INT64* time = nullptr)
+	Mat getDepthMat(INT64* time = nullptr, bool share = false)
 	{
 		HRESULT result;
 		IDepthFrame* getframe = NULL;
 		result = getDepthFrame(&getframe, time);
 		if (SUCCEEDED(result))
 		{
-			Mat mat = depth2mat(getframe);
+			Mat mat = share ? depth2matref(getframe) : depth2mat(getframe);
 			SafeRelease(getframe);
 			return mat;
 		}
@@ -429,15 +488,16 @@ public:
 	/// <summary>
 	/// Get the body index frame and store it to a CV_8U Mat class
 	/// </summary>
+	/// <param name="share">Wrap the frame buffer instead of copying it, see bodyindex2matref</param>
 	/// <returns>Pointer to a pointer to store the body index frame </returns>
-	Mat getBodyIndexMat(INT64* time = nullptr)
+	Mat getBodyIndexMat(INT64* time = nullptr, bool share = false)
 	{
 		HRESULT result;
 		IBodyIndexFrame* getframe = NULL;
 		result = getBodyIndexFrame(&getframe, time);
 		if (SUCCEEDED(result))
 		{
-			Mat mat = bodyindex2mat(getframe);
+			Mat mat = share ? bodyindex2matref(getframe) : bodyindex2mat(getframe);
 			SafeRelease(getframe);
 			return mat;
 		}
@@ -450,15 +510,16 @@ public:
 	/// <summary>
 	/// Get the color frame and store it to a CV_8UC3 Mat class
 	/// </summary>
+	/// <param name="bgra">Return the CV_8UC4 BGRA frame without converting it to BGR</param>
 	/// <returns>Pointer to a pointer to store the color frame </returns>
-	Mat getColorMat(INT64* time = nullptr)
+	Mat getColorMat(INT64* time = nullptr, bool bgra = false)
 	{
 		HRESULT result;
 		IColorFrame* getframe = NULL;
 		result = getColorFrame(&getframe, time);
 		if (SUCCEEDED(result))
 		{
-			Mat mat = color2mat(getframe);
+			Mat mat = color2mat(getframe, bgra);
 			SafeRelease(getframe);
 			return mat;
 		}
@@ -468,15 +529,16 @@ public:
 	/// <summary>
 	/// Get the infrared frame and store it to a CV_16U Mat class
 	/// </summary>
+	/// <param name="share">Wrap the frame buffer instead of copying it, see infra2matref</param>
 	/// <returns>Pointer to a pointer to store the infrared frame </returns>
-	Mat getInfraredMat(INT64* time = nullptr)
+	Mat getInfraredMat(INT64* time = nullptr, bool share = false)
 	{
 		HRESULT result;
 		IInfraredFrame* getframe = NULL;
 		result = getInfraredFrame(&getframe, time);
 		if (SUCCEEDED(result))
 		{
-			Mat mat = infra2mat(getframe);
+			Mat mat = share ? infra2matref(getframe) : infra2mat(getframe);
 			SafeRelease(getframe);
 			return mat;
 		}
@@ -486,15 +548,16 @@ public:
 	/// <summary>
 	/// Get the infrared frame and store it to a CV_16U Mat class
 	/// </summary>
+	/// <param name="share">Wrap the frame buffer instead of copying it, see longinfra2matref</param>
 	/// <returns>Pointer to a pointer to store the infrared frame </returns>
-	Mat getLongExposureInfraredMat(INT64* time = nullptr)
+	Mat getLongExposureInfraredMat(INT64* time = nullptr, bool share = false)
 	{
 		HRESULT result;
 		ILongExposureInfraredFrame* getframe = NULL;
 		result = getLongExposureInfraredFrame(&getframe, time);
 		if (SUCCEEDED(result))
 		{
-			Mat mat = longinfra2mat(getframe);
+			Mat mat = share ? longinfra2matref(getframe) : longinfra2mat(getframe);
 			SafeRelease(getframe);
 			return mat;
 		}
@@ -515,6 +578,37 @@ HRESULT IBF2KBody(IBodyFrame* frame, KinectBody bodies[]);
 /// <param name="mat">The matrix to set to identity</param>
 void SetIdentityMatrix(Matrix4 &mat);
 
+#ifdef _USE_OPENCV
+// Kinect Fusion transforms act on row vectors, p' = p * M with the
+// translation in M41..M43. KinectPose acts on column vectors.
+
+/// <summary>
+/// Convert a Kinect Fusion transform, e.g. worldToCameraTransform, to a KinectPose
+/// </summary>
+inline KinectPose KinectPoseFromMatrix4(const Matrix4& mat)
+{
+	KinectPose pose = { {
+		mat.M11, mat.M21, mat.M31, mat.M41,
+		mat.M12, mat.M22, mat.M32, mat.M42,
+		mat.M13, mat.M23, mat.M33, mat.M43 } };
+	return pose;
+}
+
+/// <summary>
+/// Convert a KinectPose, e.g. from KinectIcp, to a Kinect Fusion transform
+/// </summary>
+inline Matrix4 KinectPoseToMatrix4(const KinectPose& pose)
+{
+	const float* m = pose.m;
+	Matrix4 mat;
+	mat.M11 = m[0]; mat.M12 = m[4]; mat.M13 = m[8]; mat.M14 = 0;
+	mat.M21 = m[1]; mat.M22 = m[5]; mat.M23 = m[9]; mat.M24 = 0;
+	mat.M31 = m[2]; mat.M32 = m[6]; mat.M33 = m[10]; mat.M34 = 0;
+	mat.M41 = m[3]; mat.M42 = m[7]; mat.M43 = m[11]; mat.M44 = 1;
+	return mat;
+}
+#endif
+
 class KinectFusion
 {
 
@@ -524,8 +618,10 @@ public:
 	Matrix4* worldToCameraTransform;
 	Matrix4 defaultWorldToVolumeTransform;
 	UINT16* depthPixelBuffer;
-	NUI_FUSION_IMAGE_FRAME* depthFloatImage;
-	NUI_FUSION_IMAGE_FRAME* depthSmoothFloatImage;
+	// Converted and smoothed frame of every depth source, so the frames of a
+	// batch do not overwrite each other
+	NUI_FUSION_IMAGE_FRAME** depthFloatImage;
+	NUI_FUSION_IMAGE_FRAME** depthSmoothFloatImage;
 	NUI_FUSION_RECONSTRUCTION_PROCESSOR_TYPE processorType;
 	NUI_FUSION_CAMERA_PARAMETERS cameraParameters;
 	WAITABLE_HANDLE coordinateMapChanged;
@@ -533,8 +629,20 @@ public:
 	UINT* depthDistortLT;
 	bool cameraParametersValid;
 	int sources;
+	// Iteration limit of the camera alignment in IntegrateFrame
+	unsigned short alignIterationCount;
+	// Energy and duration of the last alignment in IntegrateFrame
+	float alignmentEnergy;
+	double alignmentMilliseconds;
+
+	// Pose pointCloud and shadedSurface were computed for, and whether they
+	// still show the volume
+	Matrix4 surfacePose;
+	bool pointCloudValid;
+	bool shadedSurfaceValid;
 
 public:
+	// Filled on request by CalculatePointCloud() and ShadeSurface()
 	NUI_FUSION_IMAGE_FRAME* pointCloud;
 	NUI_FUSION_IMAGE_FRAME* shadedSurface;
 
@@ -552,18 +660,26 @@ public:
 		depthDistortLT(NULL),
 		depthDistortMap(NULL),
 		shadedSurface(NULL),
-		sources(sourceCount)
+		sources(sourceCount),
+		alignIterationCount(200),
+		alignmentEnergy(0),
+		alignmentMilliseconds(0),
+		pointCloudValid(false),
+		shadedSurfaceValid(false)
 	{
 		cameraParameters.focalLengthX = NUI_KINECT_DEPTH_NORM_FOCAL_LENGTH_X;
 		cameraParameters.focalLengthY = NUI_KINECT_DEPTH_NORM_FOCAL_LENGTH_Y;
 		cameraParameters.principalPointX = NUI_KINECT_DEPTH_NORM_PRINCIPAL_POINT_X;
 		cameraParameters.principalPointY = NUI_KINECT_DEPTH_NORM_PRINCIPAL_POINT_Y;
 		worldToCameraTransform = new Matrix4[sourceCount];
+		depthFloatImage = new NUI_FUSION_IMAGE_FRAME*[sourceCount]();
+		depthSmoothFloatImage = new NUI_FUSION_IMAGE_FRAME*[sourceCount]();
 		for (int i = 0; i < sourceCount; i++)
 		{
 			SetIdentityMatrix(worldToCameraTransform[i]);
 		}
 		SetIdentityMatrix(defaultWorldToVolumeTransform);
+		SetIdentityMatrix(surfacePose);
 	}
 
 	~KinectFusion()
@@ -572,7 +688,14 @@ public:
 		SAFE_DELETE_ARRAY(depthPixelBuffer);
 		SAFE_DELETE_ARRAY(depthDistortLT);
 		SAFE_DELETE_ARRAY(depthDistortMap);
-		SAFE_FUSION_RELEASE_IMAGE_FRAME(depthFloatImage);
+		for (int i = 0; i < sources; i++)
+		{
+			SAFE_FUSION_RELEASE_IMAGE_FRAME(depthFloatImage[i]);
+			SAFE_FUSION_RELEASE_IMAGE_FRAME(depthSmoothFloatImage[i]);
+		}
+		SAFE_DELETE_ARRAY(depthFloatImage);
+		SAFE_DELETE_ARRAY(depthSmoothFloatImage);
+		SAFE_DELETE_ARRAY(worldToCameraTransform);
 		SAFE_FUSION_RELEASE_IMAGE_FRAME(pointCloud);
 		SAFE_FUSION_RELEASE_IMAGE_FRAME(shadedSurface);
 	}
@@ -610,11 +733,14 @@ public:
 		hr = volume->GetCurrentWorldToVolumeTransform(&defaultWorldToVolumeTransform);
 		if (FAILED(hr)) return hr;
 
-		hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_FLOAT, NUI_DEPTH_RAW_WIDTH, NUI_DEPTH_RAW_HEIGHT, nullptr, &depthFloatImage);
-		if (FAILED(hr)) return hr;
+		for (int i = 0; i < sources; i++)
+		{
+			hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_FLOAT, NUI_DEPTH_RAW_WIDTH, NUI_DEPTH_RAW_HEIGHT, nullptr, &depthFloatImage[i]);
+			if (FAILED(hr)) return hr;
 
-		hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_FLOAT, NUI_DEPTH_RAW_WIDTH, NUI_DEPTH_RAW_HEIGHT, nullptr, &depthSmoothFloatImage);
-		if (FAILED(hr)) return hr;
+			hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_FLOAT, NUI_DEPTH_RAW_WIDTH, NUI_DEPTH_RAW_HEIGHT, nullptr, &depthSmoothFloatImage[i]);
+			if (FAILED(hr)) return hr;
+		}
 
 		hr = NuiFusionCreateImageFrame(NUI_FUSION_IMAGE_TYPE_POINT_CLOUD, NUI_DEPTH_RAW_WIDTH, NUI_DEPTH_RAW_HEIGHT, &cameraParameters, &pointCloud);
 		if (FAILED(hr)) return hr;
@@ -629,6 +755,7 @@ public:
 		{
 			volume->ResetReconstruction(&worldToCameraTransform[i], &defaultWorldToVolumeTransform);
 		}
+		InvalidateSurface();
 		return hr;
 	}
 
@@ -643,31 +770,18 @@ public:
 
 	HRESULT ProcessDepth(UINT16* depthFrame, int depthSource = 0)
 	{
-		if (nullptr == depthFrame) return E_POINTER;
-
-		HRESULT hr = S_OK;
-
-		hr = volume->DepthToDepthFloatFrame(depthFrame, NUI_DEPTH_RAW_WIDTH*NUI_DEPTH_RAW_HEIGHT * sizeof(UINT16), depthFloatImage, NUI_FUSION_DEFAULT_MINIMUM_DEPTH, NUI_FUSION_DEFAULT_MAXIMUM_DEPTH, false);
-		if (FAILED(hr))
-		{
-			cout << "Failed to convert depth frame to depthFloatFrame" << endl;
-			return hr;
-		}
-
-		hr = volume->SmoothDepthFloatFrame(depthFloatImage, depthSmoothFloatImage, 3, 0.04f);
-		if (FAILED(hr))
-		{
-			cout << "Failed to smooth depth float image" << endl;
-			return hr;
-		}
+		HRESULT hr = PrepareDepth(depthFrame, depthSource);
+		if (FAILED(hr)) return hr;
 
-		hr = volume->ProcessFrame(depthSmoothFloatImage, NUI_FUSION_DEFAULT_ALIGN_ITERATION_COUNT, NUI_FUSION_DEFAULT_INTEGRATION_WEIGHT, nullptr, &worldToCameraTransform[depthSource]);
+		hr = volume->ProcessFrame(depthSmoothFloatImage[depthSource], NUI_FUSION_DEFAULT_ALIGN_ITERATION_COUNT, NUI_FUSION_DEFAULT_INTEGRATION_WEIGHT, nullptr, &worldToCameraTransform[depthSource]);
 		//hr = volume->ProcessFrame(depthFloatImage, 1000, 1, nullptr, &worldToCameraTransform[depthSource]);
 		if (FAILED(hr))
 		{
 			cout << "ProcessFrame failed" << endl;
 			return hr;
 		}
+		// The volume changed, whatever the pose turns out to be
+		InvalidateSurface();
 
 		Matrix4 calculatedCameraPose;
 		hr = volume->GetCurrentWorldToCameraTransform(&calculatedCameraPose);
@@ -678,30 +792,62 @@ public:
 		}
 
 		worldToCameraTransform[depthSource] = calculatedCameraPose;
-		volume->CalculatePointCloud(pointCloud, &worldToCameraTransform[depthSource]);
+		return hr;
+	}
+
+	HRESULT Reset()
+	{
+		SetIdentityMatrix(*worldToCameraTransform);
+		InvalidateSurface();
+		return volume->ResetReconstruction(worldToCameraTransform, nullptr);
+	}
+
+	/// <summary>
+	/// Drop the cached point cloud and shading, they are recomputed when asked for
+	/// </summary>
+	void InvalidateSurface()
+	{
+		pointCloudValid = false;
+		shadedSurfaceValid = false;
+	}
+
+	/// <summary>
+	/// Raycast the volume into pointCloud from the pose of a source, unless
+	/// pointCloud already shows the volume from that pose
+	/// </summary>
+	HRESULT CalculatePointCloud(int depthSource = 0)
+	{
+		if (pointCloudValid && memcmp(&surfacePose, &worldToCameraTransform[depthSource], sizeof(Matrix4)) == 0)
+			return S_OK;
+		InvalidateSurface();
+		HRESULT hr = volume->CalculatePointCloud(pointCloud, &worldToCameraTransform[depthSource]);
 		if (FAILED(hr))
 		{
 			cout << "CalculatePointCloud Failed" << endl;
 			return hr;
 		}
+		surfacePose = worldToCameraTransform[depthSource];
+		pointCloudValid = true;
+		return hr;
+	}
 
-		hr = NuiFusionShadePointCloud(pointCloud, &worldToCameraTransform[depthSource], nullptr, shadedSurface, nullptr);
-
+	/// <summary>
+	/// Shade the point cloud of a source into shadedSurface, unless it is already current
+	/// </summary>
+	HRESULT ShadeSurface(int depthSource = 0)
+	{
+		HRESULT hr = CalculatePointCloud(depthSource);
+		if (FAILED(hr) || shadedSurfaceValid) return hr;
+		hr = NuiFusionShadePointCloud(pointCloud, &surfacePose, nullptr, shadedSurface, nullptr);
 		if (FAILED(hr))
 		{
 			cout << "0x" << hex << hr << ": NuiFusionShadePointCloud Failed" << endl;
 			return hr;
 		}
-
+		shadedSurfaceValid = true;
 		return hr;
 	}
 
-	HRESULT Reset()
-	{
-		SetIdentityMatrix(*worldToCameraTransform);
-		return volume->ResetReconstruction(worldToCameraTransform, nullptr);
-	}
-
 	HRESULT CalculateMesh(INuiFusionMesh** mesh)
 	{
 		return volume->CalculateMesh(1, mesh);
@@ -709,38 +855,88 @@ public:
 
 	HRESULT IntegrateFrame(UINT16* depthFrame, int depthSource)
 	{
-		if (nullptr == depthFrame) return E_POINTER;
+		HRESULT hr = PrepareDepth(depthFrame, depthSource);
+		if (FAILED(hr)) return hr;
+		return AlignAndIntegrate(depthSource);
+	}
 
-		HRESULT hr = S_OK;
+	/// <summary>
+	/// Integrate one frame of every source. All frames are first converted
+	/// and smoothed into the buffers of their source, then aligned and
+	/// integrated in source order. The reconstruction is a single device
+	/// context, so its calls are never made concurrently.
+	/// </summary>
+	/// <param name="depthFrames">depthFrames[i] is the frame of source i, NULL if it has no new frame</param>
+	/// <returns>Returns the first failure, the frames of the other sources are integrated anyway</returns>
+	HRESULT IntegrateFrames(UINT16* const* depthFrames)
+	{
+		if (nullptr == depthFrames) return E_POINTER;
+		HRESULT result = S_OK;
+		vector<bool> prepared(sources, false);
+		for (int i = 0; i < sources; i++)
+		{
+			if (nullptr == depthFrames[i]) continue;
+			HRESULT hr = PrepareDepth(depthFrames[i], i);
+			prepared[i] = SUCCEEDED(hr);
+			if (FAILED(hr) && SUCCEEDED(result)) result = hr;
+		}
+		for (int i = 0; i < sources; i++)
+		{
+			if (!prepared[i]) continue;
+			HRESULT hr = AlignAndIntegrate(i);
+			if (FAILED(hr) && SUCCEEDED(result)) result = hr;
+		}
+		return result;
+	}
+
+private:
+	/// <summary>
+	/// Convert and smooth a depth frame into the buffers of its source
+	/// </summary>
+	HRESULT PrepareDepth(UINT16* depthFrame, int depthSource)
+	{
+		if (nullptr == depthFrame) return E_POINTER;
+		if (depthSource < 0 || depthSource >= sources) return E_INVALIDARG;
 
-		hr = volume->DepthToDepthFloatFrame(depthFrame, NUI_DEPTH_RAW_WIDTH*NUI_DEPTH_RAW_HEIGHT * sizeof(UINT16), depthFloatImage, NUI_FUSION_DEFAULT_MINIMUM_DEPTH, NUI_FUSION_DEFAULT_MAXIMUM_DEPTH, false);
+		HRESULT hr = volume->DepthToDepthFloatFrame(depthFrame, NUI_DEPTH_RAW_WIDTH*NUI_DEPTH_RAW_HEIGHT * sizeof(UINT16), depthFloatImage[depthSource], NUI_FUSION_DEFAULT_MINIMUM_DEPTH, NUI_FUSION_DEFAULT_MAXIMUM_DEPTH, false);
 		if (FAILED(hr))
 		{
 			cout << "Failed to convert depth frame to depthFloatFrame" << endl;
 			return hr;
 		}
 
-		hr = volume->SmoothDepthFloatFrame(depthFloatImage, depthSmoothFloatImage, 3, 0.04f);
+		hr = volume->SmoothDepthFloatFrame(depthFloatImage[depthSource], depthSmoothFloatImage[depthSource], 3, 0.04f);
 		if (FAILED(hr))
 		{
 			cout << "Failed to smooth depth float image" << endl;
 			return hr;
 		}
+		return hr;
+	}
 
-		float energy = 0.1;
-		hr = volume->AlignDepthFloatToReconstruction(depthSmoothFloatImage, 200, nullptr, &energy, &worldToCameraTransform[depthSource]);
+	/// <summary>
+	/// Align the prepared frame of a source to the volume and integrate it
+	/// </summary>
+	HRESULT AlignAndIntegrate(int depthSource)
+	{
+		HRESULT hr = S_OK;
+		auto alignBegin = chrono::high_resolution_clock::now();
+		hr = volume->AlignDepthFloatToReconstruction(depthSmoothFloatImage[depthSource], alignIterationCount, nullptr, &alignmentEnergy, &worldToCameraTransform[depthSource]);
+		alignmentMilliseconds = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - alignBegin).count();
 		if (FAILED(hr))
 		{
 			cout << "Failed to align depth to reconstruction" << endl;
 			return hr;
 		}
 
-		hr = volume->IntegrateFrame(depthSmoothFloatImage, 10, &worldToCameraTransform[depthSource]);
+		hr = volume->IntegrateFrame(depthSmoothFloatImage[depthSource], 10, &worldToCameraTransform[depthSource]);
 		if (FAILED(hr))
 		{
 			cout << "Failed to integrate frame" << endl;
 			return hr;
 		}
+		// The volume changed, whatever the pose turns out to be
+		InvalidateSurface();
 
 		Matrix4 calculatedCameraPose;
 		hr = volume->GetCurrentWorldToCameraTransform(&calculatedCameraPose);
@@ -751,28 +947,27 @@ public:
 		}
 
 		worldToCameraTransform[depthSource] = calculatedCameraPose;
-		volume->CalculatePointCloud(pointCloud, &worldToCameraTransform[depthSource]);
-		if (FAILED(hr))
-		{
-			cout << "CalculatePointCloud Failed" << endl;
-			return hr;
-		}
-
-		//hr = NuiFusionShadePointCloud(pointCloud, &worldToCameraTransform[depthSource], nullptr, shadedSurface, nullptr);
-
-		//if (FAILED(hr))
-		//{
-		//	cout << "0x" << hex << hr << ": NuiFusionShadePointCloud Failed" << endl;
-		//	return hr;
-		//}
-
 		return hr;
 	}
 
+public:
 #ifdef _USE_OPENCV
+	/// <summary>
+	/// cameraParameters in pixels, e.g. for KinectPointCloudGenerator
+	/// </summary>
+	KinectIntrinsics GetDepthIntrinsics()
+	{
+		return KinectNormalizedIntrinsics(NUI_DEPTH_RAW_WIDTH, NUI_DEPTH_RAW_HEIGHT,
+			cameraParameters.focalLengthX, cameraParameters.focalLengthY, cameraParameters.principalPointX, cameraParameters.principalPointY);
+	}
+
+	/// <summary>
+	/// The shaded surface seen from a source, computed only if the volume or the pose changed
+	/// </summary>
+	/// <returns>Returns an empty Mat if raycasting or shading fails</returns>
 	Mat GetShadedSurface(int depthSource = 0)
 	{
-		NuiFusionShadePointCloud(pointCloud, &worldToCameraTransform[depthSource], nullptr, shadedSurface, nullptr);
+		if (FAILED(ShadeSurface(depthSource))) return Mat();
 		return Mat(NUI_DEPTH_RAW_HEIGHT, NUI_DEPTH_RAW_WIDTH, CV_8UC4, shadedSurface->pFrameBuffer->pBits);
 	}
 #endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef _FRAMEPOOL_H
+#define _FRAMEPOOL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+/// <summary>
+/// Thread-safe pool of reusable frames, e.g. Mat or MyKinectFrame.
+/// Frames handed out by Acquire() keep the buffers of their previous use,
+/// so a reader filling them with Read(T&) does not allocate once the pool
+/// has warmed up. Every frame stays owned by the pool.
+/// </summary>
+template<class T>
+class FramePool
+{
+private:
+	vector<unique_ptr<T>> frames;
+	vector<T*> freeFrames;
+	mutex lock;
+
+public:
+	/// <summary>
+	/// Create a pool with the given number of frames already constructed
+	/// </summary>
+	FramePool(int count = 0)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			frames.emplace_back(new T());
+			freeFrames.push_back(frames.back().get());
+		}
+	}
+
+	/// <summary>
+	/// Take a frame out of the pool, constructing a new one only if none is free
+	/// </summary>
+	T* Acquire()
+	{
+		lock_guard<mutex> guard(lock);
+		if (freeFrames.empty())
+		{
+			frames.emplace_back(new T());
+			// Keep room for every frame, so Release() never has to grow the list
+			freeFrames.reserve(frames.size());
+			return frames.back().get();
+		}
+		T* frame = freeFrames.back();
+		freeFrames.pop_back();
+		return frame;
+	}
+
+	/// <summary>
+	/// Return a frame obtained from Acquire() to the pool
+	/// </summary>
+	void Release(T* frame)
+	{
+		if (frame == NULL) return;
+		lock_guard<mutex> guard(lock);
+		freeFrames.push_back(frame);
+	}
+
+	/// <summary>
+	/// Number of frames the pool has constructed
+	/// </summary>
+	int Size()
+	{
+		lock_guard<mutex> guard(lock);
+		return (int)frames.size();
+	}
+
+	/// <summary>
+	/// Number of frames currently available to Acquire()
+	/// </summary>
+	int Available()
+	{
+		lock_guard<mutex> guard(lock);
+		return (int)freeFrames.size();
+	}
+};
+
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef _KINECTBUFFER_H
+#define _KINECTBUFFER_H
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+#include <string.h>
+#include <functional>
+using namespace std;
+
+// Mats over memory owned by someone else, e.g. the buffer of a sensor frame.
+// Nothing here knows about the Kinect SDK, any object with AddRef()/Release()
+// can own the memory.
+
+#if CV_VERSION_MAJOR >= 4
+typedef AccessFlag KinectAccessFlag;
+#else
+typedef int KinectAccessFlag;
+#endif
+
+/// <summary>
+/// Allocator of Mats wrapping an external buffer. It never allocates, the
+/// release callback stored in UMatData::userdata runs once the last Mat
+/// sharing the buffer is released. Mats that are re-created with another
+/// size fall back to the default allocator.
+/// </summary>
+class KinectBufferAllocator : public MatAllocator
+{
+public:
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, KinectAccessFlag flags, UMatUsageFlags usageFlags) const
+	{
+		return NULL;
+	}
+
+	bool allocate(UMatData* data, KinectAccessFlag accessflags, UMatUsageFlags usageFlags) const
+	{
+		return false;
+	}
+
+	void deallocate(UMatData* u) const
+	{
+		if (u == NULL) return;
+		function<void()>* release = (function<void()>*)u->userdata;
+		if (release != NULL)
+		{
+			(*release)();
+			delete release;
+		}
+		delete u;
+	}
+
+	/// <summary>
+	/// The allocator shared by all wrapped Mats, it lives as long as the program
+	/// </summary>
+	static KinectBufferAllocator* Instance()
+	{
+		static KinectBufferAllocator* instance = new KinectBufferAllocator();
+		return instance;
+	}
+};
+
+/// <summary>
+/// Wrap a contiguous buffer in a Mat without copying it
+/// </summary>
+/// <param name="data">The buffer, rows * cols pixels of type</param>
+/// <param name="release">Called once when the last Mat referring to the buffer is released</param>
+/// <returns>Returns a Mat pointing into data</returns>
+inline Mat KinectWrapBuffer(void* data, int rows, int cols, int type, function<void()> release)
+{
+	Mat mat(rows, cols, type, data);
+	KinectBufferAllocator* allocator = KinectBufferAllocator::Instance();
+	UMatData* u = new UMatData(allocator);
+	u->data = u->origdata = (uchar*)data;
+	u->size = mat.total() * mat.elemSize();
+	u->flags |= UMatData::USER_ALLOCATED;
+	u->userdata = new function<void()>(release);
+	u->refcount = 1;
+	mat.u = u;
+	mat.allocator = allocator;
+	return mat;
+}
+
+/// <summary>
+/// Wrap the buffer of a reference counted frame in a Mat without copying it.
+/// The frame gets one AddRef(), which is released together with the last Mat,
+/// so the caller may release its own reference right away.
+/// </summary>
+/// <param name="frame">Object owning the buffer, with COM style AddRef()/Release()</param>
+/// <param name="data">The buffer of the frame</param>
+/// <param name="capacity">Number of pixels in the buffer</param>
+/// <returns>Returns the Mat, or an empty Mat if the buffer is smaller than rows * cols</returns>
+template<class Frame>
+inline Mat KinectWrapFrame(Frame* frame, void* data, size_t capacity, int rows, int cols, int type)
+{
+	if (frame == NULL || data == NULL || capacity < (size_t)rows * cols)
+		return Mat();
+	frame->AddRef();
+	return KinectWrapBuffer(data, rows, cols, type, [frame] { frame->Release(); });
+}
+
+/// <summary>
+/// Copy a contiguous buffer into an owned Mat with a single memcpy
+/// </summary>
+/// <param name="data">The buffer</param>
+/// <param name="capacity">Number of pixels in the buffer</param>
+/// <param name="dst">Output Mat, (re)allocated only if its size or type differs</param>
+/// <returns>Returns false if the buffer is smaller than rows * cols</returns>
+inline bool KinectCopyBuffer(const void* data, size_t capacity, int rows, int cols, int type, Mat& dst)
+{
+	if (data == NULL || capacity < (size_t)rows * cols)
+		return false;
+	dst.create(rows, cols, type);
+	size_t rowBytes = (size_t)cols * dst.elemSize();
+	if (dst.isContinuous())
+	{
+		memcpy(dst.data, data, rowBytes * rows);
+		return true;
+	}
+	for (int i = 0; i < rows; i++)
+		memcpy(dst.ptr(i), (const uchar*)data + rowBytes * i, rowBytes);
+	return true;
+}
+
+#endif
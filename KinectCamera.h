@@ -0,0 +1,225 @@
+#pragma once
+
+#ifndef _KINECTCAMERA_H
+#define _KINECTCAMERA_H
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+#include <math.h>
+#include <string.h>
+
+// Camera models shared by the CPU depth processing. Nothing here needs the
+// Kinect SDK, calibrations can come from ICoordinateMapper, a file or a test.
+
+/// <summary>
+/// Pinhole intrinsics in pixels with Brown-Conrady lens distortion
+/// (radial k1, k2, k3 and tangential p1, p2, as in OpenCV)
+/// </summary>
+struct KinectIntrinsics
+{
+	int width;
+	int height;
+	float fx, fy;
+	float cx, cy;
+	float k1, k2, k3;
+	float p1, p2;
+};
+
+/// <summary>
+/// Intrinsics of a width x height camera, without distortion unless given
+/// </summary>
+inline KinectIntrinsics KinectMakeIntrinsics(int width, int height, float fx, float fy, float cx, float cy, float k1 = 0, float k2 = 0, float k3 = 0, float p1 = 0, float p2 = 0)
+{
+	KinectIntrinsics intrinsics = { width, height, fx, fy, cx, cy, k1, k2, k3, p1, p2 };
+	return intrinsics;
+}
+
+/// <summary>
+/// Intrinsics from focal lengths and principal point normalized by the image
+/// size, the convention of NUI_FUSION_CAMERA_PARAMETERS
+/// </summary>
+inline KinectIntrinsics KinectNormalizedIntrinsics(int width, int height, float focalLengthX, float focalLengthY, float principalPointX, float principalPointY)
+{
+	return KinectMakeIntrinsics(width, height, focalLengthX * width, focalLengthY * height, principalPointX * width, principalPointY * height);
+}
+
+/// <summary>
+/// Rigid transform p' = R p + t, stored row-major as [R | t]
+/// </summary>
+struct KinectPose
+{
+	float m[12];
+};
+
+inline KinectPose KinectPoseIdentity()
+{
+	KinectPose pose = { { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 } };
+	return pose;
+}
+
+inline KinectPose KinectMakePose(const float r[9], const float t[3])
+{
+	KinectPose pose = { { r[0], r[1], r[2], t[0], r[3], r[4], r[5], t[1], r[6], r[7], r[8], t[2] } };
+	return pose;
+}
+
+inline void KinectPoseTransform(const KinectPose& pose, const float in[3], float out[3])
+{
+	const float* m = pose.m;
+	float x = in[0], y = in[1], z = in[2];
+	out[0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+	out[1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+	out[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+}
+
+/// <summary>
+/// Rotate a direction, without the translation
+/// </summary>
+inline void KinectPoseRotate(const KinectPose& pose, const float in[3], float out[3])
+{
+	const float* m = pose.m;
+	float x = in[0], y = in[1], z = in[2];
+	out[0] = m[0] * x + m[1] * y + m[2] * z;
+	out[1] = m[4] * x + m[5] * y + m[6] * z;
+	out[2] = m[8] * x + m[9] * y + m[10] * z;
+}
+
+/// <summary>
+/// The transform applying b first and then a
+/// </summary>
+inline KinectPose KinectPoseMultiply(const KinectPose& a, const KinectPose& b)
+{
+	KinectPose pose;
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			pose.m[i * 4 + j] = a.m[i * 4] * b.m[j] + a.m[i * 4 + 1] * b.m[4 + j] + a.m[i * 4 + 2] * b.m[8 + j];
+		}
+		pose.m[i * 4 + 3] += a.m[i * 4 + 3];
+	}
+	return pose;
+}
+
+inline KinectPose KinectPoseInverse(const KinectPose& pose)
+{
+	const float* m = pose.m;
+	KinectPose inverse;
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			inverse.m[i * 4 + j] = m[j * 4 + i];
+		inverse.m[i * 4 + 3] = -(m[i] * m[3] + m[4 + i] * m[7] + m[8 + i] * m[11]);
+	}
+	return inverse;
+}
+
+/// <summary>
+/// Make the rotation orthonormal again (Gram-Schmidt on its rows). Poses that
+/// are composed frame after frame collect rounding errors, and
+/// KinectPoseInverse() assumes a pure rotation.
+/// </summary>
+inline KinectPose KinectPoseNormalize(const KinectPose& pose)
+{
+	KinectPose out = pose;
+	float* a = out.m;
+	float* b = out.m + 4;
+	float* c = out.m + 8;
+	float length = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+	if (length <= 0) return pose;
+	a[0] /= length; a[1] /= length; a[2] /= length;
+	float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	b[0] -= dot * a[0]; b[1] -= dot * a[1]; b[2] -= dot * a[2];
+	length = sqrtf(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+	if (length <= 0) return pose;
+	b[0] /= length; b[1] /= length; b[2] /= length;
+	c[0] = a[1] * b[2] - a[2] * b[1];
+	c[1] = a[2] * b[0] - a[0] * b[2];
+	c[2] = a[0] * b[1] - a[1] * b[0];
+	return out;
+}
+
+/// <summary>
+/// Remove the lens distortion of a pixel, giving the ray (x, y, 1) in camera space
+/// </summary>
+inline void KinectUndistort(const KinectIntrinsics& intrinsics, float u, float v, float& x, float& y)
+{
+	double xd = (u - intrinsics.cx) / intrinsics.fx;
+	double yd = (v - intrinsics.cy) / intrinsics.fy;
+	double xu = xd, yu = yd;
+	// Fixed point iteration as in cv::undistortPoints, converges for the mild distortion of depth cameras
+	for (int k = 0; k < 20; k++)
+	{
+		double r2 = xu * xu + yu * yu;
+		double radial = 1 + ((intrinsics.k3 * r2 + intrinsics.k2) * r2 + intrinsics.k1) * r2;
+		double dx = 2 * intrinsics.p1 * xu * yu + intrinsics.p2 * (r2 + 2 * xu * xu);
+		double dy = intrinsics.p1 * (r2 + 2 * yu * yu) + 2 * intrinsics.p2 * xu * yu;
+		xu = (xd - dx) / radial;
+		yu = (yd - dy) / radial;
+	}
+	x = (float)xu;
+	y = (float)yu;
+}
+
+/// <summary>
+/// Project a camera space point to pixel coordinates, with lens distortion
+/// </summary>
+inline bool KinectProject(const KinectIntrinsics& intrinsics, const float p[3], float& u, float& v)
+{
+	if (p[2] <= 0) return false;
+	double x = p[0] / p[2], y = p[1] / p[2];
+	double r2 = x * x + y * y;
+	double radial = 1 + ((intrinsics.k3 * r2 + intrinsics.k2) * r2 + intrinsics.k1) * r2;
+	double xd = x * radial + 2 * intrinsics.p1 * x * y + intrinsics.p2 * (r2 + 2 * x * x);
+	double yd = y * radial + intrinsics.p1 * (r2 + 2 * y * y) + 2 * intrinsics.p2 * x * y;
+	u = (float)(intrinsics.fx * xd + intrinsics.cx);
+	v = (float)(intrinsics.fy * yd + intrinsics.cy);
+	return true;
+}
+
+/// <summary>
+/// Per-pixel undistorted viewing rays of a camera. The point seen by pixel
+/// (i, j) at depth z is (x(i, j) * z, y(i, j) * z, z). Building the table
+/// once keeps the distortion model out of the per-frame loops.
+/// </summary>
+struct KinectRayTable
+{
+	KinectIntrinsics intrinsics;
+	// CV_32F, one ray component per pixel
+	Mat x;
+	Mat y;
+
+	KinectRayTable()
+	{
+		memset(&intrinsics, 0, sizeof(intrinsics));
+	}
+
+	/// <summary>
+	/// Build the table, skipped if it already matches the intrinsics
+	/// </summary>
+	void Build(const KinectIntrinsics& intrinsics)
+	{
+		if (!x.empty() && memcmp(&this->intrinsics, &intrinsics, sizeof(intrinsics)) == 0)
+			return;
+		this->intrinsics = intrinsics;
+		x.create(intrinsics.height, intrinsics.width, CV_32F);
+		y.create(intrinsics.height, intrinsics.width, CV_32F);
+		parallel_for_(Range(0, intrinsics.height), [&](const Range& range)
+		{
+			for (int i = range.start; i < range.end; i++)
+			{
+				float* rx = x.ptr<float>(i);
+				float* ry = y.ptr<float>(i);
+				for (int j = 0; j < intrinsics.width; j++)
+					KinectUndistort(intrinsics, (float)j, (float)i, rx[j], ry[j]);
+			}
+		});
+	}
+
+	bool Empty() const
+	{
+		return x.empty();
+	}
+};
+
+#endif
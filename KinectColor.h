@@ -0,0 +1,120 @@
+#pragma once
+
+#ifndef _KINECTCOLOR_H
+#define _KINECTCOLOR_H
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+#include "KinectSimd.h"
+
+/// <summary>
+/// Drop the alpha channel of one row of BGRA pixels
+/// </summary>
+inline void Bgra2BgrRowScalar(const unsigned char* bgra, unsigned char* bgr, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		bgr[3 * j] = bgra[4 * j];
+		bgr[3 * j + 1] = bgra[4 * j + 1];
+		bgr[3 * j + 2] = bgra[4 * j + 2];
+	}
+}
+
+#ifdef KINECT_SIMD_X86
+
+KINECT_TARGET("ssse3") inline int Bgra2BgrRowSsse3(const unsigned char* bgra, unsigned char* bgr, int cols)
+{
+	// Gathers the 12 colour bytes of four pixels at the bottom of the register
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int j = 0;
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(bgra + 4 * j)), pack);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(bgra + 4 * j + 16)), pack);
+		__m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(bgra + 4 * j + 32)), pack);
+		__m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(bgra + 4 * j + 48)), pack);
+		_mm_storeu_si128((__m128i*)(bgr + 3 * j), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+		_mm_storeu_si128((__m128i*)(bgr + 3 * j + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+		_mm_storeu_si128((__m128i*)(bgr + 3 * j + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int Bgra2BgrRowAvx2(const unsigned char* bgra, unsigned char* bgr, int cols)
+{
+	const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	// Moves the 24 colour bytes of both lanes together
+	const __m256i join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	int j = 0;
+	for (; j + 8 <= cols; j += 8)
+	{
+		__m256i v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(bgra + 4 * j)), pack), join);
+		_mm_storeu_si128((__m128i*)(bgr + 3 * j), _mm256_castsi256_si128(v));
+		_mm_storel_epi64((__m128i*)(bgr + 3 * j + 16), _mm256_extracti128_si256(v, 1));
+	}
+	return j;
+}
+
+#endif
+
+inline void Bgra2BgrRow(const unsigned char* bgra, unsigned char* bgr, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = Bgra2BgrRowAvx2(bgra, bgr, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = Bgra2BgrRowSsse3(bgra, bgr, cols);
+#endif
+	Bgra2BgrRowScalar(bgra, bgr, j, cols);
+}
+
+/// <summary>
+/// Convert a CV_8UC4 BGRA Mat to CV_8UC3 BGR
+/// </summary>
+/// <param name="bgra">The BGRA image</param>
+/// <param name="bgr">Output BGR image, reallocated only if its size or type differs</param>
+/// <returns>Returns false if bgra is not CV_8UC4</returns>
+inline bool KinectBgra2Bgr(const Mat& bgra, Mat& bgr)
+{
+	if (bgra.type() != CV_8UC4)
+		return false;
+	bgr.create(bgra.rows, bgra.cols, CV_8UC3);
+	int level = KinectSimdLevel();
+	KinectForRows(bgra.rows, bgra.cols, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+			Bgra2BgrRow(bgra.ptr<unsigned char>(i), bgr.ptr<unsigned char>(i), bgra.cols, level);
+	});
+	return true;
+}
+
+/// <summary>
+/// Colour conversion with its own BGRA staging buffer. The sensor writes
+/// converted frames into Buffer(), which follows the frame resolution, and
+/// ToBgr() turns them into BGR. Each thread should use its own converter.
+/// </summary>
+class KinectColorConverter
+{
+private:
+	Mat staging;
+
+public:
+	/// <summary>
+	/// BGRA buffer of rows x cols pixels, reallocated only when the size changes
+	/// </summary>
+	Mat& Buffer(int rows, int cols)
+	{
+		staging.create(rows, cols, CV_8UC4);
+		return staging;
+	}
+
+	/// <summary>
+	/// Convert the content of Buffer() to BGR
+	/// </summary>
+	bool ToBgr(Mat& bgr)
+	{
+		return KinectBgra2Bgr(staging, bgr);
+	}
+};
+
+#endif
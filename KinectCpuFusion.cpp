@@ -0,0 +1,423 @@
+#include "KinectCpuFusion.h"
+
+KinectCpuFusion::KinectCpuFusion(int sourceCount, KinectVolumeParameters parameters) :
+	worldToCameraTransform(sourceCount < 1 ? 1 : sourceCount, KinectPoseIdentity()),
+	parameters(parameters),
+	blocksX(0), blocksY(0), blocksZ(0),
+	truncation(0.03f),
+	minDepth(KINECT_DEFAULT_MINIMUM_DEPTH),
+	maxDepth(KINECT_DEFAULT_MAXIMUM_DEPTH),
+	smoothingWidth(3),
+	smoothingThreshold(0.04f),
+	depthFloat(sourceCount < 1 ? 1 : sourceCount),
+	depthRaw(sourceCount < 1 ? 1 : sourceCount),
+	trackers(sourceCount < 1 ? 1 : sourceCount),
+	tracking(true),
+	surfaces(sourceCount < 1 ? 1 : sourceCount),
+	revision(0)
+{
+	memset(&intrinsics, 0, sizeof(intrinsics));
+	volumeToWorld = KinectPoseIdentity();
+}
+
+bool KinectCpuFusion::init(const KinectIntrinsics& depthIntrinsics)
+{
+	if (parameters.voxelsPerMeter <= 0
+		|| parameters.voxelCountX <= 0 || parameters.voxelCountX % KINECT_BLOCK != 0
+		|| parameters.voxelCountY <= 0 || parameters.voxelCountY % KINECT_BLOCK != 0
+		|| parameters.voxelCountZ <= 0 || parameters.voxelCountZ % KINECT_BLOCK != 0)
+	{
+		return false;
+	}
+	intrinsics = depthIntrinsics;
+	blocksX = parameters.voxelCountX / KINECT_BLOCK;
+	blocksY = parameters.voxelCountY / KINECT_BLOCK;
+	blocksZ = parameters.voxelCountZ / KINECT_BLOCK;
+	try
+	{
+		voxels.assign((size_t)blocksX * blocksY * blocksZ * KINECT_BLOCK_VOXELS, KinectVoxel());
+		blockWeight.assign((size_t)blocksX * blocksY * blocksZ, 0);
+	}
+	catch (const bad_alloc&)
+	{
+		voxels.clear();
+		blockWeight.clear();
+		return false;
+	}
+	// Like the SDK's default world to volume transform, the camera at the
+	// world origin looks along +Z at the middle of the volume's front face
+	float size = VoxelSize();
+	volumeToWorld.m[3] = -parameters.voxelCountX / 2 * size;
+	volumeToWorld.m[7] = -parameters.voxelCountY / 2 * size;
+	volumeToWorld.m[11] = 0;
+	for (size_t i = 0; i < trackers.size(); i++)
+	{
+		depthFloat[i].create(intrinsics.height, intrinsics.width, CV_32F);
+		if (!trackers[i].Init(intrinsics))
+			return false;
+	}
+	return Reset();
+}
+
+bool KinectCpuFusion::Reset()
+{
+	if (voxels.empty()) return false;
+	memset(voxels.data(), 0, voxels.size() * sizeof(KinectVoxel));
+	memset(blockWeight.data(), 0, blockWeight.size() * sizeof(short));
+	for (size_t i = 0; i < worldToCameraTransform.size(); i++)
+		worldToCameraTransform[i] = KinectPoseIdentity();
+	for (size_t i = 0; i < trackers.size(); i++)
+		trackers[i].ClearReference();
+	revision++;
+	return true;
+}
+
+bool KinectCpuFusion::FillVolume(const function<float(const float p[3])>& distance)
+{
+	if (voxels.empty()) return false;
+	float size = VoxelSize();
+	parallel_for_(Range(0, blocksY * blocksZ), [&](const Range& range)
+	{
+		for (int row = range.start; row < range.end; row++)
+		{
+			int by = row % blocksY, bz = row / blocksY;
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				size_t blockIndex = ((size_t)bz * blocksY + by) * blocksX + bx;
+				KinectVoxel* voxel = &voxels[blockIndex * KINECT_BLOCK_VOXELS];
+				short highest = 0;
+				for (int z = 0; z < KINECT_BLOCK; z++)
+				{
+					for (int y = 0; y < KINECT_BLOCK; y++)
+					{
+						for (int x = 0; x < KINECT_BLOCK; x++, voxel++)
+						{
+							float p[3] = { (bx * KINECT_BLOCK + x) * size, (by * KINECT_BLOCK + y) * size, (bz * KINECT_BLOCK + z) * size };
+							float w[3];
+							KinectPoseTransform(volumeToWorld, p, w);
+							float d = distance(w);
+							if (d <= -truncation)
+							{
+								voxel->tsdf = 0;
+								voxel->weight = 0;
+								continue;
+							}
+							voxel->tsdf = (short)((d >= truncation ? 1.0f : d / truncation) * KINECT_TSDF_SCALE);
+							voxel->weight = 1;
+							highest = 1;
+						}
+					}
+				}
+				blockWeight[blockIndex] = highest;
+			}
+		}
+	});
+	revision++;
+	return true;
+}
+
+void KinectCpuFusion::SetDepthRange(float minDepth, float maxDepth)
+{
+	this->minDepth = minDepth;
+	this->maxDepth = maxDepth;
+}
+
+void KinectCpuFusion::SetTruncation(float metres)
+{
+	truncation = metres;
+}
+
+KinectVolumeParameters KinectCpuFusion::Parameters() const { return parameters; }
+KinectIntrinsics KinectCpuFusion::Intrinsics() const { return intrinsics; }
+int KinectCpuFusion::BlocksX() const { return blocksX; }
+int KinectCpuFusion::BlocksY() const { return blocksY; }
+int KinectCpuFusion::BlocksZ() const { return blocksZ; }
+KinectPose KinectCpuFusion::VolumeToWorld() const { return volumeToWorld; }
+float KinectCpuFusion::VoxelSize() const { return 1.0f / parameters.voxelsPerMeter; }
+float KinectCpuFusion::Truncation() const { return truncation; }
+unsigned int KinectCpuFusion::Revision() const { return revision; }
+
+void KinectCpuFusion::SetSmoothing(int kernelWidth, float distanceThreshold)
+{
+	smoothingWidth = kernelWidth;
+	smoothingThreshold = distanceThreshold;
+}
+
+void KinectCpuFusion::SetTracking(bool enabled)
+{
+	tracking = enabled;
+	// The previous frames are stale once tracking resumes
+	for (size_t i = 0; i < trackers.size(); i++)
+		trackers[i].ClearReference();
+}
+
+void KinectCpuFusion::SetTrackingParameters(const KinectIcpParameters& parameters)
+{
+	for (size_t i = 0; i < trackers.size(); i++)
+		trackers[i].SetParameters(parameters);
+}
+
+const KinectIcpReport& KinectCpuFusion::TrackingReport(int depthSource) const
+{
+	if (depthSource < 0 || depthSource >= (int)trackers.size())
+	{
+		static const KinectIcpReport none = {};
+		return none;
+	}
+	return trackers[depthSource].LastReport();
+}
+
+KinectRaycaster* KinectCpuFusion::Surface(int depthSource)
+{
+	if (depthSource < 0 || depthSource >= (int)surfaces.size())
+		return NULL;
+	KinectRaycaster& surface = surfaces[depthSource];
+	return surface.Raycast(*this, worldToCameraTransform[depthSource]) ? &surface : NULL;
+}
+
+Mat KinectCpuFusion::GetShadedSurface(int depthSource)
+{
+	KinectRaycaster* surface = Surface(depthSource);
+	return surface == NULL ? Mat() : surface->Shaded();
+}
+
+Mat KinectCpuFusion::GetSurfaceDepth(int depthSource)
+{
+	KinectRaycaster* surface = Surface(depthSource);
+	return surface == NULL ? Mat() : surface->Depth();
+}
+
+Mat KinectCpuFusion::GetSurfaceNormals(int depthSource)
+{
+	KinectRaycaster* surface = Surface(depthSource);
+	return surface == NULL ? Mat() : surface->Normals();
+}
+
+const KinectVoxel* KinectCpuFusion::Block(int bx, int by, int bz) const
+{
+	return &voxels[(((size_t)bz * blocksY + by) * blocksX + bx) * KINECT_BLOCK_VOXELS];
+}
+
+short KinectCpuFusion::BlockWeight(int bx, int by, int bz) const
+{
+	return blockWeight[((size_t)bz * blocksY + by) * blocksX + bx];
+}
+
+bool KinectCpuFusion::ProcessDepth(const unsigned short* depthFrame, int depthSource)
+{
+	if (depthFrame == NULL || voxels.empty() || depthSource < 0 || depthSource >= (int)worldToCameraTransform.size())
+		return false;
+	if (!DepthToFloat(depthFrame, depthSource) || !Track(depthSource))
+		return false;
+	Integrate(&depthSource, 1, KINECT_DEFAULT_INTEGRATION_WEIGHT);
+	if (tracking)
+		trackers[depthSource].KeepAsReference(worldToCameraTransform[depthSource]);
+	return true;
+}
+
+bool KinectCpuFusion::ProcessDepth(const Mat& depthFrame, int depthSource)
+{
+	if (depthFrame.type() != CV_16U || depthFrame.cols != intrinsics.width || depthFrame.rows != intrinsics.height || !depthFrame.isContinuous())
+		return false;
+	return ProcessDepth(depthFrame.ptr<unsigned short>(), depthSource);
+}
+
+bool KinectCpuFusion::IntegrateFrame(const unsigned short* depthFrame, int depthSource)
+{
+	if (depthFrame == NULL || voxels.empty() || depthSource < 0 || depthSource >= (int)worldToCameraTransform.size())
+		return false;
+	if (!DepthToFloat(depthFrame, depthSource) || !Track(depthSource))
+		return false;
+	// Same integration weight as KinectFusion::IntegrateFrame
+	Integrate(&depthSource, 1, 10);
+	if (tracking)
+		trackers[depthSource].KeepAsReference(worldToCameraTransform[depthSource]);
+	return true;
+}
+
+int KinectCpuFusion::IntegrateFrames(const vector<const unsigned short*>& depthFrames, vector<bool>* integrated)
+{
+	int count = (int)min(depthFrames.size(), worldToCameraTransform.size());
+	vector<unsigned char> ready(count, 0);
+	if (!voxels.empty())
+	{
+		// Conversion, smoothing and tracking split every frame into row bands
+		// on all threads, so the sources take turns rather than each getting
+		// a single thread of a nested loop
+		for (int i = 0; i < count; i++)
+			ready[i] = depthFrames[i] != NULL && DepthToFloat(depthFrames[i], i) && Track(i);
+	}
+	vector<int> sources;
+	for (int i = 0; i < count; i++)
+	{
+		if (ready[i]) sources.push_back(i);
+	}
+	if (!sources.empty())
+		Integrate(sources.data(), (int)sources.size(), 10);
+	for (size_t k = 0; k < sources.size(); k++)
+	{
+		if (tracking)
+			trackers[sources[k]].KeepAsReference(worldToCameraTransform[sources[k]]);
+	}
+	if (integrated != NULL)
+	{
+		integrated->assign(depthFrames.size(), false);
+		for (size_t k = 0; k < sources.size(); k++)
+			(*integrated)[sources[k]] = true;
+	}
+	return (int)sources.size();
+}
+
+int KinectCpuFusion::IntegrateFrames(const vector<Mat>& depthFrames, vector<bool>* integrated)
+{
+	vector<const unsigned short*> frames(depthFrames.size(), NULL);
+	for (size_t i = 0; i < depthFrames.size(); i++)
+	{
+		const Mat& frame = depthFrames[i];
+		if (frame.type() == CV_16U && frame.cols == intrinsics.width && frame.rows == intrinsics.height && frame.isContinuous())
+			frames[i] = frame.ptr<unsigned short>();
+	}
+	return IntegrateFrames(frames, integrated);
+}
+
+bool KinectCpuFusion::DepthToFloat(const unsigned short* depthFrame, int depthSource)
+{
+	Mat depth(intrinsics.height, intrinsics.width, CV_16U, (void*)depthFrame);
+	// Same defaults as the DepthToDepthFloatFrame and SmoothDepthFloatFrame calls of KinectFusion
+	if (smoothingWidth <= 0)
+		return KinectDepthToFloat(depth, depthFloat[depthSource], minDepth, maxDepth);
+	return KinectDepthToFloat(depth, depthRaw[depthSource], minDepth, maxDepth)
+		&& KinectSmoothDepth(depthRaw[depthSource], depthFloat[depthSource], smoothingWidth, smoothingThreshold);
+}
+
+/// <summary>
+/// Align the depthFloat of a source to the surface of the volume seen from the
+/// last pose of the source and update its pose, as AlignDepthFloatToReconstruction.
+/// The first frame after a reset only becomes the reference.
+/// </summary>
+bool KinectCpuFusion::Track(int depthSource)
+{
+	if (!tracking) return true;
+	KinectIcp& tracker = trackers[depthSource];
+	// Once the source has integrated a frame the volume holds its surface.
+	// Aligning to the raycast instead of the last frame keeps the error from
+	// adding up frame after frame; the last frame stays the reference if
+	// the raycast is empty.
+	if (tracker.HasReference())
+	{
+		Mat surface = GetSurfaceDepth(depthSource);
+		if (!surface.empty())
+			tracker.SetReference(surface, worldToCameraTransform[depthSource]);
+	}
+	return tracker.Align(depthFloat[depthSource], worldToCameraTransform[depthSource]);
+}
+
+/// <summary>
+/// Camera of one frame being integrated
+/// </summary>
+struct IntegrationView
+{
+	KinectPose volumeToCamera;
+	// Camera space step of one voxel along each volume axis
+	float dx[3], dy[3], dz[3];
+	const float* depth;
+};
+
+/// <summary>
+/// Fold the depthFloat frames of some sources into every block their
+/// cameras see. Blocks are independent, so they are split across threads;
+/// each block takes the frames in the given order while it is in cache.
+/// </summary>
+void KinectCpuFusion::Integrate(const int* depthSources, int count, int maxWeight)
+{
+	float size = VoxelSize();
+	vector<IntegrationView> views(count);
+	for (int k = 0; k < count; k++)
+	{
+		IntegrationView& view = views[k];
+		view.volumeToCamera = KinectPoseMultiply(worldToCameraTransform[depthSources[k]], volumeToWorld);
+		const float* m = view.volumeToCamera.m;
+		for (int a = 0; a < 3; a++)
+		{
+			view.dx[a] = m[a * 4] * size;
+			view.dy[a] = m[a * 4 + 1] * size;
+			view.dz[a] = m[a * 4 + 2] * size;
+		}
+		view.depth = depthFloat[depthSources[k]].ptr<float>();
+	}
+	float fx = intrinsics.fx, fy = intrinsics.fy, cx = intrinsics.cx, cy = intrinsics.cy;
+	int width = intrinsics.width, height = intrinsics.height;
+	float radius = 0.87f * KINECT_BLOCK * size;
+	float invTruncation = 1.0f / truncation;
+	float farLimit = maxDepth + truncation + radius;
+
+	parallel_for_(Range(0, blocksY * blocksZ), [&](const Range& range)
+	{
+		for (int row = range.start; row < range.end; row++)
+		{
+			int by = row % blocksY, bz = row / blocksY;
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				size_t blockIndex = ((size_t)bz * blocksY + by) * blocksX + bx;
+				KinectVoxel* block = &voxels[blockIndex * KINECT_BLOCK_VOXELS];
+				short highest = blockWeight[blockIndex];
+				float origin[3] = { (float)bx * KINECT_BLOCK, (float)by * KINECT_BLOCK, (float)bz * KINECT_BLOCK };
+				float half = KINECT_BLOCK * 0.5f;
+				float center[3] = { (origin[0] + half) * size, (origin[1] + half) * size, (origin[2] + half) * size };
+				float scaled[3] = { origin[0] * size, origin[1] * size, origin[2] * size };
+				for (int k = 0; k < count; k++)
+				{
+					const IntegrationView& view = views[k];
+					const float* dx = view.dx;
+					const float* dy = view.dy;
+					const float* dz = view.dz;
+					const float* depth = view.depth;
+					float c[3];
+					KinectPoseTransform(view.volumeToCamera, center, c);
+					// Skip blocks behind the camera, beyond the depth range or outside the image
+					if (c[2] + radius <= 0 || c[2] - radius > farLimit) continue;
+					if (c[2] > radius)
+					{
+						float nearest = c[2] - radius;
+						float u = fx * c[0] / c[2] + cx, v = fy * c[1] / c[2] + cy;
+						float ru = fx * radius / nearest, rv = fy * radius / nearest;
+						if (u + ru < 0 || u - ru >= width || v + rv < 0 || v - rv >= height) continue;
+					}
+
+					float base[3];
+					KinectPoseTransform(view.volumeToCamera, scaled, base);
+					for (int z = 0; z < KINECT_BLOCK; z++)
+					{
+						for (int y = 0; y < KINECT_BLOCK; y++)
+						{
+							float px = base[0] + z * dz[0] + y * dy[0];
+							float py = base[1] + z * dz[1] + y * dy[1];
+							float pz = base[2] + z * dz[2] + y * dy[2];
+							KinectVoxel* voxel = block + (z * KINECT_BLOCK + y) * KINECT_BLOCK;
+							for (int x = 0; x < KINECT_BLOCK; x++, px += dx[0], py += dx[1], pz += dx[2])
+							{
+								if (pz <= 0) continue;
+								float inv = 1.0f / pz;
+								float u = fx * px * inv + cx + 0.5f;
+								float v = fy * py * inv + cy + 0.5f;
+								if (u < 0 || v < 0 || u >= width || v >= height) continue;
+								float d = depth[(int)v * width + (int)u];
+								if (d <= 0) continue;
+								float sdf = d - pz;
+								if (sdf < -truncation) continue;
+								float tsdf = sdf >= truncation ? 1.0f : sdf * invTruncation;
+								KinectVoxel& target = voxel[x];
+								int w = target.weight;
+								target.tsdf = (short)((target.tsdf * w + tsdf * KINECT_TSDF_SCALE) / (w + 1));
+								target.weight = (short)(w < maxWeight ? w + 1 : maxWeight);
+								if (target.weight > highest) highest = target.weight;
+							}
+						}
+					}
+				}
+				blockWeight[blockIndex] = highest;
+			}
+		}
+	});
+	revision++;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#ifndef _KINECTCPUFUSION_H
+#define _KINECTCPUFUSION_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <functional>
+#include "KinectCamera.h"
+#include "KinectIcp.h"
+#include "KinectDepthFilter.h"
+#include "KinectRaycast.h"
+
+using namespace cv;
+using namespace std;
+
+// CPU reconstruction volume with the ProcessDepth/IntegrateFrame/Reset
+// surface of KinectFusion, for machines without the Kinect SDK or a
+// DirectX11 device. The truncated signed distance of every voxel is stored
+// in blocks of KINECT_BLOCK^3 voxels, each block contiguous in memory, so
+// integrating one block touches one small piece of memory and blocks
+// outside the camera frustum are skipped as a whole.
+#define KINECT_BLOCK 8
+#define KINECT_BLOCK_VOXELS (KINECT_BLOCK * KINECT_BLOCK * KINECT_BLOCK)
+// Stored TSDF values are distance / truncation scaled to a short
+#define KINECT_TSDF_SCALE 32767.0f
+#define KINECT_DEFAULT_MINIMUM_DEPTH 0.35f
+#define KINECT_DEFAULT_MAXIMUM_DEPTH 8.0f
+#define KINECT_DEFAULT_INTEGRATION_WEIGHT 200
+
+/// <summary>
+/// Volume settings, laid out like NUI_FUSION_RECONSTRUCTION_PARAMETERS
+/// </summary>
+struct KinectVolumeParameters
+{
+	float voxelsPerMeter;
+	int voxelCountX;
+	int voxelCountY;
+	int voxelCountZ;
+};
+
+struct KinectVoxel
+{
+	short tsdf;
+	short weight;
+};
+
+class KinectCpuFusion
+{
+public:
+	// Camera pose of every depth source, as in KinectFusion. With tracking on
+	// it is the initial guess of the next frame and is updated by every frame.
+	vector<KinectPose> worldToCameraTransform;
+
+	KinectCpuFusion(int sourceCount = 1, KinectVolumeParameters parameters = { 256, 384, 384, 384 });
+
+	/// <summary>
+	/// Allocate the volume
+	/// </summary>
+	/// <param name="depthIntrinsics">Depth camera, only the pinhole part is used</param>
+	/// <returns>Returns false if the volume size is not a multiple of KINECT_BLOCK or memory runs out</returns>
+	bool init(const KinectIntrinsics& depthIntrinsics);
+
+	/// <summary>
+	/// Track the camera and integrate a depth frame
+	/// </summary>
+	/// <returns>Returns false if the frame is invalid or tracking fails, the volume is unchanged then</returns>
+	bool ProcessDepth(const unsigned short* depthFrame, int depthSource = 0);
+	bool ProcessDepth(const Mat& depthFrame, int depthSource = 0);
+	bool IntegrateFrame(const unsigned short* depthFrame, int depthSource);
+
+	/// <summary>
+	/// Track and integrate one frame of each of several sources. The frames
+	/// are converted, smoothed and aligned one source after the other, each in
+	/// its own buffers, and then folded into the volume in a single pass over
+	/// the blocks, in source order.
+	/// </summary>
+	/// <param name="depthFrames">depthFrames[i] is the frame of source i, NULL if the source has no new frame</param>
+	/// <param name="integrated">Optional, whether the frame of each source was integrated</param>
+	/// <returns>Returns the number of frames integrated, frames that fail to track are left out</returns>
+	int IntegrateFrames(const vector<const unsigned short*>& depthFrames, vector<bool>* integrated = NULL);
+	// Frames as CV_16U Mats, empty for sources without a new frame
+	int IntegrateFrames(const vector<Mat>& depthFrames, vector<bool>* integrated = NULL);
+	bool Reset();
+
+	/// <summary>
+	/// Replace the volume by a signed distance function, e.g. to test or
+	/// benchmark what reads the volume. Voxels closer than the truncation
+	/// or outside get weight 1, like after integrating one frame.
+	/// </summary>
+	/// <param name="distance">Signed distance in metres of a world space point, negative inside</param>
+	bool FillVolume(const function<float(const float p[3])>& distance);
+
+	void SetDepthRange(float minDepth, float maxDepth);
+	void SetTruncation(float metres);
+	// Edge preserving smoothing of every frame, as SmoothDepthFloatFrame, kernelWidth 0 turns it off
+	void SetSmoothing(int kernelWidth, float distanceThreshold);
+
+	/// <summary>
+	/// Turn camera tracking on or off. Without tracking frames are integrated
+	/// at worldToCameraTransform as given, e.g. poses from an external tracker.
+	/// </summary>
+	void SetTracking(bool enabled);
+	void SetTrackingParameters(const KinectIcpParameters& parameters);
+	// Iterations, residual and time of the last alignment of a source, all zero for an unknown source
+	const KinectIcpReport& TrackingReport(int depthSource = 0) const;
+
+	// Surface seen from the pose of a source, raycast on the first call after
+	// the pose or the volume changed. The images stay valid until the next call.
+	Mat GetShadedSurface(int depthSource = 0);
+	Mat GetSurfaceDepth(int depthSource = 0);
+	Mat GetSurfaceNormals(int depthSource = 0);
+
+	// Volume access, coordinates are voxel indices
+	KinectVolumeParameters Parameters() const;
+	KinectIntrinsics Intrinsics() const;
+	int BlocksX() const;
+	int BlocksY() const;
+	int BlocksZ() const;
+	const KinectVoxel* Block(int bx, int by, int bz) const;
+	// Highest weight in a block, 0 if no frame has reached it
+	short BlockWeight(int bx, int by, int bz) const;
+	// Transform from voxel index times VoxelSize() to world space
+	KinectPose VolumeToWorld() const;
+	float VoxelSize() const;
+	float Truncation() const;
+	// Changes whenever frames are integrated or the volume is reset or filled
+	unsigned int Revision() const;
+
+private:
+	KinectVolumeParameters parameters;
+	int blocksX, blocksY, blocksZ;
+	vector<KinectVoxel> voxels;
+	vector<short> blockWeight;
+	KinectIntrinsics intrinsics;
+	KinectPose volumeToWorld;
+	float truncation;
+	float minDepth, maxDepth;
+	int smoothingWidth;
+	float smoothingThreshold;
+	// Depth in metres of the frame being integrated by every source, 0 where invalid
+	vector<Mat> depthFloat;
+	// The same before smoothing
+	vector<Mat> depthRaw;
+	// ICP of every source, against the raycast volume once it holds a frame of the source
+	vector<KinectIcp> trackers;
+	bool tracking;
+	// Cached surface of every source
+	vector<KinectRaycaster> surfaces;
+	unsigned int revision;
+
+	bool DepthToFloat(const unsigned short* depthFrame, int depthSource);
+	bool Track(int depthSource);
+	void Integrate(const int* depthSources, int count, int maxWeight);
+	KinectRaycaster* Surface(int depthSource);
+};
+
+#endif
@@ -0,0 +1,231 @@
+#pragma once
+
+#ifndef _KINECTDEPTHFILTER_H
+#define _KINECTDEPTHFILTER_H
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+#include <math.h>
+#include "KinectSimd.h"
+
+// CPU versions of the depth preprocessing of Kinect Fusion,
+// DepthToDepthFloatFrame and SmoothDepthFloatFrame.
+
+// Largest smoothing kernel width, as accepted by SmoothDepthFloatFrame
+#define KINECT_MAX_SMOOTHING_WIDTH 3
+
+inline void DepthToFloatRowScalar(const unsigned short* depth, float* out, float minDepth, float maxDepth, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		float d = depth[j] * 0.001f;
+		out[j] = d < minDepth || d > maxDepth ? 0 : d;
+	}
+}
+
+/// <summary>
+/// Smooth the pixels [begin, end) of one row. lines holds the 2 * radius + 1
+/// rows around it, NULL above and below the image. Every pixel becomes the
+/// mean of the valid pixels of the window that are closer than threshold to
+/// it, invalid pixels stay 0.
+/// </summary>
+inline void SmoothRowScalar(const float* const* lines, float* out, int cols, int radius, float threshold, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		float c = lines[radius][j];
+		if (c <= 0)
+		{
+			out[j] = 0;
+			continue;
+		}
+		float sum = 0, count = 0;
+		for (int k = 0; k <= 2 * radius; k++)
+		{
+			const float* line = lines[k];
+			if (line == NULL) continue;
+			for (int x = j - radius; x <= j + radius; x++)
+			{
+				if (x < 0 || x >= cols) continue;
+				float n = line[x];
+				if (n > 0 && fabsf(n - c) < threshold)
+				{
+					sum += n;
+					count += 1;
+				}
+			}
+		}
+		out[j] = sum / count;
+	}
+}
+
+#ifdef KINECT_SIMD_X86
+
+KINECT_TARGET("ssse3") inline int DepthToFloatRowSsse3(const unsigned short* depth, float* out, float minDepth, float maxDepth, int cols)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(0.001f), low = _mm_set1_ps(minDepth), high = _mm_set1_ps(maxDepth);
+	int j = 0;
+	for (; j + 8 <= cols; j += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(depth + j));
+		__m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale);
+		__m128 b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale);
+		_mm_storeu_ps(out + j, _mm_and_ps(a, _mm_and_ps(_mm_cmpge_ps(a, low), _mm_cmple_ps(a, high))));
+		_mm_storeu_ps(out + j + 4, _mm_and_ps(b, _mm_and_ps(_mm_cmpge_ps(b, low), _mm_cmple_ps(b, high))));
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int DepthToFloatRowAvx2(const unsigned short* depth, float* out, float minDepth, float maxDepth, int cols)
+{
+	const __m256 scale = _mm256_set1_ps(0.001f), low = _mm256_set1_ps(minDepth), high = _mm256_set1_ps(maxDepth);
+	int j = 0;
+	for (; j + 8 <= cols; j += 8)
+	{
+		__m256 d = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + j)))), scale);
+		__m256 inside = _mm256_and_ps(_mm256_cmp_ps(d, low, _CMP_GE_OQ), _mm256_cmp_ps(d, high, _CMP_LE_OQ));
+		_mm256_storeu_ps(out + j, _mm256_and_ps(d, inside));
+	}
+	return j;
+}
+
+// The vector smoothing kernels run on rows with a full window and start at
+// column radius. They add the taps in the order of the scalar loop, masked
+// taps add 0, so the sums are identical.
+
+KINECT_TARGET("ssse3") inline int SmoothRowSsse3(const float* const* lines, float* out, int cols, int radius, float threshold)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1), sign = _mm_set1_ps(-0.0f), limit = _mm_set1_ps(threshold);
+	int j = radius;
+	for (; j + 4 <= cols - radius; j += 4)
+	{
+		__m128 c = _mm_loadu_ps(lines[radius] + j);
+		__m128 sum = zero, count = zero;
+		for (int k = 0; k <= 2 * radius; k++)
+		{
+			const float* line = lines[k] + j - radius;
+			for (int x = 0; x <= 2 * radius; x++)
+			{
+				__m128 n = _mm_loadu_ps(line + x);
+				__m128 take = _mm_and_ps(_mm_cmpgt_ps(n, zero), _mm_cmplt_ps(_mm_andnot_ps(sign, _mm_sub_ps(n, c)), limit));
+				sum = _mm_add_ps(sum, _mm_and_ps(take, n));
+				count = _mm_add_ps(count, _mm_and_ps(take, one));
+			}
+		}
+		_mm_storeu_ps(out + j, _mm_and_ps(_mm_div_ps(sum, count), _mm_cmpgt_ps(c, zero)));
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int SmoothRowAvx2(const float* const* lines, float* out, int cols, int radius, float threshold)
+{
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1), sign = _mm256_set1_ps(-0.0f), limit = _mm256_set1_ps(threshold);
+	int j = radius;
+	for (; j + 8 <= cols - radius; j += 8)
+	{
+		__m256 c = _mm256_loadu_ps(lines[radius] + j);
+		__m256 sum = zero, count = zero;
+		for (int k = 0; k <= 2 * radius; k++)
+		{
+			const float* line = lines[k] + j - radius;
+			for (int x = 0; x <= 2 * radius; x++)
+			{
+				__m256 n = _mm256_loadu_ps(line + x);
+				__m256 take = _mm256_and_ps(_mm256_cmp_ps(n, zero, _CMP_GT_OQ), _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(n, c)), limit, _CMP_LT_OQ));
+				sum = _mm256_add_ps(sum, _mm256_and_ps(take, n));
+				count = _mm256_add_ps(count, _mm256_and_ps(take, one));
+			}
+		}
+		_mm256_storeu_ps(out + j, _mm256_and_ps(_mm256_div_ps(sum, count), _mm256_cmp_ps(c, zero, _CMP_GT_OQ)));
+	}
+	return j;
+}
+
+#endif
+
+inline void DepthToFloatRow(const unsigned short* depth, float* out, float minDepth, float maxDepth, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = DepthToFloatRowAvx2(depth, out, minDepth, maxDepth, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = DepthToFloatRowSsse3(depth, out, minDepth, maxDepth, cols);
+#endif
+	DepthToFloatRowScalar(depth, out, minDepth, maxDepth, j, cols);
+}
+
+inline void SmoothRow(const float* const* lines, float* out, int cols, int radius, float threshold, int level)
+{
+	bool full = true;
+	for (int k = 0; k <= 2 * radius; k++)
+		full = full && lines[k] != NULL;
+	int left = radius < cols ? radius : cols;
+	int j = left;
+#ifdef KINECT_SIMD_X86
+	if (full && level >= KINECT_SIMD_AVX2) j = SmoothRowAvx2(lines, out, cols, radius, threshold);
+	else if (full && level >= KINECT_SIMD_SSSE3) j = SmoothRowSsse3(lines, out, cols, radius, threshold);
+#endif
+	SmoothRowScalar(lines, out, cols, radius, threshold, 0, left);
+	SmoothRowScalar(lines, out, cols, radius, threshold, j > left ? j : left, cols);
+}
+
+/// <summary>
+/// Convert a CV_16U depth frame in millimetres to CV_32F metres, like
+/// DepthToDepthFloatFrame. Depths outside [minDepth, maxDepth] become 0.
+/// </summary>
+/// <param name="depth">CV_16U depth frame</param>
+/// <param name="depthFloat">Output, reallocated only if its size or type differs</param>
+/// <returns>Returns false if depth is not CV_16U</returns>
+inline bool KinectDepthToFloat(const Mat& depth, Mat& depthFloat, float minDepth, float maxDepth)
+{
+	if (depth.type() != CV_16U)
+		return false;
+	depthFloat.create(depth.rows, depth.cols, CV_32F);
+	int level = KinectSimdLevel();
+	KinectForRows(depth.rows, depth.cols, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+			DepthToFloatRow(depth.ptr<unsigned short>(i), depthFloat.ptr<float>(i), minDepth, maxDepth, depth.cols, level);
+	});
+	return true;
+}
+
+/// <summary>
+/// Edge preserving smoothing of a float depth frame, like SmoothDepthFloatFrame.
+/// Each pixel becomes the mean of the pixels of its window that are closer
+/// than distanceThreshold to it, so depth edges are not blurred.
+/// </summary>
+/// <param name="depthFloat">CV_32F depth in metres, 0 where invalid</param>
+/// <param name="smoothed">Output, may not share memory with depthFloat</param>
+/// <param name="kernelWidth">Window radius from 1 to KINECT_MAX_SMOOTHING_WIDTH, the window is (2 * kernelWidth + 1)^2</param>
+/// <param name="distanceThreshold">Largest depth difference to the centre in metres</param>
+/// <returns>Returns false for an invalid type, kernel width or threshold</returns>
+inline bool KinectSmoothDepth(const Mat& depthFloat, Mat& smoothed, int kernelWidth = 3, float distanceThreshold = 0.04f)
+{
+	if (depthFloat.type() != CV_32F || kernelWidth < 1 || kernelWidth > KINECT_MAX_SMOOTHING_WIDTH || !(distanceThreshold > 0))
+		return false;
+	if (!smoothed.empty() && smoothed.data == depthFloat.data)
+		return false;
+	smoothed.create(depthFloat.rows, depthFloat.cols, CV_32F);
+	int rows = depthFloat.rows, cols = depthFloat.cols;
+	int level = KinectSimdLevel();
+	int taps = (2 * kernelWidth + 1) * (2 * kernelWidth + 1);
+	// Every row band reads its rows plus kernelWidth rows on either side, which stay in cache
+	KinectForRows(rows, cols * taps, [&](int begin, int end)
+	{
+		const float* lines[2 * KINECT_MAX_SMOOTHING_WIDTH + 1];
+		for (int i = begin; i < end; i++)
+		{
+			for (int k = 0; k <= 2 * kernelWidth; k++)
+			{
+				int y = i - kernelWidth + k;
+				lines[k] = y < 0 || y >= rows ? NULL : depthFloat.ptr<float>(y);
+			}
+			SmoothRow(lines, smoothed.ptr<float>(i), cols, kernelWidth, distanceThreshold, level);
+		}
+	});
+	return true;
+}
+
+#endif
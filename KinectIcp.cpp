@@ -0,0 +1,358 @@
+#include "KinectIcp.h"
+#include "KinectSimd.h"
+#include <mutex>
+#include <chrono>
+
+using namespace std::chrono;
+
+// Layout of the sums reduced per iteration: the upper triangle of A^T A,
+// A^T b, the squared residual and the number of correspondences
+#define ICP_ATA 0
+#define ICP_ATB 21
+#define ICP_ERROR 27
+#define ICP_COUNT 28
+#define ICP_SUMS 29
+
+KinectIcp::KinectIcp(KinectIcpParameters parameters) :
+	parameters(parameters),
+	hasReference(false)
+{
+	memset(&intrinsics, 0, sizeof(intrinsics));
+	memset(&report, 0, sizeof(report));
+	referencePose = KinectPoseIdentity();
+}
+
+bool KinectIcp::Init(const KinectIntrinsics& depthIntrinsics)
+{
+	if (parameters.levels < 1 || parameters.levels > KINECT_ICP_MAX_LEVELS)
+		return false;
+	intrinsics = depthIntrinsics;
+	ClearReference();
+	current.clear();
+	return true;
+}
+
+void KinectIcp::SetParameters(const KinectIcpParameters& parameters)
+{
+	this->parameters = parameters;
+	// The pyramids may have another number of levels now
+	ClearReference();
+	current.clear();
+}
+
+KinectIcpParameters KinectIcp::Parameters() const { return parameters; }
+bool KinectIcp::HasReference() const { return hasReference; }
+const KinectIcpReport& KinectIcp::LastReport() const { return report; }
+
+void KinectIcp::ClearReference()
+{
+	hasReference = false;
+}
+
+bool KinectIcp::SetReference(const Mat& depth, const KinectPose& worldToCamera)
+{
+	if (!BuildPyramid(depth, reference))
+		return false;
+	referencePose = worldToCamera;
+	hasReference = true;
+	return true;
+}
+
+void KinectIcp::KeepAsReference(const KinectPose& worldToCamera)
+{
+	if (current.empty()) return;
+	swap(reference, current);
+	referencePose = worldToCamera;
+	hasReference = true;
+}
+
+/// <summary>
+/// Depth, points and normals of every level. Each level halves the previous one.
+/// </summary>
+bool KinectIcp::BuildPyramid(const Mat& depth, vector<Level>& pyramid)
+{
+	if (depth.type() != CV_32F || depth.cols != intrinsics.width || depth.rows != intrinsics.height
+		|| parameters.levels < 1 || parameters.levels > KINECT_ICP_MAX_LEVELS)
+		return false;
+	pyramid.resize(parameters.levels);
+	for (int l = 0; l < parameters.levels; l++)
+	{
+		Level& level = pyramid[l];
+		if (l == 0)
+		{
+			level.intrinsics = intrinsics;
+			depth.copyTo(level.depth);
+		}
+		else
+		{
+			const Level& previous = pyramid[l - 1];
+			const KinectIntrinsics& in = previous.intrinsics;
+			level.intrinsics = KinectMakeIntrinsics(in.width / 2, in.height / 2,
+				in.fx * 0.5f, in.fy * 0.5f, (in.cx + 0.5f) * 0.5f - 0.5f, (in.cy + 0.5f) * 0.5f - 0.5f);
+			level.depth.create(level.intrinsics.height, level.intrinsics.width, CV_32F);
+			KinectForRows(level.depth.rows, level.depth.cols, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					const float* top = previous.depth.ptr<float>(2 * i);
+					const float* bottom = previous.depth.ptr<float>(2 * i + 1);
+					float* out = level.depth.ptr<float>(i);
+					for (int j = 0; j < level.depth.cols; j++)
+					{
+						float block[4] = { top[2 * j], top[2 * j + 1], bottom[2 * j], bottom[2 * j + 1] };
+						float first = 0, sum = 0;
+						int count = 0;
+						for (int k = 0; k < 4; k++)
+						{
+							if (block[k] <= 0) continue;
+							if (count == 0) first = block[k];
+							if (fabsf(block[k] - first) > KINECT_ICP_PYRAMID_DEPTH_RANGE) continue;
+							sum += block[k];
+							count++;
+						}
+						out[j] = count > 0 ? sum / count : 0;
+					}
+				}
+			});
+		}
+
+		const KinectIntrinsics& in = level.intrinsics;
+		int rows = in.height, cols = in.width;
+		level.vertices.create(rows, cols, CV_32FC3);
+		level.normals.create(rows, cols, CV_32FC3);
+		float ifx = 1.0f / in.fx, ify = 1.0f / in.fy;
+		KinectForRows(rows, cols, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const float* d = level.depth.ptr<float>(i);
+				float* v = level.vertices.ptr<float>(i);
+				float y = (i - in.cy) * ify;
+				for (int j = 0; j < cols; j++)
+				{
+					v[3 * j] = (j - in.cx) * ifx * d[j];
+					v[3 * j + 1] = y * d[j];
+					v[3 * j + 2] = d[j];
+				}
+			}
+		});
+		KinectForRows(rows, cols, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				float* n = level.normals.ptr<float>(i);
+				memset(n, 0, cols * 3 * sizeof(float));
+				if (i == 0 || i + 1 >= rows) continue;
+				const float* above = level.vertices.ptr<float>(i - 1);
+				const float* v = level.vertices.ptr<float>(i);
+				const float* below = level.vertices.ptr<float>(i + 1);
+				for (int j = 1; j + 1 < cols; j++)
+				{
+					// Central differences, so the normal belongs to the pixel itself
+					const float* p = v + 3 * j;
+					const float* left = p - 3;
+					const float* right = p + 3;
+					const float* up = above + 3 * j;
+					const float* down = below + 3 * j;
+					float z = p[2];
+					if (z <= 0 || left[2] <= 0 || right[2] <= 0 || up[2] <= 0 || down[2] <= 0) continue;
+					float edge = KINECT_ICP_EDGE_RATIO * z;
+					if (fabsf(left[2] - z) > edge || fabsf(right[2] - z) > edge || fabsf(up[2] - z) > edge || fabsf(down[2] - z) > edge) continue;
+					float a[3] = { right[0] - left[0], right[1] - left[1], right[2] - left[2] };
+					float b[3] = { down[0] - up[0], down[1] - up[1], down[2] - up[2] };
+					float c[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+					float length = sqrtf(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+					if (length <= 0) continue;
+					// Face the camera
+					if (c[0] * p[0] + c[1] * p[1] + c[2] * p[2] > 0) length = -length;
+					n[3 * j] = c[0] / length;
+					n[3 * j + 1] = c[1] / length;
+					n[3 * j + 2] = c[2] / length;
+				}
+			}
+		});
+	}
+	return true;
+}
+
+/// <summary>
+/// Sum the point-to-plane normal equations of all correspondences between
+/// source, moved into the target camera by relative, and target. Row bands
+/// are summed on their own and merged under a lock.
+/// </summary>
+/// <returns>Returns the number of valid source pixels</returns>
+int KinectIcp::Reduce(const Level& source, const Level& target, const KinectPose& relative, double sums[ICP_SUMS]) const
+{
+	memset(sums, 0, ICP_SUMS * sizeof(double));
+	int valid = 0;
+	mutex lock;
+	const KinectIntrinsics& in = target.intrinsics;
+	float maxDistance2 = parameters.distanceThreshold * parameters.distanceThreshold;
+	int rows = source.intrinsics.height, cols = source.intrinsics.width;
+	KinectForRows(rows, cols, [&](int begin, int end)
+	{
+		double local[ICP_SUMS] = { 0 };
+		int localValid = 0;
+		for (int i = begin; i < end; i++)
+		{
+			const float* v = source.vertices.ptr<float>(i);
+			const float* sn = source.normals.ptr<float>(i);
+			for (int j = 0; j < cols; j++)
+			{
+				const float* s = v + 3 * j;
+				const float* ns = sn + 3 * j;
+				if (s[2] <= 0 || (ns[0] == 0 && ns[1] == 0 && ns[2] == 0)) continue;
+				localValid++;
+				float p[3];
+				KinectPoseTransform(relative, s, p);
+				if (p[2] <= 0) continue;
+				int u = (int)(in.fx * p[0] / p[2] + in.cx + 0.5f);
+				int w = (int)(in.fy * p[1] / p[2] + in.cy + 0.5f);
+				if (u < 0 || w < 0 || u >= in.width || w >= in.height) continue;
+				const float* q = target.vertices.ptr<float>(w) + 3 * u;
+				const float* n = target.normals.ptr<float>(w) + 3 * u;
+				if (q[2] <= 0 || (n[0] == 0 && n[1] == 0 && n[2] == 0)) continue;
+				float d[3] = { p[0] - q[0], p[1] - q[1], p[2] - q[2] };
+				if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] > maxDistance2) continue;
+				float r[3];
+				KinectPoseRotate(relative, ns, r);
+				if (r[0] * n[0] + r[1] * n[1] + r[2] * n[2] < parameters.normalThreshold) continue;
+
+				// r(x) = n . (p - q) + (p x n) . omega + n . t
+				double residual = d[0] * n[0] + d[1] * n[1] + d[2] * n[2];
+				double a[6] = {
+					(double)p[1] * n[2] - (double)p[2] * n[1],
+					(double)p[2] * n[0] - (double)p[0] * n[2],
+					(double)p[0] * n[1] - (double)p[1] * n[0],
+					n[0], n[1], n[2] };
+				int k = ICP_ATA;
+				for (int x = 0; x < 6; x++)
+				{
+					for (int y = x; y < 6; y++)
+						local[k++] += a[x] * a[y];
+					local[ICP_ATB + x] -= a[x] * residual;
+				}
+				local[ICP_ERROR] += residual * residual;
+				local[ICP_COUNT] += 1;
+			}
+		}
+		lock_guard<mutex> guard(lock);
+		for (int k = 0; k < ICP_SUMS; k++)
+			sums[k] += local[k];
+		valid += localValid;
+	});
+	return valid;
+}
+
+/// <summary>
+/// Solve the 6x6 normal equations by Cholesky decomposition
+/// </summary>
+static bool SolveNormalEquations(const double sums[ICP_SUMS], double x[6])
+{
+	double a[6][6], l[6][6] = { { 0 } };
+	int k = ICP_ATA;
+	for (int i = 0; i < 6; i++)
+		for (int j = i; j < 6; j++)
+			a[i][j] = a[j][i] = sums[k++];
+	for (int i = 0; i < 6; i++)
+	{
+		for (int j = 0; j <= i; j++)
+		{
+			double s = a[i][j];
+			for (int t = 0; t < j; t++)
+				s -= l[i][t] * l[j][t];
+			if (i == j)
+			{
+				if (s <= 1e-12 * (a[i][i] + 1e-30)) return false;
+				l[i][i] = sqrt(s);
+			}
+			else
+			{
+				l[i][j] = s / l[j][j];
+			}
+		}
+	}
+	double y[6];
+	for (int i = 0; i < 6; i++)
+	{
+		double s = sums[ICP_ATB + i];
+		for (int t = 0; t < i; t++)
+			s -= l[i][t] * y[t];
+		y[i] = s / l[i][i];
+	}
+	for (int i = 5; i >= 0; i--)
+	{
+		double s = y[i];
+		for (int t = i + 1; t < 6; t++)
+			s -= l[t][i] * x[t];
+		x[i] = s / l[i][i];
+	}
+	return true;
+}
+
+/// <summary>
+/// Rigid transform of the rotation vector omega and translation t
+/// </summary>
+static KinectPose ExpPose(const double x[6])
+{
+	double theta = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+	double k[3] = { 0, 0, 0 };
+	if (theta > 0)
+	{
+		k[0] = x[0] / theta;
+		k[1] = x[1] / theta;
+		k[2] = x[2] / theta;
+	}
+	double s = sin(theta), c = 1 - cos(theta);
+	// Rodrigues: R = I + sin(theta) K + (1 - cos(theta)) K^2
+	float r[9] = {
+		(float)(1 + c * (k[0] * k[0] - 1)), (float)(-s * k[2] + c * k[0] * k[1]), (float)(s * k[1] + c * k[0] * k[2]),
+		(float)(s * k[2] + c * k[0] * k[1]), (float)(1 + c * (k[1] * k[1] - 1)), (float)(-s * k[0] + c * k[1] * k[2]),
+		(float)(-s * k[1] + c * k[0] * k[2]), (float)(s * k[0] + c * k[1] * k[2]), (float)(1 + c * (k[2] * k[2] - 1)) };
+	float t[3] = { (float)x[3], (float)x[4], (float)x[5] };
+	return KinectMakePose(r, t);
+}
+
+bool KinectIcp::Align(const Mat& depth, KinectPose& worldToCamera, KinectIcpReport* report)
+{
+	auto begin = high_resolution_clock::now();
+	memset(&this->report, 0, sizeof(this->report));
+	bool success = BuildPyramid(depth, current);
+	if (success && hasReference)
+	{
+		// Current camera to reference camera, refined on the left by every update
+		KinectPose relative = KinectPoseMultiply(referencePose, KinectPoseInverse(KinectPoseNormalize(worldToCamera)));
+		for (int l = parameters.levels - 1; l >= 0 && success; l--)
+		{
+			for (int iteration = 0; iteration < parameters.iterations[l]; iteration++)
+			{
+				double sums[ICP_SUMS], x[6];
+				int valid = Reduce(current[l], reference[l], relative, sums);
+				this->report.iterations++;
+				if (l == 0)
+				{
+					this->report.inliers = (int)sums[ICP_COUNT];
+					this->report.residual = sums[ICP_COUNT] > 0 ? (float)sqrt(sums[ICP_ERROR] / sums[ICP_COUNT]) : 0;
+				}
+				if (valid == 0 || sums[ICP_COUNT] < parameters.minimumInlierRatio * valid || !SolveNormalEquations(sums, x))
+				{
+					success = false;
+					break;
+				}
+				relative = KinectPoseNormalize(KinectPoseMultiply(ExpPose(x), relative));
+				double update = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]) + sqrt(x[3] * x[3] + x[4] * x[4] + x[5] * x[5]);
+				if (update < parameters.minimumUpdate)
+				{
+					if (l == 0) this->report.converged = true;
+					break;
+				}
+			}
+		}
+		if (success)
+			worldToCamera = KinectPoseNormalize(KinectPoseMultiply(KinectPoseInverse(relative), referencePose));
+	}
+	this->report.milliseconds = duration<double, milli>(high_resolution_clock::now() - begin).count();
+	if (report != NULL)
+		*report = this->report;
+	return success;
+}
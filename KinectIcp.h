@@ -0,0 +1,133 @@
+#pragma once
+
+#ifndef _KINECTICP_H
+#define _KINECTICP_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "KinectCamera.h"
+
+using namespace cv;
+using namespace std;
+
+// Point-to-plane ICP camera tracking on the CPU, the portable counterpart of
+// INuiFusionReconstruction::AlignDepthFloatToReconstruction. A depth frame
+// is aligned to a reference frame (a raycast of the volume, or the previous
+// frame) with projective data association, coarse to fine over a depth
+// pyramid. The 6x6 normal equations of every iteration are summed per row
+// band on all threads and merged at the end.
+#define KINECT_ICP_MAX_LEVELS 4
+// Pyramid levels average the valid depths of a 2x2 block that are within
+// this many metres of the first one, so edges are not blurred
+#define KINECT_ICP_PYRAMID_DEPTH_RANGE 0.03f
+// No normal across a depth step larger than this fraction of the depth
+#define KINECT_ICP_EDGE_RATIO 0.05f
+
+struct KinectIcpParameters
+{
+	// Pyramid levels used, level 0 is the full frame
+	int levels;
+	// Largest number of iterations per level
+	int iterations[KINECT_ICP_MAX_LEVELS];
+	// Correspondences further apart are rejected, in metres
+	float distanceThreshold;
+	// Correspondences whose normals have a smaller cosine are rejected
+	float normalThreshold;
+	// A level stops once an update moves less than this, radians plus metres
+	float minimumUpdate;
+	// Tracking fails when fewer of the valid pixels of a level find a correspondence
+	float minimumInlierRatio;
+};
+
+/// <summary>
+/// 3 levels with 10, 5 and 4 iterations, 10 cm and 20 degrees
+/// </summary>
+inline KinectIcpParameters KinectDefaultIcpParameters()
+{
+	KinectIcpParameters parameters = { 3, { 10, 5, 4, 0 }, 0.1f, 0.94f, 1e-5f, 0.1f };
+	return parameters;
+}
+
+/// <summary>
+/// Outcome of one alignment
+/// </summary>
+struct KinectIcpReport
+{
+	// Iterations run, summed over all levels
+	int iterations;
+	// RMS point-to-plane distance in metres at the last iteration of level 0
+	float residual;
+	// Correspondences at the last iteration of level 0
+	int inliers;
+	double milliseconds;
+	// Level 0 stopped before running out of iterations
+	bool converged;
+};
+
+class KinectIcp
+{
+public:
+	KinectIcp(KinectIcpParameters parameters = KinectDefaultIcpParameters());
+
+	/// <summary>
+	/// Set the camera, frames must have its size. Drops the reference frame.
+	/// </summary>
+	/// <param name="depthIntrinsics">Depth camera, only the pinhole part is used</param>
+	/// <returns>Returns false if the parameters ask for more than KINECT_ICP_MAX_LEVELS levels</returns>
+	bool Init(const KinectIntrinsics& depthIntrinsics);
+
+	void SetParameters(const KinectIcpParameters& parameters);
+	KinectIcpParameters Parameters() const;
+
+	/// <summary>
+	/// Use a depth frame seen from worldToCamera as the reference
+	/// </summary>
+	/// <param name="depth">CV_32F depth in metres, 0 where invalid</param>
+	bool SetReference(const Mat& depth, const KinectPose& worldToCamera);
+
+	/// <summary>
+	/// Make the frame of the last Align() the reference, without rebuilding its pyramid
+	/// </summary>
+	void KeepAsReference(const KinectPose& worldToCamera);
+
+	void ClearReference();
+	bool HasReference() const;
+
+	/// <summary>
+	/// Align a depth frame to the reference. Without a reference the pose is
+	/// kept and the frame is only prepared for KeepAsReference().
+	/// </summary>
+	/// <param name="depth">CV_32F depth in metres, 0 where invalid</param>
+	/// <param name="worldToCamera">Initial guess, replaced by the result on success</param>
+	/// <param name="report">Optional copy of the report</param>
+	/// <returns>Returns false if the frame does not match the camera or too few correspondences are found</returns>
+	bool Align(const Mat& depth, KinectPose& worldToCamera, KinectIcpReport* report = NULL);
+
+	/// <summary>
+	/// Report of the last Align()
+	/// </summary>
+	const KinectIcpReport& LastReport() const;
+
+private:
+	struct Level
+	{
+		KinectIntrinsics intrinsics;
+		Mat depth;
+		// CV_32FC3 camera space points and normals, 0 where invalid
+		Mat vertices;
+		Mat normals;
+	};
+
+	KinectIcpParameters parameters;
+	KinectIntrinsics intrinsics;
+	vector<Level> reference;
+	vector<Level> current;
+	KinectPose referencePose;
+	bool hasReference;
+	KinectIcpReport report;
+
+	bool BuildPyramid(const Mat& depth, vector<Level>& pyramid);
+	int Reduce(const Level& source, const Level& target, const KinectPose& relative, double sums[29]) const;
+};
+
+#endif
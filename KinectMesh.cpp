@@ -0,0 +1,392 @@
+#include "KinectMesh.h"
+#include <stdio.h>
+#include <fstream>
+#include <chrono>
+
+using namespace std::chrono;
+
+// Vertex and face count fields of the PLY header, padded with spaces so
+// Close() can fill in the final counts in place
+#define PLY_COUNT_FORMAT "%-20lld"
+#define PLY_COUNT_WIDTH 20
+
+KinectMeshWriter::KinectMeshWriter() :
+	format(KINECT_MESH_PLY),
+	vertexCount(0),
+	triangleCount(0),
+	vertexCountOffset(0),
+	faceCountOffset(0),
+	ok(false)
+{
+}
+
+KinectMeshWriter::~KinectMeshWriter()
+{
+	Close();
+}
+
+bool KinectMeshWriter::Open(string filename, KinectMeshFormat format)
+{
+	Close();
+	this->filename = filename;
+	this->format = format;
+	vertexCount = triangleCount = 0;
+	if (!file.Open(filename))
+		return false;
+	ok = true;
+	if (format == KINECT_MESH_OBJ)
+		return true;
+
+	facesName = filename + ".faces";
+	if (!faces.Open(facesName))
+	{
+		file.Close();
+		ok = false;
+		return false;
+	}
+	char count[PLY_COUNT_WIDTH + 1];
+	snprintf(count, sizeof(count), PLY_COUNT_FORMAT, 0LL);
+	string header = "ply\nformat binary_little_endian 1.0\ncomment EazyKinect TSDF surface\nelement vertex ";
+	vertexCountOffset = header.size();
+	header += string(count) + "\nproperty float x\nproperty float y\nproperty float z\nelement face ";
+	faceCountOffset = header.size();
+	header += string(count) + "\nproperty list uchar int vertex_indices\nend_header\n";
+	ok = file.Write(header.data(), header.size());
+	return ok;
+}
+
+bool KinectMeshWriter::Write(const float* vertices, int vertexCount, const int* triangles, int triangleCount)
+{
+	if (!file.IsOpen()) return false;
+	long long base = this->vertexCount;
+	if (format == KINECT_MESH_OBJ)
+	{
+		string text;
+		char line[96];
+		for (int i = 0; i < vertexCount; i++)
+		{
+			snprintf(line, sizeof(line), "v %g %g %g\n", vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2]);
+			text += line;
+		}
+		// OBJ indices start at 1
+		for (int i = 0; i < triangleCount; i++)
+		{
+			snprintf(line, sizeof(line), "f %lld %lld %lld\n", base + triangles[3 * i] + 1, base + triangles[3 * i + 1] + 1, base + triangles[3 * i + 2] + 1);
+			text += line;
+		}
+		ok = file.Write(text.data(), text.size()) && ok;
+	}
+	else
+	{
+		ok = file.Write(vertices, (long long)vertexCount * 3 * sizeof(float)) && ok;
+		vector<unsigned char> records((size_t)triangleCount * 13);
+		for (int i = 0; i < triangleCount; i++)
+		{
+			unsigned char* record = &records[(size_t)i * 13];
+			record[0] = 3;
+			for (int k = 0; k < 3; k++)
+			{
+				int index = (int)(base + triangles[3 * i + k]);
+				memcpy(record + 1 + 4 * k, &index, 4);
+			}
+		}
+		ok = faces.Write(records.data(), records.size()) && ok;
+	}
+	this->vertexCount += vertexCount;
+	this->triangleCount += triangleCount;
+	return ok;
+}
+
+bool KinectMeshWriter::Close()
+{
+	if (!file.IsOpen()) return false;
+	if (format == KINECT_MESH_PLY)
+	{
+		ok = faces.Close() && ok;
+		// Append the faces after the vertices
+		ifstream in(facesName, ios::in | ios::binary);
+		vector<char> chunk(1 << 20);
+		while (ok && in)
+		{
+			in.read(chunk.data(), chunk.size());
+			if (in.gcount() > 0)
+				ok = file.Write(chunk.data(), in.gcount());
+		}
+		in.close();
+		remove(facesName.c_str());
+
+		char count[PLY_COUNT_WIDTH + 1];
+		snprintf(count, sizeof(count), PLY_COUNT_FORMAT, vertexCount);
+		ok = ok && file.Seek(vertexCountOffset) && file.Write(count, PLY_COUNT_WIDTH);
+		snprintf(count, sizeof(count), PLY_COUNT_FORMAT, triangleCount);
+		ok = ok && file.Seek(faceCountOffset) && file.Write(count, PLY_COUNT_WIDTH);
+	}
+	ok = file.Close() && ok;
+	return ok;
+}
+
+long long KinectMeshWriter::Vertices() const { return vertexCount; }
+long long KinectMeshWriter::Triangles() const { return triangleCount; }
+
+/// <summary>
+/// Marching cubes triangle lists of all 256 corner sign cases, built from
+/// the cube topology instead of a hand written table. The surface crosses
+/// every face along segments between its sign changes; on faces with four
+/// crossings the inside corners are joined, which both cubes sharing the face
+/// agree on, so the surface has no cracks. The segments chain into loops
+/// around the cube, and every loop is fanned into triangles.
+/// Corner i sits at (i & 1, (i >> 1) & 1, (i >> 2) & 1). Edge axis * 4 + k
+/// runs along axis from the corner whose other two coordinates are the bits of k.
+/// </summary>
+struct MeshTables
+{
+	// Up to 12 triangles of three edges each, ended by -1
+	signed char triangles[256][37];
+
+	static int Edge(int a, int b)
+	{
+		int axis = (a ^ b) == 1 ? 0 : (a ^ b) == 2 ? 1 : 2;
+		int c = a < b ? a : b;
+		int u = (axis + 1) % 3, v = (axis + 2) % 3;
+		return axis * 4 + ((c >> u) & 1) + 2 * ((c >> v) & 1);
+	}
+
+	MeshTables()
+	{
+		for (int mask = 0; mask < 256; mask++)
+		{
+			int next[12];
+			for (int e = 0; e < 12; e++) next[e] = -1;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				for (int side = 0; side < 2; side++)
+				{
+					int u = (axis + 1) % 3, v = (axis + 2) % 3;
+					// Counter-clockwise seen from outside the cube
+					int square[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+					int corners[4];
+					for (int k = 0; k < 4; k++)
+					{
+						int s = side ? k : 3 - k;
+						corners[k] = (side << axis) | (square[s][0] << u) | (square[s][1] << v);
+					}
+					int edges[4], exits[4], count = 0;
+					for (int k = 0; k < 4; k++)
+					{
+						int a = corners[k], b = corners[(k + 1) % 4];
+						bool inA = (mask >> a) & 1, inB = (mask >> b) & 1;
+						if (inA == inB) continue;
+						edges[count] = Edge(a, b);
+						exits[count] = inA;
+						count++;
+					}
+					// Every exit from the inside runs to the next entry
+					for (int k = 0; k < count; k++)
+					{
+						if (exits[k])
+							next[edges[k]] = edges[(k + 1) % count];
+					}
+				}
+			}
+
+			int n = 0;
+			bool used[12] = { false };
+			for (int start = 0; start < 12; start++)
+			{
+				if (next[start] < 0 || used[start]) continue;
+				int loop[12], length = 0;
+				for (int e = start; !used[e]; e = next[e])
+				{
+					used[e] = true;
+					loop[length++] = e;
+				}
+				// The loops wind around the inside, reversed the triangles face the outside
+				for (int k = 1; k + 1 < length; k++)
+				{
+					triangles[mask][n++] = (signed char)loop[0];
+					triangles[mask][n++] = (signed char)loop[k + 1];
+					triangles[mask][n++] = (signed char)loop[k];
+				}
+			}
+			triangles[mask][n] = -1;
+		}
+	}
+
+	static const MeshTables& Instance()
+	{
+		static const MeshTables tables;
+		return tables;
+	}
+};
+
+// Voxels of a block plus one layer of its +x, +y and +z neighbours
+#define MESH_SIDE (KINECT_BLOCK + 1)
+#define MESH_SAMPLES (MESH_SIDE * MESH_SIDE * MESH_SIDE)
+
+struct BlockMesh
+{
+	vector<float> vertices;
+	vector<int> triangles;
+};
+
+KinectMeshExtractor::KinectMeshExtractor(int batchBlocks) :
+	batchBlocks(batchBlocks < 1 ? 1 : batchBlocks)
+{
+}
+
+bool KinectMeshExtractor::Extract(const KinectCpuFusion& volume, KinectMeshWriter& writer, KinectMeshReport* report)
+{
+	auto begin = high_resolution_clock::now();
+	int blocksX = volume.BlocksX(), blocksY = volume.BlocksY(), blocksZ = volume.BlocksZ();
+	int blocks = blocksX * blocksY * blocksZ;
+	if (blocks == 0) return false;
+	const MeshTables& tables = MeshTables::Instance();
+	float size = volume.VoxelSize();
+	KinectPose volumeToWorld = volume.VolumeToWorld();
+
+	// Signs present among the observed voxels of every block: 1 positive, 2 negative
+	vector<unsigned char> signs(blocks, 0);
+	parallel_for_(Range(0, blocks), [&](const Range& range)
+	{
+		for (int b = range.start; b < range.end; b++)
+		{
+			int bx = b % blocksX, by = b / blocksX % blocksY, bz = b / (blocksX * blocksY);
+			if (volume.BlockWeight(bx, by, bz) == 0) continue;
+			const KinectVoxel* voxels = volume.Block(bx, by, bz);
+			unsigned char s = 0;
+			for (int k = 0; k < KINECT_BLOCK_VOXELS && s != 3; k++)
+			{
+				if (voxels[k].weight == 0) continue;
+				s |= voxels[k].tsdf < 0 ? 2 : 1;
+			}
+			signs[b] = s;
+		}
+	});
+
+	// A block can only hold the surface if it was observed and both signs
+	// occur within it and the neighbours its cubes reach into
+	vector<int> candidates;
+	for (int b = 0; b < blocks; b++)
+	{
+		int bx = b % blocksX, by = b / blocksX % blocksY, bz = b / (blocksX * blocksY);
+		if (signs[b] == 0) continue;
+		unsigned char s = 0;
+		for (int k = 0; k < 8; k++)
+		{
+			int nx = bx + (k & 1), ny = by + ((k >> 1) & 1), nz = bz + (k >> 2);
+			if (nx < blocksX && ny < blocksY && nz < blocksZ)
+				s |= signs[(nz * blocksY + ny) * blocksX + nx];
+		}
+		if (s == 3) candidates.push_back(b);
+	}
+
+	vector<BlockMesh> meshes(batchBlocks < (int)candidates.size() ? batchBlocks : candidates.size());
+	bool ok = true;
+	long long vertices = 0, triangles = 0;
+	for (size_t first = 0; first < candidates.size() && ok; first += meshes.size())
+	{
+		int count = (int)min(meshes.size(), candidates.size() - first);
+		parallel_for_(Range(0, count), [&](const Range& range)
+		{
+			float values[MESH_SAMPLES];
+			bool observed[MESH_SAMPLES];
+			// Vertex of every edge of the block, valid if its stamp is the current block
+			vector<int> slots(MESH_SAMPLES * 3 * 2, -1);
+			int stamp = 0;
+			for (int m = range.start; m < range.end; m++)
+			{
+				int b = candidates[first + m];
+				int bx = b % blocksX, by = b / blocksX % blocksY, bz = b / (blocksX * blocksY);
+				BlockMesh& mesh = meshes[m];
+				mesh.vertices.clear();
+				mesh.triangles.clear();
+				stamp++;
+
+				for (int z = 0; z < MESH_SIDE; z++)
+				{
+					for (int y = 0; y < MESH_SIDE; y++)
+					{
+						for (int x = 0; x < MESH_SIDE; x++)
+						{
+							int sample = (z * MESH_SIDE + y) * MESH_SIDE + x;
+							int nx = bx + x / KINECT_BLOCK, ny = by + y / KINECT_BLOCK, nz = bz + z / KINECT_BLOCK;
+							observed[sample] = false;
+							if (nx >= blocksX || ny >= blocksY || nz >= blocksZ) continue;
+							const KinectVoxel& voxel = volume.Block(nx, ny, nz)[((z % KINECT_BLOCK) * KINECT_BLOCK + y % KINECT_BLOCK) * KINECT_BLOCK + x % KINECT_BLOCK];
+							observed[sample] = voxel.weight > 0;
+							values[sample] = voxel.tsdf / KINECT_TSDF_SCALE;
+						}
+					}
+				}
+
+				for (int z = 0; z < KINECT_BLOCK; z++)
+				{
+					for (int y = 0; y < KINECT_BLOCK; y++)
+					{
+						for (int x = 0; x < KINECT_BLOCK; x++)
+						{
+							int corner[8];
+							int mask = 0;
+							bool valid = true;
+							for (int i = 0; i < 8; i++)
+							{
+								corner[i] = ((z + (i >> 2)) * MESH_SIDE + y + ((i >> 1) & 1)) * MESH_SIDE + x + (i & 1);
+								// Samples past the volume have no value
+								if (!(valid = observed[corner[i]])) break;
+								if (values[corner[i]] < 0) mask |= 1 << i;
+							}
+							if (!valid || mask == 0 || mask == 255) continue;
+
+							const signed char* edges = tables.triangles[mask];
+							for (int k = 0; edges[k] >= 0; k++)
+							{
+								int edge = edges[k];
+								int axis = edge / 4, u = (axis + 1) % 3, v = (axis + 2) % 3;
+								int from = ((edge & 1) << u) | (((edge >> 1) & 1) << v);
+								int a = corner[from], c = corner[from | (1 << axis)];
+								int* slot = &slots[(a * 3 + axis) * 2];
+								if (slot[0] != stamp)
+								{
+									slot[0] = stamp;
+									slot[1] = (int)(mesh.vertices.size() / 3);
+									float t = values[a] / (values[a] - values[c]);
+									float p[3] = {
+										(float)(bx * KINECT_BLOCK + x + (from & 1)),
+										(float)(by * KINECT_BLOCK + y + ((from >> 1) & 1)),
+										(float)(bz * KINECT_BLOCK + z + (from >> 2)) };
+									p[axis] += t;
+									p[0] *= size;
+									p[1] *= size;
+									p[2] *= size;
+									float w[3];
+									KinectPoseTransform(volumeToWorld, p, w);
+									mesh.vertices.insert(mesh.vertices.end(), w, w + 3);
+								}
+								mesh.triangles.push_back(slot[1]);
+							}
+						}
+					}
+				}
+			}
+		});
+		// Written in block order, so the file does not depend on the thread count
+		for (int m = 0; m < count && ok; m++)
+		{
+			const BlockMesh& mesh = meshes[m];
+			if (mesh.triangles.empty()) continue;
+			ok = writer.Write(mesh.vertices.data(), (int)(mesh.vertices.size() / 3), mesh.triangles.data(), (int)(mesh.triangles.size() / 3));
+			vertices += mesh.vertices.size() / 3;
+			triangles += mesh.triangles.size() / 3;
+		}
+	}
+
+	if (report != NULL)
+	{
+		report->vertices = vertices;
+		report->triangles = triangles;
+		report->blocksExtracted = (int)candidates.size();
+		report->blocks = blocks;
+		report->milliseconds = duration<double, milli>(high_resolution_clock::now() - begin).count();
+	}
+	return ok;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#ifndef _KINECTMESH_H
+#define _KINECTMESH_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <string>
+#include "BlockWriter.h"
+#include "KinectCpuFusion.h"
+
+using namespace cv;
+using namespace std;
+
+// Streaming surface extraction from a KinectCpuFusion volume. Triangles are
+// produced block by block on all threads and written out in batches, so the
+// whole mesh never has to fit in memory.
+
+// Blocks extracted in parallel before their triangles are written
+#define KINECT_MESH_DEFAULT_BATCH 4096
+
+enum KinectMeshFormat
+{
+	KINECT_MESH_PLY = 0,
+	KINECT_MESH_OBJ = 1
+};
+
+/// <summary>
+/// Mesh file written piece by piece. Binary PLY keeps its faces in a
+/// temporary file next to the output until Close(), because they have to
+/// follow all vertices; OBJ is written in one pass.
+/// </summary>
+class KinectMeshWriter
+{
+public:
+	KinectMeshWriter();
+	~KinectMeshWriter();
+
+	bool Open(string filename, KinectMeshFormat format = KINECT_MESH_PLY);
+
+	/// <summary>
+	/// Append vertices and the triangles using them
+	/// </summary>
+	/// <param name="vertices">x, y, z of every vertex</param>
+	/// <param name="triangles">Three indices into vertices per triangle</param>
+	bool Write(const float* vertices, int vertexCount, const int* triangles, int triangleCount);
+
+	/// <summary>
+	/// Complete the file. Returns false if any write failed.
+	/// </summary>
+	bool Close();
+
+	long long Vertices() const;
+	long long Triangles() const;
+
+private:
+	BlockWriter file;
+	BlockWriter faces;
+	string filename;
+	string facesName;
+	KinectMeshFormat format;
+	long long vertexCount;
+	long long triangleCount;
+	long long vertexCountOffset;
+	long long faceCountOffset;
+	bool ok;
+};
+
+struct KinectMeshReport
+{
+	long long vertices;
+	long long triangles;
+	// Blocks that were observed and may hold the surface, of all blocks
+	int blocksExtracted;
+	int blocks;
+	double milliseconds;
+};
+
+/// <summary>
+/// Marching cubes over the TSDF blocks of a KinectCpuFusion volume
+/// </summary>
+class KinectMeshExtractor
+{
+public:
+	KinectMeshExtractor(int batchBlocks = KINECT_MESH_DEFAULT_BATCH);
+
+	/// <summary>
+	/// Extract the zero crossing of the volume as triangles in world space,
+	/// facing away from the surface into free space
+	/// </summary>
+	/// <param name="volume">The volume</param>
+	/// <param name="writer">An open writer</param>
+	/// <param name="report">Optional counts and time</param>
+	/// <returns>Returns false if the volume is not initialized or writing fails</returns>
+	bool Extract(const KinectCpuFusion& volume, KinectMeshWriter& writer, KinectMeshReport* report = NULL);
+
+private:
+	int batchBlocks;
+};
+
+#endif
@@ -3,12 +3,138 @@
 #ifndef _KINECT_OPENCV_TOOLS
 #define _KINECT_OPENCV_TOOLS
 
-#include <opencv2\opencv.hpp>
+#include <opencv2/opencv.hpp>
 using namespace cv;
 #include <iostream>
 #include <string>
 #include <vector>
+#include <mutex>
+#include <climits>
 using namespace std;
+#include "KinectSimd.h"
+
+/// <summary>
+/// Combine one row: blue is the high byte of infrared, green the high byte of
+/// depth times 50 (wrapping at 256) and red the low byte of depth
+/// </summary>
+inline void InfraDepth2RowScalar(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		out[3 * j] = (unsigned char)(infra[j] >> 8);
+		out[3 * j + 1] = (unsigned char)((depth[j] >> 8) * 50);
+		out[3 * j + 2] = (unsigned char)(depth[j] & 0xFF);
+	}
+}
+
+inline void Mat2InfraDepthRowScalar(const unsigned char* source, unsigned short* infra, unsigned short* depth, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		infra[j] = (unsigned short)(source[3 * j] << 8);
+		depth[j] = (unsigned short)((source[3 * j + 1] << 8) + source[3 * j + 2]);
+	}
+}
+
+#ifdef KINECT_SIMD_X86
+
+/// <summary>
+/// SSSE3 version of InfraDepth2RowScalar, returns the number of pixels done
+/// </summary>
+KINECT_TARGET("ssse3") inline int InfraDepth2RowSsse3(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int cols)
+{
+	const __m128i low = _mm_set1_epi16(0xFF);
+	const __m128i fifty = _mm_set1_epi16(50);
+	int j = 0;
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m128i i0 = _mm_loadu_si128((const __m128i*)(infra + j));
+		__m128i i1 = _mm_loadu_si128((const __m128i*)(infra + j + 8));
+		__m128i d0 = _mm_loadu_si128((const __m128i*)(depth + j));
+		__m128i d1 = _mm_loadu_si128((const __m128i*)(depth + j + 8));
+		__m128i b = _mm_packus_epi16(_mm_srli_epi16(i0, 8), _mm_srli_epi16(i1, 8));
+		__m128i g = _mm_packus_epi16(
+			_mm_and_si128(_mm_mullo_epi16(_mm_srli_epi16(d0, 8), fifty), low),
+			_mm_and_si128(_mm_mullo_epi16(_mm_srli_epi16(d1, 8), fifty), low));
+		__m128i r = _mm_packus_epi16(_mm_and_si128(d0, low), _mm_and_si128(d1, low));
+		KinectStore3(out + 3 * j, b, g, r);
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int InfraDepth2RowAvx2(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int cols)
+{
+	const __m256i low = _mm256_set1_epi16(0xFF);
+	const __m256i fifty = _mm256_set1_epi16(50);
+	int j = 0;
+	for (; j + 32 <= cols; j += 32)
+	{
+		__m256i i0 = _mm256_loadu_si256((const __m256i*)(infra + j));
+		__m256i i1 = _mm256_loadu_si256((const __m256i*)(infra + j + 16));
+		__m256i d0 = _mm256_loadu_si256((const __m256i*)(depth + j));
+		__m256i d1 = _mm256_loadu_si256((const __m256i*)(depth + j + 16));
+		// packus works per 128-bit lane, the permute puts the pixels back in order
+		__m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(i0, 8), _mm256_srli_epi16(i1, 8)), 0xD8);
+		__m256i g = _mm256_permute4x64_epi64(_mm256_packus_epi16(
+			_mm256_and_si256(_mm256_mullo_epi16(_mm256_srli_epi16(d0, 8), fifty), low),
+			_mm256_and_si256(_mm256_mullo_epi16(_mm256_srli_epi16(d1, 8), fifty), low)), 0xD8);
+		__m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(d0, low), _mm256_and_si256(d1, low)), 0xD8);
+		KinectStore3(out + 3 * j, _mm256_castsi256_si128(b), _mm256_castsi256_si128(g), _mm256_castsi256_si128(r));
+		KinectStore3(out + 3 * j + 48, _mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(r, 1));
+	}
+	return j;
+}
+
+KINECT_TARGET("ssse3") inline int Mat2InfraDepthRowSsse3(const unsigned char* source, unsigned short* infra, unsigned short* depth, int cols)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int j = 0;
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m128i b, g, r;
+		KinectLoad3(source + 3 * j, b, g, r);
+		_mm_storeu_si128((__m128i*)(infra + j), _mm_unpacklo_epi8(zero, b));
+		_mm_storeu_si128((__m128i*)(infra + j + 8), _mm_unpackhi_epi8(zero, b));
+		_mm_storeu_si128((__m128i*)(depth + j), _mm_unpacklo_epi8(r, g));
+		_mm_storeu_si128((__m128i*)(depth + j + 8), _mm_unpackhi_epi8(r, g));
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int Mat2InfraDepthRowAvx2(const unsigned char* source, unsigned short* infra, unsigned short* depth, int cols)
+{
+	int j = 0;
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m128i b, g, r;
+		KinectLoad3(source + 3 * j, b, g, r);
+		_mm256_storeu_si256((__m256i*)(infra + j), _mm256_slli_epi16(_mm256_cvtepu8_epi16(b), 8));
+		_mm256_storeu_si256((__m256i*)(depth + j), _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(g), 8), _mm256_cvtepu8_epi16(r)));
+	}
+	return j;
+}
+
+#endif
+
+inline void InfraDepth2Row(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = InfraDepth2RowAvx2(infra, depth, out, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = InfraDepth2RowSsse3(infra, depth, out, cols);
+#endif
+	InfraDepth2RowScalar(infra, depth, out, j, cols);
+}
+
+inline void Mat2InfraDepthRow(const unsigned char* source, unsigned short* infra, unsigned short* depth, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = Mat2InfraDepthRowAvx2(source, infra, depth, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = Mat2InfraDepthRowSsse3(source, infra, depth, cols);
+#endif
+	Mat2InfraDepthRowScalar(source, infra, depth, j, cols);
+}
 
 /// <summary>
 /// Combine CV_16U infrared frame and CV_16U depth frame into a CV_8UC3 mat
@@ -18,19 +144,16 @@ using namespace std;
 /// <returns>Returns a Mat in CV_8UC3 containing the combined frame</returns>
 Mat InfraDepth2Mat(Mat inframat, Mat depthmat)
 {
-	if (inframat.size() != depthmat.size())
+	if (inframat.size() != depthmat.size() || inframat.type() != CV_16U || depthmat.type() != CV_16U)
 		return Mat();
 	Size size = inframat.size();
-	Mat result(size, CV_8UC3, Scalar::all(0));
-	for (int i = 0; i < size.height; i++)
+	Mat result(size, CV_8UC3);
+	int level = KinectSimdLevel();
+	KinectForRows(size.height, size.width, [&](int begin, int end)
 	{
-		for (int j = 0; j < size.width; j++)
-		{
-			result.at<Vec3b>(i, j)[0] = inframat.at<unsigned short>(i, j) / 256;
-			result.at<Vec3b>(i, j)[1] = depthmat.at<unsigned short>(i, j) / 256 * 50;
-			result.at<Vec3b>(i, j)[2] = depthmat.at<unsigned short>(i, j) % 256;
-		}
-	}
+		for (int i = begin; i < end; i++)
+			InfraDepth2Row(inframat.ptr<unsigned short>(i), depthmat.ptr<unsigned short>(i), result.ptr<unsigned char>(i), size.width, level);
+	});
 	return result;
 }
 
@@ -43,16 +166,216 @@ Mat InfraDepth2Mat(Mat inframat, Mat depthmat)
 void Mat2InfraDepth(Mat source, Mat& inframat, Mat& depthmat)
 {
 	Size size = source.size();
-	inframat = Mat(size, CV_16U, Scalar::all(0));
-	depthmat = Mat(size, CV_16U, Scalar::all(0));
-	for (int i = 0; i < size.height; i++)
+	if (source.type() != CV_8UC3)
+	{
+		inframat = Mat(size, CV_16U, Scalar::all(0));
+		depthmat = Mat(size, CV_16U, Scalar::all(0));
+		return;
+	}
+	inframat = Mat(size, CV_16U);
+	depthmat = Mat(size, CV_16U);
+	int level = KinectSimdLevel();
+	KinectForRows(size.height, size.width, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+			Mat2InfraDepthRow(source.ptr<unsigned char>(i), inframat.ptr<unsigned short>(i), depthmat.ptr<unsigned short>(i), size.width, level);
+	});
+}
+
+// Packed frames keep infrared and depth in full. Blue is the high byte of
+// infrared, green and red the high and low byte of depth and alpha the low
+// byte of infrared, so the first three channels alone give exact depth and
+// infrared within 128. They survive lossless 8-bit codecs (PNG, FFV1, lossless
+// H.264 RGB), unlike InfraDepth2Mat whose depth high byte wraps.
+
+inline void PackInfraDepthRowScalar(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int channels, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
 	{
-		for (int j = 0; j < size.width; j++)
+		unsigned char* px = out + channels * j;
+		px[0] = (unsigned char)(infra[j] >> 8);
+		px[1] = (unsigned char)(depth[j] >> 8);
+		px[2] = (unsigned char)(depth[j] & 0xFF);
+		if (channels == 4) px[3] = (unsigned char)(infra[j] & 0xFF);
+	}
+}
+
+inline void UnpackInfraDepthRowScalar(const unsigned char* source, unsigned short* infra, unsigned short* depth, int channels, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		const unsigned char* px = source + channels * j;
+		// Without alpha the lost low byte is taken from the middle of its range
+		infra[j] = (unsigned short)((px[0] << 8) | (channels == 4 ? px[3] : 0x80));
+		depth[j] = (unsigned short)((px[1] << 8) | px[2]);
+	}
+}
+
+#ifdef KINECT_SIMD_X86
+
+KINECT_TARGET("ssse3") inline int PackInfraDepthRowSsse3(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int channels, int cols)
+{
+	int j = 0;
+	if (channels == 4)
+	{
+		// From infra low, infra high, depth low, depth high to BGRA
+		const __m128i order = _mm_setr_epi8(1, 3, 2, 0, 5, 7, 6, 4, 9, 11, 10, 8, 13, 15, 14, 12);
+		for (; j + 8 <= cols; j += 8)
 		{
-			inframat.at<unsigned short>(i, j) = source.at<Vec3b>(i, j)[0] * 256;
-			depthmat.at<unsigned short>(i, j) = source.at<Vec3b>(i, j)[1] * 256 + source.at<Vec3b>(i, j)[2];
+			__m128i i = _mm_loadu_si128((const __m128i*)(infra + j));
+			__m128i d = _mm_loadu_si128((const __m128i*)(depth + j));
+			_mm_storeu_si128((__m128i*)(out + 4 * j), _mm_shuffle_epi8(_mm_unpacklo_epi16(i, d), order));
+			_mm_storeu_si128((__m128i*)(out + 4 * j + 16), _mm_shuffle_epi8(_mm_unpackhi_epi16(i, d), order));
 		}
+		return j;
 	}
+	const __m128i low = _mm_set1_epi16(0xFF);
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m128i i0 = _mm_loadu_si128((const __m128i*)(infra + j));
+		__m128i i1 = _mm_loadu_si128((const __m128i*)(infra + j + 8));
+		__m128i d0 = _mm_loadu_si128((const __m128i*)(depth + j));
+		__m128i d1 = _mm_loadu_si128((const __m128i*)(depth + j + 8));
+		__m128i b = _mm_packus_epi16(_mm_srli_epi16(i0, 8), _mm_srli_epi16(i1, 8));
+		__m128i g = _mm_packus_epi16(_mm_srli_epi16(d0, 8), _mm_srli_epi16(d1, 8));
+		__m128i r = _mm_packus_epi16(_mm_and_si128(d0, low), _mm_and_si128(d1, low));
+		KinectStore3(out + 3 * j, b, g, r);
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int PackInfraDepthRowAvx2(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int channels, int cols)
+{
+	if (channels != 4) return PackInfraDepthRowSsse3(infra, depth, out, channels, cols);
+	const __m256i order = _mm256_setr_epi8(1, 3, 2, 0, 5, 7, 6, 4, 9, 11, 10, 8, 13, 15, 14, 12,
+		1, 3, 2, 0, 5, 7, 6, 4, 9, 11, 10, 8, 13, 15, 14, 12);
+	int j = 0;
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m256i i = _mm256_loadu_si256((const __m256i*)(infra + j));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(depth + j));
+		// Unpacking works per 128-bit lane: lo holds pixels 0-3 and 8-11, hi 4-7 and 12-15
+		__m256i lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(i, d), order);
+		__m256i hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(i, d), order);
+		_mm256_storeu_si256((__m256i*)(out + 4 * j), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(out + 4 * j + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	return j;
+}
+
+KINECT_TARGET("ssse3") inline int UnpackInfraDepthRowSsse3(const unsigned char* source, unsigned short* infra, unsigned short* depth, int channels, int cols)
+{
+	int j = 0;
+	if (channels == 4)
+	{
+		// From BGRA to four infrared values followed by four depth values
+		const __m128i order = _mm_setr_epi8(3, 0, 7, 4, 11, 8, 15, 12, 2, 1, 6, 5, 10, 9, 14, 13);
+		for (; j + 8 <= cols; j += 8)
+		{
+			__m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + 4 * j)), order);
+			__m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(source + 4 * j + 16)), order);
+			_mm_storeu_si128((__m128i*)(infra + j), _mm_unpacklo_epi64(s0, s1));
+			_mm_storeu_si128((__m128i*)(depth + j), _mm_unpackhi_epi64(s0, s1));
+		}
+		return j;
+	}
+	const __m128i middle = _mm_set1_epi8((char)0x80);
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m128i b, g, r;
+		KinectLoad3(source + 3 * j, b, g, r);
+		_mm_storeu_si128((__m128i*)(infra + j), _mm_unpacklo_epi8(middle, b));
+		_mm_storeu_si128((__m128i*)(infra + j + 8), _mm_unpackhi_epi8(middle, b));
+		_mm_storeu_si128((__m128i*)(depth + j), _mm_unpacklo_epi8(r, g));
+		_mm_storeu_si128((__m128i*)(depth + j + 8), _mm_unpackhi_epi8(r, g));
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int UnpackInfraDepthRowAvx2(const unsigned char* source, unsigned short* infra, unsigned short* depth, int channels, int cols)
+{
+	if (channels != 4) return UnpackInfraDepthRowSsse3(source, infra, depth, channels, cols);
+	const __m256i order = _mm256_setr_epi8(3, 0, 7, 4, 11, 8, 15, 12, 2, 1, 6, 5, 10, 9, 14, 13,
+		3, 0, 7, 4, 11, 8, 15, 12, 2, 1, 6, 5, 10, 9, 14, 13);
+	int j = 0;
+	for (; j + 16 <= cols; j += 16)
+	{
+		// Each lane ends up as four infrared then four depth values, the permute gathers eight of each
+		__m256i s0 = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(source + 4 * j)), order), 0xD8);
+		__m256i s1 = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(source + 4 * j + 32)), order), 0xD8);
+		_mm256_storeu_si256((__m256i*)(infra + j), _mm256_permute2x128_si256(s0, s1, 0x20));
+		_mm256_storeu_si256((__m256i*)(depth + j), _mm256_permute2x128_si256(s0, s1, 0x31));
+	}
+	return j;
+}
+
+#endif
+
+inline void PackInfraDepthRow(const unsigned short* infra, const unsigned short* depth, unsigned char* out, int channels, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = PackInfraDepthRowAvx2(infra, depth, out, channels, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = PackInfraDepthRowSsse3(infra, depth, out, channels, cols);
+#endif
+	PackInfraDepthRowScalar(infra, depth, out, channels, j, cols);
+}
+
+inline void UnpackInfraDepthRow(const unsigned char* source, unsigned short* infra, unsigned short* depth, int channels, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = UnpackInfraDepthRowAvx2(source, infra, depth, channels, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = UnpackInfraDepthRowSsse3(source, infra, depth, channels, cols);
+#endif
+	UnpackInfraDepthRowScalar(source, infra, depth, channels, j, cols);
+}
+
+/// <summary>
+/// Pack CV_16U infrared frame and CV_16U depth frame into an 8-bit mat without losing bits
+/// </summary>
+/// <param name="inframat">The Mat structure containing infrared frame</param>
+/// <param name="depthmat">The Mat structure containing depth frame</param>
+/// <param name="alpha">True for a lossless CV_8UC4 mat, false for CV_8UC3 with exact depth and infrared within 128</param>
+/// <returns>Returns the packed Mat, or an empty Mat if the frames do not match</returns>
+inline Mat InfraDepth2Packed(Mat inframat, Mat depthmat, bool alpha = true)
+{
+	if (inframat.size() != depthmat.size() || inframat.type() != CV_16U || depthmat.type() != CV_16U)
+		return Mat();
+	Size size = inframat.size();
+	int channels = alpha ? 4 : 3;
+	Mat result(size, CV_8UC(channels));
+	int level = KinectSimdLevel();
+	KinectForRows(size.height, size.width, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+			PackInfraDepthRow(inframat.ptr<unsigned short>(i), depthmat.ptr<unsigned short>(i), result.ptr<unsigned char>(i), channels, size.width, level);
+	});
+	return result;
+}
+
+/// <summary>
+/// Unpack a mat made by InfraDepth2Packed to CV_16U infrared frame and CV_16U depth frame
+/// </summary>
+/// <param name="source">Input the packed CV_8UC4 or CV_8UC3 mat</param>
+/// <param name="inframat">Output the Mat structure containing infrared frame</param>
+/// <param name="depthmat">Output the Mat structure containing depth frame</param>
+/// <returns>Returns false if source is not a packed mat</returns>
+inline bool Packed2InfraDepth(Mat source, Mat& inframat, Mat& depthmat)
+{
+	int channels = source.channels();
+	if (source.depth() != CV_8U || (channels != 3 && channels != 4))
+		return false;
+	Size size = source.size();
+	inframat.create(size, CV_16U);
+	depthmat.create(size, CV_16U);
+	int level = KinectSimdLevel();
+	KinectForRows(size.height, size.width, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+			UnpackInfraDepthRow(source.ptr<unsigned char>(i), inframat.ptr<unsigned short>(i), depthmat.ptr<unsigned short>(i), channels, size.width, level);
+	});
+	return true;
 }
 
 /// <summary>
@@ -72,4 +395,189 @@ Mat SplitUserFromBackground(Mat depth, Mat body, int userID = -1)
 	return result;
 }
 
+/// <summary>
+/// Statistics of one user's pixels in a body index frame
+/// </summary>
+struct KinectUserStats
+{
+	// Pixels labelled with the user
+	int pixels;
+	// Bounding box of those pixels, empty if there are none
+	Rect box;
+};
+
+// Users a body index frame can label, BODY_COUNT in Kinect.h
+#define KINECT_USER_COUNT 6
+
+/// <summary>
+/// Split one row for every user. out holds KINECT_USER_COUNT row pointers or
+/// is NULL; count, first and last collect pixels and column range per user.
+/// </summary>
+inline void SplitUsersRowScalar(const unsigned short* depth, const unsigned char* body, unsigned short* const* out, int begin, int end, int* count, int* first, int* last)
+{
+	for (int j = begin; j < end; j++)
+	{
+		int b = body[j];
+		if (out != NULL)
+		{
+			for (int u = 0; u < KINECT_USER_COUNT; u++)
+				out[u][j] = b == u ? depth[j] : 0;
+		}
+		if (b < KINECT_USER_COUNT)
+		{
+			count[b]++;
+			if (j < first[b]) first[b] = j;
+			if (j > last[b]) last[b] = j;
+		}
+	}
+}
+
+#ifdef KINECT_SIMD_X86
+
+inline void SplitUsersColumns(unsigned int bits, int j, int u, int* count, int* first, int* last)
+{
+	count[u] += KinectPopCount(bits);
+	int low = j + KinectLowBit(bits);
+	int high = j + KinectHighBit(bits);
+	if (low < first[u]) first[u] = low;
+	if (high > last[u]) last[u] = high;
+}
+
+KINECT_TARGET("ssse3") inline int SplitUsersRowSsse3(const unsigned short* depth, const unsigned char* body, unsigned short* const* out, int cols, int* count, int* first, int* last)
+{
+	int j = 0;
+	for (; j + 16 <= cols; j += 16)
+	{
+		__m128i b = _mm_loadu_si128((const __m128i*)(body + j));
+		__m128i d0 = _mm_loadu_si128((const __m128i*)(depth + j));
+		__m128i d1 = _mm_loadu_si128((const __m128i*)(depth + j + 8));
+		for (int u = 0; u < KINECT_USER_COUNT; u++)
+		{
+			__m128i m = _mm_cmpeq_epi8(b, _mm_set1_epi8((char)u));
+			if (out != NULL)
+			{
+				_mm_storeu_si128((__m128i*)(out[u] + j), _mm_and_si128(d0, _mm_unpacklo_epi8(m, m)));
+				_mm_storeu_si128((__m128i*)(out[u] + j + 8), _mm_and_si128(d1, _mm_unpackhi_epi8(m, m)));
+			}
+			unsigned int bits = (unsigned int)_mm_movemask_epi8(m);
+			if (bits) SplitUsersColumns(bits, j, u, count, first, last);
+		}
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int SplitUsersRowAvx2(const unsigned short* depth, const unsigned char* body, unsigned short* const* out, int cols, int* count, int* first, int* last)
+{
+	int j = 0;
+	for (; j + 32 <= cols; j += 32)
+	{
+		__m256i b = _mm256_loadu_si256((const __m256i*)(body + j));
+		__m256i d0 = _mm256_loadu_si256((const __m256i*)(depth + j));
+		__m256i d1 = _mm256_loadu_si256((const __m256i*)(depth + j + 16));
+		for (int u = 0; u < KINECT_USER_COUNT; u++)
+		{
+			__m256i m = _mm256_cmpeq_epi8(b, _mm256_set1_epi8((char)u));
+			if (out != NULL)
+			{
+				// Sign extension widens the 0xFF byte masks to 0xFFFF
+				_mm256_storeu_si256((__m256i*)(out[u] + j), _mm256_and_si256(d0, _mm256_cvtepi8_epi16(_mm256_castsi256_si128(m))));
+				_mm256_storeu_si256((__m256i*)(out[u] + j + 16), _mm256_and_si256(d1, _mm256_cvtepi8_epi16(_mm256_extracti128_si256(m, 1))));
+			}
+			unsigned int bits = (unsigned int)_mm256_movemask_epi8(m);
+			if (bits) SplitUsersColumns(bits, j, u, count, first, last);
+		}
+	}
+	return j;
+}
+
+#endif
+
+/// <summary>
+/// Split every user out of the background in a single pass over the body
+/// index and depth frames, instead of one SplitUserFromBackground() per user.
+/// </summary>
+/// <param name="depth">CV_16U depth frame</param>
+/// <param name="body">CV_8U body index frame of the same size</param>
+/// <param name="users">Receives KINECT_USER_COUNT CV_16U Mats holding the depth of each user and 0 elsewhere.
+/// Mats that already have the right size and type are written in place. NULL to only collect stats.</param>
+/// <param name="stats">Receives KINECT_USER_COUNT pixel counts and bounding boxes, may be NULL</param>
+/// <returns>Returns false if the frames do not match</returns>
+inline bool SplitUsersFromBackground(const Mat& depth, const Mat& body, Mat* users, KinectUserStats* stats = NULL)
+{
+	if (depth.size() != body.size() || depth.type() != CV_16U || body.type() != CV_8U)
+		return false;
+	int rows = depth.rows;
+	int cols = depth.cols;
+	if (users != NULL)
+	{
+		for (int u = 0; u < KINECT_USER_COUNT; u++)
+			users[u].create(rows, cols, CV_16U);
+	}
+	int level = KinectSimdLevel();
+	int count[KINECT_USER_COUNT], first[KINECT_USER_COUNT], last[KINECT_USER_COUNT];
+	int top[KINECT_USER_COUNT], bottom[KINECT_USER_COUNT];
+	for (int u = 0; u < KINECT_USER_COUNT; u++)
+	{
+		count[u] = 0;
+		first[u] = top[u] = INT_MAX;
+		last[u] = bottom[u] = -1;
+	}
+	mutex merge;
+	KinectForRows(rows, cols, [&](int begin, int end)
+	{
+		// Each range collects its own stats and merges them once
+		int c[KINECT_USER_COUNT], f[KINECT_USER_COUNT], l[KINECT_USER_COUNT], t[KINECT_USER_COUNT], b[KINECT_USER_COUNT];
+		for (int u = 0; u < KINECT_USER_COUNT; u++)
+		{
+			c[u] = 0;
+			f[u] = t[u] = INT_MAX;
+			l[u] = b[u] = -1;
+		}
+		unsigned short* rowsOut[KINECT_USER_COUNT];
+		unsigned short* const* out = users != NULL ? rowsOut : NULL;
+		for (int i = begin; i < end; i++)
+		{
+			if (users != NULL)
+			{
+				for (int u = 0; u < KINECT_USER_COUNT; u++)
+					rowsOut[u] = users[u].ptr<unsigned short>(i);
+			}
+			int before[KINECT_USER_COUNT];
+			memcpy(before, c, sizeof(c));
+			const unsigned short* d = depth.ptr<unsigned short>(i);
+			const unsigned char* bi = body.ptr<unsigned char>(i);
+			int j = 0;
+#ifdef KINECT_SIMD_X86
+			if (level >= KINECT_SIMD_AVX2) j = SplitUsersRowAvx2(d, bi, out, cols, c, f, l);
+			else if (level >= KINECT_SIMD_SSSE3) j = SplitUsersRowSsse3(d, bi, out, cols, c, f, l);
+#endif
+			SplitUsersRowScalar(d, bi, out, j, cols, c, f, l);
+			for (int u = 0; u < KINECT_USER_COUNT; u++)
+			{
+				if (c[u] == before[u]) continue;
+				if (i < t[u]) t[u] = i;
+				b[u] = i;
+			}
+		}
+		lock_guard<mutex> guard(merge);
+		for (int u = 0; u < KINECT_USER_COUNT; u++)
+		{
+			count[u] += c[u];
+			if (f[u] < first[u]) first[u] = f[u];
+			if (l[u] > last[u]) last[u] = l[u];
+			if (t[u] < top[u]) top[u] = t[u];
+			if (b[u] > bottom[u]) bottom[u] = b[u];
+		}
+	});
+	if (stats != NULL)
+	{
+		for (int u = 0; u < KINECT_USER_COUNT; u++)
+		{
+			stats[u].pixels = count[u];
+			stats[u].box = count[u] > 0 ? Rect(first[u], top[u], last[u] - first[u] + 1, bottom[u] - top[u] + 1) : Rect();
+		}
+	}
+	return true;
+}
+
 #endif
@@ -0,0 +1,322 @@
+#pragma once
+
+#ifndef _KINECTPOINTCLOUD_H
+#define _KINECTPOINTCLOUD_H
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+#include <vector>
+using namespace std;
+#include "KinectSimd.h"
+#include "KinectCamera.h"
+
+/// <summary>
+/// Points in camera space, in structure of arrays layout. A dense cloud has
+/// one point per depth pixel (0, 0, 0 where the depth is invalid), a compact
+/// cloud only the valid pixels, with index holding their pixel offsets.
+/// </summary>
+struct KinectPointCloud
+{
+	vector<float> x, y, z;
+	// Pixel offset i * cols + j of every point, only filled for compact clouds
+	vector<int> index;
+	int count;
+	int rows, cols;
+	bool compact;
+
+	KinectPointCloud() : count(0), rows(0), cols(0), compact(false) {}
+};
+
+// Lanes of the vector compaction kernels, the row buffers have this much slack
+#define KINECT_POINT_SLACK 8
+
+inline void PointRowScalar(const unsigned short* depth, const float* rx, const float* ry, float scale, float* x, float* y, float* z, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		float d = depth[j] * scale;
+		x[j] = rx[j] * d;
+		y[j] = ry[j] * d;
+		z[j] = d;
+	}
+}
+
+/// <summary>
+/// Append the valid pixels of [begin, end) at x/y/z/index + count, returns the new count
+/// </summary>
+inline int PointRowCompactScalar(const unsigned short* depth, const float* rx, const float* ry, float scale, int base, float* x, float* y, float* z, int* index, int count, int begin, int end)
+{
+	for (int j = begin; j < end; j++)
+	{
+		if (depth[j] == 0) continue;
+		float d = depth[j] * scale;
+		x[count] = rx[j] * d;
+		y[count] = ry[j] * d;
+		z[count] = d;
+		index[count] = base + j;
+		count++;
+	}
+	return count;
+}
+
+#ifdef KINECT_SIMD_X86
+
+KINECT_TARGET("ssse3") inline int PointRowSsse3(const unsigned short* depth, const float* rx, const float* ry, float scale, float* x, float* y, float* z, int cols)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 s = _mm_set1_ps(scale);
+	int j = 0;
+	for (; j + 4 <= cols; j += 4)
+	{
+		__m128 d = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(depth + j)), zero)), s);
+		_mm_storeu_ps(x + j, _mm_mul_ps(_mm_loadu_ps(rx + j), d));
+		_mm_storeu_ps(y + j, _mm_mul_ps(_mm_loadu_ps(ry + j), d));
+		_mm_storeu_ps(z + j, d);
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int PointRowAvx2(const unsigned short* depth, const float* rx, const float* ry, float scale, float* x, float* y, float* z, int cols)
+{
+	const __m256 s = _mm256_set1_ps(scale);
+	int j = 0;
+	for (; j + 8 <= cols; j += 8)
+	{
+		__m256 d = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + j)))), s);
+		_mm256_storeu_ps(x + j, _mm256_mul_ps(_mm256_loadu_ps(rx + j), d));
+		_mm256_storeu_ps(y + j, _mm256_mul_ps(_mm256_loadu_ps(ry + j), d));
+		_mm256_storeu_ps(z + j, d);
+	}
+	return j;
+}
+
+/// <summary>
+/// Shuffles moving the lanes selected by a mask to the front: pshufb masks
+/// for 4 lanes of 32 bits and permutevar8x32 indices for 8 lanes
+/// </summary>
+struct PointCompactTables
+{
+	__m128i lanes4[16];
+	int lanes8[256 * 8];
+
+	PointCompactTables()
+	{
+		for (int m = 0; m < 16; m++)
+		{
+			char bytes[16];
+			int n = 0;
+			for (int lane = 0; lane < 4; lane++)
+			{
+				if (!(m & (1 << lane))) continue;
+				for (int b = 0; b < 4; b++) bytes[4 * n + b] = (char)(4 * lane + b);
+				n++;
+			}
+			for (int b = 4 * n; b < 16; b++) bytes[b] = (char)0x80;
+			memcpy(&lanes4[m], bytes, 16);
+		}
+		for (int m = 0; m < 256; m++)
+		{
+			int n = 0;
+			for (int lane = 0; lane < 8; lane++)
+				if (m & (1 << lane)) lanes8[m * 8 + n++] = lane;
+			for (; n < 8; n++) lanes8[m * 8 + n] = 0;
+		}
+	}
+};
+
+inline const PointCompactTables& PointCompactTable()
+{
+	static const PointCompactTables tables;
+	return tables;
+}
+
+// Both kernels store whole vectors at the current count, so up to
+// KINECT_POINT_SLACK values past the returned count are overwritten
+
+KINECT_TARGET("ssse3") inline int PointRowCompactSsse3(const unsigned short* depth, const float* rx, const float* ry, float scale, int base, float* x, float* y, float* z, int* index, int& count, int cols)
+{
+	const __m128i* table = PointCompactTable().lanes4;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 fzero = _mm_setzero_ps();
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128i step = _mm_set1_epi32(4);
+	__m128i pixel = _mm_add_epi32(_mm_set1_epi32(base), _mm_setr_epi32(0, 1, 2, 3));
+	int j = 0;
+	for (; j + 4 <= cols; j += 4, pixel = _mm_add_epi32(pixel, step))
+	{
+		__m128 d = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(depth + j)), zero)), s);
+		int mask = _mm_movemask_ps(_mm_cmpgt_ps(d, fzero));
+		if (mask == 0) continue;
+		__m128i order = table[mask];
+		__m128 px = _mm_mul_ps(_mm_loadu_ps(rx + j), d);
+		__m128 py = _mm_mul_ps(_mm_loadu_ps(ry + j), d);
+		_mm_storeu_ps(x + count, _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(px), order)));
+		_mm_storeu_ps(y + count, _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(py), order)));
+		_mm_storeu_ps(z + count, _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(d), order)));
+		_mm_storeu_si128((__m128i*)(index + count), _mm_shuffle_epi8(pixel, order));
+		count += KinectPopCount((unsigned int)mask);
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int PointRowCompactAvx2(const unsigned short* depth, const float* rx, const float* ry, float scale, int base, float* x, float* y, float* z, int* index, int& count, int cols)
+{
+	const int* table = PointCompactTable().lanes8;
+	const __m256 fzero = _mm256_setzero_ps();
+	const __m256 s = _mm256_set1_ps(scale);
+	const __m256i step = _mm256_set1_epi32(8);
+	__m256i pixel = _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	int j = 0;
+	for (; j + 8 <= cols; j += 8, pixel = _mm256_add_epi32(pixel, step))
+	{
+		__m256 d = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + j)))), s);
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(d, fzero, _CMP_GT_OQ));
+		if (mask == 0) continue;
+		__m256i order = _mm256_loadu_si256((const __m256i*)(table + mask * 8));
+		_mm256_storeu_ps(x + count, _mm256_permutevar8x32_ps(_mm256_mul_ps(_mm256_loadu_ps(rx + j), d), order));
+		_mm256_storeu_ps(y + count, _mm256_permutevar8x32_ps(_mm256_mul_ps(_mm256_loadu_ps(ry + j), d), order));
+		_mm256_storeu_ps(z + count, _mm256_permutevar8x32_ps(d, order));
+		_mm256_storeu_si256((__m256i*)(index + count), _mm256_permutevar8x32_epi32(pixel, order));
+		count += KinectPopCount((unsigned int)mask);
+	}
+	return j;
+}
+
+#endif
+
+inline void PointRow(const unsigned short* depth, const float* rx, const float* ry, float scale, float* x, float* y, float* z, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = PointRowAvx2(depth, rx, ry, scale, x, y, z, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = PointRowSsse3(depth, rx, ry, scale, x, y, z, cols);
+#endif
+	PointRowScalar(depth, rx, ry, scale, x, y, z, j, cols);
+}
+
+/// <summary>
+/// Compact one row into buffers with KINECT_POINT_SLACK values of slack, returns the number of points
+/// </summary>
+inline int PointRowCompact(const unsigned short* depth, const float* rx, const float* ry, float scale, int base, float* x, float* y, float* z, int* index, int cols, int level)
+{
+	int j = 0, count = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = PointRowCompactAvx2(depth, rx, ry, scale, base, x, y, z, index, count, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = PointRowCompactSsse3(depth, rx, ry, scale, base, x, y, z, index, count, cols);
+#endif
+	return PointRowCompactScalar(depth, rx, ry, scale, base, x, y, z, index, count, j, cols);
+}
+
+/// <summary>
+/// Turns CV_16U depth frames into camera space points through a per-pixel ray table
+/// </summary>
+class KinectPointCloudGenerator
+{
+private:
+	KinectRayTable rays;
+	float depthScale;
+
+public:
+	KinectPointCloudGenerator() : depthScale(0.001f) {}
+
+	/// <summary>
+	/// Build the ray table of a depth camera
+	/// </summary>
+	/// <param name="intrinsics">Depth camera intrinsics, e.g. KinectNormalizedIntrinsics() of KinectFusion::cameraParameters</param>
+	/// <param name="depthScale">Metres per depth unit</param>
+	void Init(const KinectIntrinsics& intrinsics, float depthScale = 0.001f)
+	{
+		rays.Build(intrinsics);
+		this->depthScale = depthScale;
+	}
+
+	/// <summary>
+	/// Share a ray table that is already built, e.g. KinectRegistration::Rays()
+	/// </summary>
+	void Init(const KinectRayTable& rays, float depthScale = 0.001f)
+	{
+		this->rays = rays;
+		this->depthScale = depthScale;
+	}
+
+	const KinectRayTable& Rays() const
+	{
+		return rays;
+	}
+
+	/// <summary>
+	/// Convert a depth frame to points in metres
+	/// </summary>
+	/// <param name="depth">CV_16U depth frame of the ray table size</param>
+	/// <param name="cloud">Receives the points, its buffers are reused between calls</param>
+	/// <param name="compact">Keep only pixels with depth, together with their pixel offsets</param>
+	/// <returns>Returns false if the frame does not match the ray table</returns>
+	bool Generate(const Mat& depth, KinectPointCloud& cloud, bool compact = false) const
+	{
+		if (depth.type() != CV_16U || depth.size() != rays.x.size())
+			return false;
+		int rows = depth.rows, cols = depth.cols;
+		int level = KinectSimdLevel();
+		cloud.rows = rows;
+		cloud.cols = cols;
+		cloud.compact = compact;
+		size_t pixels = (size_t)rows * cols;
+		if (!compact)
+		{
+			cloud.x.resize(pixels);
+			cloud.y.resize(pixels);
+			cloud.z.resize(pixels);
+			cloud.index.clear();
+			cloud.count = (int)pixels;
+			KinectForRows(rows, cols, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					size_t offset = (size_t)i * cols;
+					PointRow(depth.ptr<unsigned short>(i), rays.x.ptr<float>(i), rays.y.ptr<float>(i), depthScale,
+						&cloud.x[offset], &cloud.y[offset], &cloud.z[offset], cols, level);
+				}
+			});
+			return true;
+		}
+
+		// Count per row first, so every row knows where its points go
+		vector<int> offsets(rows + 1, 0);
+		KinectForRows(rows, cols, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const unsigned short* d = depth.ptr<unsigned short>(i);
+				int n = 0;
+				for (int j = 0; j < cols; j++) n += d[j] != 0;
+				offsets[i + 1] = n;
+			}
+		});
+		for (int i = 0; i < rows; i++)
+			offsets[i + 1] += offsets[i];
+		cloud.count = offsets[rows];
+		cloud.x.resize(cloud.count);
+		cloud.y.resize(cloud.count);
+		cloud.z.resize(cloud.count);
+		cloud.index.resize(cloud.count);
+		KinectForRows(rows, cols, [&](int begin, int end)
+		{
+			// Vector stores run past the row's points, so rows are compacted into local buffers first
+			vector<float> bx(cols + KINECT_POINT_SLACK), by(cols + KINECT_POINT_SLACK), bz(cols + KINECT_POINT_SLACK);
+			vector<int> bi(cols + KINECT_POINT_SLACK);
+			for (int i = begin; i < end; i++)
+			{
+				int n = PointRowCompact(depth.ptr<unsigned short>(i), rays.x.ptr<float>(i), rays.y.ptr<float>(i), depthScale,
+					i * cols, bx.data(), by.data(), bz.data(), bi.data(), cols, level);
+				if (n == 0) continue;
+				memcpy(&cloud.x[offsets[i]], bx.data(), n * sizeof(float));
+				memcpy(&cloud.y[offsets[i]], by.data(), n * sizeof(float));
+				memcpy(&cloud.z[offsets[i]], bz.data(), n * sizeof(float));
+				memcpy(&cloud.index[offsets[i]], bi.data(), n * sizeof(int));
+			}
+		});
+		return true;
+	}
+};
+
+#endif
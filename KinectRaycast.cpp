@@ -0,0 +1,244 @@
+#include "KinectRaycast.h"
+#include "KinectCpuFusion.h"
+#include "KinectSimd.h"
+#include <float.h>
+
+/// <summary>
+/// Trilinear TSDF lookups in voxel coordinates
+/// </summary>
+struct VolumeSampler
+{
+	// Blocks are stored one after the other in block index order
+	const KinectVoxel* voxels;
+	int blocksX, blocksY;
+	const KinectCpuFusion* volume;
+
+	const KinectVoxel& At(int x, int y, int z) const
+	{
+		size_t block = ((size_t)(z / KINECT_BLOCK) * blocksY + y / KINECT_BLOCK) * blocksX + x / KINECT_BLOCK;
+		return voxels[block * KINECT_BLOCK_VOXELS + ((z % KINECT_BLOCK) * KINECT_BLOCK + y % KINECT_BLOCK) * KINECT_BLOCK + x % KINECT_BLOCK];
+	}
+
+	bool Observed(int x, int y, int z) const
+	{
+		return volume->BlockWeight(x / KINECT_BLOCK, y / KINECT_BLOCK, z / KINECT_BLOCK) != 0;
+	}
+
+	/// <summary>
+	/// TSDF in [-1, 1] at a point inside [0, count - 1]^3, false if a
+	/// surrounding voxel was never observed
+	/// </summary>
+	bool Sample(const float p[3], float& value) const
+	{
+		int x = (int)p[0], y = (int)p[1], z = (int)p[2];
+		float fx = p[0] - x, fy = p[1] - y, fz = p[2] - z;
+		float c[8];
+		const KinectVoxel* base = &At(x, y, z);
+		if (x % KINECT_BLOCK < KINECT_BLOCK - 1 && y % KINECT_BLOCK < KINECT_BLOCK - 1 && z % KINECT_BLOCK < KINECT_BLOCK - 1)
+		{
+			// All corners in one block
+			for (int i = 0; i < 8; i++)
+			{
+				const KinectVoxel& voxel = base[((i >> 2) * KINECT_BLOCK + ((i >> 1) & 1)) * KINECT_BLOCK + (i & 1)];
+				if (voxel.weight == 0) return false;
+				c[i] = voxel.tsdf;
+			}
+		}
+		else
+		{
+			for (int i = 0; i < 8; i++)
+			{
+				const KinectVoxel& voxel = At(x + (i & 1), y + ((i >> 1) & 1), z + (i >> 2));
+				if (voxel.weight == 0) return false;
+				c[i] = voxel.tsdf;
+			}
+		}
+		float c00 = c[0] + (c[1] - c[0]) * fx, c10 = c[2] + (c[3] - c[2]) * fx;
+		float c01 = c[4] + (c[5] - c[4]) * fx, c11 = c[6] + (c[7] - c[6]) * fx;
+		float c0 = c00 + (c10 - c00) * fy, c1 = c01 + (c11 - c01) * fy;
+		value = (c0 + (c1 - c0) * fz) * (1.0f / KINECT_TSDF_SCALE);
+		return true;
+	}
+};
+
+KinectRaycaster::KinectRaycaster() :
+	volume(NULL),
+	revision(0),
+	valid(false),
+	shadedValid(false)
+{
+	pose = KinectPoseIdentity();
+}
+
+void KinectRaycaster::Invalidate()
+{
+	valid = false;
+	shadedValid = false;
+}
+
+const Mat& KinectRaycaster::Depth() const { return depth; }
+const Mat& KinectRaycaster::Normals() const { return normals; }
+
+bool KinectRaycaster::Raycast(const KinectCpuFusion& volume, const KinectPose& worldToCamera)
+{
+	int blocksX = volume.BlocksX(), blocksY = volume.BlocksY(), blocksZ = volume.BlocksZ();
+	if (blocksX * blocksY * blocksZ == 0) return false;
+	if (valid && this->volume == &volume && revision == volume.Revision() && memcmp(pose.m, worldToCamera.m, sizeof(pose.m)) == 0)
+		return true;
+
+	KinectIntrinsics intrinsics = volume.Intrinsics();
+	int width = intrinsics.width, height = intrinsics.height;
+	depth.create(height, width, CV_32F);
+	normals.create(height, width, CV_32FC3);
+
+	VolumeSampler sampler = { volume.Block(0, 0, 0), blocksX, blocksY, &volume };
+	float size = volume.VoxelSize(), invSize = 1.0f / size;
+	float truncation = volume.Truncation();
+	// Rays are traced in voxel coordinates of the volume
+	KinectPose cameraToVolume = KinectPoseMultiply(KinectPoseInverse(volume.VolumeToWorld()), KinectPoseInverse(worldToCamera));
+	KinectPose volumeToCamera = KinectPoseInverse(cameraToVolume);
+	float origin[3] = { cameraToVolume.m[3] * invSize, cameraToVolume.m[7] * invSize, cameraToVolume.m[11] * invSize };
+	// Trilinear samples need the voxel after them
+	float limit[3] = { (float)(blocksX * KINECT_BLOCK - 1), (float)(blocksY * KINECT_BLOCK - 1), (float)(blocksZ * KINECT_BLOCK - 1) };
+	int tilesX = (width + KINECT_RAYCAST_TILE - 1) / KINECT_RAYCAST_TILE;
+	int tilesY = (height + KINECT_RAYCAST_TILE - 1) / KINECT_RAYCAST_TILE;
+
+	parallel_for_(Range(0, tilesX * tilesY), [&](const Range& range)
+	{
+		for (int tile = range.start; tile < range.end; tile++)
+		{
+			int left = tile % tilesX * KINECT_RAYCAST_TILE, top = tile / tilesX * KINECT_RAYCAST_TILE;
+			int right = min(left + KINECT_RAYCAST_TILE, width), bottom = min(top + KINECT_RAYCAST_TILE, height);
+			for (int v = top; v < bottom; v++)
+			{
+				float* depthRow = depth.ptr<float>(v);
+				float* normalRow = normals.ptr<float>(v);
+				for (int u = left; u < right; u++)
+				{
+					depthRow[u] = 0;
+					float* n = normalRow + u * 3;
+					n[0] = n[1] = n[2] = 0;
+
+					// The ray is origin + z * direction, z being the camera depth in metres
+					float ray[3] = { (u - intrinsics.cx) / intrinsics.fx, (v - intrinsics.cy) / intrinsics.fy, 1 };
+					float direction[3];
+					KinectPoseRotate(cameraToVolume, ray, direction);
+					direction[0] *= invSize;
+					direction[1] *= invSize;
+					direction[2] *= invSize;
+					float metresPerDepth = sqrtf(ray[0] * ray[0] + ray[1] * ray[1] + 1);
+
+					// Clip the ray to the volume
+					float enter = 0, exit = FLT_MAX;
+					for (int a = 0; a < 3; a++)
+					{
+						if (fabsf(direction[a]) < 1e-9f)
+						{
+							if (origin[a] < 0 || origin[a] > limit[a]) exit = -1;
+							continue;
+						}
+						float t0 = -origin[a] / direction[a], t1 = (limit[a] - origin[a]) / direction[a];
+						if (t0 > t1) swap(t0, t1);
+						enter = max(enter, t0);
+						exit = min(exit, t1);
+					}
+					if (enter >= exit) continue;
+
+					float z = enter, previousZ = 0, previous = 0;
+					bool hasPrevious = false;
+					while (z <= exit)
+					{
+						float p[3] = { origin[0] + z * direction[0], origin[1] + z * direction[1], origin[2] + z * direction[2] };
+						for (int a = 0; a < 3; a++)
+							p[a] = min(max(p[a], 0.0f), limit[a] - 1e-3f);
+						float value;
+						if (!sampler.Sample(p, value))
+						{
+							// Unobserved blocks cannot hold the surface, cross them in half block steps
+							hasPrevious = false;
+							z += (sampler.Observed((int)p[0], (int)p[1], (int)p[2]) ? 0.5f : KINECT_BLOCK * 0.5f) * size / metresPerDepth;
+							continue;
+						}
+						if (value < 0)
+						{
+							// Entering from free space is a hit, starting inside or behind a surface is not
+							if (hasPrevious)
+							{
+								float hit = previousZ + (z - previousZ) * previous / (previous - value);
+								float q[3] = { origin[0] + hit * direction[0], origin[1] + hit * direction[1], origin[2] + hit * direction[2] };
+								depthRow[u] = hit;
+								// Central differences of the TSDF point into free space
+								float g[3];
+								bool gradient = true;
+								for (int a = 0; a < 3 && gradient; a++)
+								{
+									float lo[3] = { q[0], q[1], q[2] }, hi[3] = { q[0], q[1], q[2] };
+									lo[a] = max(q[a] - 1, 0.0f);
+									hi[a] = min(q[a] + 1, limit[a] - 1e-3f);
+									float a0 = 0, a1 = 0;
+									gradient = sampler.Sample(lo, a0) && sampler.Sample(hi, a1);
+									g[a] = a1 - a0;
+								}
+								float c[3];
+								KinectPoseRotate(volumeToCamera, g, c);
+								float length = sqrtf(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+								if (gradient && length > 0)
+								{
+									n[0] = c[0] / length;
+									n[1] = c[1] / length;
+									n[2] = c[2] / length;
+								}
+							}
+							break;
+						}
+						hasPrevious = true;
+						previous = value;
+						previousZ = z;
+						z += max(value * truncation * KINECT_RAYCAST_STEP, 0.5f * size) / metresPerDepth;
+					}
+				}
+			}
+		}
+	});
+
+	this->volume = &volume;
+	revision = volume.Revision();
+	pose = worldToCamera;
+	valid = true;
+	shadedValid = false;
+	return true;
+}
+
+const Mat& KinectRaycaster::Shaded()
+{
+	if (shadedValid || !valid) return shaded;
+	int width = depth.cols, height = depth.rows;
+	shaded.create(height, width, CV_8UC4);
+	KinectIntrinsics intrinsics = volume->Intrinsics();
+	KinectForRows(height, width, [&](int begin, int end)
+	{
+		for (int v = begin; v < end; v++)
+		{
+			const float* depthRow = depth.ptr<float>(v);
+			const float* normalRow = normals.ptr<float>(v);
+			unsigned char* out = shaded.ptr<unsigned char>(v);
+			for (int u = 0; u < width; u++, out += 4)
+			{
+				if (depthRow[u] <= 0)
+				{
+					out[0] = out[1] = out[2] = out[3] = 0;
+					continue;
+				}
+				// Ambient plus diffuse light from a lamp at the camera
+				const float* n = normalRow + u * 3;
+				float x = (u - intrinsics.cx) / intrinsics.fx, y = (v - intrinsics.cy) / intrinsics.fy;
+				float lambert = -(n[0] * x + n[1] * y + n[2]) / sqrtf(x * x + y * y + 1);
+				unsigned char grey = (unsigned char)(255 * (0.2f + 0.8f * max(lambert, 0.0f)));
+				out[0] = out[1] = out[2] = grey;
+				out[3] = 255;
+			}
+		}
+	});
+	shadedValid = true;
+	return shaded;
+}
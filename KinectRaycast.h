@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef _KINECTRAYCAST_H
+#define _KINECTRAYCAST_H
+
+#include <opencv2/opencv.hpp>
+#include "KinectCamera.h"
+
+using namespace cv;
+
+class KinectCpuFusion;
+
+// CPU counterpart of CalculatePointCloud and NuiFusionShadePointCloud. The
+// image is cut into square tiles that are raycast on all threads; the rays
+// of a tile pass through the same blocks of the volume, which stay in cache.
+#define KINECT_RAYCAST_TILE 16
+// Ray steps near the surface are this fraction of the distance the TSDF
+// promises to be free, so a step never jumps over the zero crossing
+#define KINECT_RAYCAST_STEP 0.8f
+
+/// <summary>
+/// Surface of a KinectCpuFusion volume seen from one camera pose. Raycast()
+/// does nothing if neither the pose nor the volume changed since the last
+/// call, and the shaded image is only computed when it is asked for.
+/// </summary>
+class KinectRaycaster
+{
+public:
+	KinectRaycaster();
+
+	/// <summary>
+	/// Cast a ray through every pixel of the volume's depth camera
+	/// </summary>
+	/// <param name="volume">An initialized volume</param>
+	/// <param name="worldToCamera">The camera pose</param>
+	/// <returns>Returns false if the volume is not initialized</returns>
+	bool Raycast(const KinectCpuFusion& volume, const KinectPose& worldToCamera);
+
+	/// <summary>
+	/// Drop the cached surface, the next Raycast() runs in any case
+	/// </summary>
+	void Invalidate();
+
+	// CV_32F depth of the surface in metres, 0 where no ray hit it
+	const Mat& Depth() const;
+	// CV_32FC3 camera space unit normals facing the camera, 0 where no ray hit the surface
+	const Mat& Normals() const;
+
+	/// <summary>
+	/// CV_8UC4 grey image of the surface lit from the camera, as
+	/// NuiFusionShadePointCloud. Computed on the first call after a raycast.
+	/// </summary>
+	const Mat& Shaded();
+
+private:
+	Mat depth;
+	Mat normals;
+	Mat shaded;
+	// What the cached images show
+	const KinectCpuFusion* volume;
+	unsigned int revision;
+	KinectPose pose;
+	bool valid;
+	bool shadedValid;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#pragma once
+
+#ifndef _KINECTREGISTRATION_H
+#define _KINECTREGISTRATION_H
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+#include <vector>
+#include <limits>
+using namespace std;
+#include "KinectSimd.h"
+#include "KinectCamera.h"
+
+// Depth to colour registration without ICoordinateMapper. For every depth
+// pixel the undistorted ray, the extrinsic rotation and the colour projection
+// are folded into three per-pixel coefficients, so mapping a pixel at depth z
+// costs u = (au * z + tu) / (aw * z + tw) and the same for v.
+
+/// <summary>
+/// Map one row of depth pixels to interleaved colour coordinates, -inf where invalid
+/// </summary>
+inline void RegisterRowScalar(const unsigned short* depth, const float* au, const float* av, const float* aw, const float t[3], float* out, int begin, int end)
+{
+	const float invalid = -numeric_limits<float>::infinity();
+	for (int j = begin; j < end; j++)
+	{
+		float z = (float)depth[j];
+		float w = aw[j] * z + t[2];
+		if (depth[j] == 0 || w <= 0)
+		{
+			out[2 * j] = out[2 * j + 1] = invalid;
+			continue;
+		}
+		out[2 * j] = (au[j] * z + t[0]) / w;
+		out[2 * j + 1] = (av[j] * z + t[1]) / w;
+	}
+}
+
+#ifdef KINECT_SIMD_X86
+
+KINECT_TARGET("ssse3") inline int RegisterRowSsse3(const unsigned short* depth, const float* au, const float* av, const float* aw, const float t[3], float* out, int cols)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 fzero = _mm_setzero_ps();
+	const __m128 invalid = _mm_set1_ps(-numeric_limits<float>::infinity());
+	const __m128 tu = _mm_set1_ps(t[0]), tv = _mm_set1_ps(t[1]), tw = _mm_set1_ps(t[2]);
+	int j = 0;
+	for (; j + 4 <= cols; j += 4)
+	{
+		__m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(depth + j)), zero));
+		__m128 w = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(aw + j), z), tw);
+		__m128 valid = _mm_and_ps(_mm_cmpgt_ps(z, fzero), _mm_cmpgt_ps(w, fzero));
+		__m128 u = _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(au + j), z), tu), w);
+		__m128 v = _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(av + j), z), tv), w);
+		u = _mm_or_ps(_mm_and_ps(valid, u), _mm_andnot_ps(valid, invalid));
+		v = _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, invalid));
+		_mm_storeu_ps(out + 2 * j, _mm_unpacklo_ps(u, v));
+		_mm_storeu_ps(out + 2 * j + 4, _mm_unpackhi_ps(u, v));
+	}
+	return j;
+}
+
+KINECT_TARGET("avx2") inline int RegisterRowAvx2(const unsigned short* depth, const float* au, const float* av, const float* aw, const float t[3], float* out, int cols)
+{
+	const __m256 fzero = _mm256_setzero_ps();
+	const __m256 invalid = _mm256_set1_ps(-numeric_limits<float>::infinity());
+	const __m256 tu = _mm256_set1_ps(t[0]), tv = _mm256_set1_ps(t[1]), tw = _mm256_set1_ps(t[2]);
+	int j = 0;
+	for (; j + 8 <= cols; j += 8)
+	{
+		__m256 z = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + j))));
+		__m256 w = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(aw + j), z), tw);
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(z, fzero, _CMP_GT_OQ), _mm256_cmp_ps(w, fzero, _CMP_GT_OQ));
+		__m256 u = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(au + j), z), tu), w);
+		__m256 v = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(av + j), z), tv), w);
+		u = _mm256_blendv_ps(invalid, u, valid);
+		v = _mm256_blendv_ps(invalid, v, valid);
+		// unpack works per lane: lo holds pixels 0, 1, 4, 5 and hi 2, 3, 6, 7
+		__m256 lo = _mm256_unpacklo_ps(u, v);
+		__m256 hi = _mm256_unpackhi_ps(u, v);
+		_mm256_storeu_ps(out + 2 * j, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(out + 2 * j + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+	return j;
+}
+
+#endif
+
+inline void RegisterRow(const unsigned short* depth, const float* au, const float* av, const float* aw, const float t[3], float* out, int cols, int level)
+{
+	int j = 0;
+#ifdef KINECT_SIMD_X86
+	if (level >= KINECT_SIMD_AVX2) j = RegisterRowAvx2(depth, au, av, aw, t, out, cols);
+	else if (level >= KINECT_SIMD_SSSE3) j = RegisterRowSsse3(depth, au, av, aw, t, out, cols);
+#endif
+	RegisterRowScalar(depth, au, av, aw, t, out, j, cols);
+}
+
+/// <summary>
+/// Maps depth frames into a colour camera through lookup tables built once
+/// from the calibration. The colour camera is treated as a pinhole camera,
+/// its distortion coefficients are not applied.
+/// </summary>
+class KinectRegistration
+{
+private:
+	KinectRayTable rays;
+	KinectIntrinsics color;
+	// Per depth pixel coefficients of the colour projection, CV_32F
+	Mat au, av, aw;
+	float t[3];
+
+public:
+	KinectRegistration()
+	{
+		memset(&color, 0, sizeof(color));
+		t[0] = t[1] = t[2] = 0;
+	}
+
+	/// <summary>
+	/// Build the lookup tables
+	/// </summary>
+	/// <param name="depth">Depth camera intrinsics, including its distortion</param>
+	/// <param name="color">Colour camera intrinsics</param>
+	/// <param name="depthToColor">Transform from depth camera space to colour camera space, in metres</param>
+	/// <param name="depthScale">Metres per depth unit, 0.001 for Kinect depth in millimetres</param>
+	void Init(const KinectIntrinsics& depth, const KinectIntrinsics& color, const KinectPose& depthToColor, float depthScale = 0.001f)
+	{
+		rays.Build(depth);
+		this->color = color;
+		const float* m = depthToColor.m;
+		t[0] = color.fx * m[3] + color.cx * m[11];
+		t[1] = color.fy * m[7] + color.cy * m[11];
+		t[2] = m[11];
+		au.create(depth.height, depth.width, CV_32F);
+		av.create(depth.height, depth.width, CV_32F);
+		aw.create(depth.height, depth.width, CV_32F);
+		for (int i = 0; i < depth.height; i++)
+		{
+			const float* rx = rays.x.ptr<float>(i);
+			const float* ry = rays.y.ptr<float>(i);
+			float* pu = au.ptr<float>(i);
+			float* pv = av.ptr<float>(i);
+			float* pw = aw.ptr<float>(i);
+			for (int j = 0; j < depth.width; j++)
+			{
+				float ray[3] = { rx[j], ry[j], 1 };
+				float r[3];
+				KinectPoseRotate(depthToColor, ray, r);
+				pu[j] = depthScale * (color.fx * r[0] + color.cx * r[2]);
+				pv[j] = depthScale * (color.fy * r[1] + color.cy * r[2]);
+				pw[j] = depthScale * r[2];
+			}
+		}
+	}
+
+	bool Empty() const
+	{
+		return au.empty();
+	}
+
+	const KinectRayTable& Rays() const
+	{
+		return rays;
+	}
+
+	/// <summary>
+	/// Map every depth pixel to colour image coordinates
+	/// </summary>
+	/// <param name="depth">CV_16U depth frame of the size given to Init()</param>
+	/// <param name="colorPoints">Receives CV_32FC2 (u, v) per depth pixel, -inf where the depth is 0 or behind the colour camera</param>
+	/// <returns>Returns false if the depth frame does not match the tables</returns>
+	bool MapDepthToColor(const Mat& depth, Mat& colorPoints) const
+	{
+		if (depth.type() != CV_16U || depth.size() != au.size())
+			return false;
+		colorPoints.create(depth.rows, depth.cols, CV_32FC2);
+		int level = KinectSimdLevel();
+		KinectForRows(depth.rows, depth.cols, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+				RegisterRow(depth.ptr<unsigned short>(i), au.ptr<float>(i), av.ptr<float>(i), aw.ptr<float>(i), t, colorPoints.ptr<float>(i), depth.cols, level);
+		});
+		return true;
+	}
+
+	/// <summary>
+	/// Sample the colour image at every depth pixel (nearest neighbour). Occlusion
+	/// between the two viewpoints is not resolved.
+	/// </summary>
+	/// <param name="depth">CV_16U depth frame of the size given to Init()</param>
+	/// <param name="color">8-bit colour image of the size given to Init()</param>
+	/// <param name="aligned">Receives a depth sized image of the colour type, 0 where nothing maps</param>
+	/// <returns>Returns false if the frames do not match the tables</returns>
+	bool AlignColorToDepth(const Mat& depth, const Mat& color, Mat& aligned) const
+	{
+		if (depth.type() != CV_16U || depth.size() != au.size() || color.depth() != CV_8U
+			|| color.cols != this->color.width || color.rows != this->color.height)
+			return false;
+		aligned.create(depth.rows, depth.cols, color.type());
+		int level = KinectSimdLevel();
+		int pixelBytes = (int)color.elemSize();
+		KinectForRows(depth.rows, depth.cols, [&](int begin, int end)
+		{
+			vector<float> points(2 * depth.cols);
+			for (int i = begin; i < end; i++)
+			{
+				RegisterRow(depth.ptr<unsigned short>(i), au.ptr<float>(i), av.ptr<float>(i), aw.ptr<float>(i), t, points.data(), depth.cols, level);
+				unsigned char* out = aligned.ptr<unsigned char>(i);
+				for (int j = 0; j < depth.cols; j++)
+				{
+					// -inf fails the range test as well
+					float u = points[2 * j] + 0.5f, v = points[2 * j + 1] + 0.5f;
+					unsigned char* px = out + pixelBytes * j;
+					if (!(u >= 0 && v >= 0 && u < color.cols && v < color.rows))
+					{
+						memset(px, 0, pixelBytes);
+						continue;
+					}
+					const unsigned char* in = color.ptr<unsigned char>((int)v) + pixelBytes * (int)u;
+					if (pixelBytes == 3)
+					{
+						px[0] = in[0];
+						px[1] = in[1];
+						px[2] = in[2];
+					}
+					else
+						memcpy(px, in, pixelBytes);
+				}
+			}
+		});
+		return true;
+	}
+};
+
+#endif
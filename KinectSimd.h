@@ -0,0 +1,182 @@
+#pragma once
+
+#ifndef _KINECT_SIMD
+#define _KINECT_SIMD
+
+#include <opencv2/opencv.hpp>
+using namespace cv;
+
+// Runtime selected SIMD levels of the pixel kernels. Every kernel has a
+// scalar version, which is the reference the vector versions must match.
+enum KinectSimd
+{
+	KINECT_SIMD_SCALAR = 0,
+	KINECT_SIMD_SSSE3 = 1,
+	KINECT_SIMD_AVX2 = 2
+};
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KINECT_SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define KINECT_TARGET(isa)
+#else
+#include <cpuid.h>
+// GCC and Clang only emit instructions of the enabled ISA, so vector kernels are compiled per function
+#define KINECT_TARGET(isa) __attribute__((target(isa)))
+#endif
+#include <immintrin.h>
+#endif
+
+// Images with fewer pixels are converted on the calling thread
+#define KINECT_PARALLEL_PIXELS (1 << 18)
+
+/// <summary>
+/// Highest SIMD level supported by the CPU and the OS
+/// </summary>
+inline int KinectDetectSimd()
+{
+#ifdef KINECT_SIMD_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool ssse3 = __builtin_cpu_supports("ssse3") != 0;
+	bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+	if (avx2) return KINECT_SIMD_AVX2;
+	if (ssse3) return KINECT_SIMD_SSSE3;
+#endif
+	return KINECT_SIMD_SCALAR;
+}
+
+inline int& KinectSimdSelected()
+{
+	static int level = KinectDetectSimd();
+	return level;
+}
+
+/// <summary>
+/// SIMD level the kernels run at
+/// </summary>
+inline int KinectSimdLevel()
+{
+	return KinectSimdSelected();
+}
+
+/// <summary>
+/// Limit the kernels to a lower SIMD level, e.g. to compare them with the
+/// scalar reference. Levels above what the CPU supports are ignored.
+/// </summary>
+inline void KinectSetSimdLevel(int level)
+{
+	int supported = KinectDetectSimd();
+	KinectSimdSelected() = level < supported ? level : supported;
+}
+
+/// <summary>
+/// Run body(begin, end) over all rows, split across threads for large images
+/// </summary>
+template<class Body>
+inline void KinectForRows(int rows, int cols, const Body& body)
+{
+	if ((long long)rows * cols < KINECT_PARALLEL_PIXELS)
+	{
+		body(0, rows);
+		return;
+	}
+	parallel_for_(Range(0, rows), [&](const Range& range) { body(range.start, range.end); });
+}
+
+/// <summary>
+/// Number of set bits
+/// </summary>
+inline int KinectPopCount(unsigned int v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (int)((((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
+
+/// <summary>
+/// Positions of the lowest and highest set bit of a non-zero value
+/// </summary>
+inline int KinectLowBit(unsigned int v)
+{
+	int n = 0;
+	while (!(v & 1))
+	{
+		v >>= 1;
+		n++;
+	}
+	return n;
+}
+
+inline int KinectHighBit(unsigned int v)
+{
+	int n = 31;
+	while (!(v >> n)) n--;
+	return n;
+}
+
+#ifdef KINECT_SIMD_X86
+
+/// <summary>
+/// Interleave 16 pixels of three planes into 48 bytes of packed 3-channel data
+/// </summary>
+KINECT_TARGET("ssse3") inline void KinectStore3(unsigned char* out, __m128i a, __m128i b, __m128i c)
+{
+	const __m128i a0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+	const __m128i b0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+	const __m128i c0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+	const __m128i a1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+	const __m128i b1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+	const __m128i c1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+	const __m128i a2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+	const __m128i b2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+	const __m128i c2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+	__m128i v0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, a0), _mm_shuffle_epi8(b, b0)), _mm_shuffle_epi8(c, c0));
+	__m128i v1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, a1), _mm_shuffle_epi8(b, b1)), _mm_shuffle_epi8(c, c1));
+	__m128i v2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, a2), _mm_shuffle_epi8(b, b2)), _mm_shuffle_epi8(c, c2));
+	_mm_storeu_si128((__m128i*)out, v0);
+	_mm_storeu_si128((__m128i*)(out + 16), v1);
+	_mm_storeu_si128((__m128i*)(out + 32), v2);
+}
+
+/// <summary>
+/// Split 48 bytes of packed 3-channel data into 16 pixels of three planes
+/// </summary>
+KINECT_TARGET("ssse3") inline void KinectLoad3(const unsigned char* in, __m128i& a, __m128i& b, __m128i& c)
+{
+	__m128i v0 = _mm_loadu_si128((const __m128i*)in);
+	__m128i v1 = _mm_loadu_si128((const __m128i*)(in + 16));
+	__m128i v2 = _mm_loadu_si128((const __m128i*)(in + 32));
+	a = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(v0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+	b = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(v0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+	c = _mm_or_si128(_mm_or_si128(
+		_mm_shuffle_epi8(v0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+		_mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+		_mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+#endif
+
+#endif
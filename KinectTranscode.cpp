@@ -0,0 +1,454 @@
+// Command line transcoder for MyKinectRec and MatStream recordings.
+//
+//   KinectTranscode rec <input> <output> [-key N] [-threshold T] [-threads N] [-chunk N] [-verify]
+//   KinectTranscode mat <input> <output> [-codec raw|depth16] [-threads N] [-chunk N] [-verify]
+//
+// rec: -key 0 writes raw records, -key N delta encodes with a keyframe every
+//      N frames (see MyKinectRec::SetDeltaEncoding). Any input variant is read.
+// mat: rewrites a MatStream, including all its segments, as one raw or
+//      DEPTH16 stream. Timestamps are kept.
+//
+// The frames are split into chunks which worker threads read through their
+// own reader and encode; the main thread writes the chunks in order. With
+// -verify the output is read back and compared with the input bit by bit.
+
+#include "MyKinectRec.h"
+#include "MatStream.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+using namespace std::chrono;
+
+struct TranscodeOptions
+{
+	string kind;
+	string input;
+	string output;
+	int key;
+	int threshold;
+	int codec;
+	int threads;
+	int chunk;
+	bool verify;
+};
+
+struct TranscodeItem
+{
+	vector<unsigned char> data;
+	long long time;
+};
+
+static long long FileBytes(string fileName)
+{
+	ifstream file(fileName, ios::in | ios::binary | ios::ate);
+	if (file.fail()) return -1;
+	return (long long)file.tellg();
+}
+
+static long long StreamBytes(string fileName)
+{
+	long long total = 0;
+	for (int k = 0; ; k++)
+	{
+		long long size = FileBytes(MatStream::SegmentName(fileName, k));
+		if (size < 0) break;
+		total += size;
+	}
+	return total;
+}
+
+/// <summary>
+/// Run encode(chunk, items) for every chunk on worker threads and hand the
+/// results to write(items) in chunk order on the calling thread. At most two
+/// chunks per thread are held in memory at once.
+/// </summary>
+template<class Encode, class Write>
+static bool RunChunks(int chunks, int threads, Encode encode, Write write)
+{
+	mutex lock;
+	condition_variable changed;
+	map<int, vector<TranscodeItem>> ready;
+	int next = 0;
+	int written = 0;
+	bool failed = false;
+	int window = 2 * threads;
+
+	vector<thread> workers;
+	for (int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&]
+		{
+			while (true)
+			{
+				int chunk;
+				{
+					unique_lock<mutex> guard(lock);
+					changed.wait(guard, [&] { return failed || next >= chunks || next < written + window; });
+					if (failed || next >= chunks) return;
+					chunk = next++;
+				}
+				vector<TranscodeItem> items;
+				bool ok = encode(chunk, items);
+				{
+					lock_guard<mutex> guard(lock);
+					if (!ok) failed = true;
+					ready[chunk] = move(items);
+				}
+				changed.notify_all();
+			}
+		});
+	}
+
+	bool ok = true;
+	for (int chunk = 0; chunk < chunks && ok; chunk++)
+	{
+		vector<TranscodeItem> items;
+		{
+			unique_lock<mutex> guard(lock);
+			changed.wait(guard, [&] { return failed || ready.count(chunk) > 0; });
+			if (failed)
+			{
+				ok = false;
+				break;
+			}
+			items = move(ready[chunk]);
+			ready.erase(chunk);
+		}
+		ok = write(items);
+		{
+			lock_guard<mutex> guard(lock);
+			written++;
+			if (!ok) failed = true;
+		}
+		changed.notify_all();
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	return ok && !failed;
+}
+
+/// <summary>
+/// Run check(start, end) over frame ranges on all threads
+/// </summary>
+template<class Check>
+static bool RunRanges(int frames, int threads, Check check)
+{
+	atomic<bool> ok(true);
+	vector<thread> workers;
+	for (int t = 0; t < threads; t++)
+	{
+		int start = (int)((long long)frames * t / threads);
+		int end = (int)((long long)frames * (t + 1) / threads);
+		workers.emplace_back([&, start, end] { if (!check(start, end)) ok = false; });
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	return ok;
+}
+
+static bool SameFrame(const MyKinectFrame& a, const MyKinectFrame& b, bool images)
+{
+	if (a.depthTime != b.depthTime || a.infraTime != b.infraTime
+		|| memcmp(a.bodies, b.bodies, sizeof(a.bodies)) != 0 || memcmp(a.jind, b.jind, sizeof(a.jind)) != 0)
+		return false;
+	if (!images) return true;
+	return a.depth.size() == b.depth.size() && a.infrared.size() == b.infrared.size()
+		&& memcmp(a.depth.data, b.depth.data, a.depth.total() * a.depth.elemSize()) == 0
+		&& memcmp(a.infrared.data, b.infrared.data, a.infrared.total() * a.infrared.elemSize()) == 0;
+}
+
+static int TranscodeRec(TranscodeOptions& opt, int& frames, double& seconds)
+{
+	auto begin = high_resolution_clock::now();
+	MyKinectRec probe(opt.input, MyKinectRec::Mode::in);
+	if (probe.Failed())
+	{
+		printf("Cannot open %s\n", opt.input.c_str());
+		return 1;
+	}
+	MyKinectRecHeader inHeader = probe.Header();
+	MyKinectRecHeader outHeader = MyKinectRec::DefaultHeader();
+	if (inHeader.width != outHeader.width || inHeader.height != outHeader.height)
+	{
+		printf("%s has %dx%d frames, only %dx%d can be written\n", opt.input.c_str(), inHeader.width, inHeader.height, outHeader.width, outHeader.height);
+		return 1;
+	}
+	frames = probe.Length();
+	probe.Close();
+
+	int flags = opt.key > 0 ? MYKINECTREC_DELTA : 0;
+	int chunk = opt.chunk;
+	// Every chunk starts with a keyframe, so chunks encode independently
+	if (opt.key > 0)
+		chunk = (chunk + opt.key - 1) / opt.key * opt.key;
+	int chunks = (frames + chunk - 1) / chunk;
+
+	MyKinectRec out;
+	out.SetDeltaEncoding(opt.key, opt.threshold);
+	if (!out.Open(opt.output, MyKinectRec::Mode::out))
+	{
+		printf("Cannot create %s\n", opt.output.c_str());
+		return 1;
+	}
+	bool ok = RunChunks(chunks, opt.threads,
+		[&](int c, vector<TranscodeItem>& items)
+		{
+			MyKinectRec in(opt.input, MyKinectRec::Mode::in);
+			if (in.Failed()) return false;
+			int start = c * chunk;
+			int end = start + chunk < frames ? start + chunk : frames;
+			MyKinectFrame frame;
+			Mat depthRef, infraRef;
+			items.resize(end - start);
+			in.SeekFrame(start);
+			for (int i = start; i < end; i++)
+			{
+				if (!in.Read(frame)) return false;
+				bool keyframe = opt.key > 0 && i % opt.key == 0;
+				MyKinectRec::EncodeRecord(frame, flags, keyframe, opt.threshold, depthRef, infraRef, items[i - start].data);
+			}
+			return true;
+		},
+		[&](vector<TranscodeItem>& items)
+		{
+			for (size_t i = 0; i < items.size(); i++)
+			{
+				if (!out.WriteRecord(items[i].data.data(), (int)items[i].data.size())) return false;
+			}
+			return true;
+		});
+	// The index and header are only written when the recording is closed
+	if (!out.Close()) ok = false;
+	seconds = duration<double>(high_resolution_clock::now() - begin).count();
+	if (!ok)
+	{
+		printf("Transcoding %s failed\n", opt.input.c_str());
+		return 1;
+	}
+	if (!opt.verify) return 0;
+
+	bool lossless = opt.key == 0 || opt.threshold == 0;
+	bool same = RunRanges(frames, opt.threads, [&](int start, int end)
+	{
+		MyKinectRec a(opt.input, MyKinectRec::Mode::in);
+		MyKinectRec b(opt.output, MyKinectRec::Mode::in);
+		if (a.Failed() || b.Failed() || b.Length() != frames) return false;
+		MyKinectFrame fa, fb;
+		a.SeekFrame(start);
+		b.SeekFrame(start);
+		for (int i = start; i < end; i++)
+		{
+			if (!a.Read(fa) || !b.Read(fb) || !SameFrame(fa, fb, lossless)) return false;
+		}
+		return true;
+	});
+	if (!same)
+	{
+		printf("Verification failed: %s differs from %s\n", opt.output.c_str(), opt.input.c_str());
+		return 2;
+	}
+	printf(lossless ? "Verified: output is bit-exact\n" : "Verified: timestamps and bodies are exact, images are lossy (threshold %d)\n", opt.threshold);
+	return 0;
+}
+
+static int TranscodeMat(TranscodeOptions& opt, int& frames, double& seconds)
+{
+	auto begin = high_resolution_clock::now();
+	MatStream probe;
+	probe.Open(opt.input, MatStream::Op::in);
+	if (probe.Fail())
+	{
+		printf("Cannot open %s\n", opt.input.c_str());
+		return 1;
+	}
+	MatStreamHeader head = probe.GetHead();
+	bool timed = probe.HasTimes();
+	frames = (int)probe.FrameNum();
+	probe.Close();
+
+	MatStream out;
+	out.SetHead(head);
+	if (!out.SetCodec(opt.codec))
+	{
+		printf("The codec does not support frames of type %d with %d channels\n", head.type, head.channels);
+		return 1;
+	}
+	out.Open(opt.output, MatStream::Op::out);
+	if (out.Fail())
+	{
+		printf("Cannot create %s\n", opt.output.c_str());
+		return 1;
+	}
+	int chunks = (frames + opt.chunk - 1) / opt.chunk;
+	bool ok = RunChunks(chunks, opt.threads,
+		[&](int c, vector<TranscodeItem>& items)
+		{
+			MatStream in;
+			in.Open(opt.input, MatStream::Op::in);
+			if (in.Fail()) return false;
+			int start = c * opt.chunk;
+			int end = start + opt.chunk < frames ? start + opt.chunk : frames;
+			Mat frame;
+			vector<unsigned int> residuals;
+			items.resize(end - start);
+			in.Seek(start);
+			for (int i = start; i < end; i++)
+			{
+				if (!in.Read(frame)) return false;
+				TranscodeItem& item = items[i - start];
+				item.time = timed ? in.FrameTime(i) : 0;
+				if (opt.codec == MATSTREAM_DEPTH16)
+				{
+					if (DepthEncode(frame, item.data, residuals) < 0) return false;
+				}
+				else
+				{
+					item.data.assign(frame.data, frame.data + frame.total() * frame.elemSize());
+				}
+			}
+			return true;
+		},
+		[&](vector<TranscodeItem>& items)
+		{
+			for (size_t i = 0; i < items.size(); i++)
+			{
+				TranscodeItem& item = items[i];
+				bool written;
+				if (opt.codec == MATSTREAM_DEPTH16)
+				{
+					written = timed ? out.WriteEncoded(item.data.data(), (int)item.data.size(), item.time)
+						: out.WriteEncoded(item.data.data(), (int)item.data.size());
+				}
+				else
+				{
+					Mat frame(head.height, head.width, head.type, item.data.data());
+					written = timed ? out.Write(frame, item.time) : out.Write(frame);
+				}
+				if (!written) return false;
+			}
+			return true;
+		});
+	out.Close();
+	// Close() writes the footer and header of the last segment
+	if (out.Fail()) ok = false;
+	seconds = duration<double>(high_resolution_clock::now() - begin).count();
+	if (!ok)
+	{
+		printf("Transcoding %s failed\n", opt.input.c_str());
+		return 1;
+	}
+	if (!opt.verify) return 0;
+
+	bool same = RunRanges(frames, opt.threads, [&](int start, int end)
+	{
+		MatStream a, b;
+		a.Open(opt.input, MatStream::Op::in);
+		b.Open(opt.output, MatStream::Op::in);
+		if (a.Fail() || b.Fail() || b.FrameNum() != frames || b.HasTimes() != timed) return false;
+		Mat fa, fb;
+		a.Seek(start);
+		b.Seek(start);
+		for (int i = start; i < end; i++)
+		{
+			if (!a.Read(fa) || !b.Read(fb) || fa.size() != fb.size() || fa.type() != fb.type()) return false;
+			if (memcmp(fa.data, fb.data, fa.total() * fa.elemSize()) != 0) return false;
+			if (timed && a.FrameTime(i) != b.FrameTime(i)) return false;
+		}
+		return true;
+	});
+	if (!same)
+	{
+		printf("Verification failed: %s differs from %s\n", opt.output.c_str(), opt.input.c_str());
+		return 2;
+	}
+	printf("Verified: output is bit-exact\n");
+	return 0;
+}
+
+static void Usage()
+{
+	printf("Usage:\n");
+	printf("  KinectTranscode rec <input> <output> [-key N] [-threshold T] [-threads N] [-chunk N] [-verify]\n");
+	printf("  KinectTranscode mat <input> <output> [-codec raw|depth16] [-threads N] [-chunk N] [-verify]\n");
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		Usage();
+		return 1;
+	}
+	TranscodeOptions opt;
+	opt.kind = argv[1];
+	opt.input = argv[2];
+	opt.output = argv[3];
+	opt.key = 0;
+	opt.threshold = 0;
+	opt.codec = MATSTREAM_DEPTH16;
+	opt.threads = (int)thread::hardware_concurrency();
+	opt.chunk = 32;
+	opt.verify = false;
+	for (int i = 4; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-verify") opt.verify = true;
+		else if (arg == "-key" && hasValue) opt.key = atoi(argv[++i]);
+		else if (arg == "-threshold" && hasValue) opt.threshold = atoi(argv[++i]);
+		else if (arg == "-threads" && hasValue) opt.threads = atoi(argv[++i]);
+		else if (arg == "-chunk" && hasValue) opt.chunk = atoi(argv[++i]);
+		else if (arg == "-codec" && hasValue)
+		{
+			string codec = argv[++i];
+			if (codec == "raw") opt.codec = MATSTREAM_RAW;
+			else if (codec == "depth16") opt.codec = MATSTREAM_DEPTH16;
+			else
+			{
+				Usage();
+				return 1;
+			}
+		}
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+	if (opt.threads < 1) opt.threads = 1;
+	if (opt.chunk < 1) opt.chunk = 1;
+	if (opt.key < 0) opt.key = 0;
+
+	int frames = 0;
+	int result;
+	long long inBytes, outBytes;
+	// Time spent reading, encoding and writing, without verification
+	double seconds = 0;
+	if (opt.kind == "rec")
+	{
+		result = TranscodeRec(opt, frames, seconds);
+		inBytes = FileBytes(opt.input);
+		outBytes = FileBytes(opt.output);
+	}
+	else if (opt.kind == "mat")
+	{
+		result = TranscodeMat(opt, frames, seconds);
+		inBytes = StreamBytes(opt.input);
+		outBytes = StreamBytes(opt.output);
+	}
+	else
+	{
+		Usage();
+		return 1;
+	}
+	if (result != 1)
+	{
+		printf("%d frames in %.2f s: %.1f frames/s, %.1f MB/s in, %.1f MB/s out\n", frames, seconds,
+			frames / seconds, inBytes / seconds / 1e6, outBytes / seconds / 1e6);
+		printf("%lld bytes -> %lld bytes (%.2fx)\n", inBytes, outBytes, outBytes > 0 ? (double)inBytes / outBytes : 0.0);
+	}
+	return result;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#ifndef _MAPPEDFILE_H
+#define _MAPPEDFILE_H
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <string>
+using namespace std;
+
+/// <summary>
+/// Read-only memory mapping of a whole file
+/// </summary>
+class MappedFile
+{
+private:
+	const unsigned char* data;
+	long long size;
+#ifdef _WIN32
+	HANDLE fileHandle;
+	HANDLE mapHandle;
+#else
+	int fd;
+#endif
+
+public:
+#ifdef _WIN32
+	MappedFile() : data(NULL), size(0), fileHandle(INVALID_HANDLE_VALUE), mapHandle(NULL) {}
+#else
+	MappedFile() : data(NULL), size(0), fd(-1) {}
+#endif
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	/// <summary>
+	/// Map the file read-only. The mapping stays valid until Close().
+	/// </summary>
+	/// <param name="filename">The file to map</param>
+	/// <returns>Returns true if the whole file is mapped</returns>
+	bool Open(string filename)
+	{
+		Close();
+#ifdef _WIN32
+		fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (fileHandle == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		size = fileSize.QuadPart;
+		mapHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapHandle == NULL)
+		{
+			Close();
+			return false;
+		}
+		data = (const unsigned char*)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0);
+		if (data == NULL)
+		{
+			Close();
+			return false;
+		}
+#else
+		fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+		size = st.st_size;
+		void* p = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+		{
+			Close();
+			return false;
+		}
+		data = (const unsigned char*)p;
+#endif
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != NULL) UnmapViewOfFile(data);
+		if (mapHandle != NULL) CloseHandle(mapHandle);
+		if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+		mapHandle = NULL;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (data != NULL) munmap((void*)data, (size_t)size);
+		if (fd >= 0) close(fd);
+		fd = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	/// <summary>
+	/// Hint the OS that the given byte range will be read soon
+	/// </summary>
+	void Prefetch(long long offset, long long length)
+	{
+		if (data == NULL || offset >= size) return;
+		if (offset + length > size) length = size - offset;
+#ifndef _WIN32
+		long long page = sysconf(_SC_PAGESIZE);
+		long long start = offset / page * page;
+		madvise((void*)(data + start), (size_t)(offset + length - start), MADV_WILLNEED);
+#endif
+	}
+
+	bool IsOpen()
+	{
+		return data != NULL;
+	}
+
+	const unsigned char* Data()
+	{
+		return data;
+	}
+
+	long long Size()
+	{
+		return size;
+	}
+};
+
+#endif
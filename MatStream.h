@@ -3,12 +3,23 @@
 #ifndef _MATSTREAM_H
 #define _MATSTREAM_H
 
-#include <opencv2\opencv.hpp>
+#include <opencv2/opencv.hpp>
 using namespace cv;
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <climits>
 using namespace std;
+#include "MappedFile.h"
+#include "DepthCodec.h"
+#include "FramePool.h"
 
 struct MatStreamHeader
 {
@@ -20,6 +31,42 @@ struct MatStreamHeader
 	int time;
 };
 
+// Frame payload encodings
+enum MatStreamCodec
+{
+	MATSTREAM_RAW = 0,
+	MATSTREAM_DEPTH16 = 1
+};
+
+// Files that use a codec store MATSTREAM_EXTENDED in place of the leading
+// frame count, so older readers see no frames rather than misread encoded
+// data. MatStreamHeader is then followed by a MatStreamExtHeader, every
+// frame is prefixed with its encoded size in bytes, and Close() appends a
+// table of frame offsets followed by a MatStreamFooter at the end of file.
+// Raw files only get a footer when they carry per-frame timestamps; it sits
+// after the last frame, where older readers never look.
+#define MATSTREAM_EXTENDED (-1)
+#define MATSTREAM_VERSION 2
+#define MATSTREAM_FOOTER_MAGIC 0x544D534D
+#define MATSTREAM_NO_TABLE (-1)
+
+// Ring depth used when segmented mode turns on asynchronous writing by itself
+#define MATSTREAM_DEFAULT_RING 8
+
+struct MatStreamExtHeader
+{
+	int version;
+	int codec;
+};
+
+struct MatStreamFooter
+{
+	long long frameNum;
+	long long offsetTable;
+	long long timeTable;
+	int version;
+	int magic;
+};
 
 class MatStream
 {
@@ -28,36 +75,550 @@ public:
 	{
 		in,
 		out,
+		mapped,
 		unknown
 	};
 
+	enum Overflow
+	{
+		block,
+		drop
+	};
+
 private:
-	int frameNum;
+	// Frames in the whole logical stream, across all segments
+	long long frameNum;
+	// Frames in the file this object has open
+	long long segmentFrames;
 	MatStreamHeader header;
 	fstream file;
+	string fileName;
 	Op mode;
+	MappedFile mapping;
+	long long cursor;
+
+	int codec;
+	vector<long long> offsets;
+	long long writePos;
+	vector<unsigned char> codecBuffer;
+	vector<unsigned int> codecResiduals;
+	vector<unsigned char> readBuffer;
+
+	// Per-frame timestamps, kept when the first frame was written with one
+	vector<long long> times;
+	bool timed;
+	long long lastTime;
+
+	// Segmented mode: the writer rolls over to SegmentName(fileName, segment)
+	// once a segment reaches its byte or frame budget. On read, the following
+	// segments are opened as parts and exposed as one logical stream.
+	long long segmentBytes;
+	long long segmentFrameBudget;
+	// Advanced by the writer thread in asynchronous mode while SegmentNum() reads it
+	atomic<int> segment;
+	vector<unique_ptr<MatStream>> parts;
+	vector<long long> partStart;
+	int part;
+
+	// Asynchronous write mode: Write() copies frames into a ring of
+	// pre-allocated slots which a dedicated I/O thread drains to the file.
+	bool async;
+	int ringDepth;
+	Overflow overflow;
+	vector<Mat> ring;
+	vector<long long> ringTimes;
+	int ringHead;
+	int ringCount;
+	int highWater;
+	long long dropped;
+	bool stopping;
+	bool writeFailed;
+	mutex ringLock;
+	condition_variable ringNotEmpty;
+	condition_variable ringNotFull;
+	thread writer;
 
 private:
+	bool Extended()
+	{
+		return codec != MATSTREAM_RAW;
+	}
+
+	long long DataStart()
+	{
+		return sizeof(int) + sizeof(header) + (Extended() ? sizeof(MatStreamExtHeader) : 0);
+	}
+
 	void ReadHead()
 	{
 		if (file.fail()) return;
 		if (mode == Op::out) return;
-		file.seekg(ios::beg, 0);
-		file.read((char*)(&frameNum), sizeof(frameNum));
+		int prefix = 0;
+		file.seekg(0, ios::beg);
+		file.read((char*)(&prefix), sizeof(prefix));
 		file.read((char*)(&header), sizeof(header));
+		if (file.fail()) return;
+		codec = MATSTREAM_RAW;
+		if (prefix == MATSTREAM_EXTENDED)
+		{
+			MatStreamExtHeader ext;
+			file.read((char*)(&ext), sizeof(ext));
+			if (file.fail()) return;
+			codec = ext.codec;
+		}
+		file.seekg(0, ios::end);
+		long long fileSize = file.tellg();
+		if (!Extended())
+			segmentFrames = RawFrames(prefix, fileSize);
+		LoadIndex(fileSize, [this](long long pos, void* dst, size_t n)
+		{
+			file.clear();
+			file.seekg(pos, ios::beg);
+			file.read((char*)dst, n);
+			return !file.fail();
+		});
+		file.clear();
+		file.seekg(DataStart(), ios::beg);
 	}
 
 	void WriteHead()
 	{
 		if (file.fail()) return;
 		if (mode == Op::in) return;
-		file.seekp(ios::beg, 0);
-		file.write((char*)(&frameNum), sizeof(frameNum));
+		file.seekp(0, ios::beg);
+		// The legacy prefix is a 32-bit count; streams longer than that are
+		// meant to be split into segments, whose footers hold 64-bit counts.
+		int prefix = Extended() ? MATSTREAM_EXTENDED : (int)min(segmentFrames, (long long)INT_MAX);
+		file.write((char*)(&prefix), sizeof(prefix));
 		file.write((char*)(&header), sizeof(header));
+		if (Extended())
+		{
+			MatStreamExtHeader ext = { MATSTREAM_VERSION, codec };
+			file.write((char*)(&ext), sizeof(ext));
+		}
+	}
+
+	/// <summary>
+	/// Number of frames in a raw file. A recording that was never closed still
+	/// has 0 in its head, so fall back to the number of complete frames in the file.
+	/// </summary>
+	long long RawFrames(int prefix, long long fileSize)
+	{
+		long long available = FrameSize() > 0 ? (fileSize - DataStart()) / FrameSize() : 0;
+		if (prefix <= 0 || prefix > available)
+			return available;
+		return prefix;
+	}
+
+	void WriteTable(vector<long long>& table, long long& tablePos)
+	{
+		tablePos = writePos;
+		if (!table.empty())
+			file.write((char*)table.data(), table.size() * sizeof(long long));
+		writePos += table.size() * sizeof(long long);
+	}
+
+	void WriteFooter()
+	{
+		MatStreamFooter footer = { segmentFrames, MATSTREAM_NO_TABLE, MATSTREAM_NO_TABLE, MATSTREAM_VERSION, MATSTREAM_FOOTER_MAGIC };
+		if (Extended())
+			WriteTable(offsets, footer.offsetTable);
+		if (timed)
+			WriteTable(times, footer.timeTable);
+		file.write((char*)(&footer), sizeof(footer));
+	}
+
+	/// <summary>
+	/// Load the frame offset and timestamp tables from the footer. An extended
+	/// file that was never closed has no footer, so its offsets are recovered
+	/// by walking the size prefix of every complete frame instead.
+	/// </summary>
+	template<class ReadFn>
+	void LoadIndex(long long fileSize, ReadFn readAt)
+	{
+		offsets.clear();
+		times.clear();
+		MatStreamFooter footer;
+		long long tableEnd = fileSize - sizeof(footer);
+		if (tableEnd >= DataStart()
+			&& readAt(tableEnd, &footer, sizeof(footer))
+			&& footer.magic == MATSTREAM_FOOTER_MAGIC
+			&& footer.frameNum >= 0)
+		{
+			long long tableSize = footer.frameNum * (long long)sizeof(long long);
+			auto readTable = [&](long long pos, vector<long long>& table)
+			{
+				if (pos == MATSTREAM_NO_TABLE) return true;
+				if (pos < DataStart() || pos + tableSize > tableEnd) return false;
+				table.resize((size_t)footer.frameNum);
+				return tableSize == 0 || readAt(pos, table.data(), (size_t)tableSize);
+			};
+			bool valid = readTable(footer.offsetTable, offsets) && readTable(footer.timeTable, times);
+			if (Extended() && offsets.size() != (size_t)footer.frameNum)
+				valid = false;
+			if (!Extended() && DataStart() + footer.frameNum * FrameSize() > tableEnd)
+				valid = false;
+			if (valid)
+			{
+				segmentFrames = footer.frameNum;
+				return;
+			}
+			offsets.clear();
+			times.clear();
+		}
+		if (!Extended()) return;
+		long long pos = DataStart();
+		int size;
+		while (pos + (long long)sizeof(size) <= fileSize && readAt(pos, &size, sizeof(size)))
+		{
+			if (size < 0 || pos + (long long)sizeof(size) + size > fileSize) break;
+			offsets.push_back(pos);
+			pos += sizeof(size) + size;
+		}
+		segmentFrames = offsets.size();
+	}
+
+	void MapHead()
+	{
+		long long dataStart = sizeof(int) + sizeof(header);
+		if (mapping.Size() < dataStart)
+		{
+			mapping.Close();
+			return;
+		}
+		int prefix;
+		memcpy(&prefix, mapping.Data(), sizeof(prefix));
+		memcpy(&header, mapping.Data() + sizeof(prefix), sizeof(header));
+		codec = MATSTREAM_RAW;
+		if (prefix == MATSTREAM_EXTENDED)
+		{
+			MatStreamExtHeader ext;
+			if (mapping.Size() < dataStart + (long long)sizeof(ext))
+			{
+				mapping.Close();
+				return;
+			}
+			memcpy(&ext, mapping.Data() + dataStart, sizeof(ext));
+			codec = ext.codec;
+		}
+		long long fileSize = mapping.Size();
+		if (!Extended())
+			segmentFrames = RawFrames(prefix, fileSize);
+		LoadIndex(fileSize, [this, fileSize](long long pos, void* dst, size_t n)
+		{
+			if (pos < 0 || pos + (long long)n > fileSize) return false;
+			memcpy(dst, mapping.Data() + pos, n);
+			return true;
+		});
+	}
+
+	/// <summary>
+	/// Open the segments following the file this object has open, if any
+	/// </summary>
+	void OpenParts(Op op)
+	{
+		long long start = segmentFrames;
+		for (int k = 1; ; k++)
+		{
+			string name = SegmentName(fileName, k);
+			if (!ifstream(name, ios::in | ios::binary).good()) break;
+			unique_ptr<MatStream> next(new MatStream());
+			next->Open(name, op);
+			MatStreamHeader h = next->GetHead();
+			if (next->Fail() || h.height != header.height || h.width != header.width || h.type != header.type)
+				break;
+			partStart.push_back(start);
+			start += next->FrameNum();
+			parts.push_back(move(next));
+		}
+		frameNum = start;
+	}
+
+	bool StartSegment(string name)
+	{
+		file.open(name, ios::out | ios::binary);
+		segmentFrames = 0;
+		offsets.clear();
+		times.clear();
+		WriteHead();
+		writePos = DataStart();
+		return !file.fail();
+	}
+
+	void FinishSegment()
+	{
+		if (file.fail()) return;
+		if (Extended() || timed)
+		{
+			WriteFooter();
+		}
+		if (!Extended())
+		{
+			WriteHead();
+		}
+		file.close();
+	}
+
+	void Rollover()
+	{
+		bool full = (segmentBytes > 0 && writePos >= segmentBytes)
+			|| (segmentFrameBudget > 0 && segmentFrames >= segmentFrameBudget);
+		if (full && segmentFrames > 0)
+		{
+			FinishSegment();
+			StartSegment(SegmentName(fileName, ++segment));
+		}
+	}
+
+	void WritePayload(const unsigned char* data, int size, long long time)
+	{
+		offsets.push_back(writePos);
+		file.write((char*)(&size), sizeof(size));
+		file.write((char*)data, size);
+		writePos += sizeof(size) + size;
+		if (timed) times.push_back(time);
+		segmentFrames++;
+	}
+
+	void WriteFrame(const Mat& content, long long time)
+	{
+		Rollover();
+		if (Extended())
+		{
+			int size = DepthEncode(content, codecBuffer, codecResiduals);
+			WritePayload(codecBuffer.data(), size, time);
+			return;
+		}
+		file.write((char*)content.data, FrameSize());
+		writePos += FrameSize();
+		if (timed) times.push_back(time);
+		segmentFrames++;
+	}
+
+	long long FrameOffset(long long index)
+	{
+		return Extended() ? offsets[(size_t)index] : DataStart() + index * FrameSize();
+	}
+
+	Mat MapFrame(long long index)
+	{
+		return Mat(header.height, header.width, header.type, (void*)(mapping.Data() + FrameOffset(index)));
+	}
+
+	/// <summary>
+	/// Read from the current part, moving on to the next one when it is exhausted
+	/// </summary>
+	Mat ReadPart()
+	{
+		while (true)
+		{
+			Mat content = parts[part]->Read();
+			if (!content.empty() || part + 1 >= (int)parts.size())
+				return content;
+			part++;
+			parts[part]->Seek(0);
+		}
+	}
+
+	bool ReadPart(Mat& out)
+	{
+		while (true)
+		{
+			if (parts[part]->Read(out)) return true;
+			if (part + 1 >= (int)parts.size()) return false;
+			part++;
+			parts[part]->Seek(0);
+		}
+	}
+
+	/// <summary>
+	/// Switch to the first part once this object's own file is exhausted
+	/// </summary>
+	void NextPart()
+	{
+		if (part < 0 && cursor >= segmentFrames && !parts.empty())
+		{
+			part = 0;
+			parts[0]->Seek(0);
+		}
+	}
+
+	bool Append(const Mat& content, long long time)
+	{
+		if (content.rows != header.height || content.cols != header.width)
+			return false;
+		if (mode != Op::out) return false;
+		if (writer.joinable())
+		{
+			if (!WriteAsync(content, time)) return false;
+		}
+		else
+		{
+			if (file.fail()) return false;
+			WriteFrame(content, time);
+		}
+		frameNum++;
+		lastTime = time;
+		return true;
+	}
+
+	bool AppendEncoded(const unsigned char* data, int size, long long time)
+	{
+		if (mode != Op::out || !Extended() || writer.joinable() || file.fail())
+			return false;
+		Rollover();
+		WritePayload(data, size, time);
+		frameNum++;
+		lastTime = time;
+		return true;
+	}
+
+	void StartWriter()
+	{
+		ring.resize(ringDepth);
+		ringTimes.resize(ringDepth);
+		for (int i = 0; i < ringDepth; i++)
+			ring[i].create(header.height, header.width, header.type);
+		ringHead = 0;
+		ringCount = 0;
+		highWater = 0;
+		dropped = 0;
+		stopping = false;
+		writeFailed = false;
+		writer = thread(&MatStream::WriterLoop, this);
+	}
+
+	void StopWriter()
+	{
+		if (!writer.joinable()) return;
+		{
+			lock_guard<mutex> lock(ringLock);
+			stopping = true;
+		}
+		ringNotEmpty.notify_one();
+		writer.join();
+	}
+
+	void WriterLoop()
+	{
+		unique_lock<mutex> lock(ringLock);
+		while (true)
+		{
+			ringNotEmpty.wait(lock, [this] { return ringCount > 0 || stopping; });
+			if (ringCount == 0) break;
+			Mat& slot = ring[ringHead];
+			long long time = ringTimes[ringHead];
+			// The producer never touches the head slot while it is queued, so
+			// encoding, segment rollover and the disk write can run without
+			// holding the lock.
+			lock.unlock();
+			WriteFrame(slot, time);
+			bool failed = file.fail();
+			lock.lock();
+			writeFailed = writeFailed || failed;
+			ringHead = (ringHead + 1) % ringDepth;
+			ringCount--;
+			ringNotFull.notify_one();
+		}
+	}
+
+	bool WriteAsync(const Mat& content, long long time)
+	{
+		int slot;
+		{
+			unique_lock<mutex> lock(ringLock);
+			if (writeFailed) return false;
+			if (ringCount == ringDepth)
+			{
+				if (overflow == Overflow::drop)
+				{
+					dropped++;
+					return false;
+				}
+				ringNotFull.wait(lock, [this] { return ringCount < ringDepth; });
+			}
+			slot = (ringHead + ringCount) % ringDepth;
+		}
+		// Only this thread fills slots, and the writer thread never reads past
+		// ringCount, so the copy also happens outside the lock.
+		content.copyTo(ring[slot]);
+		ringTimes[slot] = time;
+		{
+			lock_guard<mutex> lock(ringLock);
+			ringCount++;
+			if (ringCount > highWater) highWater = ringCount;
+		}
+		ringNotEmpty.notify_one();
+		return true;
 	}
 
 public:
-	MatStream() : mode(Op::unknown), frameNum(0) {}
+	MatStream() : frameNum(0), segmentFrames(0), mode(Op::unknown), cursor(0), codec(MATSTREAM_RAW), writePos(0),
+		timed(false), lastTime(0), segmentBytes(0), segmentFrameBudget(0), segment(0), part(-1),
+		async(false), ringDepth(0), overflow(Overflow::block),
+		ringHead(0), ringCount(0), highWater(0), dropped(0), stopping(false), writeFailed(false) {}
+
+	~MatStream()
+	{
+		StopWriter();
+	}
+
+	/// <summary>
+	/// Name of the k-th segment of a segmented stream. Segment 0 is the file itself.
+	/// </summary>
+	static string SegmentName(string filename, int k)
+	{
+		if (k == 0) return filename;
+		return filename + "." + to_string(k);
+	}
+
+	/// <summary>
+	/// Enable the asynchronous write mode. Must be called before Open(filename, Op::out).
+	/// </summary>
+	/// <param name="depth">Number of frames the ring buffer can hold</param>
+	/// <param name="policy">What Write() does when the ring is full: block until a slot is free, or drop the frame</param>
+	void SetAsync(int depth, Overflow policy = Overflow::block)
+	{
+		async = depth > 0;
+		ringDepth = depth;
+		overflow = policy;
+	}
+
+	/// <summary>
+	/// Enable the segmented mode. Must be called before Open(filename, Op::out).
+	/// Writing rolls over to a new segment file once the current one reaches
+	/// either budget. Rollover runs on the I/O thread, so this also turns on
+	/// the asynchronous mode if SetAsync() was not called.
+	/// </summary>
+	/// <param name="maxBytes">Size budget of a segment in bytes, or 0 for no limit</param>
+	/// <param name="maxFrames">Frame budget of a segment, or 0 for no limit</param>
+	void SetSegments(long long maxBytes, long long maxFrames = 0)
+	{
+		segmentBytes = maxBytes;
+		segmentFrameBudget = maxFrames;
+		if (!async && (maxBytes > 0 || maxFrames > 0))
+			SetAsync(MATSTREAM_DEFAULT_RING);
+	}
+
+	/// <summary>
+	/// Select the encoding of written frames. Must be called after SetHead() and before Open(filename, Op::out).
+	/// </summary>
+	/// <param name="_codec">One of MatStreamCodec. MATSTREAM_DEPTH16 is lossless and needs CV_16U single channel frames.</param>
+	/// <returns>Returns false if the codec cannot encode frames of the current head</returns>
+	bool SetCodec(int _codec)
+	{
+		if (_codec == MATSTREAM_DEPTH16 && (header.type != CV_16U || header.channels != 1))
+			return false;
+		if (_codec != MATSTREAM_RAW && _codec != MATSTREAM_DEPTH16)
+			return false;
+		codec = _codec;
+		return true;
+	}
+
+	int Codec()
+	{
+		return codec;
+	}
 
 	void SetHead(MatStreamHeader _header)
 	{
@@ -70,9 +631,24 @@ public:
 		return header;
 	}
 
+	/// <summary>
+	/// Open a MatStream file. Op::mapped maps the file read-only so that
+	/// ReadAt() can return frames without copying them. When reading, any
+	/// segments written after the file are opened too.
+	/// </summary>
 	void Open(string filename, Op op)
 	{
 		mode = op;
+		fileName = filename;
+		cursor = 0;
+		frameNum = 0;
+		segmentFrames = 0;
+		segment = 0;
+		part = -1;
+		timed = false;
+		lastTime = 0;
+		parts.clear();
+		partStart.clear();
 		if (op == Op::in)
 		{
 			file.open(filename, ios::in | ios::binary);
@@ -80,51 +656,283 @@ public:
 		}
 		if (op == Op::out)
 		{
-			file.open(filename, ios::out | ios::binary);
-			WriteHead();
+			StartSegment(filename);
+			if (async && !file.fail())
+				StartWriter();
+		}
+		if (op == Op::mapped)
+		{
+			if (mapping.Open(filename))
+				MapHead();
+		}
+		if (op == Op::in || op == Op::mapped)
+		{
+			frameNum = segmentFrames;
+			if (!Fail())
+				OpenParts(op);
 		}
 	}
 
 	bool Fail()
 	{
+		if (mode == Op::mapped) return !mapping.IsOpen();
+		if (writer.joinable())
+		{
+			lock_guard<mutex> lock(ringLock);
+			return writeFailed;
+		}
 		return file.fail();
 	}
 
+	/// <summary>
+	/// Size in bytes of a single frame on disk
+	/// </summary>
+	long long FrameSize()
+	{
+		return (long long)header.height*header.width*header.bytesPerPixel*header.channels;
+	}
+
 	bool Write(Mat content)
 	{
-		if (content.rows != header.height || content.cols != header.width)
-			return false;
-		if (file.fail()) return false;
-		if (mode == Op::in) return false;
-		file.write((char*)content.data, header.height*header.width*header.bytesPerPixel*header.channels);
-		frameNum++;
-		return true;
+		return Append(content, lastTime);
+	}
+
+	/// <summary>
+	/// Write a frame together with its timestamp, e.g. the relative time returned
+	/// by KinectSensor::getDepthMat(). Timestamps must not decrease. The table is
+	/// written on Close() if the first frame carried a timestamp; frames written
+	/// later without one repeat the previous timestamp.
+	/// </summary>
+	bool Write(Mat content, long long time)
+	{
+		if (frameNum == 0) timed = true;
+		return Append(content, time);
+	}
+
+	/// <summary>
+	/// Append a frame already encoded with DepthEncode() to a stream opened
+	/// with MATSTREAM_DEPTH16, so frames can be encoded on other threads.
+	/// Not available in the asynchronous mode.
+	/// </summary>
+	bool WriteEncoded(const unsigned char* data, int size)
+	{
+		return AppendEncoded(data, size, lastTime);
+	}
+
+	/// <summary>
+	/// Append an encoded frame together with its timestamp, see Write(Mat, long long)
+	/// </summary>
+	bool WriteEncoded(const unsigned char* data, int size, long long time)
+	{
+		if (frameNum == 0) timed = true;
+		return AppendEncoded(data, size, time);
 	}
 
 	Mat Read()
 	{
-		Mat content(header.height, header.width, header.type, Scalar::all(0));
-		if (file.fail()) return Mat();
-		if (mode == Op::out) return Mat();
-		file.read((char*)(content.data), header.height*header.width*header.bytesPerPixel*header.channels);
+		NextPart();
+		if (part >= 0) return ReadPart();
+		if (mode == Op::mapped && !Extended() && cursor < segmentFrames && mapping.IsOpen())
+			return MapFrame(cursor++);
+		Mat content;
+		if (!Read(content)) return Mat();
 		return content;
 	}
 
+	/// <summary>
+	/// Read the next frame into a caller-owned Mat. The Mat is only reallocated
+	/// if its size or type does not match the head, so reading into the same
+	/// Mat again does not allocate. Mapped raw frames are copied. Use a
+	/// FramePool&lt;Mat&gt; to recycle Mats that are handed to other threads.
+	/// </summary>
+	/// <returns>Returns false at the end of the stream or on a read error</returns>
+	bool Read(Mat& out)
+	{
+		NextPart();
+		if (part >= 0) return ReadPart(out);
+		if (mode != Op::in && mode != Op::mapped) return false;
+		if (cursor >= segmentFrames) return false;
+		if (mode == Op::in && file.fail()) return false;
+		if (mode == Op::mapped && !mapping.IsOpen()) return false;
+		long long index = cursor++;
+		// A Mat returned by Read()/ReadAt() points into the read-only mapping
+		// and create() would keep it, so detach it before writing the frame
+		if (mode == Op::mapped && out.data >= mapping.Data() && out.data < mapping.Data() + mapping.Size())
+			out.release();
+		if (Extended())
+		{
+			int size = 0;
+			const unsigned char* data;
+			if (mode == Op::mapped)
+			{
+				long long offset = FrameOffset(index);
+				memcpy(&size, mapping.Data() + offset, sizeof(size));
+				data = mapping.Data() + offset + sizeof(size);
+			}
+			else
+			{
+				file.read((char*)(&size), sizeof(size));
+				if (file.fail() || size < 0) return false;
+				// Sized for the worst case up front, so it does not grow with the frames
+				if (readBuffer.size() < (size_t)size)
+					readBuffer.resize(max((size_t)size, DepthCodecBound(header.height, header.width)));
+				file.read((char*)readBuffer.data(), size);
+				if (file.fail()) return false;
+				data = readBuffer.data();
+			}
+			return DepthDecode(data, size, header.height, header.width, out);
+		}
+		out.create(header.height, header.width, header.type);
+		size_t rowSize = (size_t)header.width*header.bytesPerPixel*header.channels;
+		int rows = out.isContinuous() ? 1 : header.height;
+		if (out.isContinuous()) rowSize *= header.height;
+		const unsigned char* src = mode == Op::mapped ? mapping.Data() + FrameOffset(index) : NULL;
+		for (int i = 0; i < rows; i++)
+		{
+			if (src != NULL)
+				memcpy(out.ptr(i), src + i * rowSize, rowSize);
+			else
+				file.read((char*)out.ptr(i), rowSize);
+		}
+		return mode == Op::mapped || !file.fail();
+	}
+
+	/// <summary>
+	/// Read the frame at the given index.
+	/// In Op::mapped mode the returned Mat of a raw file points straight into
+	/// the read-only mapping: it must not be written to and is only valid until
+	/// Close(). Encoded frames are always decoded into a new Mat.
+	/// </summary>
+	/// <param name="index">Zero-based index of the frame in the logical stream</param>
+	/// <returns>Returns the frame, or an empty Mat if index is out of range</returns>
+	Mat ReadAt(long long index)
+	{
+		if (!Seek(index)) return Mat();
+		return Read();
+	}
+
+	/// <summary>
+	/// Move the read position so that the next Read() returns the frame at the given index
+	/// </summary>
+	/// <returns>Returns false if index is out of range or the stream is not open for reading</returns>
+	bool Seek(long long index)
+	{
+		if (index < 0 || index >= frameNum) return false;
+		if (index >= segmentFrames)
+		{
+			part = (int)(upper_bound(partStart.begin(), partStart.end(), index) - partStart.begin()) - 1;
+			return parts[part]->Seek(index - partStart[part]);
+		}
+		part = -1;
+		if (mode == Op::mapped)
+		{
+			if (!mapping.IsOpen()) return false;
+			cursor = index;
+			return true;
+		}
+		if (mode != Op::in) return false;
+		file.clear();
+		file.seekg(FrameOffset(index), ios::beg);
+		cursor = index;
+		return true;
+	}
+
+	/// <summary>
+	/// Move the read position to the first frame whose timestamp is not earlier than time
+	/// </summary>
+	/// <param name="time">Timestamp as passed to Write(Mat, long long)</param>
+	/// <returns>Returns the index of that frame, or -1 if the file has no timestamps or every frame is earlier</returns>
+	long long SeekTime(long long time)
+	{
+		if (!times.empty())
+		{
+			long long index = lower_bound(times.begin(), times.end(), time) - times.begin();
+			if (index < (long long)times.size())
+				return Seek(index) ? index : -1;
+		}
+		for (size_t p = 0; p < parts.size(); p++)
+		{
+			long long index = parts[p]->SeekTime(time);
+			if (index >= 0)
+			{
+				part = (int)p;
+				return partStart[p] + index;
+			}
+		}
+		return -1;
+	}
+
+	bool HasTimes()
+	{
+		return !times.empty();
+	}
+
+	/// <summary>
+	/// Timestamp of the frame at the given index, or -1 if the file has no timestamps
+	/// </summary>
+	long long FrameTime(long long index)
+	{
+		if (index >= segmentFrames && index < frameNum)
+		{
+			int p = (int)(upper_bound(partStart.begin(), partStart.end(), index) - partStart.begin()) - 1;
+			return parts[p]->FrameTime(index - partStart[p]);
+		}
+		if (index < 0 || index >= (long long)times.size()) return -1;
+		return times[(size_t)index];
+	}
+
 	void Close()
 	{
-		if (file.fail()) return;
+		parts.clear();
+		partStart.clear();
+		part = -1;
+		if (mode == Op::mapped)
+		{
+			mapping.Close();
+			return;
+		}
+		StopWriter();
 		if (mode == Op::out)
 		{
-			file.seekp(ios::beg, 0);
-			file.write((char*)(&frameNum), sizeof(frameNum));
+			FinishSegment();
+			return;
 		}
+		if (file.fail()) return;
 		file.close();
 	}
 
-	int FrameNum()
+	long long FrameNum()
 	{
 		return frameNum;
 	}
+
+	/// <summary>
+	/// Number of segment files the stream is made of. When writing asynchronously
+	/// it is only exact once Close() has returned.
+	/// </summary>
+	int SegmentNum()
+	{
+		if (mode == Op::out) return segment + 1;
+		return (int)parts.size() + 1;
+	}
+
+	/// <summary>
+	/// Largest number of frames that were queued at once in asynchronous mode
+	/// </summary>
+	int HighWaterMark()
+	{
+		lock_guard<mutex> lock(ringLock);
+		return highWater;
+	}
+
+	/// <summary>
+	/// Number of frames dropped because the ring was full in asynchronous mode
+	/// </summary>
+	long long DroppedFrames()
+	{
+		lock_guard<mutex> lock(ringLock);
+		return dropped;
+	}
 };
 
 #endif
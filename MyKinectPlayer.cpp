@@ -0,0 +1,250 @@
+#include "MyKinectPlayer.h"
+
+MyKinectPlayer::MyKinectPlayer() : lookahead(MYKINECTPLAYER_LOOKAHEAD), position(0), generation(0), ended(true), stopping(false)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+MyKinectPlayer::~MyKinectPlayer()
+{
+	Close();
+}
+
+bool MyKinectPlayer::Open(string fileName, int lookahead)
+{
+	Close();
+	if (!rec.Open(fileName, MyKinectRec::Mode::in))
+	{
+		return false;
+	}
+	this->lookahead = lookahead < 1 ? 1 : lookahead;
+	position = 0;
+	ended = false;
+	stopping = false;
+	memset(&stats, 0, sizeof(stats));
+	reader = thread(&MyKinectPlayer::ReaderLoop, this);
+	return true;
+}
+
+void MyKinectPlayer::Close()
+{
+	if (reader.joinable())
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+		space.notify_all();
+		queued.notify_all();
+		reader.join();
+	}
+	ClearQueue();
+	rec.Close();
+	ended = true;
+}
+
+bool MyKinectPlayer::Failed() { return rec.Failed(); }
+
+int MyKinectPlayer::Length() { return rec.Length(); }
+
+/// <summary>
+/// Take the next frame in playback order, waiting for the prefetch thread if
+/// the queue is empty. Returns NULL at the end of the recording. The frame
+/// stays valid until it is handed back with Release().
+/// </summary>
+MyKinectFrame* MyKinectPlayer::Next(int* index)
+{
+	unique_lock<mutex> guard(lock);
+	if (!queue.empty())
+	{
+		stats.hits++;
+	}
+	else if (!ended && !stopping)
+	{
+		stats.stalls++;
+		queued.wait(guard, [this] { return !queue.empty() || ended || stopping; });
+	}
+	if (queue.empty())
+	{
+		return NULL;
+	}
+	Entry entry = queue.front();
+	queue.pop_front();
+	guard.unlock();
+	space.notify_one();
+	if (index != NULL) *index = entry.index;
+	return entry.frame;
+}
+
+void MyKinectPlayer::Release(MyKinectFrame* frame)
+{
+	pool.Release(frame);
+}
+
+/// <summary>
+/// Copy the next frame into a caller-owned frame, like MyKinectRec::Read()
+/// </summary>
+bool MyKinectPlayer::Read(MyKinectFrame& frame)
+{
+	MyKinectFrame* next = Next();
+	if (next == NULL)
+	{
+		return false;
+	}
+	next->depth.copyTo(frame.depth);
+	frame.depthTime = next->depthTime;
+	next->infrared.copyTo(frame.infrared);
+	frame.infraTime = next->infraTime;
+	memcpy(frame.bodies, next->bodies, sizeof(frame.bodies));
+	memcpy(frame.jind, next->jind, sizeof(frame.jind));
+	Release(next);
+	return true;
+}
+
+/// <summary>
+/// Restart prefetching at index. Frames already queued are dropped.
+/// </summary>
+void MyKinectPlayer::SeekFrame(int index)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		for (size_t i = 0; i < queue.size(); i++)
+			pool.Release(queue[i].frame);
+		queue.clear();
+		position = index;
+		generation++;
+		ended = false;
+	}
+	space.notify_all();
+}
+
+void MyKinectPlayer::SetLookahead(int lookahead)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		this->lookahead = lookahead < 1 ? 1 : lookahead;
+	}
+	space.notify_all();
+}
+
+MyKinectPlayerStats MyKinectPlayer::Stats()
+{
+	lock_guard<mutex> guard(lock);
+	return stats;
+}
+
+void MyKinectPlayer::ClearQueue()
+{
+	lock_guard<mutex> guard(lock);
+	for (size_t i = 0; i < queue.size(); i++)
+		pool.Release(queue[i].frame);
+	queue.clear();
+}
+
+void MyKinectPlayer::ReaderLoop()
+{
+	// Index the file is positioned at, seeking only when playback jumps
+	int filePos = 0;
+	unique_lock<mutex> guard(lock);
+	while (true)
+	{
+		space.wait(guard, [this] { return stopping || (!ended && (int)queue.size() < lookahead); });
+		if (stopping)
+		{
+			break;
+		}
+		if (position >= rec.Length())
+		{
+			ended = true;
+			queued.notify_all();
+			continue;
+		}
+		int index = position++;
+		int readGeneration = generation;
+		guard.unlock();
+
+		// The file is only touched by this thread, so reading runs unlocked
+		MyKinectFrame* frame = pool.Acquire();
+		if (index != filePos)
+			rec.SeekFrame(index);
+		bool ok = rec.Read(*frame);
+		filePos = index + 1;
+
+		guard.lock();
+		if (readGeneration != generation)
+		{
+			pool.Release(frame);
+			continue;
+		}
+		if (!ok)
+		{
+			pool.Release(frame);
+			ended = true;
+			queued.notify_all();
+			continue;
+		}
+		stats.frames++;
+		queue.push_back(Entry{ index, frame });
+		if ((int)queue.size() > stats.maxQueued)
+			stats.maxQueued = (int)queue.size();
+		queued.notify_one();
+	}
+}
+
+/// <summary>
+/// Process every frame of a recording in parallel. The frames are split into
+/// one contiguous range per thread and each thread reads its range in order
+/// through its own MyKinectRec, so process may be called concurrently and in
+/// any frame order. threads = 0 uses one thread per hardware thread.
+/// </summary>
+bool MyKinectPlayer::ForEach(string fileName, function<void(int, MyKinectFrame&)> process, int threads)
+{
+	MyKinectRec probe;
+	if (!probe.Open(fileName, MyKinectRec::Mode::in))
+	{
+		return false;
+	}
+	int length = probe.Length();
+	probe.Close();
+	if (threads <= 0)
+		threads = (int)thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	if (threads > length)
+		threads = length > 0 ? length : 1;
+
+	vector<thread> workers;
+	vector<char> failed(threads, 0);
+	for (int t = 0; t < threads; t++)
+	{
+		int start = (int)((long long)length * t / threads);
+		int end = (int)((long long)length * (t + 1) / threads);
+		workers.emplace_back([&, t, start, end]
+		{
+			MyKinectRec part;
+			if (!part.Open(fileName, MyKinectRec::Mode::in))
+			{
+				failed[t] = 1;
+				return;
+			}
+			MyKinectFrame frame;
+			part.SeekFrame(start);
+			for (int i = start; i < end; i++)
+			{
+				if (!part.Read(frame))
+				{
+					failed[t] = 1;
+					return;
+				}
+				process(i, frame);
+			}
+		});
+	}
+	bool ok = true;
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].join();
+		ok = ok && !failed[t];
+	}
+	return ok;
+}
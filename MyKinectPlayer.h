@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef MYKINECTPLAYER_H
+#define MYKINECTPLAYER_H
+
+#include "MyKinectRec.h"
+#include "FramePool.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+using namespace cv;
+using namespace std;
+
+#define MYKINECTPLAYER_LOOKAHEAD 4
+
+struct MyKinectPlayerStats
+{
+	// Frames read from disk by the prefetch thread
+	long long frames;
+	// Next() calls served from the queue without waiting
+	long long hits;
+	// Next() calls that had to wait for the disk
+	long long stalls;
+	// Most frames queued at once
+	int maxQueued;
+};
+
+/// <summary>
+/// Playback of a MyKinectRec file with a background thread reading up to
+/// lookahead frames ahead into a bounded queue. Frames are recycled through
+/// a FramePool, so steady state playback does not allocate.
+/// </summary>
+class MyKinectPlayer
+{
+public:
+	MyKinectPlayer();
+	~MyKinectPlayer();
+	bool Open(string fileName, int lookahead = MYKINECTPLAYER_LOOKAHEAD);
+	void Close();
+	bool Failed();
+	int Length();
+
+	MyKinectFrame* Next(int* index = NULL);
+	void Release(MyKinectFrame* frame);
+	bool Read(MyKinectFrame& frame);
+	void SeekFrame(int index);
+	void SetLookahead(int lookahead);
+	MyKinectPlayerStats Stats();
+
+	static bool ForEach(string fileName, function<void(int, MyKinectFrame&)> process, int threads = 0);
+
+private:
+	struct Entry
+	{
+		int index;
+		MyKinectFrame* frame;
+	};
+
+	MyKinectRec rec;
+	FramePool<MyKinectFrame> pool;
+	deque<Entry> queue;
+	int lookahead;
+	// Index of the next frame the prefetch thread reads
+	int position;
+	// Bumped by SeekFrame(), frames read for an older generation are dropped
+	int generation;
+	bool ended;
+	bool stopping;
+	MyKinectPlayerStats stats;
+	mutex lock;
+	condition_variable queued;
+	condition_variable space;
+	thread reader;
+
+	void ReaderLoop();
+	void ClearQueue();
+};
+
+#endif
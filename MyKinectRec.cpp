@@ -7,28 +7,62 @@ MyKinectFrame::MyKinectFrame() :
 	memset(jind, 0, sizeof(Point2f)*BODY_COUNT*JointType_Count);
 }
 
-MyKinectRec::MyKinectRec()
+MyKinectRecHeader MyKinectRec::DefaultHeader()
+{
+	MyKinectRecHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = MYKINECTREC_MAGIC;
+	h.version = MYKINECTREC_VERSION;
+	h.width = NUI_DEPTH_RAW_WIDTH;
+	h.height = NUI_DEPTH_RAW_HEIGHT;
+	h.bodyCount = BODY_COUNT;
+	h.jointCount = JointType_Count;
+	h.bodySize = sizeof(KinectBody);
+	h.recordSize = RecordSize(h.width, h.height);
+	return h;
+}
+
+int MyKinectRec::RecordSize(int width, int height)
+{
+	return width * height * 2 * 2 + 2 * sizeof(INT64)
+		+ BODY_COUNT * sizeof(KinectBody) + BODY_COUNT * JointType_Count * sizeof(Point2f);
+}
+
+MyKinectRec::MyKinectRec() : directIO(false), blockSize(BLOCKWRITER_DEFAULT_BLOCK), headerSize(0), writePos(0), skelTrack(true), keyInterval(0), deltaThreshold(0), forceKey(true), readIndex(0), refIndex(-1)
 {
 	failed = true;
+	header = DefaultHeader();
 }
 
-MyKinectRec::MyKinectRec(string fileName, Mode mode)
+MyKinectRec::MyKinectRec(string fileName, Mode mode) : directIO(false), blockSize(BLOCKWRITER_DEFAULT_BLOCK), headerSize(0), writePos(0), skelTrack(true), keyInterval(0), deltaThreshold(0), forceKey(true), readIndex(0), refIndex(-1)
 {
-	failed = Open(fileName, mode);
+	header = DefaultHeader();
+	Open(fileName, mode);
 }
 
 bool MyKinectRec::Open(string fileName, Mode mode)
 {
+	header = DefaultHeader();
+	offsets.clear();
+	iomode = mode;
+	readIndex = 0;
+	refIndex = -1;
 	if (mode == Mode::in)
 	{
 		file.open(fileName, ios::in | ios::binary);
+		failed = file.fail() || !ReadHeader();
 	}
 	if (mode == Mode::out)
 	{
-		file.open(fileName, ios::out | ios::binary);
+		if (keyInterval > 0)
+		{
+			header.flags |= MYKINECTREC_DELTA;
+			header.keyInterval = keyInterval;
+			forceKey = true;
+		}
+		failed = !writer.Open(fileName, directIO, blockSize) || !WriteHeader();
+		if (!failed && skelTrack) skel.Open(MyKinectSkel::SidecarName(fileName), MyKinectSkel::Mode::out);
 	}
-	iomode = mode;
-	failed = file.fail();
 	if (!failed)
 	{
 		this->fileName = fileName;
@@ -43,75 +77,245 @@ bool MyKinectRec::Open(string fileName, Mode mode)
 MyKinectFrame MyKinectRec::Read()
 {
 	MyKinectFrame frame;
+	Read(frame);
+	return frame;
+}
+
+/// <summary>
+/// Read the next frame into a caller-owned frame, reusing its depth and
+/// infrared buffers. Frames can be recycled through a FramePool<MyKinectFrame>.
+/// </summary>
+bool MyKinectRec::Read(MyKinectFrame& frame)
+{
 	if (failed || iomode != Mode::in)
 	{
-		return frame;
+		return false;
+	}
+	if (header.flags & MYKINECTREC_DELTA)
+	{
+		return ReadDelta(frame);
 	}
+	readIndex++;
+	frame.depth.create(header.height, header.width, CV_16U);
+	frame.infrared.create(header.height, header.width, CV_16U);
 	file.read((char*)(frame.depth.data), frame.depth.cols*frame.depth.rows * 2);
 	file.read((char*)(&frame.depthTime), sizeof(INT64));
-	file.read((char*)(frame.infrared.data), frame.infrared.cols*frame.depth.rows * 2);
+	file.read((char*)(frame.infrared.data), frame.infrared.cols*frame.infrared.rows * 2);
 	file.read((char*)(&frame.infraTime), sizeof(INT64));
 	file.read((char*)(frame.bodies), BODY_COUNT * sizeof(KinectBody));
 	file.read((char*)(frame.jind), BODY_COUNT * JointType_Count * sizeof(Point2f));
-	if (file.eof()) return frame;
-	return frame;
+	return !file.fail();
 }
 
-void MyKinectRec::Write(MyKinectFrame frame)
+/// <summary>
+/// Append a frame. The record is gathered into the writer's staging block,
+/// which reaches the disk as one large write when it fills up. Frames whose
+/// images do not match the header size are skipped. A failed write stops the
+/// recording, see Failed().
+/// </summary>
+void MyKinectRec::Write(const MyKinectFrame& frame)
 {
 	if (failed || iomode != Mode::out)
 	{
 		return;
 	}
-	file.write((char*)(frame.depth.data), frame.depth.cols*frame.depth.rows * 2);
-	file.write((char*)(&frame.depthTime), sizeof(INT64));
-	file.write((char*)(frame.infrared.data), frame.infrared.cols*frame.depth.rows * 2);
-	file.write((char*)(&frame.infraTime), sizeof(INT64));
-	file.write((char*)(frame.bodies), BODY_COUNT * sizeof(KinectBody));
-	file.write((char*)(frame.jind), BODY_COUNT * JointType_Count * sizeof(Point2f));
+	if (frame.depth.rows != header.height || frame.depth.cols != header.width || frame.depth.type() != CV_16U || !frame.depth.isContinuous()
+		|| frame.infrared.rows != header.height || frame.infrared.cols != header.width || frame.infrared.type() != CV_16U || !frame.infrared.isContinuous())
+	{
+		return;
+	}
+	if (header.flags & MYKINECTREC_DELTA)
+	{
+		WriteDelta(frame);
+		return;
+	}
+	int imageBytes = header.width * header.height * 2;
+	offsets.push_back(writePos);
+	writePos += header.recordSize;
+	failed = !writer.Write(frame.depth.data, imageBytes)
+		|| !writer.Write(&frame.depthTime, sizeof(INT64))
+		|| !writer.Write(frame.infrared.data, imageBytes)
+		|| !writer.Write(&frame.infraTime, sizeof(INT64))
+		|| !writer.Write(frame.bodies, BODY_COUNT * sizeof(KinectBody))
+		|| !writer.Write(frame.jind, BODY_COUNT * JointType_Count * sizeof(Point2f));
+	if (failed)
+	{
+		return;
+	}
+	skel.Write(frame.depthTime, frame.bodies, frame.jind);
 }
 
-void MyKinectRec::Close()
+/// <summary>
+/// Finish the file. A recording whose writes failed gets neither index nor
+/// header, so it does not claim frames that never reached the disk.
+/// </summary>
+/// <returns>Returns false if the file was not open or a write failed</returns>
+bool MyKinectRec::Close()
 {
+	bool ok = !failed;
+	if (!failed && iomode == Mode::out)
+	{
+		header.frameCount = offsets.size();
+		header.indexOffset = writePos;
+		ok = writer.Seek(writePos)
+			&& (offsets.empty() || writer.Write(offsets.data(), offsets.size() * sizeof(INT64)))
+			&& WriteHeader();
+	}
+	skel.Close();
+	if (!writer.Close())
+	{
+		ok = false;
+	}
 	file.close();
 	failed = true;
+	return ok;
 }
 
 void MyKinectRec::SeekFrame(int index)
 {
 	if (iomode == Mode::in)
 	{
-		file.seekg(index * sizeof(MyKinectFrame), ios::beg);
+		readIndex = index;
+		file.clear();
+		file.seekg(FrameOffset(index), ios::beg);
 	}
 	else
 	{
-		file.seekp(index * sizeof(MyKinectFrame), ios::beg);
+		// Rewinding a recording drops the frames from index on, they are overwritten by the next Write().
+		// There is nothing to seek to past the end: the index would skip the frames never written.
+		if (index < 0 || index > (int)offsets.size())
+			return;
+		if (index < (int)offsets.size())
+		{
+			writePos = offsets[index];
+			offsets.resize(index);
+		}
+		else if (header.flags & MYKINECTREC_DELTA)
+		{
+			// Delta records vary in size, the end is where the last one stopped
+			return;
+		}
+		else
+		{
+			writePos = FrameOffset(index);
+		}
+		if (!writer.Seek(writePos))
+		{
+			failed = true;
+			return;
+		}
+		// The frame before index is no longer the reference of the next one
+		forceKey = true;
+		skel.SeekFrame(index);
 	}
 }
 
 int MyKinectRec::Length()
 {
-	return Size() / sizeof(MyKinectFrame);
+	if (iomode == Mode::out)
+		return (int)offsets.size();
+	return (int)header.frameCount;
 }
 
-int MyKinectRec::Size()
+INT64 MyKinectRec::Size()
 {
 	if (iomode == Mode::in)
 	{
-		int pos = file.tellg();
+		INT64 pos = file.tellg();
 		file.seekg(0, ios::end);
-		int size = file.tellg();
+		INT64 size = file.tellg();
 		file.seekg(pos, ios::beg);
 		return size;
 	}
 	else
 	{
-		int pos = file.tellp();
-		file.seekp(0, ios::end);
-		int size = file.tellp();
-		file.seekp(pos, ios::beg);
-		return size;
+		return writer.Size();
+	}
+}
+
+INT64 MyKinectRec::FrameOffset(int index)
+{
+	if (index >= 0 && index < (int)offsets.size())
+		return offsets[index];
+	return headerSize + (INT64)index * header.recordSize;
+}
+
+/// <summary>
+/// Read the file header and the frame offset table. Headerless files are
+/// taken as version 0 with the default layout, and files that were never
+/// closed have their length derived from the file size.
+/// </summary>
+bool MyKinectRec::ReadHeader()
+{
+	INT64 fileSize = Size();
+	MyKinectRecHeader h;
+	memset(&h, 0, sizeof(h));
+	file.read((char*)(&h), sizeof(h));
+	file.clear();
+	if (h.magic != MYKINECTREC_MAGIC)
+	{
+		header = DefaultHeader();
+		header.version = 0;
+		headerSize = 0;
+		header.frameCount = fileSize / header.recordSize;
+		file.seekg(0, ios::beg);
+		return true;
+	}
+	if (h.version > MYKINECTREC_VERSION || (h.flags & ~MYKINECTREC_DELTA) != 0 || h.bodyCount != BODY_COUNT || h.jointCount != JointType_Count
+		|| h.bodySize != sizeof(KinectBody) || h.recordSize != RecordSize(h.width, h.height))
+	{
+		return false;
+	}
+	header = h;
+	headerSize = sizeof(MyKinectRecHeader);
+	if (header.indexOffset > 0 && header.indexOffset + header.frameCount * (INT64)sizeof(INT64) <= fileSize)
+	{
+		offsets.resize((size_t)header.frameCount);
+		file.seekg(header.indexOffset, ios::beg);
+		if (header.frameCount > 0)
+			file.read((char*)offsets.data(), offsets.size() * sizeof(INT64));
+		if (file.fail())
+		{
+			file.clear();
+			offsets.clear();
+		}
+	}
+	if (offsets.empty())
+	{
+		header.indexOffset = 0;
+		header.frameCount = (fileSize - headerSize) / header.recordSize;
+	}
+	if (offsets.empty() && (header.flags & MYKINECTREC_DELTA))
+	{
+		// Recover the frames of a delta file that was never closed from the record sizes
+		INT64 pos = headerSize;
+		MyKinectRecDelta rec;
+		while (pos + (INT64)sizeof(rec) <= fileSize)
+		{
+			file.seekg(pos, ios::beg);
+			file.read((char*)(&rec), sizeof(rec));
+			if (file.fail() || rec.recordBytes <= (int)sizeof(rec) || pos + rec.recordBytes > fileSize)
+				break;
+			offsets.push_back(pos);
+			pos += rec.recordBytes;
+		}
+		file.clear();
+		header.frameCount = offsets.size();
+	}
+	file.seekg(headerSize, ios::beg);
+	return true;
+}
+
+bool MyKinectRec::WriteHeader()
+{
+	if (!writer.Seek(0) || !writer.Write(&header, sizeof(header)))
+	{
+		return false;
 	}
+	headerSize = sizeof(header);
+	if (offsets.empty())
+		writePos = headerSize;
+	return writer.Seek(writePos);
 }
 
 bool MyKinectRec::Failed() { return failed; }
@@ -119,3 +323,250 @@ bool MyKinectRec::Failed() { return failed; }
 bool MyKinectRec::Eof() { return file.eof(); }
 
 string MyKinectRec::FileName() { return fileName; }
+
+int MyKinectRec::Version() { return header.version; }
+
+MyKinectRecHeader MyKinectRec::Header() { return header; }
+
+/// <summary>
+/// Write the skeleton sidecar (MyKinectSkel::SidecarName) along with the
+/// recording. On by default, takes effect at the next Open() for writing.
+/// </summary>
+void MyKinectRec::SetSkeletonTrack(bool enable) { skelTrack = enable; }
+
+/// <summary>
+/// Write recordings with direct I/O, bypassing the OS cache, in aligned
+/// blocks of blockSize bytes. Takes effect at the next Open() for writing.
+/// </summary>
+void MyKinectRec::SetDirectIO(bool enable, int blockSize)
+{
+	directIO = enable;
+	this->blockSize = blockSize;
+}
+
+/// <summary>
+/// Write recordings as keyframes every keyInterval frames and per-pixel
+/// deltas to the previous frame in between. Depth and infrared differences
+/// up to threshold are dropped, 0 keeps the recording lossless. keyInterval
+/// 0 writes raw records. Takes effect at the next Open() for writing.
+/// </summary>
+void MyKinectRec::SetDeltaEncoding(int keyInterval, int threshold)
+{
+	this->keyInterval = keyInterval < 0 ? 0 : keyInterval;
+	deltaThreshold = threshold < 0 ? 0 : threshold;
+}
+
+void MyKinectRec::WriteDelta(const MyKinectFrame& frame)
+{
+	bool keyframe = forceKey || offsets.size() % header.keyInterval == 0;
+	int size = EncodeRecord(frame, header.flags, keyframe, deltaThreshold, depthRef, infraRef, recordBuffer);
+	forceKey = false;
+	AppendRecord(recordBuffer.data(), size);
+}
+
+/// <summary>
+/// Serialise a frame into one record of a file with the given header flags.
+/// Delta records are encoded against depthRef and infraRef, which are
+/// updated to the decoded frame; a keyframe restarts them. Encoding does not
+/// touch any file, so independent runs of frames can be encoded in parallel
+/// and appended in order with WriteRecord().
+/// </summary>
+/// <returns>Returns the record size in bytes</returns>
+int MyKinectRec::EncodeRecord(const MyKinectFrame& frame, int flags, bool keyframe, int threshold, Mat& depthRef, Mat& infraRef, vector<unsigned char>& record)
+{
+	int imageBytes = frame.depth.cols * frame.depth.rows * 2;
+	int tailBytes = BODY_COUNT * sizeof(KinectBody) + BODY_COUNT * JointType_Count * sizeof(Point2f);
+	if (!(flags & MYKINECTREC_DELTA))
+	{
+		record.resize(2 * imageBytes + 2 * sizeof(INT64) + tailBytes);
+		unsigned char* p = record.data();
+		memcpy(p, frame.depth.data, imageBytes);
+		p += imageBytes;
+		memcpy(p, &frame.depthTime, sizeof(INT64));
+		p += sizeof(INT64);
+		memcpy(p, frame.infrared.data, imageBytes);
+		p += imageBytes;
+		memcpy(p, &frame.infraTime, sizeof(INT64));
+		p += sizeof(INT64);
+		memcpy(p, frame.bodies, BODY_COUNT * sizeof(KinectBody));
+		memcpy(p + BODY_COUNT * sizeof(KinectBody), frame.jind, BODY_COUNT * JointType_Count * sizeof(Point2f));
+		return (int)record.size();
+	}
+	// The codec scratch is per thread, so parallel encoders do not share it
+	static thread_local vector<unsigned char> depthCode, infraCode;
+	static thread_local vector<unsigned int> residuals;
+	MyKinectRecDelta rec;
+	rec.keyframe = keyframe || depthRef.size() != frame.depth.size() || infraRef.size() != frame.infrared.size();
+	if (rec.keyframe)
+	{
+		rec.depthBytes = DepthEncode(frame.depth, depthCode, residuals);
+		rec.infraBytes = DepthEncode(frame.infrared, infraCode, residuals);
+		frame.depth.copyTo(depthRef);
+		frame.infrared.copyTo(infraRef);
+	}
+	else
+	{
+		rec.depthBytes = DepthEncodeDelta(frame.depth, depthRef, threshold, depthCode, residuals);
+		rec.infraBytes = DepthEncodeDelta(frame.infrared, infraRef, threshold, infraCode, residuals);
+	}
+	rec.recordBytes = sizeof(rec) + rec.depthBytes + rec.infraBytes + 2 * sizeof(INT64) + tailBytes;
+	record.resize(rec.recordBytes);
+	unsigned char* p = record.data();
+	memcpy(p, &rec, sizeof(rec));
+	p += sizeof(rec);
+	memcpy(p, depthCode.data(), rec.depthBytes);
+	p += rec.depthBytes;
+	memcpy(p, &frame.depthTime, sizeof(INT64));
+	p += sizeof(INT64);
+	memcpy(p, infraCode.data(), rec.infraBytes);
+	p += rec.infraBytes;
+	memcpy(p, &frame.infraTime, sizeof(INT64));
+	p += sizeof(INT64);
+	memcpy(p, frame.bodies, BODY_COUNT * sizeof(KinectBody));
+	memcpy(p + BODY_COUNT * sizeof(KinectBody), frame.jind, BODY_COUNT * JointType_Count * sizeof(Point2f));
+	return rec.recordBytes;
+}
+
+/// <summary>
+/// Append a record made by EncodeRecord() with this file's header flags.
+/// The caller keeps the delta references, so a run of records has to start
+/// with a keyframe.
+/// </summary>
+bool MyKinectRec::WriteRecord(const unsigned char* record, int size)
+{
+	if (failed || iomode != Mode::out)
+	{
+		return false;
+	}
+	if (header.flags & MYKINECTREC_DELTA)
+	{
+		MyKinectRecDelta rec;
+		if (size < (int)sizeof(rec)) return false;
+		memcpy(&rec, record, sizeof(rec));
+		if (rec.recordBytes != size || (!rec.keyframe && offsets.empty())) return false;
+		// Frames written with Write() afterwards cannot use this encoder's references
+		forceKey = true;
+	}
+	else if (size != header.recordSize)
+	{
+		return false;
+	}
+	AppendRecord(record, size);
+	return !failed;
+}
+
+void MyKinectRec::AppendRecord(const unsigned char* record, int size)
+{
+	int tailBytes = BODY_COUNT * sizeof(KinectBody) + BODY_COUNT * JointType_Count * sizeof(Point2f);
+	int depthTimeAt = header.width * header.height * 2;
+	if (header.flags & MYKINECTREC_DELTA)
+	{
+		MyKinectRecDelta rec;
+		memcpy(&rec, record, sizeof(rec));
+		depthTimeAt = sizeof(rec) + rec.depthBytes;
+	}
+	offsets.push_back(writePos);
+	writePos += size;
+	if (!writer.Write(record, size))
+	{
+		failed = true;
+		return;
+	}
+	if (!skel.Failed())
+	{
+		INT64 depthTime;
+		KinectBody bodies[BODY_COUNT];
+		Point2f jind[BODY_COUNT][JointType_Count];
+		memcpy(&depthTime, record + depthTimeAt, sizeof(INT64));
+		memcpy(bodies, record + size - tailBytes, sizeof(bodies));
+		memcpy(jind, record + size - tailBytes + sizeof(bodies), sizeof(jind));
+		skel.Write(depthTime, bodies, jind);
+	}
+}
+
+bool MyKinectRec::ReadDeltaHeader(int index, MyKinectRecDelta& rec)
+{
+	if (index < 0 || index >= (int)offsets.size()) return false;
+	file.clear();
+	file.seekg(offsets[index], ios::beg);
+	file.read((char*)(&rec), sizeof(rec));
+	return !file.fail();
+}
+
+/// <summary>
+/// Decode record index on top of the reference frames. The full frame is
+/// filled in only if one is given.
+/// </summary>
+bool MyKinectRec::DecodeDelta(int index, MyKinectFrame* frame)
+{
+	MyKinectRecDelta rec;
+	refIndex = -1;
+	if (!ReadDeltaHeader(index, rec) || rec.depthBytes < 0 || rec.infraBytes < 0) return false;
+	if (!rec.keyframe && (depthRef.empty() || infraRef.empty())) return false;
+	INT64 depthTime, infraTime;
+	depthCode.resize(rec.depthBytes);
+	file.read((char*)depthCode.data(), rec.depthBytes);
+	file.read((char*)(&depthTime), sizeof(INT64));
+	infraCode.resize(rec.infraBytes);
+	file.read((char*)infraCode.data(), rec.infraBytes);
+	file.read((char*)(&infraTime), sizeof(INT64));
+	if (file.fail()) return false;
+	bool ok;
+	if (rec.keyframe)
+	{
+		ok = DepthDecode(depthCode.data(), rec.depthBytes, header.height, header.width, depthRef)
+			&& DepthDecode(infraCode.data(), rec.infraBytes, header.height, header.width, infraRef);
+	}
+	else
+	{
+		ok = DepthDecodeDelta(depthCode.data(), rec.depthBytes, depthRef)
+			&& DepthDecodeDelta(infraCode.data(), rec.infraBytes, infraRef);
+	}
+	if (!ok) return false;
+	refIndex = index;
+	if (frame != NULL)
+	{
+		depthRef.copyTo(frame->depth);
+		infraRef.copyTo(frame->infrared);
+		frame->depthTime = depthTime;
+		frame->infraTime = infraTime;
+		file.read((char*)(frame->bodies), BODY_COUNT * sizeof(KinectBody));
+		file.read((char*)(frame->jind), BODY_COUNT * JointType_Count * sizeof(Point2f));
+		return !file.fail();
+	}
+	return true;
+}
+
+/// <summary>
+/// Read the next frame of a delta encoded file. A frame that does not follow
+/// the reference frames is decoded from the nearest keyframe before it.
+/// </summary>
+bool MyKinectRec::ReadDelta(MyKinectFrame& frame)
+{
+	int index = readIndex;
+	MyKinectRecDelta rec;
+	if (!ReadDeltaHeader(index, rec)) return false;
+	if (!rec.keyframe && refIndex != index - 1)
+	{
+		int start = index - 1;
+		while (true)
+		{
+			if (start == refIndex)
+			{
+				start++;
+				break;
+			}
+			MyKinectRecDelta prior;
+			if (!ReadDeltaHeader(start, prior)) return false;
+			if (prior.keyframe) break;
+			start--;
+		}
+		for (int i = start; i < index; i++)
+		{
+			if (!DecodeDelta(i, NULL)) return false;
+		}
+	}
+	if (!DecodeDelta(index, &frame)) return false;
+	readIndex = index + 1;
+	return true;
+}
@@ -13,6 +13,11 @@
 #include <Windows.h>
 #include <opencv2/opencv.hpp>
 #include <fstream>
+#include <vector>
+#include "FramePool.h"
+#include "MyKinectSkel.h"
+#include "BlockWriter.h"
+#include "DepthCodec.h"
 
 using namespace cv;
 using namespace std;
@@ -29,6 +34,46 @@ struct MyKinectFrame
 	MyKinectFrame();
 };
 
+// Files start with a MyKinectRecHeader and end with a table of INT64 frame
+// offsets written by Close(). Files written before the header existed are
+// read as version 0: back to back records of the default layout.
+#define MYKINECTREC_MAGIC 0x43524B4D
+#define MYKINECTREC_VERSION 1
+// Header flag: records are MyKinectRecDelta encoded and vary in size
+#define MYKINECTREC_DELTA 1
+
+struct MyKinectRecHeader
+{
+	int magic;
+	int version;
+	int width;
+	int height;
+	int bodyCount;
+	int jointCount;
+	// sizeof(KinectBody) of the writer
+	int bodySize;
+	// Bytes of one frame record: depth, depthTime, infrared, infraTime, bodies, jind
+	int recordSize;
+	int flags;
+	// Frames between keyframes of a delta encoded file
+	int keyInterval;
+	INT64 frameCount;
+	// Position of the frame offset table, 0 if the file was never closed
+	INT64 indexOffset;
+};
+
+// Start of a record in a delta encoded file. It is followed by the depth
+// payload, depthTime, the infrared payload, infraTime, bodies and jind.
+// Keyframe payloads are DepthEncode()d, the others DepthEncodeDelta()d
+// against the previous frame.
+struct MyKinectRecDelta
+{
+	int recordBytes;
+	int keyframe;
+	int depthBytes;
+	int infraBytes;
+};
+
 class MyKinectRec
 {
 public:
@@ -42,20 +87,64 @@ public:
 	MyKinectRec(string fileName, Mode mode);
 	bool Open(string fileName, Mode mode);
 	MyKinectFrame Read();
-	void Write(MyKinectFrame frame);
-	void Close();
+	bool Read(MyKinectFrame& frame);
+	void Write(const MyKinectFrame& frame);
+	bool Close();
 	void SeekFrame(int index);
 	int Length();
-	int Size();
+	INT64 Size();
 	bool Failed();
 	bool Eof();
 	string FileName();
+	int Version();
+	MyKinectRecHeader Header();
+	void SetSkeletonTrack(bool enable);
+	void SetDirectIO(bool enable, int blockSize = BLOCKWRITER_DEFAULT_BLOCK);
+	void SetDeltaEncoding(int keyInterval, int threshold = 0);
+
+	static MyKinectRecHeader DefaultHeader();
+	static int RecordSize(int width, int height);
+	static int EncodeRecord(const MyKinectFrame& frame, int flags, bool keyframe, int threshold, Mat& depthRef, Mat& infraRef, vector<unsigned char>& record);
+	bool WriteRecord(const unsigned char* record, int size);
 
 private:
 	fstream file;
+	// Output goes through one aligned staging block, see BlockWriter
+	BlockWriter writer;
+	bool directIO;
+	int blockSize;
 	string fileName;
 	bool failed;
 	Mode iomode;
+	MyKinectRecHeader header;
+	int headerSize;
+	vector<INT64> offsets;
+	INT64 writePos;
+	// Skeleton-only sidecar written next to the recording, see MyKinectSkel
+	MyKinectSkel skel;
+	bool skelTrack;
+	// Delta encoding, see MyKinectRecDelta
+	int keyInterval;
+	int deltaThreshold;
+	bool forceKey;
+	Mat depthRef;
+	Mat infraRef;
+	vector<unsigned char> depthCode;
+	vector<unsigned char> infraCode;
+	vector<unsigned char> recordBuffer;
+	// Index of the next frame Read() returns
+	int readIndex;
+	// Index of the frame held by depthRef and infraRef, -1 if none
+	int refIndex;
+
+	bool ReadHeader();
+	bool WriteHeader();
+	INT64 FrameOffset(int index);
+	void WriteDelta(const MyKinectFrame& frame);
+	void AppendRecord(const unsigned char* record, int size);
+	bool ReadDelta(MyKinectFrame& frame);
+	bool ReadDeltaHeader(int index, MyKinectRecDelta& rec);
+	bool DecodeDelta(int index, MyKinectFrame* frame);
 };
 
 #endif
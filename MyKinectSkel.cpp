@@ -0,0 +1,366 @@
+#include "MyKinectSkel.h"
+
+// Per-frame byte offsets of the columns, see the layout in MyKinectSkel.h
+#define SKEL_BODY_BYTES (1 + 1 + 1 + sizeof(INT64))
+#define SKEL_JOINT_BYTES (3 * sizeof(float) + 1 + 2 * sizeof(float))
+
+MyKinectSkel::MyKinectSkel() : failed(true), iomode(Mode::in), cachedBlock(-1)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+string MyKinectSkel::SidecarName(string recordingName)
+{
+	return recordingName + ".skel";
+}
+
+int MyKinectSkel::FrameBytes()
+{
+	return (int)(sizeof(INT64) + BODY_COUNT * SKEL_BODY_BYTES + BODY_COUNT * JointType_Count * SKEL_JOINT_BYTES);
+}
+
+INT64 MyKinectSkel::BodyUnit(int body)
+{
+	return sizeof(INT64) + body * SKEL_BODY_BYTES;
+}
+
+INT64 MyKinectSkel::JointUnit(int body, int joint)
+{
+	return sizeof(INT64) + BODY_COUNT * SKEL_BODY_BYTES + (body * JointType_Count + joint) * SKEL_JOINT_BYTES;
+}
+
+bool MyKinectSkel::Open(string fileName, Mode mode)
+{
+	if (file.is_open()) Close();
+	memset(&header, 0, sizeof(header));
+	pending.clear();
+	cachedBlock = -1;
+	iomode = mode;
+	if (mode == Mode::in)
+	{
+		file.open(fileName, ios::in | ios::binary);
+		failed = file.fail();
+		if (failed) return false;
+		file.seekg(0, ios::end);
+		INT64 fileSize = file.tellg();
+		file.seekg(0, ios::beg);
+		file.read((char*)(&header), sizeof(header));
+		failed = file.fail() || header.magic != MYKINECTSKEL_MAGIC || header.version > MYKINECTSKEL_VERSION
+			|| header.bodyCount != BODY_COUNT || header.jointCount != JointType_Count
+			|| header.frameBytes != FrameBytes() || header.blockFrames <= 0;
+		if (!failed)
+		{
+			// A sidecar that was never closed still has all its full blocks
+			INT64 blockBytes = (INT64)header.blockFrames * header.frameBytes;
+			INT64 complete = (fileSize - (INT64)sizeof(header)) / blockBytes * header.blockFrames;
+			if (header.frameCount > complete + header.blockFrames || header.frameCount == 0)
+				header.frameCount = complete;
+		}
+	}
+	if (mode == Mode::out)
+	{
+		// Opened for reading too, so SeekFrame() can take back a written block
+		file.open(fileName, ios::in | ios::out | ios::trunc | ios::binary);
+		failed = file.fail();
+		if (!failed)
+		{
+			header.magic = MYKINECTSKEL_MAGIC;
+			header.version = MYKINECTSKEL_VERSION;
+			header.bodyCount = BODY_COUNT;
+			header.jointCount = JointType_Count;
+			header.blockFrames = MYKINECTSKEL_BLOCK;
+			header.frameBytes = FrameBytes();
+			file.write((char*)(&header), sizeof(header));
+			pending.reserve(MYKINECTSKEL_BLOCK);
+		}
+	}
+	return !failed;
+}
+
+void MyKinectSkel::Write(INT64 time, const KinectBody bodies[BODY_COUNT], const Point2f jind[BODY_COUNT][JointType_Count])
+{
+	if (failed || iomode != Mode::out)
+	{
+		return;
+	}
+	pending.resize(pending.size() + 1);
+	Row& row = pending.back();
+	row.time = time;
+	memcpy(row.bodies, bodies, sizeof(row.bodies));
+	memcpy(row.jind, jind, sizeof(row.jind));
+	if ((int)pending.size() == header.blockFrames)
+		FlushBlock();
+}
+
+void MyKinectSkel::Close()
+{
+	if (!failed && iomode == Mode::out)
+	{
+		FlushBlock();
+		file.seekp(0, ios::beg);
+		file.write((char*)(&header), sizeof(header));
+	}
+	file.close();
+	pending.clear();
+	cachedBlock = -1;
+	failed = true;
+}
+
+/// <summary>
+/// Drop the written frames from index on, like MyKinectRec::SeekFrame() does
+/// for a recording being written. Only supported in output mode.
+/// </summary>
+void MyKinectSkel::SeekFrame(int index)
+{
+	if (failed || iomode != Mode::out || index < 0 || index >= Length())
+	{
+		return;
+	}
+	if (index >= header.frameCount)
+	{
+		pending.resize((size_t)(index - header.frameCount));
+		return;
+	}
+	// Take the block holding index back into the pending rows
+	int block = index / header.blockFrames;
+	int n = BlockFrames(block);
+	vector<char> data((size_t)n * header.frameBytes);
+	file.seekg(BlockOffset(block), ios::beg);
+	file.read(data.data(), data.size());
+	pending.resize(index - block * header.blockFrames);
+	for (int i = 0; i < (int)pending.size(); i++)
+		UnpackRow(data.data(), n, i, pending[i]);
+	header.frameCount = (INT64)block * header.blockFrames;
+	file.clear();
+	file.seekp(BlockOffset(block), ios::beg);
+}
+
+bool MyKinectSkel::Failed() { return failed; }
+
+int MyKinectSkel::Length()
+{
+	return (int)header.frameCount + (int)pending.size();
+}
+
+int MyKinectSkel::BlockFrames(int block)
+{
+	INT64 left = header.frameCount - (INT64)block * header.blockFrames;
+	return (int)(left < header.blockFrames ? left : header.blockFrames);
+}
+
+INT64 MyKinectSkel::BlockOffset(int block)
+{
+	return sizeof(MyKinectSkelHeader) + (INT64)block * header.blockFrames * header.frameBytes;
+}
+
+/// <summary>
+/// Write the pending rows as one columnar block
+/// </summary>
+void MyKinectSkel::FlushBlock()
+{
+	if (pending.empty()) return;
+	int n = (int)pending.size();
+	blockData.resize((size_t)n * header.frameBytes);
+	PackRows(pending.data(), n, blockData.data());
+	file.seekp(BlockOffset((int)(header.frameCount / header.blockFrames)), ios::beg);
+	file.write(blockData.data(), blockData.size());
+	header.frameCount += n;
+	pending.clear();
+	cachedBlock = -1;
+}
+
+void MyKinectSkel::PackRows(const Row* rows, int n, char* dst)
+{
+	for (int i = 0; i < n; i++)
+	{
+		const Row& row = rows[i];
+		memcpy(dst + i * sizeof(INT64), &row.time, sizeof(INT64));
+		for (int b = 0; b < BODY_COUNT; b++)
+		{
+			const KinectBody& body = row.bodies[b];
+			char* col = dst + BodyUnit(b) * n;
+			col[i] = (char)body.tracked;
+			col[n + i] = (char)body.left;
+			col[2 * n + i] = (char)body.right;
+			memcpy(col + 3 * n + i * sizeof(INT64), &body.time, sizeof(INT64));
+			for (int j = 0; j < JointType_Count; j++)
+			{
+				const Joint& joint = body.joints[j];
+				col = dst + JointUnit(b, j) * n;
+				memcpy(col + i * sizeof(float), &joint.Position.X, sizeof(float));
+				memcpy(col + (n + i) * sizeof(float), &joint.Position.Y, sizeof(float));
+				memcpy(col + (2 * n + i) * sizeof(float), &joint.Position.Z, sizeof(float));
+				col[3 * n * sizeof(float) + i] = (char)joint.TrackingState;
+				col += 3 * n * sizeof(float) + n;
+				memcpy(col + i * sizeof(float), &row.jind[b][j].x, sizeof(float));
+				memcpy(col + (n + i) * sizeof(float), &row.jind[b][j].y, sizeof(float));
+			}
+		}
+	}
+}
+
+void MyKinectSkel::UnpackRow(const char* src, int n, int i, Row& row)
+{
+	memcpy(&row.time, src + i * sizeof(INT64), sizeof(INT64));
+	for (int b = 0; b < BODY_COUNT; b++)
+	{
+		KinectBody& body = row.bodies[b];
+		const char* col = src + BodyUnit(b) * n;
+		body.tracked = (BOOLEAN)col[i];
+		body.left = (HandState)(unsigned char)col[n + i];
+		body.right = (HandState)(unsigned char)col[2 * n + i];
+		memcpy(&body.time, col + 3 * n + i * sizeof(INT64), sizeof(INT64));
+		for (int j = 0; j < JointType_Count; j++)
+		{
+			Joint& joint = body.joints[j];
+			col = src + JointUnit(b, j) * n;
+			joint.JointType = (JointType)j;
+			memcpy(&joint.Position.X, col + i * sizeof(float), sizeof(float));
+			memcpy(&joint.Position.Y, col + (n + i) * sizeof(float), sizeof(float));
+			memcpy(&joint.Position.Z, col + (2 * n + i) * sizeof(float), sizeof(float));
+			joint.TrackingState = (TrackingState)(unsigned char)col[3 * n * sizeof(float) + i];
+			col += 3 * n * sizeof(float) + n;
+			memcpy(&row.jind[b][j].x, col + i * sizeof(float), sizeof(float));
+			memcpy(&row.jind[b][j].y, col + (n + i) * sizeof(float), sizeof(float));
+		}
+	}
+}
+
+bool MyKinectSkel::LoadBlock(int block)
+{
+	if (block == cachedBlock) return true;
+	blockData.resize((size_t)BlockFrames(block) * header.frameBytes);
+	file.clear();
+	file.seekg(BlockOffset(block), ios::beg);
+	file.read(blockData.data(), blockData.size());
+	if (file.fail())
+	{
+		file.clear();
+		cachedBlock = -1;
+		return false;
+	}
+	cachedBlock = block;
+	return true;
+}
+
+/// <summary>
+/// Gather one column of every block, size bytes per frame starting at the
+/// per-frame offset unit. Reads only the column itself.
+/// </summary>
+bool MyKinectSkel::ReadColumn(INT64 unit, int size, vector<char>& out)
+{
+	if (failed || iomode != Mode::in)
+	{
+		return false;
+	}
+	out.resize((size_t)header.frameCount * size);
+	int blockCount = (int)((header.frameCount + header.blockFrames - 1) / header.blockFrames);
+	size_t pos = 0;
+	file.clear();
+	for (int k = 0; k < blockCount; k++)
+	{
+		int n = BlockFrames(k);
+		file.seekg(BlockOffset(k) + unit * n, ios::beg);
+		file.read(out.data() + pos, (size_t)n * size);
+		pos += (size_t)n * size;
+	}
+	if (file.fail())
+	{
+		file.clear();
+		return false;
+	}
+	return true;
+}
+
+bool MyKinectSkel::ReadTimes(vector<INT64>& times)
+{
+	vector<char> col;
+	if (!ReadColumn(0, sizeof(INT64), col)) return false;
+	times.resize((size_t)header.frameCount);
+	if (!times.empty()) memcpy(times.data(), col.data(), col.size());
+	return true;
+}
+
+bool MyKinectSkel::ReadTracked(int body, vector<BOOLEAN>& tracked)
+{
+	vector<char> col;
+	if (body < 0 || body >= BODY_COUNT || !ReadColumn(BodyUnit(body), 1, col)) return false;
+	tracked.assign(col.begin(), col.end());
+	return true;
+}
+
+bool MyKinectSkel::ReadHands(int body, vector<HandState>& left, vector<HandState>& right)
+{
+	vector<char> l, r;
+	if (body < 0 || body >= BODY_COUNT || !ReadColumn(BodyUnit(body) + 1, 1, l) || !ReadColumn(BodyUnit(body) + 2, 1, r))
+		return false;
+	left.resize(l.size());
+	right.resize(r.size());
+	for (size_t i = 0; i < l.size(); i++)
+	{
+		left[i] = (HandState)(unsigned char)l[i];
+		right[i] = (HandState)(unsigned char)r[i];
+	}
+	return true;
+}
+
+/// <summary>
+/// Read the trajectory of one joint over the whole recording, optionally
+/// with its tracking states and depth space positions
+/// </summary>
+bool MyKinectSkel::ReadJoint(int body, int joint, vector<CameraSpacePoint>& positions, vector<TrackingState>* states, vector<Point2f>* jind)
+{
+	if (body < 0 || body >= BODY_COUNT || joint < 0 || joint >= JointType_Count) return false;
+	INT64 unit = JointUnit(body, joint);
+	vector<char> x, y, z;
+	if (!ReadColumn(unit, sizeof(float), x) || !ReadColumn(unit + sizeof(float), sizeof(float), y)
+		|| !ReadColumn(unit + 2 * sizeof(float), sizeof(float), z))
+		return false;
+	size_t count = (size_t)header.frameCount;
+	positions.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		memcpy(&positions[i].X, x.data() + i * sizeof(float), sizeof(float));
+		memcpy(&positions[i].Y, y.data() + i * sizeof(float), sizeof(float));
+		memcpy(&positions[i].Z, z.data() + i * sizeof(float), sizeof(float));
+	}
+	if (states != NULL)
+	{
+		if (!ReadColumn(unit + 3 * sizeof(float), 1, x)) return false;
+		states->resize(count);
+		for (size_t i = 0; i < count; i++)
+			(*states)[i] = (TrackingState)(unsigned char)x[i];
+	}
+	if (jind != NULL)
+	{
+		INT64 jindUnit = unit + 3 * sizeof(float) + 1;
+		if (!ReadColumn(jindUnit, sizeof(float), x) || !ReadColumn(jindUnit + sizeof(float), sizeof(float), y)) return false;
+		jind->resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			memcpy(&(*jind)[i].x, x.data() + i * sizeof(float), sizeof(float));
+			memcpy(&(*jind)[i].y, y.data() + i * sizeof(float), sizeof(float));
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Read every body of one frame. Loads the whole block holding the frame,
+/// so reading frames in order touches each block once.
+/// </summary>
+bool MyKinectSkel::ReadFrame(int index, INT64& time, KinectBody bodies[BODY_COUNT], Point2f jind[BODY_COUNT][JointType_Count])
+{
+	if (failed || iomode != Mode::in || index < 0 || index >= header.frameCount)
+	{
+		return false;
+	}
+	int block = index / header.blockFrames;
+	if (!LoadBlock(block)) return false;
+	Row row;
+	UnpackRow(blockData.data(), BlockFrames(block), index - block * header.blockFrames, row);
+	time = row.time;
+	memcpy(bodies, row.bodies, sizeof(row.bodies));
+	memcpy(jind, row.jind, sizeof(row.jind));
+	return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#ifndef MYKINECTSKEL_H
+#define MYKINECTSKEL_H
+
+#ifndef _USE_OPENCV
+#define _USE_OPENCV
+#endif
+
+#include "EasyKinect.h"
+#include <Kinect.h>
+#include <Windows.h>
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+// Skeleton-only sidecar of a MyKinectRec recording.
+// Frames are grouped in blocks of up to MYKINECTSKEL_BLOCK frames and every
+// block is stored column by column: the frame times, then per body the
+// tracked flag, hand states and body time, then per body and joint the
+// camera space position, tracking state and depth space position (jind).
+// A column of a block with n frames starts at n times the per-frame offset
+// of that column, so one joint can be read across a recording without
+// touching anything else. Every block but the last holds blockFrames frames,
+// so block positions follow from the header alone.
+#define MYKINECTSKEL_MAGIC 0x4C4B534D
+#define MYKINECTSKEL_VERSION 1
+#define MYKINECTSKEL_BLOCK 256
+
+struct MyKinectSkelHeader
+{
+	int magic;
+	int version;
+	int bodyCount;
+	int jointCount;
+	int blockFrames;
+	// Bytes of one frame summed over all columns
+	int frameBytes;
+	INT64 frameCount;
+};
+
+class MyKinectSkel
+{
+public:
+	enum Mode
+	{
+		in,
+		out
+	};
+
+	MyKinectSkel();
+	bool Open(string fileName, Mode mode);
+	void Write(INT64 time, const KinectBody bodies[BODY_COUNT], const Point2f jind[BODY_COUNT][JointType_Count]);
+	void Close();
+	void SeekFrame(int index);
+	bool Failed();
+	int Length();
+
+	bool ReadTimes(vector<INT64>& times);
+	bool ReadTracked(int body, vector<BOOLEAN>& tracked);
+	bool ReadHands(int body, vector<HandState>& left, vector<HandState>& right);
+	bool ReadJoint(int body, int joint, vector<CameraSpacePoint>& positions, vector<TrackingState>* states = NULL, vector<Point2f>* jind = NULL);
+	bool ReadFrame(int index, INT64& time, KinectBody bodies[BODY_COUNT], Point2f jind[BODY_COUNT][JointType_Count]);
+
+	static string SidecarName(string recordingName);
+
+private:
+	struct Row
+	{
+		INT64 time;
+		KinectBody bodies[BODY_COUNT];
+		Point2f jind[BODY_COUNT][JointType_Count];
+	};
+
+	fstream file;
+	bool failed;
+	Mode iomode;
+	MyKinectSkelHeader header;
+	vector<Row> pending;
+	vector<char> blockData;
+	int cachedBlock;
+
+	void FlushBlock();
+	int BlockFrames(int block);
+	INT64 BlockOffset(int block);
+	bool LoadBlock(int block);
+	bool ReadColumn(INT64 unit, int size, vector<char>& out);
+	void PackRows(const Row* rows, int n, char* dst);
+	void UnpackRow(const char* src, int n, int i, Row& row);
+
+	static int FrameBytes();
+	static INT64 BodyUnit(int body);
+	static INT64 JointUnit(int body, int joint);
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "TestUtil.h"
+#include "KinectBuffer.h"
+
+// Mats wrapping a fake sensor frame must share its bits, keep it alive for
+// as long as any of them refers to it and release it exactly once
+
+struct FakeFrame
+{
+	vector<unsigned short> bits;
+	int references;
+	int addRefs;
+	int releases;
+
+	FakeFrame(int pixels) : bits(pixels), references(1), addRefs(0), releases(0)
+	{
+		for (int k = 0; k < pixels; k++) bits[k] = (unsigned short)(k * 7);
+	}
+
+	unsigned long AddRef()
+	{
+		addRefs++;
+		return ++references;
+	}
+
+	unsigned long Release()
+	{
+		releases++;
+		// The sensor recycles the buffer of a released frame
+		if (--references == 0) fill(bits.begin(), bits.end(), 0xDEAD);
+		return references;
+	}
+};
+
+int main()
+{
+	const int rows = 6, cols = 10;
+
+	// The wrapped Mat shares the bits, the caller can drop its own reference
+	FakeFrame frame(rows * cols);
+	Mat wrapped = KinectWrapFrame(&frame, frame.bits.data(), frame.bits.size(), rows, cols, CV_16U);
+	CHECK(wrapped.data == (uchar*)frame.bits.data() && wrapped.rows == rows && wrapped.cols == cols);
+	CHECK(frame.addRefs == 1 && frame.references == 2);
+	frame.Release();
+	frame.bits[5] = 1234;
+	CHECK(wrapped.at<unsigned short>(0, 5) == 1234);
+
+	// Copies and ROIs keep the frame alive, clone() is a copy of its own
+	Mat copy = wrapped;
+	Mat roi = wrapped(Rect(2, 1, 5, 3));
+	Mat cloned = wrapped.clone();
+	CHECK(roi.data == wrapped.data + wrapped.step + 2 * sizeof(unsigned short));
+	CHECK(cloned.data != wrapped.data && SameMat(cloned, wrapped));
+	wrapped.release();
+	copy.release();
+	CHECK(frame.releases == 1 && frame.references == 1);
+	CHECK(roi.at<unsigned short>(0, 0) == 1 * cols * 7 + 2 * 7);
+	roi.release();
+	// The last release returns the frame, once
+	CHECK(frame.releases == 2 && frame.references == 0);
+	CHECK(cloned.at<unsigned short>(0, 5) == 1234 && cloned.at<unsigned short>(rows - 1, cols - 1) == (unsigned short)((rows * cols - 1) * 7));
+	cloned.release();
+	CHECK(frame.releases == 2);
+
+	// Re-creating a wrapped Mat with another size releases the frame and allocates
+	FakeFrame resized(rows * cols);
+	Mat reused = KinectWrapFrame(&resized, resized.bits.data(), resized.bits.size(), rows, cols, CV_16U);
+	resized.Release();
+	reused.create(rows * 2, cols, CV_16U);
+	CHECK(resized.references == 0 && resized.releases == 2);
+	CHECK(reused.data != (uchar*)resized.bits.data() && reused.rows == rows * 2);
+	reused.release();
+	CHECK(resized.releases == 2);
+
+	// Buffers smaller than the frame and missing frames are refused without an AddRef
+	FakeFrame small(rows * cols - 1);
+	CHECK(KinectWrapFrame(&small, small.bits.data(), small.bits.size(), rows, cols, CV_16U).empty());
+	CHECK(KinectWrapFrame((FakeFrame*)NULL, small.bits.data(), small.bits.size(), rows, cols, CV_16U).empty());
+	CHECK(small.addRefs == 0);
+
+	// KinectWrapBuffer runs its callback once
+	int released = 0;
+	{
+		vector<unsigned char> bytes(rows * cols * 3, 9);
+		Mat colour = KinectWrapBuffer(bytes.data(), rows, cols, CV_8UC3, [&released] { released++; });
+		Mat view = colour;
+		CHECK(view.data == bytes.data() && released == 0);
+	}
+	CHECK(released == 1);
+
+	// KinectCopyBuffer copies into an owned Mat, continuous or a strided ROI
+	FakeFrame source(rows * cols);
+	Mat owned;
+	CHECK(KinectCopyBuffer(source.bits.data(), source.bits.size(), rows, cols, CV_16U, owned));
+	CHECK(owned.data != (uchar*)source.bits.data() && owned.isContinuous());
+	Mat view(rows, cols, CV_16U, source.bits.data());
+	CHECK(SameMat(owned, view));
+	const uchar* kept = owned.data;
+	CHECK(KinectCopyBuffer(source.bits.data(), source.bits.size(), rows, cols, CV_16U, owned));
+	CHECK(owned.data == kept);
+
+	Mat padded(rows + 2, cols + 5, CV_16U, Scalar(0));
+	for (int i = 0; i < padded.rows; i++)
+		memset(padded.ptr(i), 0x55, padded.cols * sizeof(unsigned short));
+	Mat strided = padded(Rect(3, 1, cols, rows));
+	CHECK(!strided.isContinuous());
+	CHECK(KinectCopyBuffer(source.bits.data(), source.bits.size(), rows, cols, CV_16U, strided));
+	CHECK(strided.data == padded.ptr(1) + 3 * sizeof(unsigned short) && SameMat(strided, view));
+	// The padding around the ROI is untouched
+	bool intact = true;
+	for (int i = 0; i < padded.rows; i++)
+	{
+		for (int j = 0; j < padded.cols; j++)
+		{
+			bool inside = i >= 1 && i <= rows && j >= 3 && j < 3 + cols;
+			intact = intact && (inside || padded.at<unsigned short>(i, j) == 0x5555);
+		}
+	}
+	CHECK(intact);
+	// The copy does not follow the source
+	source.bits[0] = 4321;
+	CHECK(owned.at<unsigned short>(0, 0) == 0 && strided.at<unsigned short>(0, 0) == 0);
+
+	Mat untouched;
+	CHECK(!KinectCopyBuffer(source.bits.data(), rows * cols - 1, rows, cols, CV_16U, untouched));
+	CHECK(!KinectCopyBuffer(NULL, rows * cols, rows, cols, CV_16U, untouched));
+	CHECK(untouched.empty());
+	return TestResult();
+}
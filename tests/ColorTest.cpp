@@ -0,0 +1,91 @@
+#include "TestUtil.h"
+#include "KinectColor.h"
+#include <thread>
+#include <atomic>
+
+// BGRA to BGR at every SIMD level against the scalar path, and per-thread
+// converters used the way color2mat uses them
+
+static Mat RandomBgra(int rows, int cols, mt19937& rng)
+{
+	Mat m(rows, cols, CV_8UC4);
+	for (int i = 0; i < rows; i++)
+	{
+		unsigned char* row = m.ptr<unsigned char>(i);
+		for (int k = 0; k < cols * 4; k++)
+			row[k] = (unsigned char)rng();
+	}
+	return m;
+}
+
+static Mat ScalarBgr(const Mat& bgra)
+{
+	Mat bgr(bgra.rows, bgra.cols, CV_8UC3);
+	for (int i = 0; i < bgra.rows; i++)
+		Bgra2BgrRowScalar(bgra.ptr<unsigned char>(i), bgr.ptr<unsigned char>(i), 0, bgra.cols);
+	return bgr;
+}
+
+int main()
+{
+	mt19937 rng(17);
+	int supported = KinectDetectSimd();
+
+	// Widths around the 8 and 16 pixel vector steps. The output lives in a
+	// larger buffer whose guard bytes must survive, the 12 byte stores of the
+	// vector kernels must not run past the last pixel.
+	int sizes[][2] = { { 1, 1 }, { 1, 7 }, { 2, 8 }, { 3, 9 }, { 1, 15 }, { 2, 16 }, { 1, 17 }, { 3, 33 },
+		{ 2, 45 }, { 424, 512 }, { 1080, 1920 } };
+	const int guard = 64;
+	for (auto& s : sizes)
+	{
+		Mat bgra = RandomBgra(s[0], s[1], rng);
+		Mat expected = ScalarBgr(bgra);
+		for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+		{
+			KinectSetSimdLevel(level);
+			vector<unsigned char> buffer(bgra.total() * 3 + guard, 0xAB);
+			Mat bgr(s[0], s[1], CV_8UC3, buffer.data());
+			CHECK(KinectBgra2Bgr(bgra, bgr));
+			CHECK(bgr.data == buffer.data());
+			CHECK(SameMat(bgr, expected));
+			bool intact = true;
+			for (int k = 0; k < guard; k++)
+				intact = intact && buffer[bgra.total() * 3 + k] == 0xAB;
+			CHECK(intact);
+		}
+	}
+	KinectSetSimdLevel(supported);
+
+	// Unaligned source rows, and a type that is not BGRA
+	Mat big = RandomBgra(40, 100, rng), bgr;
+	Rect roi(3, 5, 71, 29);
+	CHECK(KinectBgra2Bgr(big(roi), bgr));
+	CHECK(SameMat(bgr, ScalarBgr(big(roi))));
+	CHECK(!KinectBgra2Bgr(Mat(4, 4, CV_8UC3), bgr));
+
+	// Several capture threads, each with its own converter like color2mat,
+	// switching between the colour and the depth resolution
+	Mat frames[2] = { RandomBgra(1080, 1920, rng), RandomBgra(424, 512, rng) };
+	Mat expected[2] = { ScalarBgr(frames[0]), ScalarBgr(frames[1]) };
+	atomic<int> mismatches(0);
+	vector<thread> threads;
+	for (int t = 0; t < 4; t++)
+	{
+		threads.emplace_back([&, t]()
+		{
+			static thread_local KinectColorConverter converter;
+			for (int k = 0; k < 12; k++)
+			{
+				int f = (k + t) % 2;
+				Mat& buffer = converter.Buffer(frames[f].rows, frames[f].cols);
+				frames[f].copyTo(buffer);
+				Mat out;
+				if (!converter.ToBgr(out) || !SameMat(out, expected[f])) mismatches++;
+			}
+		});
+	}
+	for (auto& t : threads) t.join();
+	CHECK(mismatches == 0);
+	return TestResult();
+}
@@ -0,0 +1,132 @@
+#include "TestUtil.h"
+#include "DepthCodec.h"
+#include "MatStream.h"
+
+// Compression ratio and decode speed of the keyframe + delta encoding that
+// MyKinectRec::SetDeltaEncoding() writes, over a depth sequence.
+// Usage: DeltaCodecBench [recording.ms]
+// Without a recording a synthetic 512x424 sequence is used. Every keyInterval
+// frames is a DepthEncode() keyframe, the others are DepthEncodeDelta() against
+// the previous decoded frame. Fails unless threshold 0 is lossless and decoding
+// keeps up with the 30 fps of the sensor.
+
+struct DeltaRun
+{
+	double ratio;
+	double encodeMs;
+	double decodeMs;
+	int maxError;
+};
+
+static DeltaRun Run(const vector<Mat>& frames, int keyInterval, int threshold)
+{
+	vector<vector<unsigned char>> codes(frames.size());
+	vector<unsigned int> residuals;
+	Mat reference;
+	size_t raw = 0, encoded = 0;
+	double encodeMs = TimeMs(1, [&]()
+	{
+		for (size_t k = 0; k < frames.size(); k++)
+		{
+			if (k % keyInterval == 0)
+			{
+				DepthEncode(frames[k], codes[k], residuals);
+				frames[k].copyTo(reference);
+			}
+			else
+			{
+				DepthEncodeDelta(frames[k], reference, threshold, codes[k], residuals);
+			}
+		}
+	}) / frames.size();
+	for (size_t k = 0; k < frames.size(); k++)
+	{
+		raw += frames[k].total() * frames[k].elemSize();
+		encoded += codes[k].size();
+	}
+
+	int rows = frames[0].rows, cols = frames[0].cols;
+	Mat decoded;
+	double decodeMs = TimeMs(1, [&]()
+	{
+		for (size_t k = 0; k < frames.size(); k++)
+		{
+			if (k % keyInterval == 0)
+				DepthDecode(codes[k].data(), codes[k].size(), rows, cols, decoded);
+			else
+				DepthDecodeDelta(codes[k].data(), codes[k].size(), decoded);
+		}
+	}) / frames.size();
+
+	int maxError = 0;
+	for (size_t k = 0; k < frames.size(); k++)
+	{
+		bool ok = k % keyInterval == 0
+			? DepthDecode(codes[k].data(), codes[k].size(), rows, cols, decoded)
+			: DepthDecodeDelta(codes[k].data(), codes[k].size(), decoded);
+		if (!ok) return { 0, encodeMs, decodeMs, INT_MAX };
+		for (int i = 0; i < rows; i++)
+		{
+			const unsigned short* a = frames[k].ptr<unsigned short>(i);
+			const unsigned short* b = decoded.ptr<unsigned short>(i);
+			for (int j = 0; j < cols; j++)
+				maxError = max(maxError, abs(a[j] - b[j]));
+		}
+	}
+	DeltaRun run = { (double)raw / encoded, encodeMs, decodeMs, maxError };
+	return run;
+}
+
+static bool Report(const char* name, const vector<Mat>& frames)
+{
+	printf("%s, %d frames of %dx%d\n", name, (int)frames.size(), frames[0].cols, frames[0].rows);
+	printf("%8s %9s %7s %10s %10s %9s\n", "interval", "threshold", "ratio", "encode ms", "decode ms", "max error");
+	bool ok = true;
+	int intervals[] = { 1, 10, 30 };
+	int thresholds[] = { 0, 2, 8 };
+	for (int interval : intervals)
+	{
+		for (int threshold : thresholds)
+		{
+			if (interval == 1 && threshold > 0) continue;
+			DeltaRun run = Run(frames, interval, threshold);
+			printf("%8d %9d %6.2fx %10.2f %10.2f %9d\n", interval, threshold, run.ratio, run.encodeMs, run.decodeMs, run.maxError);
+			ok = ok && run.maxError <= threshold && run.decodeMs < 1000.0 / 30;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	bool ok = true;
+	if (argc > 1)
+	{
+		vector<Mat> frames;
+		MatStream in;
+		in.Open(argv[1], MatStream::in);
+		Mat frame;
+		while (!in.Fail() && in.Read(frame))
+			frames.push_back(frame.clone());
+		if (frames.empty() || frames[0].type() != CV_16U)
+		{
+			printf("%s holds no CV_16U frames\n", argv[1]);
+			return 1;
+		}
+		ok = Report(argv[1], frames);
+	}
+	else
+	{
+		// A panning camera, and a camera on a tripod where only noise and dropouts change
+		vector<Mat> panning, still;
+		for (int k = 0; k < 120; k++)
+		{
+			panning.push_back(SyntheticDepth(424, 512, k));
+			still.push_back(SyntheticDepth(424, 512, 0, k + 1));
+		}
+		ok = Report("panning", panning) && ok;
+		ok = Report("still", still) && ok;
+	}
+	printf(ok ? "within threshold and real time\n" : "FAILED: needs errors within threshold and real time decoding\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+#include "TestUtil.h"
+#include "DepthCodec.h"
+#include "MatStream.h"
+
+// Compression ratio and speed of the DEPTH16 codec on a depth sequence.
+// Usage: DepthCodecBench [recording.ms]
+// Without a recording a synthetic 512x424 sequence is used. Fails unless
+// frames shrink at least 2x and encode faster than the 30 fps of the sensor.
+
+int main(int argc, char** argv)
+{
+	vector<Mat> frames;
+	if (argc > 1)
+	{
+		MatStream in;
+		in.Open(argv[1], MatStream::in);
+		Mat frame;
+		while (!in.Fail() && in.Read(frame))
+			frames.push_back(frame.clone());
+		if (frames.empty() || frames[0].type() != CV_16U)
+		{
+			printf("%s holds no CV_16U frames\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+	{
+		for (int k = 0; k < 120; k++)
+			frames.push_back(SyntheticDepth(424, 512, k));
+	}
+
+	vector<vector<unsigned char>> codes(frames.size());
+	vector<unsigned int> residuals;
+	size_t raw = 0, encoded = 0;
+	double encodeMs = TimeMs(1, [&]()
+	{
+		for (size_t k = 0; k < frames.size(); k++)
+			DepthEncode(frames[k], codes[k], residuals);
+	}) / frames.size();
+	for (size_t k = 0; k < frames.size(); k++)
+	{
+		raw += frames[k].total() * frames[k].elemSize();
+		encoded += codes[k].size();
+	}
+	Mat decoded;
+	bool lossless = true;
+	double decodeMs = TimeMs(1, [&]()
+	{
+		for (size_t k = 0; k < frames.size(); k++)
+			DepthDecode(codes[k].data(), codes[k].size(), frames[k].rows, frames[k].cols, decoded);
+	}) / frames.size();
+	for (size_t k = 0; k < frames.size() && lossless; k++)
+	{
+		lossless = DepthDecode(codes[k].data(), codes[k].size(), frames[k].rows, frames[k].cols, decoded)
+			&& SameMat(frames[k], decoded);
+	}
+
+	double ratio = (double)raw / encoded;
+	printf("%d frames of %dx%d\n", (int)frames.size(), frames[0].cols, frames[0].rows);
+	printf("ratio %.2fx, encode %.2f ms/frame (%.0f fps), decode %.2f ms/frame, lossless %s\n",
+		ratio, encodeMs, 1000 / encodeMs, decodeMs, lossless ? "yes" : "NO");
+	bool ok = lossless && ratio >= 2 && encodeMs < 1000.0 / 30;
+	printf(ok ? "meets 2x and real time\n" : "FAILED: needs lossless, 2x and real time\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#include "TestUtil.h"
+#include "DepthCodec.h"
+#include "MatStream.h"
+
+// Lossless round trips of DepthEncode/DepthDecode and of DEPTH16 MatStream files
+
+static bool RoundTrip(const Mat& frame)
+{
+	vector<unsigned char> code;
+	vector<unsigned int> residuals;
+	int size = DepthEncode(frame, code, residuals);
+	if (size < 0 || (size_t)size > DepthCodecBound(frame.rows, frame.cols)) return false;
+	Mat decoded;
+	return DepthDecode(code.data(), size, frame.rows, frame.cols, decoded) && SameMat(frame, decoded);
+}
+
+int main()
+{
+	mt19937 rng(3);
+
+	// Sensor-like frames, and the scratch buffers reused from frame to frame
+	vector<unsigned char> code;
+	vector<unsigned int> residuals;
+	Mat decoded;
+	for (int frame = 0; frame < 5; frame++)
+	{
+		Mat depth = SyntheticDepth(424, 512, frame);
+		int size = DepthEncode(depth, code, residuals);
+		CHECK(size > 0);
+		CHECK(DepthDecode(code.data(), size, 424, 512, decoded));
+		CHECK(SameMat(depth, decoded));
+		// Truncated data is reported, not decoded from past the end
+		CHECK(!DepthDecode(code.data(), size / 2, 424, 512, decoded));
+	}
+
+	// Sizes that leave partial blocks, full range noise, constant frames
+	int sizes[][2] = { { 1, 1 }, { 1, 17 }, { 17, 1 }, { 7, 13 }, { 3, 15 }, { 5, 16 }, { 424, 512 } };
+	for (auto& s : sizes)
+	{
+		Mat noise(s[0], s[1], CV_16U), zero(s[0], s[1], CV_16U), full(s[0], s[1], CV_16U);
+		for (int i = 0; i < s[0]; i++)
+		{
+			for (int j = 0; j < s[1]; j++)
+			{
+				noise.at<unsigned short>(i, j) = (unsigned short)rng();
+				zero.at<unsigned short>(i, j) = 0;
+				full.at<unsigned short>(i, j) = 65535;
+			}
+		}
+		CHECK(RoundTrip(noise));
+		CHECK(RoundTrip(zero));
+		CHECK(RoundTrip(full));
+	}
+	CHECK(DepthEncode(Mat(4, 4, CV_8U), code) == -1);
+
+	// Deltas against the previous frame: exact at threshold 0, within the threshold otherwise
+	for (int threshold = 0; threshold <= 4; threshold += 4)
+	{
+		Mat encoderRef = SyntheticDepth(424, 512, 0), decoderRef = encoderRef.clone();
+		for (int frame = 1; frame < 4; frame++)
+		{
+			Mat depth = SyntheticDepth(424, 512, frame);
+			int size = DepthEncodeDelta(depth, encoderRef, threshold, code, residuals);
+			CHECK(size > 0);
+			CHECK(DepthDecodeDelta(code.data(), size, decoderRef));
+			CHECK(SameMat(encoderRef, decoderRef));
+			CHECK(norm(depth, decoderRef, NORM_INF) <= threshold);
+		}
+	}
+	CHECK(DepthEncodeDelta(Mat(4, 4, CV_16U), decoded, 0, code) == -1);
+
+	// Through a DEPTH16 MatStream, synchronous and asynchronous, read back by stream and by mapping
+	for (int async = 0; async < 2; async++)
+	{
+		MatStreamHeader head = { 424, 512, 1, 2, CV_16U, 0 };
+		MatStream out;
+		out.SetHead(head);
+		CHECK(out.SetCodec(MATSTREAM_DEPTH16));
+		if (async) out.SetAsync(4);
+		out.Open("DepthCodecTest.ms", MatStream::out);
+		CHECK(!out.Fail());
+		for (int frame = 0; frame < 10; frame++)
+			CHECK(out.Write(SyntheticDepth(424, 512, frame)));
+		out.Close();
+
+		for (int mapped = 0; mapped < 2; mapped++)
+		{
+			MatStream in;
+			in.Open("DepthCodecTest.ms", mapped ? MatStream::mapped : MatStream::in);
+			CHECK(!in.Fail());
+			CHECK(in.Codec() == MATSTREAM_DEPTH16);
+			CHECK(in.FrameNum() == 10);
+			Mat frame;
+			for (int k = 0; k < 10; k++)
+			{
+				CHECK(in.Read(frame));
+				CHECK(SameMat(frame, SyntheticDepth(424, 512, k)));
+			}
+			CHECK(!in.Read(frame));
+			CHECK(SameMat(in.ReadAt(7), SyntheticDepth(424, 512, 7)));
+		}
+	}
+	remove("DepthCodecTest.ms");
+	return TestResult();
+}
@@ -0,0 +1,29 @@
+#include "TestUtil.h"
+#include "KinectDepthFilter.h"
+
+// Milliseconds per 512x424 frame to convert depth to metres and to smooth it
+// with the 7x7 window of SmoothDepthFloatFrame, at each SIMD level
+
+int main()
+{
+	Mat depth = SyntheticDepth(424, 512, 0);
+	int supported = KinectDetectSimd();
+	const char* names[] = { "scalar", "SSSE3", "AVX2" };
+	double scalarFloat = 0, scalarSmooth = 0;
+	Mat depthFloat, smoothed;
+	for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+	{
+		KinectSetSimdLevel(level);
+		double toFloat = TimeMs(500, [&]() { KinectDepthToFloat(depth, depthFloat, 0.35f, 8.0f); });
+		double smooth = TimeMs(50, [&]() { KinectSmoothDepth(depthFloat, smoothed, 3, 0.04f); });
+		if (level == KINECT_SIMD_SCALAR)
+		{
+			scalarFloat = toFloat;
+			scalarSmooth = smooth;
+		}
+		printf("%-6s to float %.3f ms (%.1fx)  smooth 7x7 %.2f ms (%.1fx)\n", names[level],
+			toFloat, scalarFloat / toFloat, smooth, scalarSmooth / smooth);
+	}
+	KinectSetSimdLevel(supported);
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include "TestUtil.h"
+#include "KinectDepthFilter.h"
+
+// Depth conversion and smoothing at every SIMD level against a per-pixel
+// definition, on sizes around the vector widths with holes, far pixels and
+// depth edges
+
+static Mat NoisyDepth(int rows, int cols, mt19937& rng)
+{
+	Mat depth(rows, cols, CV_16U);
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			int v = 800 + (int)(400 * sinf(j * 0.05f)) + (i > rows / 2 ? 700 : 0) + (int)(rng() % 20);
+			if (rng() % 10 == 0) v = 0;
+			if (rng() % 50 == 0) v = 9000;
+			depth.at<unsigned short>(i, j) = (unsigned short)v;
+		}
+	}
+	return depth;
+}
+
+static bool Bitwise(const Mat& a, const Mat& b)
+{
+	return a.rows == b.rows && a.cols == b.cols && a.type() == b.type() && memcmp(a.data, b.data, a.total() * a.elemSize()) == 0;
+}
+
+int main()
+{
+	mt19937 rng(22);
+	int supported = KinectDetectSimd();
+	const float minDepth = 0.35f, maxDepth = 8.0f, threshold = 0.04f;
+	int sizes[][2] = { { 1, 1 }, { 1, 5 }, { 3, 3 }, { 7, 13 }, { 9, 17 }, { 50, 37 }, { 424, 512 } };
+	for (auto& s : sizes)
+	{
+		Mat depth = NoisyDepth(s[0], s[1], rng);
+		KinectSetSimdLevel(KINECT_SIMD_SCALAR);
+		Mat scalar;
+		CHECK(KinectDepthToFloat(depth, scalar, minDepth, maxDepth));
+		bool same = true;
+		for (int i = 0; i < depth.rows; i++)
+		{
+			for (int j = 0; j < depth.cols; j++)
+			{
+				float d = depth.at<unsigned short>(i, j) * 0.001f;
+				same = same && scalar.at<float>(i, j) == (d < minDepth || d > maxDepth ? 0 : d);
+			}
+		}
+		CHECK(same);
+
+		for (int width = 1; width <= KINECT_MAX_SMOOTHING_WIDTH; width++)
+		{
+			KinectSetSimdLevel(KINECT_SIMD_SCALAR);
+			Mat smoothed;
+			CHECK(KinectSmoothDepth(scalar, smoothed, width, threshold));
+			// Mean of the valid window pixels within the threshold of the centre,
+			// summed in the order of the kernels
+			same = true;
+			for (int i = 0; i < depth.rows; i++)
+			{
+				for (int j = 0; j < depth.cols; j++)
+				{
+					float c = scalar.at<float>(i, j), sum = 0, count = 0;
+					for (int y = i - width; y <= i + width; y++)
+					{
+						for (int x = j - width; x <= j + width; x++)
+						{
+							if (y < 0 || y >= depth.rows || x < 0 || x >= depth.cols) continue;
+							float n = scalar.at<float>(y, x);
+							if (n > 0 && fabsf(n - c) < threshold)
+							{
+								sum += n;
+								count += 1;
+							}
+						}
+					}
+					same = same && smoothed.at<float>(i, j) == (c > 0 ? sum / count : 0);
+				}
+			}
+			CHECK(same);
+
+			for (int level = KINECT_SIMD_SSSE3; level <= supported; level++)
+			{
+				KinectSetSimdLevel(level);
+				Mat simdFloat, simdSmoothed;
+				CHECK(KinectDepthToFloat(depth, simdFloat, minDepth, maxDepth));
+				CHECK(KinectSmoothDepth(simdFloat, simdSmoothed, width, threshold));
+				CHECK(Bitwise(simdFloat, scalar));
+				CHECK(Bitwise(simdSmoothed, smoothed));
+			}
+		}
+	}
+
+	// Invalid input
+	Mat out;
+	Mat depthFloat(4, 4, CV_32F, Scalar(1.0f));
+	CHECK(!KinectDepthToFloat(depthFloat, out, minDepth, maxDepth));
+	CHECK(!KinectSmoothDepth(Mat(4, 4, CV_16U), out));
+	CHECK(!KinectSmoothDepth(depthFloat, out, 0));
+	CHECK(!KinectSmoothDepth(depthFloat, out, KINECT_MAX_SMOOTHING_WIDTH + 1));
+	CHECK(!KinectSmoothDepth(depthFloat, out, 1, 0));
+	Mat inPlace = depthFloat;
+	CHECK(!KinectSmoothDepth(depthFloat, inPlace));
+
+	KinectSetSimdLevel(supported);
+	return TestResult();
+}
@@ -0,0 +1,88 @@
+#include "TestUtil.h"
+#include "KinectCpuFusion.h"
+#include "Scene.h"
+#include <thread>
+
+// Milliseconds to integrate one 512x424 frame into a 384^3 volume, the
+// KinectFusion default size, with one thread and with all of them; then
+// IntegrateFrames() against one IntegrateFrame() per source for 1, 2 and 4
+// sources on all threads. Poses are given, so only the depth preparation and
+// the passes over the volume are timed.
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	const int frames = 10;
+	vector<vector<unsigned short>> depth(frames, vector<unsigned short>(512 * 424));
+	vector<KinectPose> poses(frames);
+	for (int k = 0; k < frames; k++)
+	{
+		poses[k] = PoseRotY(0.01f * k - 0.05f, 0.01f * k - 0.05f, 0, 0);
+		RenderDepth(intrinsics, poses[k], depth[k].data());
+	}
+
+	int cores = max(1, (int)thread::hardware_concurrency());
+	int threads = getNumThreads();
+	for (int n : { 1, cores })
+	{
+		setNumThreads(n);
+		KinectCpuFusion fusion;
+		if (!fusion.init(intrinsics))
+		{
+			printf("FAILED: cannot allocate the volume\n");
+			return 1;
+		}
+		fusion.SetTracking(false);
+		double ms = 0;
+		for (int k = 0; k < frames; k++)
+		{
+			fusion.worldToCameraTransform[0] = poses[k];
+			ms += TimeMs(1, [&]() { fusion.ProcessDepth(depth[k].data()); });
+		}
+		printf("%2d threads: %.1f ms/frame\n", n, ms / frames);
+		if (cores == 1) break;
+	}
+
+	setNumThreads(cores);
+	const int sets = 4;
+	for (int sources : { 1, 2, 4 })
+	{
+		// Cameras side by side, each moving a little every set
+		vector<vector<Mat>> streams(sets, vector<Mat>(sources));
+		vector<vector<KinectPose>> truth(sets, vector<KinectPose>(sources));
+		for (int f = 0; f < sets; f++)
+		{
+			for (int s = 0; s < sources; s++)
+			{
+				float offset = s - (sources - 1) * 0.5f;
+				truth[f][s] = PoseRotY(0.08f * offset + 0.004f * f, 0.07f * offset + 0.003f * f, 0, 0);
+				streams[f][s].create(424, 512, CV_16U);
+				RenderDepth(intrinsics, truth[f][s], streams[f][s].ptr<unsigned short>());
+			}
+		}
+		KinectCpuFusion sequential(sources), batched(sources);
+		if (!sequential.init(intrinsics) || !batched.init(intrinsics))
+		{
+			printf("FAILED: cannot allocate the volumes\n");
+			return 1;
+		}
+		sequential.SetTracking(false);
+		batched.SetTracking(false);
+		double sequentialMs = 0, batchedMs = 0;
+		for (int f = 0; f < sets; f++)
+		{
+			for (int s = 0; s < sources; s++)
+				sequential.worldToCameraTransform[s] = batched.worldToCameraTransform[s] = truth[f][s];
+			sequentialMs += TimeMs(1, [&]()
+			{
+				for (int s = 0; s < sources; s++)
+					sequential.IntegrateFrame(streams[f][s].ptr<unsigned short>(), s);
+			});
+			batchedMs += TimeMs(1, [&]() { batched.IntegrateFrames(streams[f]); });
+		}
+		printf("%d sources, %d threads: sequential %.1f ms, batched %.1f ms per set (%.2fx)\n", sources, cores,
+			sequentialMs / sets, batchedMs / sets, sequentialMs / batchedMs);
+	}
+	setNumThreads(threads);
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include "TestUtil.h"
+#include "KinectCpuFusion.h"
+#include "Scene.h"
+
+// Frames of the synthetic scene rendered from known poses and integrated
+// without tracking must put the zero crossing of the volume on the surface
+
+static const KinectVoxel& Voxel(const KinectCpuFusion& fusion, int x, int y, int z)
+{
+	const KinectVoxel* block = fusion.Block(x / KINECT_BLOCK, y / KINECT_BLOCK, z / KINECT_BLOCK);
+	return block[((z % KINECT_BLOCK) * KINECT_BLOCK + y % KINECT_BLOCK) * KINECT_BLOCK + x % KINECT_BLOCK];
+}
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	// 2 m cube of 7.8 mm voxels, x and y from -1 to 1, z from 0 to 2
+	KinectVolumeParameters parameters = { 128, 256, 256, 256 };
+	KinectCpuFusion fusion(1, parameters);
+	CHECK(fusion.init(intrinsics));
+	CHECK(fusion.BlocksX() == 32 && fusion.BlocksY() == 32 && fusion.BlocksZ() == 32);
+	fusion.SetTracking(false);
+
+	vector<unsigned short> depth(512 * 424);
+	for (int k = 0; k < 10; k++)
+	{
+		KinectPose pose = PoseRotY(0.01f * k - 0.05f, 0.01f * k - 0.05f, 0, 0);
+		RenderDepth(intrinsics, pose, depth.data());
+		fusion.worldToCameraTransform[0] = pose;
+		unsigned int revision = fusion.Revision();
+		CHECK(fusion.ProcessDepth(depth.data()));
+		CHECK(fusion.Revision() != revision);
+	}
+
+	// Walk volume columns along +z and compare the first zero crossing with the
+	// analytic surface in front of the same world point, over the front of the
+	// large sphere where the columns are close to the viewing rays
+	float size = fusion.VoxelSize();
+	KinectPose volumeToWorld = fusion.VolumeToWorld();
+	double maxError = 0;
+	int checked = 0;
+	for (int x = 112; x <= 144; x += 2)
+	{
+		for (int y = 112; y <= 144; y += 2)
+		{
+			float previous = 0;
+			int previousZ = -1;
+			for (int z = 0; z < parameters.voxelCountZ; z++)
+			{
+				const KinectVoxel& voxel = Voxel(fusion, x, y, z);
+				if (voxel.weight == 0)
+				{
+					previousZ = -1;
+					continue;
+				}
+				float tsdf = voxel.tsdf / KINECT_TSDF_SCALE;
+				if (previousZ >= 0 && previous > 0 && tsdf <= 0)
+				{
+					float crossing = previousZ + previous / (previous - tsdf);
+					float p[3] = { x * size, y * size, crossing * size }, w[3];
+					KinectPoseTransform(volumeToWorld, p, w);
+					float origin[3] = { w[0], w[1], 0 }, direction[3] = { 0, 0, 1 };
+					maxError = max(maxError, (double)fabsf(SceneHit(origin, direction) - w[2]));
+					checked++;
+					break;
+				}
+				previous = tsdf;
+				previousZ = z;
+			}
+		}
+	}
+	printf("%d zero crossings, max error %.2f mm, voxel %.2f mm\n", checked, maxError * 1000, size * 1000);
+	CHECK(checked > 200);
+	CHECK(maxError < size);
+
+	// Frames that do not match the camera are rejected and leave the volume alone
+	unsigned int revision = fusion.Revision();
+	CHECK(!fusion.ProcessDepth(Mat(424, 511, CV_16U)));
+	CHECK(!fusion.ProcessDepth(Mat(424, 512, CV_32F)));
+	CHECK(!fusion.ProcessDepth(depth.data(), 1));
+	CHECK(!fusion.ProcessDepth((const unsigned short*)NULL));
+	CHECK(fusion.Revision() == revision);
+
+	// Reset empties the volume
+	CHECK(fusion.Reset());
+	bool empty = true;
+	for (int bz = 0; bz < fusion.BlocksZ(); bz++)
+		for (int by = 0; by < fusion.BlocksY(); by++)
+			for (int bx = 0; bx < fusion.BlocksX(); bx++)
+				empty = empty && fusion.BlockWeight(bx, by, bz) == 0;
+	CHECK(empty);
+
+	// Sizes that are not whole blocks are refused
+	KinectVolumeParameters odd = { 128, 100, 256, 256 };
+	KinectCpuFusion invalid(1, odd);
+	CHECK(!invalid.init(intrinsics));
+	return TestResult();
+}
@@ -0,0 +1,106 @@
+#include "TestUtil.h"
+#include "KinectIcp.h"
+#include "KinectCpuFusion.h"
+#include "Scene.h"
+
+// Point-to-plane ICP must recover known camera motions between rendered
+// frames of the synthetic scene, alone and as the tracking of the volume
+
+static float PoseError(const KinectPose& a, const KinectPose& b)
+{
+	float e = 0;
+	for (int k = 0; k < 12; k++)
+		e = max(e, fabsf(a.m[k] - b.m[k]));
+	return e;
+}
+
+static Mat RenderMetres(const KinectIntrinsics& intrinsics, const KinectPose& worldToCamera)
+{
+	vector<unsigned short> raw(intrinsics.width * intrinsics.height);
+	RenderDepth(intrinsics, worldToCamera, raw.data());
+	Mat depth(intrinsics.height, intrinsics.width, CV_32F);
+	for (size_t k = 0; k < raw.size(); k++)
+		depth.ptr<float>()[k] = raw[k] * 0.001f;
+	return depth;
+}
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	KinectIcp icp;
+	CHECK(icp.Init(intrinsics));
+
+	// Without a reference the pose is kept
+	KinectPose reference = KinectPoseIdentity();
+	Mat first = RenderMetres(intrinsics, reference);
+	KinectPose pose = PoseRotY(0.02f, 0.01f, 0, 0);
+	KinectPose kept = pose;
+	CHECK(!icp.HasReference());
+	icp.Align(first, pose);
+	CHECK(PoseError(pose, kept) == 0);
+
+	// Rotations up to 3.4 degrees and translations up to 5 cm in all three axes
+	for (int c = 0; c < 6; c++)
+	{
+		float sign = c % 2 ? 1.0f : -1.0f;
+		KinectPose truth = PoseRotY(0.01f * (c + 1) * sign, -0.008f * (c + 1) * sign, 0.004f * c, 0.01f * c);
+		Mat moved = RenderMetres(intrinsics, truth);
+		CHECK(icp.SetReference(first, reference));
+		KinectPose estimate = reference;
+		KinectIcpReport report;
+		CHECK(icp.Align(moved, estimate, &report));
+		float error = PoseError(estimate, truth);
+		printf("case %d: %d iterations, %d inliers, residual %.2f mm, pose error %.5f\n",
+			c, report.iterations, report.inliers, report.residual * 1000, error);
+		CHECK(error < 2e-3f);
+		CHECK(report.inliers > 10000 && report.residual < 2e-3f);
+		CHECK(icp.LastReport().iterations == report.iterations && icp.LastReport().residual == report.residual);
+	}
+
+	// Frames that do not match the camera are rejected
+	KinectPose untouched = reference;
+	CHECK(!icp.Align(Mat(424, 511, CV_32F), untouched));
+	CHECK(!icp.Align(Mat(424, 512, CV_16U), untouched));
+	CHECK(PoseError(untouched, reference) == 0);
+
+	// Tracking in the volume aligns every frame to the raycast surface, so
+	// sensor noise averages out where chaining frame to frame alignments adds
+	// it up. Half resolution frames keep the raycasts cheap.
+	KinectIntrinsics half = KinectNormalizedIntrinsics(256, 212, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	KinectVolumeParameters parameters = { 128, 256, 256, 256 };
+	KinectCpuFusion fusion(1, parameters);
+	CHECK(fusion.init(half));
+	KinectIcp chain;
+	CHECK(chain.Init(half));
+	KinectPose chained = KinectPoseIdentity();
+	vector<unsigned short> depth(256 * 212);
+	Mat metres(212, 256, CV_32F);
+	mt19937 rng(21);
+	normal_distribution<float> noise(0, 4);
+	const int frames = 20;
+	float modelError = 0, chainError = 0;
+	for (int k = 0; k < frames; k++)
+	{
+		KinectPose truth = PoseRotY(0.006f * k, 0.006f * k, 0.002f * k, 0);
+		RenderDepth(half, truth, depth.data());
+		for (size_t p = 0; p < depth.size(); p++)
+		{
+			if (depth[p]) depth[p] = (unsigned short)max(1.0f, depth[p] + noise(rng));
+			metres.ptr<float>()[p] = depth[p] * 0.001f;
+		}
+		CHECK(fusion.ProcessDepth(depth.data()));
+		chain.Align(metres, chained);
+		chain.KeepAsReference(chained);
+		if (k == 0) continue;
+		CHECK(fusion.TrackingReport().inliers > 2000);
+		modelError = max(modelError, PoseError(fusion.worldToCameraTransform[0], truth));
+		chainError = PoseError(chained, truth);
+	}
+	printf("%d noisy frames: frame to model error at most %.5f, frame to frame error %.5f at the end\n", frames, modelError, chainError);
+	CHECK(modelError < 3e-3f);
+	CHECK(chainError > 3 * modelError);
+
+	// Unknown sources have an empty report
+	CHECK(fusion.TrackingReport(1).iterations == 0 && fusion.TrackingReport(-1).inliers == 0);
+	return TestResult();
+}
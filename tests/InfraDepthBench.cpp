@@ -0,0 +1,44 @@
+#include "TestUtil.h"
+#include "KinectOpenCvTools.h"
+
+// Milliseconds per frame of InfraDepth2Mat and Mat2InfraDepth at each SIMD
+// level the CPU supports, single threaded at the 512x424 sensor size and
+// threaded at 1920x1080
+
+int main()
+{
+	mt19937 rng(13);
+	int supported = KinectDetectSimd();
+	const char* names[] = { "scalar", "SSSE3", "AVX2" };
+	int sizes[][2] = { { 424, 512 }, { 1080, 1920 } };
+	for (auto& s : sizes)
+	{
+		Mat infra(s[0], s[1], CV_16U), depth(s[0], s[1], CV_16U);
+		for (int i = 0; i < s[0]; i++)
+		{
+			for (int j = 0; j < s[1]; j++)
+			{
+				infra.at<unsigned short>(i, j) = (unsigned short)rng();
+				depth.at<unsigned short>(i, j) = (unsigned short)rng();
+			}
+		}
+		Mat combined = InfraDepth2Mat(infra, depth), outInfra, outDepth;
+		printf("%dx%d\n", s[1], s[0]);
+		double scalarForward = 0, scalarBackward = 0;
+		for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+		{
+			KinectSetSimdLevel(level);
+			double forward = TimeMs(200, [&]() { InfraDepth2Mat(infra, depth); });
+			double backward = TimeMs(200, [&]() { Mat2InfraDepth(combined, outInfra, outDepth); });
+			if (level == KINECT_SIMD_SCALAR)
+			{
+				scalarForward = forward;
+				scalarBackward = backward;
+			}
+			printf("  %-6s InfraDepth2Mat %.3f ms (%.1fx)  Mat2InfraDepth %.3f ms (%.1fx)\n", names[level],
+				forward, scalarForward / forward, backward, scalarBackward / backward);
+		}
+	}
+	KinectSetSimdLevel(supported);
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include "TestUtil.h"
+#include "KinectOpenCvTools.h"
+
+// InfraDepth2Mat and Mat2InfraDepth at every SIMD level the CPU supports must
+// give the same bytes as the scalar per-pixel definition, whatever the width
+
+static Mat ReferenceInfraDepth2Mat(const Mat& inframat, const Mat& depthmat)
+{
+	Mat result(inframat.size(), CV_8UC3);
+	for (int i = 0; i < inframat.rows; i++)
+	{
+		for (int j = 0; j < inframat.cols; j++)
+		{
+			unsigned char* px = result.ptr<unsigned char>(i) + 3 * j;
+			px[0] = (unsigned char)(inframat.at<unsigned short>(i, j) / 256);
+			px[1] = (unsigned char)(depthmat.at<unsigned short>(i, j) / 256 * 50);
+			px[2] = (unsigned char)(depthmat.at<unsigned short>(i, j) % 256);
+		}
+	}
+	return result;
+}
+
+static void ReferenceMat2InfraDepth(const Mat& source, Mat& inframat, Mat& depthmat)
+{
+	inframat = Mat(source.size(), CV_16U);
+	depthmat = Mat(source.size(), CV_16U);
+	for (int i = 0; i < source.rows; i++)
+	{
+		for (int j = 0; j < source.cols; j++)
+		{
+			const unsigned char* px = source.ptr<unsigned char>(i) + 3 * j;
+			inframat.at<unsigned short>(i, j) = (unsigned short)(px[0] * 256);
+			depthmat.at<unsigned short>(i, j) = (unsigned short)(px[1] * 256 + px[2]);
+		}
+	}
+}
+
+static Mat RandomMat(int rows, int cols, int type, mt19937& rng)
+{
+	Mat m(rows, cols, type);
+	for (int i = 0; i < rows; i++)
+	{
+		unsigned char* row = m.ptr<unsigned char>(i);
+		for (size_t k = 0; k < cols * m.elemSize(); k++)
+			row[k] = (unsigned char)rng();
+	}
+	return m;
+}
+
+int main()
+{
+	mt19937 rng(13);
+	int supported = KinectDetectSimd();
+	printf("SIMD levels 0 to %d\n", supported);
+
+	// Widths below, at and around the 16 and 32 pixel vector steps, the sensor
+	// size, and an image large enough to be split across threads
+	int sizes[][2] = { { 1, 1 }, { 1, 7 }, { 2, 15 }, { 1, 16 }, { 3, 17 }, { 2, 31 }, { 1, 32 }, { 5, 33 },
+		{ 7, 47 }, { 3, 63 }, { 2, 65 }, { 424, 512 }, { 541, 961 } };
+	for (auto& s : sizes)
+	{
+		Mat infra = RandomMat(s[0], s[1], CV_16U, rng), depth = RandomMat(s[0], s[1], CV_16U, rng);
+		Mat combined = RandomMat(s[0], s[1], CV_8UC3, rng);
+		Mat expected = ReferenceInfraDepth2Mat(infra, depth);
+		Mat expectedInfra, expectedDepth;
+		ReferenceMat2InfraDepth(combined, expectedInfra, expectedDepth);
+		for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+		{
+			KinectSetSimdLevel(level);
+			CHECK(KinectSimdLevel() == level);
+			CHECK(SameMat(InfraDepth2Mat(infra, depth), expected));
+			Mat outInfra, outDepth;
+			Mat2InfraDepth(combined, outInfra, outDepth);
+			CHECK(SameMat(outInfra, expectedInfra));
+			CHECK(SameMat(outDepth, expectedDepth));
+		}
+	}
+
+	// Rows that do not start on a vector boundary: views into larger images
+	Mat infra = RandomMat(40, 100, CV_16U, rng), depth = RandomMat(40, 100, CV_16U, rng);
+	Mat combined = RandomMat(40, 100, CV_8UC3, rng);
+	Rect roi(3, 5, 71, 29);
+	Mat expected = ReferenceInfraDepth2Mat(infra(roi), depth(roi));
+	Mat expectedInfra, expectedDepth;
+	ReferenceMat2InfraDepth(combined(roi), expectedInfra, expectedDepth);
+	for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+	{
+		KinectSetSimdLevel(level);
+		CHECK(SameMat(InfraDepth2Mat(infra(roi), depth(roi)), expected));
+		Mat outInfra, outDepth;
+		Mat2InfraDepth(combined(roi), outInfra, outDepth);
+		CHECK(SameMat(outInfra, expectedInfra));
+		CHECK(SameMat(outDepth, expectedDepth));
+	}
+
+	// Mismatched inputs
+	CHECK(InfraDepth2Mat(infra, depth(roi)).empty());
+	CHECK(InfraDepth2Mat(combined, combined).empty());
+	Mat outInfra, outDepth;
+	Mat2InfraDepth(infra, outInfra, outDepth);
+	CHECK(outInfra.size() == infra.size() && norm(outInfra, NORM_INF) == 0 && norm(outDepth, NORM_INF) == 0);
+
+	KinectSetSimdLevel(supported);
+	return TestResult();
+}
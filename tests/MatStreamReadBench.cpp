@@ -0,0 +1,98 @@
+#include "TestUtil.h"
+#include "MatStream.h"
+#include <atomic>
+#include <new>
+
+// Allocations and time per frame of Read() against Read(Mat&) into a reused Mat,
+// for raw and DEPTH16 files opened as stream and as mapping. Allocations are
+// counted as operator new calls plus frames that landed in a different buffer
+// than the previous one. Fails unless Read(Mat&) settles at zero.
+
+static atomic<long long> allocations(0);
+
+void* operator new(size_t size)
+{
+	allocations++;
+	void* p = malloc(size ? size : 1);
+	if (p == NULL) throw bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+struct ReadCost
+{
+	double allocations;
+	double ms;
+};
+
+template <class ReadFrame>
+static ReadCost Measure(const char* file, MatStream::Op op, const ReadFrame& read)
+{
+	MatStream in;
+	in.Open(file, op);
+	long long frames = in.FrameNum();
+	Mat frame;
+	// First frame sizes the Mat, the rest should reuse it
+	read(in, frame);
+	const unsigned char* last = frame.data;
+	long long before = allocations;
+	long long moved = 0;
+	auto begin = chrono::steady_clock::now();
+	for (long long k = 1; k < frames; k++)
+	{
+		read(in, frame);
+		if (frame.data != last) moved++;
+		last = frame.data;
+	}
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+	ReadCost cost = { (double)(allocations - before + moved) / (frames - 1), ms / (frames - 1) };
+	in.Close();
+	return cost;
+}
+
+int main()
+{
+	const int frames = 120;
+	const char* names[] = { "raw", "DEPTH16" };
+	const char* files[] = { "MatStreamReadBench.raw.ms", "MatStreamReadBench.depth.ms" };
+	for (int codec = 0; codec < 2; codec++)
+	{
+		MatStreamHeader head = { 424, 512, 1, 2, CV_16U, 0 };
+		MatStream out;
+		out.SetHead(head);
+		out.SetCodec(codec ? MATSTREAM_DEPTH16 : MATSTREAM_RAW);
+		out.Open(files[codec], MatStream::out);
+		for (int k = 0; k < frames; k++)
+			out.Write(SyntheticDepth(424, 512, k));
+		out.Close();
+	}
+
+	bool ok = true;
+	printf("%d frames of 512x424, allocations and ms per frame\n", frames);
+	printf("%-8s %-7s %22s %22s\n", "codec", "open", "Read()", "Read(Mat&)");
+	for (int codec = 0; codec < 2; codec++)
+	{
+		for (int mapped = 0; mapped < 2; mapped++)
+		{
+			MatStream::Op op = mapped ? MatStream::mapped : MatStream::in;
+			ReadCost fresh = Measure(files[codec], op, [](MatStream& in, Mat& frame) { frame = in.Read(); });
+			ReadCost reused = Measure(files[codec], op, [](MatStream& in, Mat& frame) { in.Read(frame); });
+			printf("%-8s %-7s %10.2f %8.3f ms %10.2f %8.3f ms\n", names[codec], mapped ? "mapped" : "stream",
+				fresh.allocations, fresh.ms, reused.allocations, reused.ms);
+			ok = ok && reused.allocations == 0;
+		}
+	}
+	for (int codec = 0; codec < 2; codec++)
+		remove(files[codec]);
+	printf(ok ? "Read(Mat&) does not allocate\n" : "FAILED: Read(Mat&) allocates\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+#include "TestUtil.h"
+#include "MatStream.h"
+
+// Segmented asynchronous writes and reading them back as one stream, and
+// reading into caller-owned Mats
+
+static Mat Frame(int k)
+{
+	Mat frame(48, 64, CV_16U);
+	for (int i = 0; i < frame.rows; i++)
+	{
+		for (int j = 0; j < frame.cols; j++)
+			frame.at<unsigned short>(i, j) = (unsigned short)(k * 1000 + i * frame.cols + j);
+	}
+	return frame;
+}
+
+int main()
+{
+	// SegmentNum() is polled while the writer thread rolls over
+	{
+		MatStreamHeader head = { 48, 64, 1, 2, CV_16U, 0 };
+		MatStream out;
+		out.SetHead(head);
+		out.SetSegments(0, 5);
+		out.Open("MatStreamTest.ms", MatStream::out);
+		CHECK(!out.Fail());
+		int seen = 1;
+		for (int k = 0; k < 23; k++)
+		{
+			CHECK(out.Write(Frame(k)));
+			int num = out.SegmentNum();
+			CHECK(num >= seen && num <= 5);
+			seen = num;
+		}
+		out.Close();
+		CHECK(out.SegmentNum() == 5);
+	}
+	{
+		MatStream in;
+		in.Open("MatStreamTest.ms", MatStream::in);
+		CHECK(!in.Fail());
+		CHECK(in.SegmentNum() == 5);
+		CHECK(in.FrameNum() == 23);
+		Mat frame;
+		for (int k = 0; k < 23; k++)
+		{
+			CHECK(in.Read(frame));
+			CHECK(SameMat(frame, Frame(k)));
+		}
+		CHECK(!in.Read(frame));
+		CHECK(SameMat(in.ReadAt(12), Frame(12)));
+		in.Close();
+	}
+	for (int k = 0; k < 5; k++)
+		remove(MatStream::SegmentName("MatStreamTest.ms", k).c_str());
+
+	// Reading into a caller-owned Mat reuses it, even when it is a frame
+	// previously returned straight out of the read-only mapping
+	{
+		MatStreamHeader head = { 48, 64, 1, 2, CV_16U, 0 };
+		MatStream out;
+		out.SetHead(head);
+		out.Open("MatStreamTest.ms", MatStream::out);
+		for (int k = 0; k < 6; k++)
+			out.Write(Frame(k));
+		out.Close();
+	}
+	for (int mapped = 0; mapped < 2; mapped++)
+	{
+		MatStream in;
+		in.Open("MatStreamTest.ms", mapped ? MatStream::mapped : MatStream::in);
+		Mat frame;
+		CHECK(in.Read(frame));
+		const unsigned char* reused = frame.data;
+		CHECK(in.Read(frame));
+		CHECK(frame.data == reused);
+		CHECK(SameMat(frame, Frame(1)));
+		frame = in.Read();
+		CHECK(SameMat(frame, Frame(2)));
+		CHECK(in.Read(frame));
+		CHECK(SameMat(frame, Frame(3)));
+		Mat view = in.ReadAt(1);
+		frame = view;
+		CHECK(in.Read(frame));
+		CHECK(SameMat(frame, Frame(2)));
+		if (mapped) CHECK(SameMat(view, Frame(1)));
+		in.Close();
+	}
+	remove("MatStreamTest.ms");
+	return TestResult();
+}
@@ -0,0 +1,50 @@
+#include "TestUtil.h"
+#include "KinectMesh.h"
+#include "Scene.h"
+#include <thread>
+
+// Milliseconds to extract a sphere and a box filled into the default 384^3
+// volume and write them to binary PLY, from one thread up to every core
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	KinectCpuFusion fusion;
+	if (!fusion.init(intrinsics))
+	{
+		printf("FAILED: cannot allocate the volume\n");
+		return 1;
+	}
+	const float center[3] = { 0, 0, 0.75f }, halfSize[3] = { 0.4f, 0.3f, 0.5f };
+	const char* names[] = { "sphere", "box" };
+	function<float(const float p[3])> shapes[] =
+	{
+		[&](const float p[3]) { return SphereDistance(p, center, 0.5f); },
+		[&](const float p[3]) { return BoxDistance(p, center, halfSize); }
+	};
+	int cores = max(1, (int)thread::hardware_concurrency());
+	int threads = getNumThreads();
+	for (int s = 0; s < 2; s++)
+	{
+		fusion.FillVolume(shapes[s]);
+		double single = 0;
+		for (int n = 1; n <= cores; n = n < cores && n * 2 > cores ? cores : n * 2)
+		{
+			setNumThreads(n);
+			KinectMeshReport report;
+			double ms = TimeMs(3, [&]()
+			{
+				KinectMeshWriter writer;
+				writer.Open("MeshBench.ply");
+				KinectMeshExtractor().Extract(fusion, writer, &report);
+				writer.Close();
+			});
+			if (n == 1) single = ms;
+			printf("%-6s %2d threads: %.1f ms (%.1fx), %lld triangles, %d/%d blocks\n", names[s], n, ms, single / ms,
+				report.triangles, report.blocksExtracted, report.blocks);
+		}
+	}
+	remove("MeshBench.ply");
+	setNumThreads(threads);
+	return 0;
+}
@@ -0,0 +1,177 @@
+#include "TestUtil.h"
+#include "KinectMesh.h"
+#include "Scene.h"
+#include <fstream>
+#include <map>
+#include <tuple>
+
+// Meshes of a sphere and a box filled into the volume, read back from the
+// PLY file: vertices on the surface, triangles facing out, and closed once
+// the vertices the blocks share are welded
+
+struct PlyMesh
+{
+	vector<float> vertices;
+	vector<int> triangles;
+	bool ok;
+};
+
+static PlyMesh ReadPly(const char* filename)
+{
+	PlyMesh mesh = { {}, {}, false };
+	ifstream in(filename, ios::binary);
+	string line;
+	long long vertexCount = -1, faceCount = -1;
+	while (getline(in, line) && line != "end_header")
+	{
+		if (line.compare(0, 15, "element vertex ") == 0) vertexCount = atoll(line.c_str() + 15);
+		if (line.compare(0, 13, "element face ") == 0) faceCount = atoll(line.c_str() + 13);
+	}
+	if (!in || vertexCount < 0 || faceCount < 0) return mesh;
+	mesh.vertices.resize(vertexCount * 3);
+	mesh.triangles.resize(faceCount * 3);
+	in.read((char*)mesh.vertices.data(), vertexCount * 12);
+	bool triangles = true;
+	for (long long f = 0; f < faceCount; f++)
+	{
+		unsigned char n = 0;
+		in.read((char*)&n, 1);
+		in.read((char*)&mesh.triangles[f * 3], 12);
+		triangles = triangles && n == 3;
+	}
+	// Nothing may follow the faces
+	mesh.ok = in && triangles && in.peek() == EOF;
+	return mesh;
+}
+
+// Every directed edge of the welded, non-degenerate triangles must appear
+// once and its reverse once: each edge has two consistently wound triangles
+static bool Watertight(const PlyMesh& mesh, long long& welded)
+{
+	map<tuple<long long, long long, long long>, int> ids;
+	vector<int> id(mesh.vertices.size() / 3);
+	for (size_t v = 0; v < id.size(); v++)
+	{
+		const float* p = &mesh.vertices[v * 3];
+		auto key = make_tuple(llround(p[0] * 1e5), llround(p[1] * 1e5), llround(p[2] * 1e5));
+		auto it = ids.insert(make_pair(key, (int)ids.size())).first;
+		id[v] = it->second;
+	}
+	welded = ids.size();
+	map<pair<int, int>, int> edges;
+	for (size_t t = 0; t < mesh.triangles.size(); t += 3)
+	{
+		int a = id[mesh.triangles[t]], b = id[mesh.triangles[t + 1]], c = id[mesh.triangles[t + 2]];
+		if (a == b || b == c || a == c) continue;
+		edges[make_pair(a, b)]++;
+		edges[make_pair(b, c)]++;
+		edges[make_pair(c, a)]++;
+	}
+	for (auto& e : edges)
+	{
+		auto reverse = edges.find(make_pair(e.first.second, e.first.first));
+		if (e.second != 1 || reverse == edges.end() || reverse->second != 1)
+			return false;
+	}
+	return !edges.empty();
+}
+
+static void CheckShape(const char* name, KinectCpuFusion& fusion, const function<float(const float p[3])>& distance, const float center[3])
+{
+	CHECK(fusion.FillVolume(distance));
+	long long vertices = -1, triangles = -1;
+	for (int threads : { 1, 4 })
+	{
+		setNumThreads(threads);
+		KinectMeshWriter writer;
+		CHECK(writer.Open("MeshTest.ply"));
+		KinectMeshExtractor extractor(256);
+		KinectMeshReport report;
+		CHECK(extractor.Extract(fusion, writer, &report));
+		CHECK(writer.Close());
+		// The same mesh whatever the number of threads
+		if (vertices >= 0) CHECK(report.vertices == vertices && report.triangles == triangles);
+		vertices = report.vertices;
+		triangles = report.triangles;
+
+		PlyMesh mesh = ReadPly("MeshTest.ply");
+		CHECK(mesh.ok);
+		CHECK((long long)mesh.vertices.size() == report.vertices * 3 && (long long)mesh.triangles.size() == report.triangles * 3);
+		double maxDistance = 0;
+		for (size_t v = 0; v < mesh.vertices.size(); v += 3)
+			maxDistance = max(maxDistance, (double)fabsf(distance(&mesh.vertices[v])));
+		int outward = 0;
+		for (size_t t = 0; t < mesh.triangles.size(); t += 3)
+		{
+			const float* a = &mesh.vertices[mesh.triangles[t] * 3];
+			const float* b = &mesh.vertices[mesh.triangles[t + 1] * 3];
+			const float* c = &mesh.vertices[mesh.triangles[t + 2] * 3];
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float m[3] = { (a[0] + b[0] + c[0]) / 3 - center[0], (a[1] + b[1] + c[1]) / 3 - center[1], (a[2] + b[2] + c[2]) / 3 - center[2] };
+			outward += n[0] * m[0] + n[1] * m[1] + n[2] * m[2] > 0;
+		}
+		long long welded = 0;
+		bool closed = Watertight(mesh, welded);
+		printf("%s, %d threads: %lld vertices (%lld welded), %lld triangles, %d/%d blocks, max distance %.2f mm, %.1f%% outward, %s\n",
+			name, threads, report.vertices, welded, report.triangles, report.blocksExtracted, report.blocks,
+			maxDistance * 1000, 100.0 * outward / report.triangles, closed ? "closed" : "OPEN");
+		CHECK(report.triangles > 1000);
+		CHECK(maxDistance < 0.25 * fusion.VoxelSize());
+		CHECK(outward >= 0.99 * report.triangles);
+		CHECK(closed);
+	}
+	remove("MeshTest.ply");
+}
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	// 1 m cube of 3.9 mm voxels, x and y from -0.5 to 0.5, z from 0 to 1
+	KinectVolumeParameters parameters = { 256, 256, 256, 256 };
+	KinectCpuFusion fusion(1, parameters);
+	CHECK(fusion.init(intrinsics));
+
+	const float center[3] = { 0, 0, 0.5f }, halfSize[3] = { 0.3f, 0.2f, 0.35f };
+	CheckShape("sphere", fusion, [&](const float p[3]) { return SphereDistance(p, center, 0.3f); }, center);
+	CheckShape("box", fusion, [&](const float p[3]) { return BoxDistance(p, center, halfSize); }, center);
+
+	// A plane across the whole volume ends at the last samples: the cells at
+	// the far faces have corners past the volume and are left out, so every
+	// one of the 255 x 255 cells in between has two triangles
+	float plane = 0.5f + 0.3f * fusion.VoxelSize();
+	CHECK(fusion.FillVolume([&](const float p[3]) { return plane - p[2]; }));
+	KinectMeshWriter across;
+	CHECK(across.Open("MeshTest.ply"));
+	KinectMeshReport planeReport;
+	CHECK(KinectMeshExtractor().Extract(fusion, across, &planeReport));
+	CHECK(across.Close());
+	PlyMesh planeMesh = ReadPly("MeshTest.ply");
+	CHECK(planeMesh.ok && planeReport.triangles == 2 * 255 * 255);
+	bool flat = true;
+	for (size_t v = 0; v < planeMesh.vertices.size(); v += 3)
+		flat = flat && fabsf(planeMesh.vertices[v + 2] - plane) < 1e-4f;
+	CHECK(flat);
+	remove("MeshTest.ply");
+
+	// OBJ has the same counts
+	KinectMeshWriter obj;
+	CHECK(obj.Open("MeshTest.obj", KINECT_MESH_OBJ));
+	KinectMeshReport report;
+	CHECK(KinectMeshExtractor().Extract(fusion, obj, &report));
+	CHECK(obj.Close());
+	CHECK(obj.Vertices() == report.vertices && obj.Triangles() == report.triangles);
+	remove("MeshTest.obj");
+
+	// An uninitialized volume or a closed writer fail
+	KinectMeshWriter closed;
+	CHECK(!KinectMeshExtractor().Extract(fusion, closed));
+	KinectMeshWriter unused;
+	CHECK(unused.Open("MeshTest.ply"));
+	CHECK(!KinectMeshExtractor().Extract(KinectCpuFusion(), unused));
+	unused.Close();
+	remove("MeshTest.ply");
+
+	setNumThreads(1);
+	return TestResult();
+}
@@ -0,0 +1,107 @@
+#include "TestUtil.h"
+#include "KinectCpuFusion.h"
+#include "Scene.h"
+
+// Replaying recorded frames of several cameras through IntegrateFrames()
+// must leave the same volume as IntegrateFrame() per source at known poses,
+// and track every camera when the poses are left to the volume
+
+static void Render(const KinectIntrinsics& intrinsics, int sources, int frames, vector<vector<Mat>>& streams, vector<vector<KinectPose>>& truth)
+{
+	// Three cameras side by side, each moving a little every frame
+	streams.assign(frames, vector<Mat>(sources));
+	truth.assign(frames, vector<KinectPose>(sources));
+	for (int f = 0; f < frames; f++)
+	{
+		for (int s = 0; s < sources; s++)
+		{
+			truth[f][s] = PoseRotY(0.12f * (s - 1) + 0.004f * f, 0.1f * (s - 1) + 0.003f * f, 0.002f * f, 0.005f * f);
+			streams[f][s].create(intrinsics.height, intrinsics.width, CV_16U);
+			RenderDepth(intrinsics, truth[f][s], streams[f][s].ptr<unsigned short>());
+		}
+	}
+}
+
+static float PoseError(const KinectPose& a, const KinectPose& b)
+{
+	float e = 0;
+	for (int k = 0; k < 12; k++)
+		e = max(e, fabsf(a.m[k] - b.m[k]));
+	return e;
+}
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	// 2 m cube of 7.8 mm voxels, x and y from -1 to 1, z from 0 to 2
+	KinectVolumeParameters parameters = { 128, 256, 256, 256 };
+	const int sources = 3, frames = 6;
+	vector<vector<Mat>> streams;
+	vector<vector<KinectPose>> truth;
+	Render(intrinsics, sources, frames, streams, truth);
+
+	// At known poses the batch folds the frames in source order, like one call per source
+	KinectCpuFusion sequential(sources, parameters), batched(sources, parameters);
+	CHECK(sequential.init(intrinsics) && batched.init(intrinsics));
+	sequential.SetTracking(false);
+	batched.SetTracking(false);
+	double sequentialMs = 0, batchedMs = 0;
+	for (int f = 0; f < frames; f++)
+	{
+		for (int s = 0; s < sources; s++)
+			sequential.worldToCameraTransform[s] = batched.worldToCameraTransform[s] = truth[f][s];
+		sequentialMs += TimeMs(1, [&]()
+		{
+			for (int s = 0; s < sources; s++)
+				CHECK(sequential.IntegrateFrame(streams[f][s].ptr<unsigned short>(), s));
+		});
+		vector<bool> integrated;
+		batchedMs += TimeMs(1, [&]() { CHECK(batched.IntegrateFrames(streams[f], &integrated) == sources); });
+		CHECK(integrated == vector<bool>(sources, true));
+	}
+	size_t bytes = (size_t)batched.BlocksX() * batched.BlocksY() * batched.BlocksZ() * KINECT_BLOCK_VOXELS * sizeof(KinectVoxel);
+	bool same = memcmp(sequential.Block(0, 0, 0), batched.Block(0, 0, 0), bytes) == 0;
+	printf("%d sources x %d frames: sequential %.1f ms, batched %.1f ms per set; volumes %s\n",
+		sources, frames, sequentialMs / frames, batchedMs / frames, same ? "identical" : "DIFFERENT");
+	CHECK(same);
+
+	// Sources without a frame and frames of the wrong size are left out
+	unsigned int revision = batched.Revision();
+	vector<Mat> partial(sources);
+	partial[1] = streams[frames - 1][1];
+	partial[2] = Mat(10, 10, CV_16U);
+	vector<bool> integrated;
+	CHECK(batched.IntegrateFrames(partial, &integrated) == 1);
+	CHECK(integrated.size() == sources && !integrated[0] && integrated[1] && !integrated[2]);
+	CHECK(batched.Revision() != revision);
+	vector<const unsigned short*> none(sources, NULL);
+	revision = batched.Revision();
+	CHECK(batched.IntegrateFrames(none, &integrated) == 0);
+	CHECK(batched.Revision() == revision);
+
+	// Tracked, every source aligns to the surface before the batch is folded
+	// in, where one call per source already sees the frames of the sources
+	// before it. Both must follow the cameras. Half resolution frames keep
+	// the raycasts cheap.
+	KinectIntrinsics half = KinectNormalizedIntrinsics(256, 212, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	Render(half, sources, frames, streams, truth);
+	KinectCpuFusion trackedSequential(sources, parameters), trackedBatched(sources, parameters);
+	CHECK(trackedSequential.init(half) && trackedBatched.init(half));
+	for (int s = 0; s < sources; s++)
+		trackedSequential.worldToCameraTransform[s] = trackedBatched.worldToCameraTransform[s] = truth[0][s];
+	for (int f = 0; f < frames; f++)
+	{
+		for (int s = 0; s < sources; s++)
+			CHECK(trackedSequential.IntegrateFrame(streams[f][s].ptr<unsigned short>(), s));
+		CHECK(trackedBatched.IntegrateFrames(streams[f]) == sources);
+	}
+	float sequentialError = 0, batchedError = 0;
+	for (int s = 0; s < sources; s++)
+	{
+		sequentialError = max(sequentialError, PoseError(trackedSequential.worldToCameraTransform[s], truth[frames - 1][s]));
+		batchedError = max(batchedError, PoseError(trackedBatched.worldToCameraTransform[s], truth[frames - 1][s]));
+	}
+	printf("tracked: sequential pose error %.5f, batched pose error %.5f\n", sequentialError, batchedError);
+	CHECK(sequentialError < 3e-3f && batchedError < 3e-3f);
+	return TestResult();
+}
@@ -0,0 +1,129 @@
+#include "TestUtil.h"
+#include "KinectOpenCvTools.h"
+#include "MatStream.h"
+
+// Size and speed of storing infrared and depth as InfraDepth2Packed frames
+// through PNG, against two raw MatStream files, over a synthetic 512x424
+// sequence. Every way is checked to read back what was written.
+
+// Infrared falling off with the square of depth over a textured scene
+static Mat SyntheticInfrared(const Mat& depth, int frame)
+{
+	mt19937 rng(frame + 101);
+	normal_distribution<float> noise(0, 1);
+	Mat infra(depth.size(), CV_16U);
+	for (int i = 0; i < depth.rows; i++)
+	{
+		for (int j = 0; j < depth.cols; j++)
+		{
+			int d = depth.at<unsigned short>(i, j);
+			float texture = 1 + 0.2f * (((i + frame) / 12 + j / 12) % 3);
+			float ir = d == 0 ? 0 : 4e9f * texture / ((float)d * d) + 40 * noise(rng);
+			infra.at<unsigned short>(i, j) = (unsigned short)min(max(ir, 0.0f), 65535.0f);
+		}
+	}
+	return infra;
+}
+
+static long long FileSize(const string& name)
+{
+	ifstream f(name, ios::binary | ios::ate);
+	return f ? (long long)f.tellg() : 0;
+}
+
+int main()
+{
+	const int frames = 60;
+	vector<Mat> infra, depth;
+	for (int k = 0; k < frames; k++)
+	{
+		depth.push_back(SyntheticDepth(424, 512, k));
+		infra.push_back(SyntheticInfrared(depth.back(), k));
+	}
+	bool ok = true;
+	printf("%d frames of 512x424 infrared + depth\n", frames);
+	printf("%-22s %12s %10s %10s\n", "", "bytes/frame", "write ms", "read ms");
+
+	// Raw MatStream, one file per stream
+	{
+		MatStreamHeader head = { 424, 512, 1, 2, CV_16U, 0 };
+		MatStream infraOut, depthOut;
+		infraOut.SetHead(head);
+		depthOut.SetHead(head);
+		double writeMs = TimeMs(1, [&]()
+		{
+			infraOut.Open("PackedBench.infra.ms", MatStream::out);
+			depthOut.Open("PackedBench.depth.ms", MatStream::out);
+			for (int k = 0; k < frames; k++)
+			{
+				infraOut.Write(infra[k]);
+				depthOut.Write(depth[k]);
+			}
+			infraOut.Close();
+			depthOut.Close();
+		}) / frames;
+		MatStream infraIn, depthIn;
+		Mat ir, d;
+		bool same = true;
+		double readMs = TimeMs(1, [&]()
+		{
+			infraIn.Open("PackedBench.infra.ms", MatStream::in);
+			depthIn.Open("PackedBench.depth.ms", MatStream::in);
+			for (int k = 0; k < frames; k++)
+			{
+				same = infraIn.Read(ir) && depthIn.Read(d) && same;
+				same = same && SameMat(ir, infra[k]) && SameMat(d, depth[k]);
+			}
+			infraIn.Close();
+			depthIn.Close();
+		}) / frames;
+		long long bytes = FileSize("PackedBench.infra.ms") + FileSize("PackedBench.depth.ms");
+		printf("%-22s %12lld %10.3f %10.3f%s\n", "raw MatStream", bytes / frames, writeMs, readMs, same ? "" : "  MISMATCH");
+		ok = ok && same;
+		remove("PackedBench.infra.ms");
+		remove("PackedBench.depth.ms");
+	}
+
+	// Packed frames alone, then through PNG
+	for (int alpha = 1; alpha >= 0; alpha--)
+	{
+		vector<Mat> packed(frames);
+		double packMs = TimeMs(1, [&]()
+		{
+			for (int k = 0; k < frames; k++)
+				packed[k] = InfraDepth2Packed(infra[k], depth[k], alpha != 0);
+		}) / frames;
+		Mat ir, d;
+		double unpackMs = TimeMs(1, [&]()
+		{
+			for (int k = 0; k < frames; k++)
+				Packed2InfraDepth(packed[k], ir, d);
+		}) / frames;
+		printf("%-22s %12d %10.3f %10.3f\n", alpha ? "packed 8UC4" : "packed 8UC3",
+			(int)(packed[0].total() * packed[0].elemSize()), packMs, unpackMs);
+
+		vector<vector<unsigned char>> png(frames);
+		double encodeMs = TimeMs(1, [&]()
+		{
+			for (int k = 0; k < frames; k++)
+				imencode(".png", packed[k], png[k]);
+		}) / frames;
+		bool same = true;
+		double decodeMs = TimeMs(1, [&]()
+		{
+			for (int k = 0; k < frames; k++)
+			{
+				same = Packed2InfraDepth(imdecode(png[k], IMREAD_UNCHANGED), ir, d) && same;
+				same = same && SameMat(d, depth[k]) && (alpha ? SameMat(ir, infra[k]) : norm(ir, infra[k], NORM_INF) <= 128);
+			}
+		}) / frames;
+		size_t bytes = 0;
+		for (int k = 0; k < frames; k++)
+			bytes += png[k].size();
+		printf("%-22s %12d %10.3f %10.3f%s\n", alpha ? "packed 8UC4 + PNG" : "packed 8UC3 + PNG",
+			(int)(bytes / frames), packMs + encodeMs, decodeMs + unpackMs, same ? "" : "  MISMATCH");
+		ok = ok && same;
+	}
+	printf(ok ? "all read back\n" : "FAILED: frames did not read back\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include "TestUtil.h"
+#include "KinectOpenCvTools.h"
+
+// InfraDepth2Packed and Packed2InfraDepth round trips at every SIMD level:
+// bit exact with alpha, exact depth and infrared within 128 without
+
+static Mat RandomMat(int rows, int cols, mt19937& rng)
+{
+	Mat m(rows, cols, CV_16U);
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+			m.at<unsigned short>(i, j) = (unsigned short)rng();
+	}
+	return m;
+}
+
+// The documented layout, B G R A = infrared high, depth high, depth low, infrared low
+static bool PackedLayout(const Mat& packed, const Mat& infra, const Mat& depth)
+{
+	int channels = packed.channels();
+	for (int i = 0; i < packed.rows; i++)
+	{
+		for (int j = 0; j < packed.cols; j++)
+		{
+			const unsigned char* px = packed.ptr<unsigned char>(i) + channels * j;
+			unsigned short ir = infra.at<unsigned short>(i, j), d = depth.at<unsigned short>(i, j);
+			if (px[0] != ir >> 8 || px[1] != d >> 8 || px[2] != (d & 0xFF)) return false;
+			if (channels == 4 && px[3] != (ir & 0xFF)) return false;
+		}
+	}
+	return true;
+}
+
+int main()
+{
+	mt19937 rng(15);
+	int supported = KinectDetectSimd();
+	int sizes[][2] = { { 1, 1 }, { 1, 7 }, { 2, 15 }, { 1, 16 }, { 3, 17 }, { 2, 31 }, { 1, 32 }, { 5, 33 },
+		{ 7, 47 }, { 3, 63 }, { 2, 65 }, { 424, 512 }, { 541, 961 } };
+	for (auto& s : sizes)
+	{
+		Mat infra = RandomMat(s[0], s[1], rng), depth = RandomMat(s[0], s[1], rng);
+		for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+		{
+			KinectSetSimdLevel(level);
+			Mat packed = InfraDepth2Packed(infra, depth);
+			Mat packed3 = InfraDepth2Packed(infra, depth, false);
+			CHECK(packed.type() == CV_8UC4 && packed3.type() == CV_8UC3);
+			CHECK(PackedLayout(packed, infra, depth));
+			CHECK(PackedLayout(packed3, infra, depth));
+
+			Mat outInfra, outDepth;
+			CHECK(Packed2InfraDepth(packed, outInfra, outDepth));
+			CHECK(SameMat(outInfra, infra));
+			CHECK(SameMat(outDepth, depth));
+			CHECK(Packed2InfraDepth(packed3, outInfra, outDepth));
+			CHECK(SameMat(outDepth, depth));
+			CHECK(norm(outInfra, infra, NORM_INF) <= 128);
+		}
+	}
+
+	// Views whose rows are not vector aligned, and output Mats that are reused
+	Mat infra = RandomMat(40, 100, rng), depth = RandomMat(40, 100, rng);
+	Rect roi(3, 5, 71, 29);
+	Mat outInfra(29, 71, CV_16U), outDepth(29, 71, CV_16U);
+	const unsigned char* reused = outInfra.data;
+	for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+	{
+		KinectSetSimdLevel(level);
+		Mat packed = InfraDepth2Packed(infra(roi), depth(roi));
+		CHECK(PackedLayout(packed, infra(roi), depth(roi)));
+		CHECK(Packed2InfraDepth(InfraDepth2Packed(infra, depth)(roi), outInfra, outDepth));
+		CHECK(outInfra.data == reused);
+		CHECK(SameMat(outInfra, infra(roi).clone()));
+		CHECK(SameMat(outDepth, depth(roi).clone()));
+	}
+
+	// Mismatched inputs
+	CHECK(InfraDepth2Packed(infra, depth(roi)).empty());
+	CHECK(!Packed2InfraDepth(infra, outInfra, outDepth));
+	CHECK(!Packed2InfraDepth(Mat(4, 4, CV_8UC2), outInfra, outDepth));
+
+	KinectSetSimdLevel(supported);
+	return TestResult();
+}
@@ -0,0 +1,44 @@
+#include "TestUtil.h"
+#include "KinectPointCloud.h"
+
+// Milliseconds per 512x424 frame of dense and compact point clouds at each
+// SIMD level, against an interleaved cloud computed with a division per pixel
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	KinectPointCloudGenerator generator;
+	generator.Init(intrinsics);
+	Mat depth = SyntheticDepth(424, 512, 0);
+	int supported = KinectDetectSimd();
+	const char* names[] = { "scalar", "SSSE3", "AVX2" };
+
+	vector<float> interleaved(depth.total() * 3);
+	double naive = TimeMs(200, [&]()
+	{
+		for (int i = 0; i < depth.rows; i++)
+		{
+			for (int j = 0; j < depth.cols; j++)
+			{
+				float z = depth.at<unsigned short>(i, j) * 0.001f;
+				float* p = &interleaved[3 * (i * depth.cols + j)];
+				p[0] = (j - intrinsics.cx) / intrinsics.fx * z;
+				p[1] = (i - intrinsics.cy) / intrinsics.fy * z;
+				p[2] = z;
+			}
+		}
+	});
+	printf("interleaved, divisions  %.3f ms\n", naive);
+
+	KinectPointCloud cloud;
+	for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+	{
+		KinectSetSimdLevel(level);
+		double dense = TimeMs(500, [&]() { generator.Generate(depth, cloud); });
+		double compact = TimeMs(500, [&]() { generator.Generate(depth, cloud, true); });
+		printf("%-6s dense %.3f ms (%.1fx)  compact %.3f ms (%.1fx, %d of %d points)\n", names[level],
+			dense, naive / dense, compact, naive / compact, cloud.count, (int)depth.total());
+	}
+	KinectSetSimdLevel(supported);
+	return 0;
+}
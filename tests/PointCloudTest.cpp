@@ -0,0 +1,134 @@
+#include "TestUtil.h"
+#include "KinectPointCloud.h"
+#include "KinectRegistration.h"
+
+// Point clouds at every SIMD level against the scalar structure of arrays
+// output, and the compaction kernels against the slack of their row buffers
+
+static Mat RandomDepth(int rows, int cols, int zeroEvery, mt19937& rng)
+{
+	Mat depth(rows, cols, CV_16U);
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+			depth.at<unsigned short>(i, j) = rng() % zeroEvery == 0 ? 0 : (unsigned short)(1 + rng() % 8000);
+	}
+	return depth;
+}
+
+static bool SameCloud(const KinectPointCloud& a, const KinectPointCloud& b)
+{
+	return a.count == b.count && a.rows == b.rows && a.cols == b.cols && a.compact == b.compact
+		&& a.x == b.x && a.y == b.y && a.z == b.z && a.index == b.index;
+}
+
+int main()
+{
+	mt19937 rng(19);
+	int supported = KinectDetectSimd();
+	const float scale = 0.001f;
+
+	// Generate() against the per-pixel definition at the scalar level, then
+	// every SIMD level against the scalar clouds
+	int sizes[][2] = { { 1, 1 }, { 5, 7 }, { 3, 13 }, { 2, 17 }, { 4, 31 }, { 424, 512 } };
+	for (auto& s : sizes)
+	{
+		int rows = s[0], cols = s[1];
+		KinectPointCloudGenerator generator;
+		generator.Init(KinectMakeIntrinsics(cols, rows, 300, 300, cols / 2.0f, rows / 2.0f, 0.05f));
+		const KinectRayTable& rays = generator.Rays();
+		for (int zeroEvery : { 1, 2, 3, 1 << 30 })
+		{
+			Mat depth = RandomDepth(rows, cols, zeroEvery, rng);
+			KinectSetSimdLevel(KINECT_SIMD_SCALAR);
+			KinectPointCloud dense, compact;
+			CHECK(generator.Generate(depth, dense));
+			CHECK(generator.Generate(depth, compact, true));
+			bool same = dense.count == rows * cols && !dense.compact && dense.index.empty() && compact.compact;
+			int n = 0;
+			for (int i = 0; i < rows && same; i++)
+			{
+				for (int j = 0; j < cols && same; j++)
+				{
+					int k = i * cols + j;
+					float z = depth.at<unsigned short>(i, j) * scale;
+					float x = rays.x.at<float>(i, j) * z, y = rays.y.at<float>(i, j) * z;
+					same = dense.x[k] == x && dense.y[k] == y && dense.z[k] == z;
+					if (depth.at<unsigned short>(i, j) == 0) continue;
+					same = same && n < compact.count && compact.index[n] == k && compact.x[n] == x && compact.y[n] == y && compact.z[n] == z;
+					n++;
+				}
+			}
+			CHECK(same && n == compact.count);
+
+			for (int level = KINECT_SIMD_SSSE3; level <= supported; level++)
+			{
+				KinectSetSimdLevel(level);
+				KinectPointCloud simdDense, simdCompact;
+				CHECK(generator.Generate(depth, simdDense));
+				CHECK(generator.Generate(depth, simdCompact, true));
+				CHECK(SameCloud(simdDense, dense));
+				CHECK(SameCloud(simdCompact, compact));
+			}
+		}
+	}
+
+	// The compaction kernels store whole vectors at the running count. Row
+	// buffers have KINECT_POINT_SLACK values of slack and nothing may land
+	// past that; the points before the count must match the scalar kernel.
+	const int guard = 32;
+	const float poison = -12345.0f;
+	for (int cols : { 1, 3, 4, 7, 8, 9, 15, 16, 17, 33, 512 })
+	{
+		vector<float> rx(cols), ry(cols);
+		for (int j = 0; j < cols; j++)
+		{
+			rx[j] = (j - cols / 2.0f) / 300;
+			ry[j] = 0.25f;
+		}
+		// No valid pixel, all valid, alternating, only the last lanes, random
+		vector<vector<unsigned short>> patterns(5, vector<unsigned short>(cols, 0));
+		for (int j = 0; j < cols; j++)
+		{
+			patterns[1][j] = (unsigned short)(500 + j);
+			patterns[2][j] = j % 2 ? (unsigned short)(700 + j) : 0;
+			patterns[3][j] = j % 8 >= 6 || j == cols - 1 ? (unsigned short)(900 + j) : 0;
+			patterns[4][j] = rng() % 3 ? (unsigned short)(1 + rng() % 8000) : 0;
+		}
+		for (auto& depth : patterns)
+		{
+			size_t size = cols + KINECT_POINT_SLACK + guard;
+			vector<float> ex(size), ey(size), ez(size);
+			vector<int> ei(size);
+			int expected = PointRowCompactScalar(depth.data(), rx.data(), ry.data(), scale, 1000, ex.data(), ey.data(), ez.data(), ei.data(), 0, 0, cols);
+			for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+			{
+				vector<float> x(size, poison), y(size, poison), z(size, poison);
+				vector<int> index(size, -1);
+				int n = PointRowCompact(depth.data(), rx.data(), ry.data(), scale, 1000, x.data(), y.data(), z.data(), index.data(), cols, level);
+				CHECK(n == expected);
+				bool same = true;
+				for (int k = 0; k < n; k++)
+					same = same && x[k] == ex[k] && y[k] == ey[k] && z[k] == ez[k] && index[k] == ei[k];
+				CHECK(same);
+				bool intact = true;
+				for (size_t k = cols + KINECT_POINT_SLACK; k < size; k++)
+					intact = intact && x[k] == poison && y[k] == poison && z[k] == poison && index[k] == -1;
+				CHECK(intact);
+			}
+		}
+	}
+
+	// A generator can share the ray table of a registration
+	KinectIntrinsics depthCamera = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	KinectRegistration registration;
+	registration.Init(depthCamera, KinectMakeIntrinsics(1920, 1080, 1000, 1000, 960, 540), KinectPoseIdentity());
+	KinectPointCloudGenerator shared;
+	shared.Init(registration.Rays());
+	CHECK(shared.Rays().x.data == registration.Rays().x.data);
+	KinectPointCloud cloud;
+	CHECK(!shared.Generate(Mat(424, 511, CV_16U), cloud));
+
+	KinectSetSimdLevel(supported);
+	return TestResult();
+}
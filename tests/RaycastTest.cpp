@@ -0,0 +1,74 @@
+#include "TestUtil.h"
+#include "KinectCpuFusion.h"
+#include "Scene.h"
+
+// Raycasts of shapes filled into the volume against the analytic depth and
+// normals, and the cached surface against pose and volume changes
+
+int main()
+{
+	KinectIntrinsics intrinsics = KinectNormalizedIntrinsics(512, 424, 0.72113f, 0.870799f, 0.50602675f, 0.499133f);
+	// 1 m cube of 3.9 mm voxels, x and y from -0.5 to 0.5, z from 0 to 1
+	KinectVolumeParameters parameters = { 256, 256, 256, 256 };
+	KinectCpuFusion fusion(1, parameters);
+	CHECK(fusion.init(intrinsics));
+
+	// Sphere in front of the camera at the origin
+	const float center[3] = { 0, 0, 0.6f }, radius = 0.3f;
+	CHECK(fusion.FillVolume([&](const float p[3]) { return SphereDistance(p, center, radius); }));
+	Mat depth, normals, shaded;
+	double raycast = TimeMs(1, [&]() { depth = fusion.GetSurfaceDepth(); });
+	double cached = TimeMs(1, [&]() { CHECK(fusion.GetSurfaceDepth().data == depth.data); });
+	double shade = TimeMs(1, [&]() { shaded = fusion.GetShadedSurface(); });
+	normals = fusion.GetSurfaceNormals();
+	CHECK(depth.type() == CV_32F && depth.rows == 424 && depth.cols == 512);
+	CHECK(normals.type() == CV_32FC3 && shaded.type() == CV_8UC4);
+
+	int hits = 0, misses = 0;
+	double maxError = 0, maxAngle = 0;
+	for (int i = 0; i < intrinsics.height; i++)
+	{
+		for (int j = 0; j < intrinsics.width; j++)
+		{
+			// Depth z of the ray z * (x, y, 1) at the sphere, skipping the silhouette
+			double x = (j - intrinsics.cx) / intrinsics.fx, y = (i - intrinsics.cy) / intrinsics.fy;
+			double a = x * x + y * y + 1, b = -2 * center[2], c = center[2] * center[2] - radius * radius;
+			double disc = b * b - 4 * a * c;
+			float z = depth.at<float>(i, j);
+			if (disc < 0.01)
+			{
+				if (disc < 0 && z > 0) misses++;
+				continue;
+			}
+			if (z <= 0)
+			{
+				misses++;
+				continue;
+			}
+			hits++;
+			double expected = (-b - sqrt(disc)) / (2 * a);
+			maxError = max(maxError, fabs(z - expected));
+			Vec3f n = normals.at<Vec3f>(i, j);
+			double p[3] = { x * expected, y * expected, expected - center[2] };
+			double cosine = (n[0] * p[0] + n[1] * p[1] + n[2] * p[2]) / radius;
+			maxAngle = max(maxAngle, acos(min(1.0, cosine)) * 180 / CV_PI);
+		}
+	}
+	printf("raycast %.1f ms, cached %.3f ms, shading %.1f ms; %d hits, %d misses, max depth error %.3f mm, max normal error %.2f degrees\n",
+		raycast, cached, shade, hits, misses, maxError * 1000, maxAngle);
+	CHECK(hits > 10000 && misses <= 50);
+	CHECK(maxError < 0.5 * fusion.VoxelSize());
+	CHECK(maxAngle < 3);
+
+	// A new volume and a new pose both cast again
+	unsigned int revision = fusion.Revision();
+	CHECK(fusion.FillVolume([](const float p[3]) { return 0.5f - p[2]; }));
+	CHECK(fusion.Revision() != revision);
+	CHECK(fabsf(fusion.GetSurfaceDepth().at<float>(212, 256) - 0.5f) < 0.002f);
+	fusion.worldToCameraTransform[0].m[11] = -0.1f;
+	CHECK(fabsf(fusion.GetSurfaceDepth().at<float>(212, 256) - 0.4f) < 0.002f);
+
+	// Unknown sources have no surface
+	CHECK(fusion.GetSurfaceDepth(1).empty() && fusion.GetSurfaceDepth(-1).empty());
+	return TestResult();
+}
@@ -0,0 +1,154 @@
+#include "TestUtil.h"
+#include "KinectRegistration.h"
+
+// KinectRegistration against projections worked out by hand, and every SIMD
+// level against the scalar row kernel
+
+static bool Near(float a, float b, float tolerance = 0.01f)
+{
+	return fabsf(a - b) <= tolerance;
+}
+
+// Colour coordinates of depth pixel (i, j) at z millimetres, computed by MapDepthToColor
+static Point2f Mapped(const KinectRegistration& registration, int rows, int cols, int i, int j, unsigned short z)
+{
+	Mat depth(rows, cols, CV_16U, Scalar(0)), points;
+	depth.at<unsigned short>(i, j) = z;
+	if (!registration.MapDepthToColor(depth, points)) return Point2f(-1, -1);
+	const float* p = points.ptr<float>(i) + 2 * j;
+	return Point2f(p[0], p[1]);
+}
+
+int main()
+{
+	// Depth camera with a 400 px focal length, colour camera with 1000 px at 1920x1080
+	KinectIntrinsics depth = KinectMakeIntrinsics(512, 424, 400, 400, 256, 212);
+	KinectIntrinsics color = KinectMakeIntrinsics(1920, 1080, 1000, 1000, 960, 540);
+
+	// Colour camera 52 mm to the side: a depth point (x, y, z) in metres is
+	// (x - 0.052, y, z) in colour space and lands on (1000 (x - 0.052) / z + 960, 1000 y / z + 540)
+	{
+		float r[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, t[3] = { -0.052f, 0, 0 };
+		KinectRegistration registration;
+		registration.Init(depth, color, KinectMakePose(r, t));
+		// Principal point at 1 m: (0, 0, 1) -> (-0.052, 0, 1)
+		Point2f p = Mapped(registration, 424, 512, 212, 256, 1000);
+		CHECK(Near(p.x, 908) && Near(p.y, 540));
+		// 80 px right at 2 m: x = 80 / 400 * 2 = 0.4 -> (0.348, 0, 2)
+		p = Mapped(registration, 424, 512, 212, 336, 2000);
+		CHECK(Near(p.x, 1134) && Near(p.y, 540));
+		// 80 px up at 1.5 m: y = -0.3 -> (-0.052, -0.3, 1.5)
+		p = Mapped(registration, 424, 512, 132, 256, 1500);
+		CHECK(Near(p.x, 960 - 52 / 1.5f) && Near(p.y, 340));
+		// Depth 0 is invalid
+		p = Mapped(registration, 424, 512, 212, 256, 0);
+		CHECK(isinf(p.x) && p.x < 0 && isinf(p.y));
+	}
+
+	// Colour camera rolled 90 degrees about the optical axis: (x, y, z) -> (-y, x, z)
+	{
+		float r[9] = { 0, -1, 0, 1, 0, 0, 0, 0, 1 }, t[3] = { 0, 0, 0 };
+		KinectRegistration registration;
+		registration.Init(depth, color, KinectMakePose(r, t));
+		// (0.4, 0, 2) -> (0, 0.4, 2)
+		Point2f p = Mapped(registration, 424, 512, 212, 336, 2000);
+		CHECK(Near(p.x, 960) && Near(p.y, 740));
+	}
+
+	// Points that end up behind the colour camera are invalid
+	{
+		float r[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, t[3] = { 0, 0, -3 };
+		KinectRegistration registration;
+		registration.Init(depth, color, KinectMakePose(r, t));
+		Point2f p = Mapped(registration, 424, 512, 212, 256, 1000);
+		CHECK(isinf(p.x) && isinf(p.y));
+		CHECK(!isinf(Mapped(registration, 424, 512, 212, 256, 4000).x));
+	}
+
+	// Radial distortion k1 = 0.1: the ray x = 0.5 is seen at xd = 0.5 (1 + 0.1 * 0.25) = 0.5125,
+	// pixel 256 + 400 * 0.5125 = 461. At 1 m it is (0.5, 0, 1) and lands on 1000 * 0.5 + 960.
+	{
+		KinectIntrinsics distorted = KinectMakeIntrinsics(512, 424, 400, 400, 256, 212, 0.1f);
+		float x, y;
+		KinectUndistort(distorted, 461, 212, x, y);
+		CHECK(Near(x, 0.5f, 1e-5f) && Near(y, 0, 1e-5f));
+		float point[3] = { 0.5f, 0, 1 }, u, v;
+		CHECK(KinectProject(distorted, point, u, v));
+		CHECK(Near(u, 461, 1e-3f) && Near(v, 212, 1e-3f));
+
+		KinectRegistration registration;
+		registration.Init(distorted, color, KinectPoseIdentity());
+		Point2f p = Mapped(registration, 424, 512, 212, 461, 1000);
+		CHECK(Near(p.x, 1460) && Near(p.y, 540));
+	}
+
+	// AlignColorToDepth samples the colour pixel nearest to the mapped point
+	{
+		float r[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, t[3] = { -0.052f, 0, 0 };
+		KinectRegistration registration;
+		registration.Init(depth, color, KinectMakePose(r, t));
+		Mat image(1080, 1920, CV_8UC3);
+		for (int i = 0; i < image.rows; i++)
+		{
+			for (int j = 0; j < image.cols; j++)
+			{
+				unsigned char* px = image.ptr<unsigned char>(i) + 3 * j;
+				px[0] = (unsigned char)j;
+				px[1] = (unsigned char)(j >> 8);
+				px[2] = (unsigned char)i;
+			}
+		}
+		Mat frame(424, 512, CV_16U, Scalar(0)), aligned;
+		frame.at<unsigned short>(212, 256) = 1000;
+		frame.at<unsigned short>(132, 256) = 1500;
+		CHECK(registration.AlignColorToDepth(frame, image, aligned));
+		CHECK(aligned.type() == CV_8UC3);
+		// (908, 540), and (925.33, 340) rounds to column 925
+		CHECK(memcmp(aligned.ptr<unsigned char>(212) + 3 * 256, image.ptr<unsigned char>(540) + 3 * 908, 3) == 0);
+		CHECK(memcmp(aligned.ptr<unsigned char>(132) + 3 * 256, image.ptr<unsigned char>(340) + 3 * 925, 3) == 0);
+		const unsigned char* empty = aligned.ptr<unsigned char>(0);
+		CHECK(empty[0] == 0 && empty[1] == 0 && empty[2] == 0);
+		CHECK(!registration.AlignColorToDepth(frame, Mat(480, 640, CV_8UC3), aligned));
+		CHECK(!registration.MapDepthToColor(Mat(424, 511, CV_16U), aligned));
+	}
+
+	// Every SIMD level matches the scalar kernel, odd widths leave tails for it
+	mt19937 rng(18);
+	float a = 0.02f, b = -0.01f;
+	float r[9] = { cosf(a), 0, sinf(a), sinf(a) * sinf(b), cosf(b), -cosf(a) * sinf(b), -sinf(a) * cosf(b), sinf(b), cosf(a) * cosf(b) };
+	float t[3] = { -0.052f, 0.001f, 0.002f };
+	int widths[] = { 1, 3, 4, 7, 8, 13, 37, 512 };
+	int supported = KinectDetectSimd();
+	for (int width : widths)
+	{
+		KinectIntrinsics d = KinectMakeIntrinsics(width, 9, 365.5f, 365.5f, width / 2.0f, 4.5f, 0.09f, -0.27f, 0.09f);
+		KinectRegistration registration;
+		registration.Init(d, color, KinectMakePose(r, t));
+		Mat frame(9, width, CV_16U);
+		for (int i = 0; i < frame.rows; i++)
+		{
+			for (int j = 0; j < width; j++)
+				frame.at<unsigned short>(i, j) = rng() % 8 == 0 ? 0 : (unsigned short)(500 + rng() % 4000);
+		}
+		KinectSetSimdLevel(KINECT_SIMD_SCALAR);
+		Mat expected;
+		registration.MapDepthToColor(frame, expected);
+		for (int level = KINECT_SIMD_SSSE3; level <= supported; level++)
+		{
+			KinectSetSimdLevel(level);
+			Mat points;
+			CHECK(registration.MapDepthToColor(frame, points));
+			bool same = true;
+			for (int i = 0; i < frame.rows; i++)
+			{
+				const float* p = points.ptr<float>(i);
+				const float* q = expected.ptr<float>(i);
+				for (int k = 0; k < 2 * width; k++)
+					same = same && (isinf(q[k]) ? p[k] == q[k] : Near(p[k], q[k], 1e-3f));
+			}
+			CHECK(same);
+		}
+	}
+	KinectSetSimdLevel(supported);
+	return TestResult();
+}
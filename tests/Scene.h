@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef _SCENE_H
+#define _SCENE_H
+
+#include "KinectCamera.h"
+#include <math.h>
+#include <algorithm>
+
+// Synthetic scene of the volume tests, in world space metres: a sphere of
+// radius 0.25 at (0, 0, 1.2), a smaller one of radius 0.12 at (0.3, -0.2, 1)
+// and a wall at z = 1.45 behind them.
+
+/// <summary>
+/// Distance along the unit direction d from o to the first surface, -1 if the ray hits nothing
+/// </summary>
+inline float SceneHit(const float o[3], const float d[3])
+{
+	const float centers[2][3] = { { 0, 0, 1.2f }, { 0.3f, -0.2f, 1.0f } };
+	const float radii[2] = { 0.25f, 0.12f };
+	float best = 1e9f;
+	for (int s = 0; s < 2; s++)
+	{
+		float oc[3] = { o[0] - centers[s][0], o[1] - centers[s][1], o[2] - centers[s][2] };
+		float b = oc[0] * d[0] + oc[1] * d[1] + oc[2] * d[2];
+		float c = oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2] - radii[s] * radii[s];
+		float disc = b * b - c;
+		if (disc < 0) continue;
+		float t = -b - sqrtf(disc);
+		if (t > 0 && t < best) best = t;
+	}
+	if (d[2] > 1e-6f)
+	{
+		float t = (1.45f - o[2]) / d[2];
+		if (t > 0 && t < best) best = t;
+	}
+	return best < 1e8f ? best : -1;
+}
+
+/// <summary>
+/// Signed distance of a world space point to the scene, negative inside
+/// </summary>
+inline float SceneDistance(const float p[3])
+{
+	float d = p[2] - 1.45f;
+	const float centers[2][3] = { { 0, 0, 1.2f }, { 0.3f, -0.2f, 1.0f } };
+	const float radii[2] = { 0.25f, 0.12f };
+	for (int s = 0; s < 2; s++)
+	{
+		float x = p[0] - centers[s][0], y = p[1] - centers[s][1], z = p[2] - centers[s][2];
+		float sphere = sqrtf(x * x + y * y + z * z) - radii[s];
+		if (sphere < d) d = sphere;
+	}
+	// The wall is the back of the scene, everything behind it is inside
+	return d;
+}
+
+/// <summary>
+/// Render the depth in millimetres the camera at worldToCamera sees, 0 where it sees nothing
+/// </summary>
+inline void RenderDepth(const KinectIntrinsics& intrinsics, const KinectPose& worldToCamera, unsigned short* out)
+{
+	KinectPose cameraToWorld = KinectPoseInverse(worldToCamera);
+	float o[3] = { cameraToWorld.m[3], cameraToWorld.m[7], cameraToWorld.m[11] };
+	for (int i = 0; i < intrinsics.height; i++)
+	{
+		for (int j = 0; j < intrinsics.width; j++)
+		{
+			float ray[3] = { (j - intrinsics.cx) / intrinsics.fx, (i - intrinsics.cy) / intrinsics.fy, 1 };
+			float d[3];
+			KinectPoseRotate(cameraToWorld, ray, d);
+			float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+			d[0] /= length;
+			d[1] /= length;
+			d[2] /= length;
+			float t = SceneHit(o, d);
+			unsigned short& pixel = out[i * intrinsics.width + j];
+			if (t < 0)
+			{
+				pixel = 0;
+				continue;
+			}
+			float p[3] = { o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2] };
+			float c[3];
+			KinectPoseTransform(worldToCamera, p, c);
+			pixel = (unsigned short)(c[2] * 1000 + 0.5f);
+		}
+	}
+}
+
+/// <summary>
+/// Rotation by angle radians about the y axis followed by a translation
+/// </summary>
+inline KinectPose PoseRotY(float angle, float tx, float ty, float tz)
+{
+	float r[9] = { cosf(angle), 0, sinf(angle), 0, 1, 0, -sinf(angle), 0, cosf(angle) };
+	float t[3] = { tx, ty, tz };
+	return KinectMakePose(r, t);
+}
+
+/// <summary>
+/// Signed distance to a sphere of radius r at c, for FillVolume()
+/// </summary>
+inline float SphereDistance(const float p[3], const float c[3], float r)
+{
+	float x = p[0] - c[0], y = p[1] - c[1], z = p[2] - c[2];
+	return sqrtf(x * x + y * y + z * z) - r;
+}
+
+/// <summary>
+/// Signed distance to an axis aligned box with half sizes h centred at c, for FillVolume()
+/// </summary>
+inline float BoxDistance(const float p[3], const float c[3], const float h[3])
+{
+	float q[3], outside = 0, inside = -1e9f;
+	for (int k = 0; k < 3; k++)
+	{
+		q[k] = fabsf(p[k] - c[k]) - h[k];
+		outside += std::max(q[k], 0.0f) * std::max(q[k], 0.0f);
+		inside = std::max(inside, q[k]);
+	}
+	return sqrtf(outside) + std::min(inside, 0.0f);
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include "TestUtil.h"
+#include "KinectOpenCvTools.h"
+
+// SplitUsersFromBackground at every SIMD level against one
+// SplitUserFromBackground() per user, and its stats against the pixels
+
+static Mat RandomBody(int rows, int cols, int absent, mt19937& rng)
+{
+	// Runs of one user index or 255 background, long enough to cover whole
+	// vectors and short enough to end inside them
+	Mat body(rows, cols, CV_8U);
+	int run = 0, value = 255;
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			if (run-- <= 0)
+			{
+				int pick = rng() % 8;
+				value = pick >= KINECT_USER_COUNT || pick == absent ? 255 : pick;
+				run = rng() % 40;
+			}
+			body.at<unsigned char>(i, j) = (unsigned char)value;
+		}
+	}
+	return body;
+}
+
+static Mat RandomDepth(int rows, int cols, mt19937& rng)
+{
+	Mat depth(rows, cols, CV_16U);
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+			depth.at<unsigned short>(i, j) = (unsigned short)(rng() % 10 ? 1 + rng() % 65535 : 0);
+	}
+	return depth;
+}
+
+int main()
+{
+	mt19937 rng(14);
+	int supported = KinectDetectSimd();
+	int sizes[][2] = { { 1, 1 }, { 3, 7 }, { 5, 15 }, { 4, 16 }, { 6, 17 }, { 3, 31 }, { 2, 32 }, { 7, 33 }, { 5, 63 }, { 424, 512 } };
+	for (auto& s : sizes)
+	{
+		int rows = s[0], cols = s[1];
+		// Every user present, and each one missing in turn
+		for (int absent = -1; absent < KINECT_USER_COUNT; absent++)
+		{
+			Mat depth = RandomDepth(rows, cols, rng);
+			Mat body = RandomBody(rows, cols, absent, rng);
+			Mat expected[KINECT_USER_COUNT];
+			KinectUserStats reference[KINECT_USER_COUNT];
+			for (int u = 0; u < KINECT_USER_COUNT; u++)
+			{
+				expected[u] = SplitUserFromBackground(depth, body, u);
+				int pixels = 0, left = INT_MAX, top = INT_MAX, right = -1, bottom = -1;
+				for (int i = 0; i < rows; i++)
+				{
+					for (int j = 0; j < cols; j++)
+					{
+						if (body.at<unsigned char>(i, j) != u) continue;
+						pixels++;
+						left = min(left, j);
+						right = max(right, j);
+						top = min(top, i);
+						bottom = max(bottom, i);
+					}
+				}
+				reference[u].pixels = pixels;
+				reference[u].box = pixels ? Rect(left, top, right - left + 1, bottom - top + 1) : Rect();
+			}
+			if (absent >= 0) CHECK(reference[absent].pixels == 0);
+
+			for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+			{
+				KinectSetSimdLevel(level);
+				// Empty Mats are allocated, Mats of the right size are overwritten in place
+				Mat users[KINECT_USER_COUNT];
+				for (int u = 0; u < KINECT_USER_COUNT; u += 2)
+				{
+					users[u].create(rows, cols, CV_16U);
+					for (int i = 0; i < rows; i++)
+						memset(users[u].ptr(i), 0xAB, cols * 2);
+				}
+				const unsigned char* kept = users[0].data;
+				KinectUserStats stats[KINECT_USER_COUNT];
+				CHECK(SplitUsersFromBackground(depth, body, users, stats));
+				CHECK(users[0].data == kept);
+				bool same = true;
+				for (int u = 0; u < KINECT_USER_COUNT; u++)
+				{
+					same = same && SameMat(users[u], expected[u]) && stats[u].pixels == reference[u].pixels
+						&& stats[u].box.x == reference[u].box.x && stats[u].box.y == reference[u].box.y
+						&& stats[u].box.width == reference[u].box.width && stats[u].box.height == reference[u].box.height;
+				}
+				if (!same) printf("%dx%d, user %d absent, level %d\n", cols, rows, absent, level);
+				CHECK(same);
+
+				// Stats alone
+				KinectUserStats only[KINECT_USER_COUNT];
+				CHECK(SplitUsersFromBackground(depth, body, NULL, only));
+				bool counted = true;
+				for (int u = 0; u < KINECT_USER_COUNT; u++)
+					counted = counted && only[u].pixels == reference[u].pixels && only[u].box.area() == reference[u].box.area();
+				CHECK(counted);
+			}
+		}
+	}
+
+	// Row padded frames give the same users as the continuous ones
+	Mat depth = RandomDepth(40, 80, rng), body = RandomBody(40, 80, -1, rng);
+	Rect roi(3, 2, 61, 35);
+	for (int level = KINECT_SIMD_SCALAR; level <= supported; level++)
+	{
+		KinectSetSimdLevel(level);
+		Mat users[KINECT_USER_COUNT], whole[KINECT_USER_COUNT];
+		CHECK(SplitUsersFromBackground(depth(roi), body(roi), users));
+		CHECK(SplitUsersFromBackground(depth, body, whole));
+		bool same = true;
+		for (int u = 0; u < KINECT_USER_COUNT; u++)
+			same = same && SameMat(users[u], whole[u](roi));
+		CHECK(same);
+	}
+
+	// Frames that do not match
+	Mat users[KINECT_USER_COUNT];
+	CHECK(!SplitUsersFromBackground(depth, Mat(40, 81, CV_8U), users));
+	CHECK(!SplitUsersFromBackground(Mat(40, 80, CV_8U), body, users));
+	CHECK(!SplitUsersFromBackground(depth, Mat(40, 80, CV_16U), users));
+
+	KinectSetSimdLevel(supported);
+	return TestResult();
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifndef _TESTUTIL_H
+#define _TESTUTIL_H
+
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+
+using namespace cv;
+using namespace std;
+
+// Every test is a plain executable: CHECK() reports a failed condition and
+// carries on, TestResult() turns the failures into the exit code.
+
+static int testFailures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); testFailures++; } } while (0)
+
+inline int TestResult()
+{
+	if (testFailures) printf("FAILED: %d checks\n", testFailures);
+	else printf("passed\n");
+	return testFailures ? 1 : 0;
+}
+
+/// <summary>
+/// Average milliseconds per call of body over repeats calls
+/// </summary>
+template <class Body>
+double TimeMs(int repeats, const Body& body)
+{
+	auto begin = chrono::steady_clock::now();
+	for (int i = 0; i < repeats; i++) body();
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() / repeats;
+}
+
+/// <summary>
+/// Same type, size and pixel bytes
+/// </summary>
+inline bool SameMat(const Mat& a, const Mat& b)
+{
+	if (a.type() != b.type() || a.rows != b.rows || a.cols != b.cols) return false;
+	size_t bytes = a.cols * a.elemSize();
+	for (int i = 0; i < a.rows; i++)
+	{
+		if (memcmp(a.ptr(i), b.ptr(i), bytes) != 0) return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Kinect-like CV_16U depth in millimetres: a slanted wall and a floor with
+/// a sphere in front, seen by a camera panning with frame. Noise grows with
+/// depth, and there are shadows next to the sphere and dropped pixels.
+/// </summary>
+inline Mat SyntheticDepth(int rows, int cols, int frame, unsigned int seed = 1)
+{
+	mt19937 rng(seed + frame * 7919);
+	normal_distribution<float> noise(0, 1);
+	uniform_real_distribution<float> uniform(0, 1);
+	Mat depth(rows, cols, CV_16U);
+	float f = cols * 0.72f;
+	float pan = 0.004f * frame;
+	for (int i = 0; i < rows; i++)
+	{
+		unsigned short* row = depth.ptr<unsigned short>(i);
+		for (int j = 0; j < cols; j++)
+		{
+			float x = (j - cols * 0.5f) / f + pan, y = (i - rows * 0.5f) / f;
+			// Wall at 3 m tilted to the side, floor 1 m below the camera
+			float z = 3000 / (1 + 0.3f * x);
+			if (y > 0 && 1000 / y < z) z = 1000 / y;
+			// Sphere of radius 400 mm at 1.8 m
+			float sx = x * 1800 - 200, sy = y * 1800;
+			float r2 = sx * sx + sy * sy;
+			bool shadow = false;
+			if (r2 < 400 * 400)
+				z = 1800 - sqrtf(400 * 400 - r2);
+			else if (r2 < 440 * 440 && sx < 0)
+				shadow = true;
+			if (shadow || uniform(rng) < 0.01f || z > 8000)
+			{
+				row[j] = 0;
+				continue;
+			}
+			z += noise(rng) * (0.5f + z * z * 1.5e-7f);
+			row[j] = (unsigned short)(z + 0.5f);
+		}
+	}
+	return depth;
+}
+
+#endif